@@ -0,0 +1,226 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file chunk_store_benchmark.c
+ * @brief Measures the download bandwidth the chunk store saves.
+ *
+ * Three jobs run against one store, as the agent runs them: every block is
+ * looked up by its digest first, only the missing blocks are downloaded,
+ * and the installed image is added to the store. The first job starts cold
+ * with an empty store. The second delivers the same image again under a new
+ * job. The third delivers a new version of the image in which one block in
+ * every eight changed.
+ *
+ * Usage: ota_chunk_store_benchmark [imageSizeKb] [budgetKb]
+ */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <dirent.h>
+#include <unistd.h>
+
+/* OpenSSL includes. */
+#include <openssl/sha.h>
+
+#include "storage/chunk_store_posix.h"
+#include "utils/clock.h"
+
+#define BENCH_STORE_DIR         "chunks"
+#define BENCH_BLOCK_SIZE        4096U
+#define BENCH_DEFAULT_SIZE_KB   1024U
+#define BENCH_CHANGED_INTERVAL  8U
+
+/*-----------------------------------------------------------*/
+
+/* Fills a block with bytes depending on its id and the image version. */
+static void fillBlock( uint8_t * block,
+                       uint32_t blockId,
+                       uint32_t version )
+{
+    uint32_t seed = ( blockId * 2654435761U ) ^ version;
+    size_t i;
+
+    for( i = 0U; i < BENCH_BLOCK_SIZE; i++ )
+    {
+        seed = ( seed * 1103515245U ) + 12345U;
+        block[ i ] = ( uint8_t ) ( seed >> 16 );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getBlockVersion( uint32_t blockId,
+                                 uint32_t imageVersion )
+{
+    return ( ( blockId % BENCH_CHANGED_INTERVAL ) == 0U ) ? imageVersion : 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool runJob( ChunkStoreContext_t * store,
+                    const char * name,
+                    uint32_t blockCount,
+                    uint32_t imageVersion )
+{
+    uint8_t block[ BENCH_BLOCK_SIZE ];
+    uint8_t stored[ BENCH_BLOCK_SIZE ];
+    uint8_t fileDigest[ CHUNK_STORE_DIGEST_SIZE ];
+    uint8_t * digests = malloc( ( size_t ) blockCount * CHUNK_STORE_DIGEST_SIZE );
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    uint64_t lookupTimeUs = 0U;
+    uint64_t downloadedBytes = 0U;
+    uint32_t servedBlocks = 0U;
+    bool success = digests != NULL;
+    size_t length = 0U;
+    uint32_t blockId;
+
+    /* The digest list of the image arrives with the job. */
+    for( blockId = 0U; success && ( blockId < blockCount ); blockId++ )
+    {
+        fillBlock( block, blockId, getBlockVersion( blockId, imageVersion ) );
+        ( void ) SHA256( block, sizeof( block ), &digests[ blockId * CHUNK_STORE_DIGEST_SIZE ] );
+    }
+
+    for( blockId = 0U; success && ( blockId < blockCount ); blockId++ )
+    {
+        if( ChunkStore_GetChunk( store,
+                                 &digests[ blockId * CHUNK_STORE_DIGEST_SIZE ],
+                                 stored,
+                                 sizeof( stored ),
+                                 &length ) )
+        {
+            servedBlocks++;
+        }
+        else
+        {
+            downloadedBytes += BENCH_BLOCK_SIZE;
+        }
+    }
+
+    lookupTimeUs = Clock_GetTimeUs() - startTimeUs;
+
+    /* The installed image is added to the store for the next job. */
+    for( blockId = 0U; success && ( blockId < blockCount ); blockId++ )
+    {
+        fillBlock( block, blockId, getBlockVersion( blockId, imageVersion ) );
+        success = ChunkStore_PutChunk( store, block, sizeof( block ), NULL );
+    }
+
+    if( success )
+    {
+        ( void ) SHA256( digests, ( size_t ) blockCount * CHUNK_STORE_DIGEST_SIZE, fileDigest );
+        success = ChunkStore_PutManifest( store,
+                                          fileDigest,
+                                          digests,
+                                          ( size_t ) blockCount * CHUNK_STORE_DIGEST_SIZE );
+    }
+
+    if( success )
+    {
+        printf( "%-14s %6u of %6u blocks served locally, %10llu bytes downloaded, "
+                "%10llu bytes saved, lookups took %llu us.\n",
+                name,
+                servedBlocks,
+                blockCount,
+                ( unsigned long long ) downloadedBytes,
+                ( unsigned long long ) servedBlocks * BENCH_BLOCK_SIZE,
+                ( unsigned long long ) lookupTimeUs );
+    }
+    else
+    {
+        printf( "%-14s failed\n", name );
+    }
+
+    free( digests );
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+static void removeStore( void )
+{
+    char path[ 512 ];
+    struct dirent * entry = NULL;
+    DIR * directory = opendir( BENCH_STORE_DIR );
+
+    while( ( directory != NULL ) && ( ( entry = readdir( directory ) ) != NULL ) )
+    {
+        if( entry->d_name[ 0 ] != '.' )
+        {
+            ( void ) snprintf( path, sizeof( path ), "%s/%s", BENCH_STORE_DIR, entry->d_name );
+            ( void ) unlink( path );
+        }
+    }
+
+    if( directory != NULL )
+    {
+        ( void ) closedir( directory );
+    }
+
+    ( void ) rmdir( BENCH_STORE_DIR );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    char directory[] = "/tmp/ota_chunk_store_benchmark_XXXXXX";
+    ChunkStoreContext_t store;
+    uint32_t imageSize = BENCH_DEFAULT_SIZE_KB * 1024U;
+    uint64_t budget = 0U;
+    uint32_t blockCount = 0U;
+    bool success = false;
+
+    if( argc > 1 )
+    {
+        imageSize = ( uint32_t ) strtoul( argv[ 1 ], NULL, 10 ) * 1024U;
+    }
+
+    /* By default the store holds both versions of the image. */
+    budget = ( argc > 2 ) ? ( strtoull( argv[ 2 ], NULL, 10 ) * 1024U ) : ( 4U * ( uint64_t ) imageSize );
+    blockCount = imageSize / BENCH_BLOCK_SIZE;
+
+    memset( &store, 0x00, sizeof( store ) );
+
+    if( ( blockCount == 0U ) || ( mkdtemp( directory ) == NULL ) || ( chdir( directory ) != 0 ) )
+    {
+        printf( "Usage: %s [imageSizeKb] [budgetKb]\n", argv[ 0 ] );
+    }
+    else if( ChunkStore_Open( &store, BENCH_STORE_DIR, budget ) )
+    {
+        printf( "%u blocks of %u bytes, store budget %llu KB:\n",
+                blockCount,
+                BENCH_BLOCK_SIZE,
+                ( unsigned long long ) ( budget / 1024U ) );
+        success = runJob( &store, "cold", blockCount, 0U ) &&
+                  runJob( &store, "warm, same", blockCount, 0U ) &&
+                  runJob( &store, "warm, changed", blockCount, 1U );
+        printf( "%u entries evicted to stay within the budget.\n", store.stats.evictions );
+        ChunkStore_Close( &store );
+    }
+    else
+    {
+        printf( "Failed to open the chunk store.\n" );
+    }
+
+    removeStore();
+    ( void ) chdir( "/" );
+    ( void ) rmdir( directory );
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file image_handoff_benchmark.c
+ * @brief Compares handing an image to the installer as a sealed memory file
+ * with copying the image into a file for it.
+ *
+ * Each way runs in a child process of its own. The child resets its peak
+ * resident set size by writing 5 to /proc/self/clear_refs and reads it back
+ * from VmHWM in /proc/self/status, so the growth it reports is its own.
+ * A second child plays the installer: it maps the image it receives
+ * read-only and reads it once.
+ *
+ * Usage: ota_handoff_benchmark [imageSizeKb]
+ */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "storage/image_handoff_posix.h"
+#include "utils/clock.h"
+
+#define BENCH_IMAGE_PATH       "image.bin"
+#define BENCH_COPY_PATH        "image_copy.bin"
+#define BENCH_SOCKET_PATH      "installer.sock"
+#define BENCH_DEFAULT_SIZE_KB  4096U
+#define BENCH_RUNS             5U
+
+/**
+ * @brief Result of one measured run, passed back from the child.
+ */
+typedef struct BenchResult
+{
+    bool success;         /**< @brief The image was passed on. */
+    uint64_t timeUs;      /**< @brief Time the run took. */
+    uint64_t bytesCopied; /**< @brief Bytes copied through user space. */
+    long peakRssGrowthKb; /**< @brief Growth of the peak resident set size,
+                             -1 if it could not be reset. */
+} BenchResult_t;
+
+typedef bool ( * BenchRun_t )( uint32_t imageSize,
+                               BenchResult_t * result );
+
+/*-----------------------------------------------------------*/
+
+static long readPeakRssKb( void )
+{
+    char line[ 128 ];
+    long peakKb = -1;
+    FILE * status = fopen( "/proc/self/status", "r" );
+
+    while( ( status != NULL ) && ( peakKb < 0 ) &&
+           ( fgets( line, sizeof( line ), status ) != NULL ) )
+    {
+        if( strncmp( line, "VmHWM:", 6U ) == 0 )
+        {
+            peakKb = strtol( &line[ 6 ], NULL, 10 );
+        }
+    }
+
+    if( status != NULL )
+    {
+        ( void ) fclose( status );
+    }
+
+    return peakKb;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool resetPeakRss( void )
+{
+    bool reset = false;
+    int fd = open( "/proc/self/clear_refs", O_WRONLY | O_CLOEXEC );
+
+    if( fd >= 0 )
+    {
+        reset = write( fd, "5", 1U ) == 1;
+        ( void ) close( fd );
+    }
+
+    return reset;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool writeImage( uint32_t imageSize )
+{
+    uint8_t block[ 4096 ];
+    uint32_t written = 0U;
+    uint32_t length;
+    bool success = true;
+    FILE * image = fopen( BENCH_IMAGE_PATH, "wb" );
+    size_t i;
+
+    for( i = 0U; i < sizeof( block ); i++ )
+    {
+        block[ i ] = ( uint8_t ) ( i * 31U );
+    }
+
+    success = image != NULL;
+
+    while( success && ( written < imageSize ) )
+    {
+        length = ( ( imageSize - written ) < sizeof( block ) ) ?
+                 ( imageSize - written ) : ( uint32_t ) sizeof( block );
+        success = fwrite( block, 1U, length, image ) == length;
+        written += length;
+    }
+
+    if( image != NULL )
+    {
+        success = ( fclose( image ) == 0 ) && success;
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Accepts runs images, maps each read-only and reads it once. */
+static void runInstaller( int listenFd,
+                          uint32_t runs )
+{
+    ImageHandoffMessage_t message;
+    union
+    {
+        char buffer[ CMSG_SPACE( sizeof( int ) ) ];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = &message, .iov_len = sizeof( message ) };
+    struct msghdr header;
+    struct cmsghdr * cmsg = NULL;
+    volatile uint8_t sum = 0U;
+    uint8_t answer;
+    uint8_t * image;
+    int socketFd;
+    int imageFd;
+    uint32_t run;
+    uint32_t i;
+
+    for( run = 0U; run < runs; run++ )
+    {
+        socketFd = accept( listenFd, NULL, NULL );
+        imageFd = -1;
+        answer = 1U;
+
+        memset( &control, 0x00, sizeof( control ) );
+        memset( &header, 0x00, sizeof( header ) );
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1U;
+        header.msg_control = control.buffer;
+        header.msg_controllen = sizeof( control.buffer );
+
+        if( ( socketFd >= 0 ) &&
+            ( recvmsg( socketFd, &header, 0 ) == ( ssize_t ) sizeof( message ) ) &&
+            ( message.magic == IMAGE_HANDOFF_MAGIC ) )
+        {
+            cmsg = CMSG_FIRSTHDR( &header );
+
+            if( ( cmsg != NULL ) && ( cmsg->cmsg_type == SCM_RIGHTS ) )
+            {
+                memcpy( &imageFd, CMSG_DATA( cmsg ), sizeof( int ) );
+            }
+        }
+
+        if( imageFd >= 0 )
+        {
+            image = mmap( NULL, message.imageSize, PROT_READ, MAP_SHARED, imageFd, 0 );
+
+            if( image != MAP_FAILED )
+            {
+                for( i = 0U; i < message.imageSize; i++ )
+                {
+                    sum += image[ i ];
+                }
+
+                ( void ) munmap( image, message.imageSize );
+                answer = 0U;
+            }
+
+            ( void ) close( imageFd );
+        }
+
+        if( socketFd >= 0 )
+        {
+            ( void ) send( socketFd, &answer, sizeof( answer ), MSG_NOSIGNAL );
+            ( void ) close( socketFd );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static pid_t startInstaller( uint32_t runs )
+{
+    struct sockaddr_un address;
+    pid_t installer = -1;
+    int listenFd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+
+    memset( &address, 0x00, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    strncpy( address.sun_path, BENCH_SOCKET_PATH, sizeof( address.sun_path ) - 1U );
+
+    if( ( listenFd >= 0 ) &&
+        ( bind( listenFd, ( struct sockaddr * ) &address, sizeof( address ) ) == 0 ) &&
+        ( listen( listenFd, 1 ) == 0 ) )
+    {
+        installer = fork();
+
+        if( installer == 0 )
+        {
+            runInstaller( listenFd, runs );
+            _exit( EXIT_SUCCESS );
+        }
+    }
+
+    if( listenFd >= 0 )
+    {
+        ( void ) close( listenFd );
+    }
+
+    return installer;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool handOff( uint32_t imageSize,
+                     BenchResult_t * result )
+{
+    ImageHandoffStats_t stats = { 0 };
+    bool success = ImageHandoff_Send( BENCH_SOCKET_PATH, BENCH_IMAGE_PATH, imageSize, &stats );
+
+    result->timeUs = stats.fillTimeUs + stats.sealTimeUs + stats.sendTimeUs;
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+/* What an installer without a shared descriptor needs: a copy of the image
+ * read into memory and written to a file of its own. */
+static bool copyImage( uint32_t imageSize,
+                       BenchResult_t * result )
+{
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    uint8_t * image = ( uint8_t * ) malloc( imageSize );
+    bool success = false;
+    int imageFd = open( BENCH_IMAGE_PATH, O_RDONLY | O_CLOEXEC );
+    int copyFd = open( BENCH_COPY_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 );
+
+    if( ( image != NULL ) && ( imageFd >= 0 ) && ( copyFd >= 0 ) )
+    {
+        success = ( read( imageFd, image, imageSize ) == ( ssize_t ) imageSize ) &&
+                  ( write( copyFd, image, imageSize ) == ( ssize_t ) imageSize ) &&
+                  ( fsync( copyFd ) == 0 );
+    }
+
+    result->timeUs = Clock_GetTimeUs() - startTimeUs;
+    result->bytesCopied = success ? ( 2U * ( uint64_t ) imageSize ) : 0U;
+
+    if( copyFd >= 0 )
+    {
+        ( void ) close( copyFd );
+        ( void ) unlink( BENCH_COPY_PATH );
+    }
+
+    if( imageFd >= 0 )
+    {
+        ( void ) close( imageFd );
+    }
+
+    free( image );
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Runs one way in a fresh child, so that neither way inherits the peak of
+ * the other. */
+static bool measure( BenchRun_t run,
+                     uint32_t imageSize,
+                     BenchResult_t * result )
+{
+    BenchResult_t childResult;
+    int status = 0;
+    int pipeFds[ 2 ];
+    long startKb;
+    pid_t child = -1;
+    bool received = false;
+
+    if( pipe( pipeFds ) == 0 )
+    {
+        child = fork();
+
+        if( child == 0 )
+        {
+            memset( &childResult, 0x00, sizeof( childResult ) );
+            startKb = resetPeakRss() ? readPeakRssKb() : -1;
+            childResult.success = run( imageSize, &childResult );
+            childResult.peakRssGrowthKb = ( startKb >= 0 ) ? ( readPeakRssKb() - startKb ) : -1;
+            ( void ) write( pipeFds[ 1 ], &childResult, sizeof( childResult ) );
+            _exit( EXIT_SUCCESS );
+        }
+
+        ( void ) close( pipeFds[ 1 ] );
+
+        if( child > 0 )
+        {
+            received = read( pipeFds[ 0 ], result, sizeof( *result ) ) == ( ssize_t ) sizeof( *result );
+            ( void ) waitpid( child, &status, 0 );
+        }
+
+        ( void ) close( pipeFds[ 0 ] );
+    }
+
+    return received && result->success;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool report( const char * name,
+                    BenchRun_t run,
+                    uint32_t imageSize )
+{
+    BenchResult_t result;
+    uint64_t totalTimeUs = 0U;
+    long maxGrowthKb = -1;
+    bool success = true;
+    uint32_t i;
+
+    for( i = 0U; success && ( i < BENCH_RUNS ); i++ )
+    {
+        memset( &result, 0x00, sizeof( result ) );
+        success = measure( run, imageSize, &result );
+        totalTimeUs += result.timeUs;
+        maxGrowthKb = ( result.peakRssGrowthKb > maxGrowthKb ) ? result.peakRssGrowthKb : maxGrowthKb;
+    }
+
+    if( success )
+    {
+        printf( "%-9s %10llu us %12llu bytes copied   peak RSS +%ld KB\n",
+                name,
+                ( unsigned long long ) ( totalTimeUs / BENCH_RUNS ),
+                ( unsigned long long ) result.bytesCopied,
+                maxGrowthKb );
+    }
+    else
+    {
+        printf( "%-9s failed\n", name );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    char directory[] = "/tmp/ota_handoff_benchmark_XXXXXX";
+    uint32_t imageSize = BENCH_DEFAULT_SIZE_KB * 1024U;
+    pid_t installer = -1;
+    int status = 0;
+    bool success = false;
+
+    if( argc > 1 )
+    {
+        imageSize = ( uint32_t ) strtoul( argv[ 1 ], NULL, 10 ) * 1024U;
+    }
+
+    if( ( imageSize == 0U ) || ( mkdtemp( directory ) == NULL ) || ( chdir( directory ) != 0 ) )
+    {
+        printf( "Usage: %s [imageSizeKb]\n", argv[ 0 ] );
+    }
+    else if( writeImage( imageSize ) )
+    {
+        installer = startInstaller( BENCH_RUNS );
+    }
+    else
+    {
+        printf( "Failed to write the image: errno=%d.\n", errno );
+    }
+
+    if( installer > 0 )
+    {
+        printf( "Handing over a %u KB image, mean of %u runs:\n",
+                ( unsigned int ) ( imageSize / 1024U ), ( unsigned int ) BENCH_RUNS );
+        success = report( "memfd", handOff, imageSize );
+        success = report( "file copy", copyImage, imageSize ) && success;
+
+        ( void ) kill( installer, SIGTERM );
+        ( void ) waitpid( installer, &status, 0 );
+    }
+
+    ( void ) unlink( BENCH_SOCKET_PATH );
+    ( void ) unlink( BENCH_IMAGE_PATH );
+    ( void ) chdir( "/" );
+    ( void ) rmdir( directory );
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
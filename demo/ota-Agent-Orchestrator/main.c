@@ -17,21 +17,62 @@
 #include "os/ota_os_freertos.h"
 #include "semphr.h"
 #include "task.h"
+#include "timers.h"
 
 #include "core_mqtt.h"
 #include "mqtt_wrapper.h"
 #include "ota_demo.h"
 #include "transport/transport_wrapper.h"
 #include "utils/clock.h"
+#include "utils/connection_supervisor.h"
+#include "utils/io_watcher.h"
 
 #define MAX_THING_NAME_SIZE 128U
+#define CONNECT_BASE_BACKOFF_MS    500U
+#define CONNECT_MAX_BACKOFF_MS     32000U
+
+/* Cut the connection after it was up this long, to test recovery. */
+#ifndef OTA_FAULT_INJECTION_INTERVAL_MS
+    #define OTA_FAULT_INJECTION_INTERVAL_MS    0U
+#endif
+
+/* The MQTT task sleeps until the socket has data, a command is queued or a
+ * deadline is due, instead of polling every few ticks. */
+#ifndef MQTT_TASK_EVENT_DRIVEN
+    #define MQTT_TASK_EVENT_DRIVEN    1
+#endif
+
+#define MQTT_TASK_POLL_TICKS                10U
+#define MQTT_TASK_MAX_PACKETS_PER_WAKEUP    16U
+#define MQTT_TASK_STATS_INTERVAL_MS         60000U
+
+/* A PINGREQ goes out every half keep-alive interval, and the PINGRESP is
+ * due before the next one. */
+#define MQTT_KEEP_ALIVE_PERIOD_MS    ( MQTT_WRAPPER_KEEP_ALIVE_SECONDS * 1000U / 2U )
 
 static TransportInterface_t transport = { 0 };
 static MQTTContext_t mqttContext = { 0 };
 static uint8_t networkBuffer[ 5000U ];
-
-static StaticSemaphore_t MQTTAgentLockBuffer;
-static StaticSemaphore_t MQTTStateUpdateLockBuffer;
+static MQTTPubAckInfo_t outgoingPublishRecords[ MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES ];
+static uint32_t processStartTimeMs = 0U;
+static char ** commandLineArgs = NULL;
+static ConnectionSupervisorContext_t connectionSupervisor;
+
+static TaskHandle_t mqttTaskHandle = NULL;
+static IoWatcherContext_t socketWatcher;
+static TimerHandle_t keepAliveTimer = NULL;
+static bool keepAliveDue = false;
+static bool pingResponsePending = false;
+static uint32_t mqttPacketsReceived = 0U;
+static bool receivePending = false;
+static bool eventDriven = false;
+static uint32_t mqttTaskWakeups = 0U;
+static uint32_t mqttTaskDataWakeups = 0U;
+static uint32_t mqttTaskStatsStartMs = 0U;
+static bool connectionFailed = false;
+
+/* The MQTT task owns the context and other tasks reach it through the
+ * command queue of the wrapper, so the coreMQTT hooks take no locks. */
 SemaphoreHandle_t MQTTAgentLock = NULL;
 SemaphoreHandle_t MQTTStateUpdateLock = NULL;
 
@@ -41,6 +82,35 @@ static void mqttProcessLoopTask( void * parameters );
 
 static void suspendResumeLoopTask( void * parameters );
 
+static bool connectToBroker( void * context,
+                             bool * sessionPresent );
+
+static void teardownConnection( void * context );
+
+static void delayTask( uint32_t delayMs );
+
+static void connectToBrokerFirst( void );
+
+static void reconnectToBroker( void );
+
+static void socketWatcherTask( void * parameters );
+
+static void wakeMqttTask( void * context );
+
+static void keepAliveTimerCallback( TimerHandle_t timer );
+
+static void serviceConnection( void );
+
+static void keepConnectionAlive( void );
+
+
+static uint32_t timeUntil( uint32_t nowMs,
+                           uint32_t deadlineMs );
+
+static uint32_t getMqttTaskWaitMs( void );
+
+static void reportMqttTaskStats( void );
+
 static void mqttEventCallback( MQTTContext_t * mqttContext,
                                MQTTPacketInfo_t * packetInfo,
                                MQTTDeserializedInfo_t * deserializedInfo );
@@ -54,6 +124,9 @@ int main( int argc, char * argv[] )
 {
     MQTTStatus_t mqttResult;
     MQTTFixedBuffer_t fixedBuffer = { 0 };
+    ConnectionSupervisorConfig_t supervisorConfig = { 0 };
+
+    processStartTimeMs = Clock_GetTimeMs();
 
     if( argc != 6 )
     {
@@ -63,11 +136,6 @@ int main( int argc, char * argv[] )
         return 1;
     }
 
-    MQTTAgentLock = xSemaphoreCreateRecursiveMutexStatic(
-        &MQTTAgentLockBuffer );
-    MQTTStateUpdateLock = xSemaphoreCreateMutexStatic(
-        &MQTTStateUpdateLockBuffer );
-
     fixedBuffer.pBuffer = networkBuffer;
     fixedBuffer.size = 5000U;
 
@@ -79,13 +147,60 @@ int main( int argc, char * argv[] )
                             &fixedBuffer );
     assert( mqttResult == MQTTSuccess );
 
+    /* coreMQTT tracks the QoS 1 publishes in flight. */
+    mqttResult = MQTT_InitStatefulQoS( &mqttContext,
+                                       outgoingPublishRecords,
+                                       MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES,
+                                       NULL,
+                                       0U );
+    assert( mqttResult == MQTTSuccess );
+
+    commandLineArgs = argv;
+
+    supervisorConfig.baseBackoffMs = CONNECT_BASE_BACKOFF_MS;
+    supervisorConfig.maxBackoffMs = CONNECT_MAX_BACKOFF_MS;
+    supervisorConfig.maxAttempts = 0U;
+    supervisorConfig.faultIntervalMs = OTA_FAULT_INJECTION_INTERVAL_MS;
+    supervisorConfig.connect = connectToBroker;
+    supervisorConfig.teardown = teardownConnection;
+    supervisorConfig.delay = delayTask;
+    ConnectionSupervisor_Init( &connectionSupervisor, &supervisorConfig );
+
+    #if MQTT_TASK_EVENT_DRIVEN
+        eventDriven = IoWatcher_Init( &socketWatcher );
+
+        if( !eventDriven )
+        {
+            printf( "Watching the socket failed. Polling it instead.\n" );
+        }
+    #endif
+
+    /* Started once connected. */
+    keepAliveTimer = xTimerCreate( "T_KEEPALIVE",
+                                   pdMS_TO_TICKS( MQTT_KEEP_ALIVE_PERIOD_MS ),
+                                   pdTRUE,
+                                   NULL,
+                                   keepAliveTimerCallback );
+    assert( keepAliveTimer != NULL );
+
+    /* The event queue exists before the MQTT task reports the
+     * connection. */
+    otaDemo_setProcessStartTime( processStartTimeMs );
+    ( void ) OtaInitEvent_FreeRTOS();
+
     xTaskCreate( otaAgentTask, "T_OTA", 6000, ( void * ) argv, 1, NULL );
-    xTaskCreate( mqttProcessLoopTask, "T_MQTT", 6000, NULL, 2, NULL );
+    xTaskCreate( mqttProcessLoopTask, "T_MQTT", 6000, NULL, 2, &mqttTaskHandle );
     xTaskCreate( suspendResumeLoopTask, "T_SUSPEND", 6000, NULL, 2, NULL );
 
+    if( eventDriven )
+    {
+        xTaskCreate( socketWatcherTask, "T_WATCH", 2000, NULL, tskIDLE_PRIORITY, NULL );
+    }
+
     mqttWrapper_setCoreMqttContext( &mqttContext );
     mqttWrapper_setThingName( argv[ 5 ],
                               strnlen( argv[ 5 ], MAX_THING_NAME_SIZE ) );
+    mqttWrapper_useCommandQueue( wakeMqttTask, NULL );
 
     vTaskStartScheduler();
 
@@ -123,24 +238,360 @@ static void suspendResumeLoopTask( void * parameters )
 
 static void mqttProcessLoopTask( void * parameters )
 {
+    TickType_t waitTicks = MQTT_TASK_POLL_TICKS;
+    bool corked = false;
+
     ( void ) parameters;
 
+    /* The task owning the context builds the connection too. */
+    connectToBrokerFirst();
+    mqttTaskStatsStartMs = Clock_GetTimeMs();
+
     while( true )
     {
-        if( mqttWrapper_isConnected() )
+        waitTicks = MQTT_TASK_POLL_TICKS;
+
+        /* A send stopped part way through a packet, nothing can follow it
+         * on this connection. */
+        if( !connectionFailed && mqttWrapper_isConnectionBroken() )
         {
-            MQTTStatus_t status = MQTT_ProcessLoop( &mqttContext );
+            printf( "MQTT send failed. Reconnecting to the persistent session.\n" );
+            reconnectToBroker();
+        }
+
+        if( !connectionFailed && mqttWrapper_isConnected() )
+        {
+            serviceConnection();
+
+            /* Back-to-back publishes leave in as few TCP segments as
+             * possible. */
+            corked = mqttWrapper_getQueuedCommandCount() > 1U;
+
+            if( corked )
+            {
+                transport_tlsSetCork( true );
+            }
 
-            if( status == MQTTRecvFailed )
+            ( void ) mqttWrapper_processCommands();
+            ( void ) mqttWrapper_resendPublishes();
+
+            if( corked )
             {
-                printf( "ERROR: MQTT Receive failed. Closing connection.\n" );
-                exit( 1 );
+                transport_tlsSetCork( false );
             }
+
+            /* A tick more, so the deadline has passed on waking. */
+            waitTicks = eventDriven ? pdMS_TO_TICKS( getMqttTaskWaitMs() ) + 1U : waitTicks;
+            waitTicks = ( mqttWrapper_isConnectionBroken() || receivePending ) ? 0U : waitTicks;
+        }
+
+        reportMqttTaskStats();
+
+        /* Once the supervisor gave up, the task only waits. */
+        waitTicks = connectionFailed ? portMAX_DELAY : waitTicks;
+
+        /* Woken early when a command is queued, the socket has data or the
+         * keep-alive is due. */
+        ( void ) ulTaskNotifyTake( pdTRUE, waitTicks );
+        mqttTaskWakeups++;
+    }
+}
+
+static void serviceConnection( void )
+{
+    MQTTStatus_t status = MQTTSuccess;
+    uint32_t packetsBefore = 0U;
+    uint32_t packets = 0U;
+    bool readable = true;
+
+    if( eventDriven )
+    {
+        readable = IoWatcher_Claim( &socketWatcher ) || receivePending;
+        mqttTaskDataWakeups += readable ? 1U : 0U;
+    }
+
+    receivePending = false;
+
+    /* OpenSSL and coreMQTT may hold bytes the socket does not signal again,
+     * so packets are received until a call delivers none. The keep-alive
+     * is left to the timer. */
+    if( readable )
+    {
+        do
+        {
+            packetsBefore = mqttPacketsReceived;
+            status = MQTT_ReceiveLoop( &mqttContext );
+            packets++;
+        } while( ( status == MQTTSuccess ) && ( mqttPacketsReceived != packetsBefore ) &&
+                 ( packets < MQTT_TASK_MAX_PACKETS_PER_WAKEUP ) );
+
+        /* Stopped at the limit to serve the commands; more may be waiting. */
+        receivePending = eventDriven && ( status == MQTTSuccess ) &&
+                         ( mqttPacketsReceived != packetsBefore );
+
+        if( eventDriven )
+        {
+            IoWatcher_Rearm( &socketWatcher );
+        }
+    }
+
+    if( ( status == MQTTRecvFailed ) || ( status == MQTTSendFailed ) )
+    {
+        printf( "MQTT connection lost. Reconnecting to the persistent session.\n" );
+        reconnectToBroker();
+    }
+    else if( ConnectionSupervisor_FaultDue( &connectionSupervisor ) )
+    {
+        printf( "Fault injection: cutting the MQTT connection.\n" );
+        reconnectToBroker();
+    }
+    else
+    {
+        keepConnectionAlive();
+    }
+}
+
+/* The timer only marks the keep-alive due; the task owning the context
+ * sends the PINGREQ. */
+static void keepConnectionAlive( void )
+{
+    if( __atomic_exchange_n( &keepAliveDue, false, __ATOMIC_RELAXED ) )
+    {
+        if( pingResponsePending )
+        {
+            printf( "MQTT PINGRESP not received. Reconnecting to the persistent session.\n" );
+            reconnectToBroker();
+        }
+        else if( MQTT_Ping( &mqttContext ) == MQTTSuccess )
+        {
+            pingResponsePending = true;
+        }
+        else
+        {
+            printf( "MQTT PINGREQ failed. Reconnecting to the persistent session.\n" );
+            reconnectToBroker();
         }
-        vTaskDelay( 10 );
     }
 }
 
+static uint32_t timeUntil( uint32_t nowMs,
+                           uint32_t deadlineMs )
+{
+    int32_t remainingMs = ( int32_t ) ( deadlineMs - nowMs );
+
+    return ( remainingMs > 0 ) ? ( uint32_t ) remainingMs : 0U;
+}
+
+static uint32_t getMqttTaskWaitMs( void )
+{
+    uint32_t nowMs = Clock_GetTimeMs();
+    uint32_t faultIntervalMs = connectionSupervisor.config.faultIntervalMs;
+    uint32_t waitMs = timeUntil( nowMs, mqttTaskStatsStartMs + MQTT_TASK_STATS_INTERVAL_MS );
+    uint32_t deadlineMs = mqttWrapper_getResendDelayMs();
+
+    waitMs = ( deadlineMs < waitMs ) ? deadlineMs : waitMs;
+
+    if( faultIntervalMs > 0U )
+    {
+        deadlineMs = timeUntil( nowMs, connectionSupervisor.connectedAtMs + faultIntervalMs );
+        waitMs = ( deadlineMs < waitMs ) ? deadlineMs : waitMs;
+    }
+
+    return waitMs;
+}
+
+static void reportMqttTaskStats( void )
+{
+    const IoWatcherStats_t * stats = &socketWatcher.stats;
+    TransportRecvStats_t recvStats;
+    TransportSendStats_t sendStats;
+    uint32_t elapsedMs = Clock_GetTimeMs() - mqttTaskStatsStartMs;
+
+    if( OTA_DEMO_STATS && ( elapsedMs >= MQTT_TASK_STATS_INTERVAL_MS ) )
+    {
+        printf( "MQTT task: %u wakeups in %u ms, %u.%02u per second, %u with data on the socket. "
+                "Data waited %llu us on average and %u us at most before it was processed.\n",
+                mqttTaskWakeups,
+                elapsedMs,
+                mqttTaskWakeups * 1000U / elapsedMs,
+                ( mqttTaskWakeups * 100000U / elapsedMs ) % 100U,
+                mqttTaskDataWakeups,
+                ( unsigned long long ) ( ( stats->claimed > 0U ) ? stats->totalLatencyUs / stats->claimed : 0U ),
+                stats->maxLatencyUs );
+
+        transport_tlsGetRecvStats( &recvStats );
+        printf( "Transport: %u receive calls, %u with nothing received, "
+                "taking up to %u us at the median, %u us at the 99th percentile and %u us at most. "
+                "%llu bytes received with %u reads from OpenSSL, %llu per MB.\n",
+                recvStats.calls,
+                recvStats.retries,
+                recvStats.p50Us,
+                recvStats.p99Us,
+                recvStats.maxUs,
+                ( unsigned long long ) recvStats.bytes,
+                recvStats.transportReads,
+                ( unsigned long long ) ( ( recvStats.bytes > 0U ) ?
+                                         ( ( uint64_t ) recvStats.transportReads << 20 ) / recvStats.bytes : 0U ) );
+        transport_tlsResetRecvStats();
+
+        transport_tlsGetSendStats( &sendStats );
+        printf( "Transport: %u TLS records sent, %llu bytes on the wire.\n",
+                sendStats.records,
+                ( unsigned long long ) sendStats.wireBytes );
+        transport_tlsResetSendStats();
+
+        mqttTaskWakeups = 0U;
+        mqttTaskDataWakeups = 0U;
+        mqttTaskStatsStartMs += elapsedMs;
+    }
+}
+
+static void wakeMqttTask( void * context )
+{
+    ( void ) context;
+
+    if( mqttTaskHandle != NULL )
+    {
+        ( void ) xTaskNotifyGive( mqttTaskHandle );
+    }
+}
+
+/* At the idle priority it only waits in epoll while no other task is
+ * ready, and the notify switches to the MQTT task at once. */
+static void socketWatcherTask( void * parameters )
+{
+    ( void ) parameters;
+
+    for( ; ; )
+    {
+        if( IoWatcher_Wait( &socketWatcher ) )
+        {
+            wakeMqttTask( NULL );
+        }
+        else
+        {
+            vTaskDelay( MQTT_TASK_POLL_TICKS );
+        }
+    }
+}
+
+static void keepAliveTimerCallback( TimerHandle_t timer )
+{
+    ( void ) timer;
+
+    __atomic_store_n( &keepAliveDue, true, __ATOMIC_RELAXED );
+    wakeMqttTask( NULL );
+}
+
+/* The session outlives the connection, so the broker keeps the
+ * subscriptions and the unacknowledged QoS 1 publishes while it is down. */
+static bool connectToBroker( void * context,
+                             bool * sessionPresent )
+{
+    char * thingName = commandLineArgs[ 5 ];
+    bool result = false;
+
+    ( void ) context;
+
+    result = transport_tlsConnect( commandLineArgs[ 1 ],
+                                   commandLineArgs[ 2 ],
+                                   commandLineArgs[ 3 ],
+                                   commandLineArgs[ 4 ] );
+
+    if( result )
+    {
+        result = mqttWrapper_connectSession( thingName,
+                                             strnlen( thingName, MAX_THING_NAME_SIZE ),
+                                             false,
+                                             sessionPresent );
+    }
+
+    /* Watched once connected, so the CONNACK wakes nobody. */
+    if( result && eventDriven )
+    {
+        result = IoWatcher_Watch( &socketWatcher, transport_tlsGetSocket() );
+    }
+
+    if( result )
+    {
+        pingResponsePending = false;
+        __atomic_store_n( &keepAliveDue, false, __ATOMIC_RELAXED );
+        ( void ) xTimerReset( keepAliveTimer, 0U );
+    }
+
+    return result;
+}
+
+/* No DISCONNECT can be sent on a broken connection. */
+static void teardownConnection( void * context )
+{
+    ( void ) context;
+
+    ( void ) xTimerStop( keepAliveTimer, 0U );
+
+    if( eventDriven )
+    {
+        ( void ) IoWatcher_Watch( &socketWatcher, -1 );
+    }
+
+    transport_tlsDisconnect();
+    mqttContext.connectStatus = MQTTNotConnected;
+}
+
+static void delayTask( uint32_t delayMs )
+{
+    vTaskDelay( pdMS_TO_TICKS( delayMs ) );
+}
+
+/* A session left by an earlier run has nothing in flight for this one; the
+ * agent subscribes anyway. */
+static void connectToBrokerFirst( void )
+{
+    uint32_t connectStartTimeMs = Clock_GetTimeMs();
+    bool sessionPresent = false;
+
+    if( ConnectionSupervisor_Connect( &connectionSupervisor, &sessionPresent ) )
+    {
+        otaDemo_handleConnect( sessionPresent, Clock_GetTimeMs() - connectStartTimeMs );
+    }
+    else
+    {
+        printf( "ERROR: Connecting to IoT Core failed.\n" );
+        connectionFailed = true;
+        otaDemo_handleConnectionFailed();
+    }
+}
+
+static void reconnectToBroker( void )
+{
+    const ConnectionSupervisorStats_t * stats = &connectionSupervisor.stats;
+    uint32_t lostTimeMs = Clock_GetTimeMs();
+    bool sessionPresent = false;
+    size_t replayed = 0U;
+
+    if( !ConnectionSupervisor_Reconnect( &connectionSupervisor, &sessionPresent ) )
+    {
+        printf( "ERROR: Reconnecting to IoT Core failed.\n" );
+        connectionFailed = true;
+        otaDemo_handleConnectionFailed();
+        return;
+    }
+
+    replayed = mqttWrapper_resumeSession( sessionPresent );
+    printf( "Reconnected in %u ms, session %s, %u unacknowledged publishes replayed. "
+            "%u reconnects, %u failed attempts, %u faults injected, %u ms down in total, %u ms at most.\n",
+            Clock_GetTimeMs() - lostTimeMs,
+            sessionPresent ? "resumed" : "lost",
+            ( unsigned int ) replayed,
+            stats->reconnects,
+            stats->failedAttempts,
+            stats->faultsInjected,
+            stats->downtimeMs,
+            stats->longestDowntimeMs );
+
+    otaDemo_handleReconnect( sessionPresent, lostTimeMs );
+}
+
 static void mqttEventCallback( MQTTContext_t * mqttContext,
                                MQTTPacketInfo_t * packetInfo,
                                MQTTDeserializedInfo_t * deserializedInfo )
@@ -152,6 +603,8 @@ static void mqttEventCallback( MQTTContext_t * mqttContext,
 
     ( void ) mqttContext;
 
+    mqttPacketsReceived++;
+
     if( ( packetInfo->type & 0xF0U ) == MQTT_PACKET_TYPE_PUBLISH )
     {
         assert( deserializedInfo->pPublishInfo != NULL );
@@ -167,19 +620,26 @@ static void mqttEventCallback( MQTTContext_t * mqttContext,
         switch( packetInfo->type )
         {
             case MQTT_PACKET_TYPE_PUBACK:
-                printf( "PUBACK received with packet id: %u\n",
-                        ( unsigned int ) deserializedInfo->packetIdentifier );
+                ( void ) mqttWrapper_handlePubAck( deserializedInfo->packetIdentifier );
                 break;
 
             case MQTT_PACKET_TYPE_SUBACK:
                 printf( "SUBACK received with packet id: %u\n",
                         ( unsigned int ) deserializedInfo->packetIdentifier );
+                ( void ) mqttWrapper_handleSubAck( packetInfo,
+                                                   deserializedInfo->packetIdentifier );
                 break;
 
             case MQTT_PACKET_TYPE_UNSUBACK:
                 printf( "UNSUBACK received with packet id: %u\n",
                         ( unsigned int ) deserializedInfo->packetIdentifier );
                 break;
+
+            /* Passed on because the task receives with MQTT_ReceiveLoop. */
+            case MQTT_PACKET_TYPE_PINGRESP:
+                pingResponsePending = false;
+                break;
+
             default:
                 printf( "Error: Unknown packet type received:(%02x).\n",
                         packetInfo->type );
@@ -210,23 +670,7 @@ static void handleIncomingMQTTMessage( char * topic,
 
 static void otaAgentTask( void * parameters )
 {
-    char ** commandLineArgs = ( char ** ) parameters;
-    char * certificateFilePath = commandLineArgs[ 1 ];
-    char * privateKeyFilePath = commandLineArgs[ 2 ];
-    char * rootCAFilePath = commandLineArgs[ 3 ];
-    char * endpoint = commandLineArgs[ 4 ];
-    char * thingName = commandLineArgs[ 5 ];
-
-    bool result = transport_tlsConnect( certificateFilePath,
-                                        privateKeyFilePath,
-                                        rootCAFilePath,
-                                        endpoint );
-    assert( result );
-
-    result = mqttWrapper_connect( thingName,
-                                  strnlen( thingName, MAX_THING_NAME_SIZE ) );
-    assert( result );
-    printf( "Successfully connected to IoT Core\n" );
+    ( void ) parameters;
 
     otaDemo_start();
 
@@ -9,24 +9,60 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "MQTTFileDownloader.h"
+#include "core_json.h"
 #include "jobs.h"
 #include "mqtt_wrapper.h"
 #include "ota_demo.h"
 #include "ota_job_processor.h"
 #include "os/ota_os_freertos.h"
+#include "storage/image_handoff_posix.h"
+#include "storage/ota_storage_posix.h"
+#include "utils/clock.h"
+#include "utils/job_index.h"
+#include "utils/job_progress.h"
+#include "utils/job_report.h"
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "timers.h"
+#include "backoff_algorithm.h"
+#include <openssl/sha.h>
+#include <sys/resource.h>
 
 #define CONFIG_MAX_FILE_SIZE           65536U
 #define NUM_OF_BLOCKS_REQUESTED        1U
 #define START_JOB_MSG_LENGTH           147U
-#define MAX_THING_NAME_SIZE            128U
-#define MAX_JOB_ID_LENGTH              64U
-#define UPDATE_JOB_MSG_LENGTH          48U
+#define UPDATE_JOB_MSG_LENGTH          64U
 #define MAX_NUM_OF_OTA_DATA_BUFFERS    5U
+#define OTA_SLOT_METADATA_PATH         "ota_slots.dat"
+#define OTA_SLOT_A_PATH                "ota_slot_a.bin"
+#define OTA_SLOT_B_PATH                "ota_slot_b.bin"
+#define OTA_PARTITION_SECTORS          16U /* CONFIG_MAX_FILE_SIZE in 4 KB sectors */
+#define ERASE_AHEAD_SECTORS            4U
+#define OTA_WRITE_UNIT_SIZE            4096U
+#define OTA_WRITE_OPEN_UNITS           3U
+#define OTA_RESUME_JOURNAL_PATH        "ota_resume.journal"
+#define OTA_JOURNAL_SYNC_BLOCKS        16U /* Blocks which may have to be downloaded again after a crash */
+#define OTA_JOURNAL_SNAPSHOT_RECORDS   64U
+#define OTA_BLOCK_DIGEST_FILE_TYPE     1U /* fileType of the SHA-256 digest list of the image blocks */
+#define OTA_CHUNK_STORE_DIR            "ota_chunks"
+#define OTA_CHUNK_STORE_BUDGET         ( 4U * CONFIG_MAX_FILE_SIZE )
+#define OTA_INSTALLER_SOCKET_PATH      "ota_installer.sock"
+#define OTA_JOB_POLL_BASE_BACKOFF_MS   1000U  /* StartNext polling is only a fallback to notify-next */
+#define OTA_JOB_POLL_MAX_BACKOFF_MS    60000U
+#define OTA_PREFETCH_BLOCKS            8U /* Blocks left when the document of the next job is fetched */
+#define MAX_JOB_VERSION_LENGTH         10U
+#define GET_PENDING_JOBS_MSG           "{}"
+#define DESCRIBE_JOB_MSG               "{\"includeJobDocument\":true}"
+#define OTA_PROGRESS_MIN_INTERVAL_MS   2000U
+#define OTA_PROGRESS_MIN_PERCENT       10U
+#define OTA_PROGRESS_HEARTBEAT_MS      60000U /* Well below the shortest step timeout of one minute */
+#define OTA_PROGRESS_RETRY_MS          5000U
+#define OTA_FINAL_STATUS_MAX_ATTEMPTS  3U
+#define OTA_SUBSCRIBE_FILTER_COUNT     7U /* Six jobs topics and the stream data */
 
 MqttFileDownloaderContext_t mqttFileDownloaderContext = { 0 };
 static uint32_t numOfBlocksRemaining = 0;
@@ -39,20 +75,72 @@ char globalJobId[ MAX_JOB_ID_LENGTH ] = { 0 };
 
 static OtaDataEvent_t dataBuffers[ MAX_NUM_OF_OTA_DATA_BUFFERS ] = { 0 };
 static OtaJobEventData_t jobDocBuffer = { 0 };
+static bool jobDocBufferUsed = false;
+static OtaJobEventData_t nextJobDocBuffer = { 0 };
+static bool nextJobDocBufferUsed = false;
 static SemaphoreHandle_t bufferSemaphore;
 
 static OtaState_t otaAgentState = OtaAgentStateInit;
 
-static void finishDownload( void );
+static OtaStorageContext_t otaStorage = { 0 };
+static AfrOtaJobDocumentFields_t imageFileFields = { 0 };
+static AfrOtaJobDocumentFields_t digestFileFields = { 0 };
+static bool digestFileListed = false;
+static bool downloadingDigests = false;
+static JobIndex_t jobIndex = { 0 };
+static uint32_t messagesRouted = 0;
+static BackoffAlgorithmContext_t jobPollBackoff = { 0 };
+static TimerHandle_t jobPollTimer = NULL;
+static uint32_t jobNotifiedTimeMs = 0;
+static bool jobNotified = false;
+static uint64_t routingTimeNs = 0;
+static JobIndex_t nextJobIndex = { 0 };
+static char nextJobId[ MAX_JOB_ID_LENGTH ] = { 0 };
+static char nextJobVersion[ MAX_JOB_VERSION_LENGTH + 1 ] = { 0 };
+static bool nextJobRequested = false;
+static bool nextJobReady = false;
+static bool nextJobPrefetched = false;
+static uint32_t jobEndTimeMs = 0;
+static bool jobEnded = false;
+static bool prefetchedJobStarting = false;
+static JobProgressContext_t jobProgress = { 0 };
+static bool jobProgressActive = false;
+static char finalStatusJobId[ MAX_JOB_ID_LENGTH ] = { 0 };
+static JobCurrentStatus_t finalStatus = Failed;
+static char finalStatusDetails[ JOB_REPORT_DETAILS_SIZE ] = { 0 };
+static uint32_t finalStatusAttempts = 0;
+static bool finalStatusPending = false;
+static JobReport_t jobReport = { 0 };
+static uint32_t connectTimeMs = 0;
+static uint32_t nextJobFetchStartMs = 0;
+static uint32_t nextJobFetchMs = 0;
+static uint32_t nextUnrequestedBlock = 0;
+static uint32_t processStartTimeMs = 0;
+static bool startupReported = false;
+static bool subscriptionsPending = false;
+static bool blockRequestDeferred = false;
+static uint32_t subscribeTimeMs = 0;
+static size_t subscribedFilters = 0U;
+static volatile bool subscriptionsGranted = false;
+static long downloadContextSwitches = 0;
+static bool sessionResumed = false;
+static uint32_t connectionLostTimeMs = 0U;
+static bool reconnectDataPending = false;
+
+static void startAgent( const OtaConnectionEvent_t * connection );
+static void finishDownload( bool imageStored );
 static void processOTAEvents( void );
 static void requestJobDocumentHandler( void );
 static bool receivedJobDocumentHandler( OtaJobEventData_t * jobDoc );
-static bool jobDocumentParser( char * message,
-                               size_t messageLength,
+static bool jobDocumentParser( const JobIndex_t * index,
                                AfrOtaJobDocumentFields_t * jobFields );
 static void initMqttDownloader( AfrOtaJobDocumentFields_t * jobFields );
 static OtaDataEvent_t * getOtaDataEventBuffer( void );
 static void freeOtaDataEventBuffer( OtaDataEvent_t * const buffer );
+static OtaJobEventData_t * getJobDocBuffer( void );
+static void freeJobDocBuffer( void );
+static OtaJobEventData_t * getNextJobDocBuffer( void );
+static void freeNextJobDocBuffer( void );
 static void handleMqttStreamsBlockArrived( int32_t blockId,
                                            uint8_t * data,
                                            size_t dataLength );
@@ -62,6 +150,80 @@ static bool isBlockNeeded( uint32_t blockId );
 static void markBlockDownloaded( uint32_t blockId );
 static uint32_t findNextBlockToRequest();
 static uint32_t findSuccessiveBlocksToRequest( uint32_t startingBlock );
+static bool isImageBlockNeeded( void * blockContext,
+                                uint32_t blockId );
+static void handleStoredBlock( void * blockContext,
+                               uint32_t blockId,
+                               const uint8_t * data,
+                               size_t length );
+static void startImageDownload( void );
+static void computeFileDigest( uint8_t * fileDigest );
+static void handOffImage( void );
+static void registerTopicRoutes( void );
+static bool handleStartNextAccepted( char * topic,
+                                     size_t topicLength,
+                                     uint8_t * message,
+                                     size_t messageLength,
+                                     void * context );
+static bool handleStreamData( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              void * context );
+static bool handleNotifyNext( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              void * context );
+static void subscribeToOtaTopics( void );
+static void handleSubAck( uint16_t packetId,
+                          bool granted,
+                          void * context );
+static void scheduleJobPoll( void );
+static void jobPollTimerCallback( TimerHandle_t timer );
+static bool handleGetPendingAccepted( char * topic,
+                                      size_t topicLength,
+                                      uint8_t * message,
+                                      size_t messageLength,
+                                      void * context );
+static bool handleJobExecutionResponse( char * topic,
+                                        size_t topicLength,
+                                        uint8_t * message,
+                                        size_t messageLength,
+                                        void * context );
+static bool topicEndsWith( const char * topic,
+                           size_t topicLength,
+                           const char * suffix );
+static bool handleDescribeAccepted( uint8_t * message,
+                                    size_t messageLength );
+static bool handleUpdateResponse( const char * jobId,
+                                  size_t jobIdLength,
+                                  uint8_t * message,
+                                  size_t messageLength,
+                                  bool accepted );
+static void handleFinalStatusResponse( const char * jobId,
+                                       const OtaJobStatusEvent_t * response );
+static bool sendProgressReport( void * sendContext,
+                                const char * message,
+                                size_t messageLength );
+static void startProgressReports( OtaJobEventData_t * jobDoc );
+static void requestNextJob( void );
+static void requestNextJobDocument( void );
+static bool receivedNextJobHandler( OtaJobEventData_t * jobDoc );
+static void startNextJob( void );
+static void updateJobStatus( const char * jobId,
+                             JobCurrentStatus_t status,
+                             const char * expectedVersion,
+                             const char * statusDetails );
+static bool publishControlMessage( char * topic,
+                                   size_t topicLength,
+                                   uint8_t * message,
+                                   size_t messageLength,
+                                   MqttWrapperPubAckHandler_t handler );
+static void handleFinalStatusAck( uint16_t packetId,
+                                  uint32_t ackTimeMs,
+                                  void * context );
+static long getContextSwitches( void );
 
 
 static void freeOtaDataEventBuffer( OtaDataEvent_t * const pxBuffer )
@@ -104,15 +266,85 @@ static OtaDataEvent_t * getOtaDataEventBuffer( void )
     return freeBuffer;
 }
 
-void otaDemo_start( void )
+/* The document of the current job is written by the MQTT task only while
+ * the buffer is free. The agent owns it from the event until the job ends,
+ * as the fields of the job point into it, or until the document is found
+ * unusable. */
+static OtaJobEventData_t * getJobDocBuffer( void )
+{
+    OtaJobEventData_t * freeBuffer = NULL;
+
+    if( xSemaphoreTake( bufferSemaphore, portMAX_DELAY ) == pdTRUE )
+    {
+        if( !jobDocBufferUsed )
+        {
+            jobDocBufferUsed = true;
+            freeBuffer = &jobDocBuffer;
+        }
+
+        ( void ) xSemaphoreGive( bufferSemaphore );
+    }
+    else
+    {
+        printf( "Failed to get buffer semaphore. \n" );
+    }
+
+    return freeBuffer;
+}
+
+static void freeJobDocBuffer( void )
+{
+    if( xSemaphoreTake( bufferSemaphore, portMAX_DELAY ) == pdTRUE )
+    {
+        jobDocBufferUsed = false;
+        ( void ) xSemaphoreGive( bufferSemaphore );
+    }
+    else
+    {
+        printf( "Failed to get buffer semaphore. \n" );
+    }
+}
+
+/* The document of the next job is written by the MQTT task only while the
+ * buffer is free. The agent owns it from the event until the job starts or
+ * the document is found unusable. */
+static OtaJobEventData_t * getNextJobDocBuffer( void )
 {
-    OtaEventMsg_t initEvent = { 0 };
+    OtaJobEventData_t * freeBuffer = NULL;
+
+    if( xSemaphoreTake( bufferSemaphore, portMAX_DELAY ) == pdTRUE )
+    {
+        if( !nextJobDocBufferUsed )
+        {
+            nextJobDocBufferUsed = true;
+            freeBuffer = &nextJobDocBuffer;
+        }
+
+        ( void ) xSemaphoreGive( bufferSemaphore );
+    }
+    else
+    {
+        printf( "Failed to get buffer semaphore. \n" );
+    }
+
+    return freeBuffer;
+}
 
-    if( !mqttWrapper_isConnected() )
+static void freeNextJobDocBuffer( void )
+{
+    if( xSemaphoreTake( bufferSemaphore, portMAX_DELAY ) == pdTRUE )
     {
-        return;
+        nextJobDocBufferUsed = false;
+        ( void ) xSemaphoreGive( bufferSemaphore );
+    }
+    else
+    {
+        printf( "Failed to get buffer semaphore. \n" );
     }
+}
 
+void otaDemo_start( void )
+{
     bufferSemaphore = xSemaphoreCreateMutex();
 
     if( bufferSemaphore != NULL )
@@ -120,31 +352,113 @@ void otaDemo_start( void )
         memset( dataBuffers, 0x00, sizeof( dataBuffers ) );
     }
 
-    OtaInitEvent_FreeRTOS();
-
-    initEvent.eventId = OtaAgentEventRequestJobDocument;
-    OtaSendEvent_FreeRTOS( &initEvent );
-
+    /* The MQTT task connects and starts the agent through an event. */
     while( otaAgentState != OtaAgentStateStopped )
     {
         processOTAEvents();
     }
 }
 
+static void startAgent( const OtaConnectionEvent_t * connection )
+{
+    OtaStorageConfig_t storageConfig = {
+        .slotMetadataPath = OTA_SLOT_METADATA_PATH,
+        .slotPaths = { OTA_SLOT_A_PATH, OTA_SLOT_B_PATH },
+        .journalPath = OTA_RESUME_JOURNAL_PATH,
+        .chunkStoreDir = OTA_CHUNK_STORE_DIR,
+        .chunkStoreBudget = OTA_CHUNK_STORE_BUDGET,
+        .geometry = FLASH_SIM_NOR_GEOMETRY( OTA_PARTITION_SECTORS ),
+        .blockSize = mqttFileDownloader_CONFIG_BLOCK_SIZE,
+        .eraseAheadSectors = ERASE_AHEAD_SECTORS,
+        .writeUnitSize = OTA_WRITE_UNIT_SIZE,
+        .writeOpenUnits = OTA_WRITE_OPEN_UNITS,
+        .journalSyncBlocks = OTA_JOURNAL_SYNC_BLOCKS,
+        .journalSnapshotRecords = OTA_JOURNAL_SNAPSHOT_RECORDS,
+        .isBlockNeeded = isImageBlockNeeded,
+        .blockStored = handleStoredBlock,
+        .blockContext = NULL
+    };
+
+    printf( "Successfully connected to IoT Core\n" );
+    connectTimeMs = connection->connectTimeMs;
+
+    /* The SUBSCRIBE and the first StartNext go out back to back. The local
+     * storage is opened while both are in flight. */
+    registerTopicRoutes();
+    subscribeToOtaTopics();
+    requestJobDocumentHandler();
+    otaAgentState = OtaAgentStateRequestingJob;
+
+    /* Reaching AWS IoT is the self-test of a newly installed image. */
+    if( !OtaStorage_Init( &otaStorage, &storageConfig ) )
+    {
+        printf( "Failed to open the image slots. Images are only kept in RAM. \n" );
+    }
+
+    srand( ( unsigned int ) Clock_GetTimeUs() );
+    BackoffAlgorithm_InitializeParams( &jobPollBackoff,
+                                       OTA_JOB_POLL_BASE_BACKOFF_MS,
+                                       OTA_JOB_POLL_MAX_BACKOFF_MS,
+                                       BACKOFF_ALGORITHM_RETRY_FOREVER );
+    jobPollTimer = xTimerCreate( "OtaJobPoll",
+                                 pdMS_TO_TICKS( OTA_JOB_POLL_BASE_BACKOFF_MS ),
+                                 pdFALSE,
+                                 NULL,
+                                 jobPollTimerCallback );
+}
+
 OtaState_t getOtaAgentState()
 {
     return otaAgentState;
 }
 
+void otaDemo_setProcessStartTime( uint32_t processStartMs )
+{
+    processStartTimeMs = processStartMs;
+}
+
+/* The connection functions are called by the MQTT task; the agent picks up
+ * in its own task. */
+void otaDemo_handleConnect( bool sessionPresent,
+                            uint32_t connectTimeMs )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    nextEvent.connection.sessionPresent = sessionPresent;
+    nextEvent.connection.connectTimeMs = connectTimeMs;
+    nextEvent.eventId = OtaAgentEventStart;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
+void otaDemo_handleReconnect( bool sessionPresent,
+                              uint32_t lostTimeMs )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    nextEvent.connection.sessionPresent = sessionPresent;
+    nextEvent.connection.lostTimeMs = lostTimeMs;
+    nextEvent.eventId = OtaAgentEventReconnected;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
+void otaDemo_handleConnectionFailed( void )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    nextEvent.eventId = OtaAgentEventConnectionFailed;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
 static void requestJobDocumentHandler()
 {
-    char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+    const char * thingName = NULL;
     size_t thingNameLength = 0U;
     char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
     char messageBuffer[ START_JOB_MSG_LENGTH ] = { 0 };
     size_t topicLength = 0U;
 
-    mqttWrapper_getThingName( thingName, &thingNameLength );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
+    JobReport_Begin( &jobReport, JOB_REPORT_FETCH, Clock_GetTimeMs() );
 
     /*
      * AWS IoT Jobs library:
@@ -167,15 +481,16 @@ static void requestJobDocumentHandler()
                                               messageBuffer,
                                               START_JOB_MSG_LENGTH );
 
-    mqttWrapper_publish( topicBuffer,
-                         topicLength,
-                         ( uint8_t * ) messageBuffer,
-                         messageLength );
+    ( void ) publishControlMessage( topicBuffer,
+                                    topicLength,
+                                    ( uint8_t * ) messageBuffer,
+                                    messageLength,
+                                    NULL );
 }
 
 static void initMqttDownloader( AfrOtaJobDocumentFields_t * jobFields )
 {
-    char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+    const char * thingName = NULL;
     size_t thingNameLength = 0U;
 
     numOfBlocksRemaining = jobFields->fileSize /
@@ -187,8 +502,14 @@ static void initMqttDownloader( AfrOtaJobDocumentFields_t * jobFields )
     int bitmapSize = ( numOfBlocksRemaining + ( 8 - 1 ) ) / 8;
     blockBitmap = ( uint8_t * ) calloc( bitmapSize, sizeof( uint8_t ) );
     totalBlocks = numOfBlocksRemaining;
+    nextUnrequestedBlock = 0U;
+
+    if( !downloadingDigests )
+    {
+        ( void ) OtaStorage_Open( &otaStorage, globalJobId, strnlen( globalJobId, MAX_JOB_ID_LENGTH ) );
+    }
 
-    mqttWrapper_getThingName( thingName, &thingNameLength );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
 
     /*
      * MQTT streams Library:
@@ -208,22 +529,31 @@ static bool receivedJobDocumentHandler( OtaJobEventData_t * jobDoc )
 {
     bool parseJobDocument = false;
     bool handled = false;
-    char * jobId;
+    const char * jobId;
     size_t jobIdLength = 0U;
     AfrOtaJobDocumentFields_t jobFields = { 0 };
+    uint8_t fileDigest[ SHA256_DIGEST_LENGTH ] = { 0 };
+    uint64_t startTimeUs = Clock_GetTimeUs();
 
     /*
-     * AWS IoT Jobs library:
-     * Extracting the job ID from the received OTA job document.
+     * A single pass over the message finds the job ID, the OTA job document
+     * and every file of the document, instead of one coreJSON search each.
      */
-    jobIdLength = Jobs_GetJobId( ( char * ) jobDoc->jobData, jobDoc->jobDataLength, ( const char ** ) &jobId );
+    if( JobIndex_Build( &jobIndex, ( const char * ) jobDoc->jobData, jobDoc->jobDataLength ) )
+    {
+        OTA_STATS_PRINTF( "Indexed the job message with %u files in %llu us. \n",
+                          JobIndex_GetFileCount( &jobIndex ),
+                          ( unsigned long long ) ( Clock_GetTimeUs() - startTimeUs ) );
+        jobIdLength = JobIndex_GetJobId( &jobIndex, &jobId );
+    }
 
     if( jobIdLength )
     {
         if( strncmp( globalJobId, jobId, jobIdLength ) )
         {
-            parseJobDocument = true;
-            strncpy( globalJobId, jobId, jobIdLength );
+            parseJobDocument = jobIdLength < MAX_JOB_ID_LENGTH;
+            memcpy( globalJobId, jobId, parseJobDocument ? jobIdLength : 0U );
+            globalJobId[ parseJobDocument ? jobIdLength : 0U ] = '\0';
         }
         else
         {
@@ -233,11 +563,51 @@ static bool receivedJobDocumentHandler( OtaJobEventData_t * jobDoc )
 
     if( parseJobDocument )
     {
-        handled = jobDocumentParser( ( char * ) jobDoc->jobData, jobDoc->jobDataLength, &jobFields );
+        handled = jobDocumentParser( &jobIndex, &jobFields );
 
         if( handled )
         {
-            initMqttDownloader( &jobFields );
+            imageFileFields = jobFields;
+
+            /* Polling starts over at the base delay once the queue drains. */
+            BackoffAlgorithm_InitializeParams( &jobPollBackoff,
+                                               OTA_JOB_POLL_BASE_BACKOFF_MS,
+                                               OTA_JOB_POLL_MAX_BACKOFF_MS,
+                                               BACKOFF_ALGORITHM_RETRY_FOREVER );
+
+            if( jobNotified )
+            {
+                OTA_STATS_PRINTF( "Started the job %u ms after its notification. \n",
+                                  Clock_GetTimeMs() - jobNotifiedTimeMs );
+                jobNotified = false;
+            }
+
+            /* A prefetched document was fetched during the previous job. */
+            if( prefetchedJobStarting )
+            {
+                JobReport_SetPhase( &jobReport, JOB_REPORT_FETCH, nextJobFetchMs );
+            }
+            else
+            {
+                JobReport_End( &jobReport, JOB_REPORT_FETCH, Clock_GetTimeMs() );
+            }
+
+            JobReport_SetPhase( &jobReport, JOB_REPORT_CONNECT, connectTimeMs );
+            JobReport_Begin( &jobReport, JOB_REPORT_FIRST_BLOCK, Clock_GetTimeMs() );
+
+            startProgressReports( jobDoc );
+
+            /* An image seen before, under any job, is described by its
+             * manifest in the chunk store. With a digest list of the new
+             * image, only the blocks which differ from the running image or
+             * are not in the chunk store are downloaded. The list is fetched
+             * first. */
+            computeFileDigest( fileDigest );
+            downloadingDigests = !OtaStorage_BeginImage( &otaStorage, fileDigest, jobFields.fileSize ) &&
+                                 digestFileListed &&
+                                 OtaStorage_CanUseBlockDigests( &otaStorage );
+
+            initMqttDownloader( downloadingDigests ? &digestFileFields : &jobFields );
         }
     }
 
@@ -266,10 +636,11 @@ static void requestDataBlock( uint32_t startingBlock,
                                                                        getStreamRequest,
                                                                        GET_STREAM_REQUEST_BUFFER_SIZE );
 
-    mqttWrapper_publish( mqttFileDownloaderContext.topicGetStream,
-                         mqttFileDownloaderContext.topicGetStreamLength,
-                         ( uint8_t * ) getStreamRequest,
-                         getStreamRequestLength );
+    ( void ) publishControlMessage( mqttFileDownloaderContext.topicGetStream,
+                                    mqttFileDownloaderContext.topicGetStreamLength,
+                                    ( uint8_t * ) getStreamRequest,
+                                    getStreamRequestLength,
+                                    NULL );
 }
 
 
@@ -290,6 +661,15 @@ static void processOTAEvents()
 
     switch( recvEventId )
     {
+        case OtaAgentEventStart:
+
+            if( otaAgentState == OtaAgentStateInit )
+            {
+                startAgent( &recvEvent.connection );
+            }
+
+            break;
+
         case OtaAgentEventRequestJobDocument:
             printf( "Request Job Document event Received \n" );
             printf( "-------------------------------------\n" );
@@ -304,24 +684,37 @@ static void processOTAEvents()
             if( otaAgentState == OtaAgentStateSuspended )
             {
                 printf( "OTA-Agent is in Suspend State. Hence dropping Job Document. \n" );
+                freeJobDocBuffer();
                 break;
             }
 
             if( receivedJobDocumentHandler( recvEvent.jobEvent ) )
             {
                 printf( "Received OTA Job. \n" );
-                nextEvent.eventId = OtaAgentEventRequestFileBlock;
+                nextEvent.eventId = ( numOfBlocksRemaining == 0U ) ? OtaAgentEventCloseFile
+                                                                   : OtaAgentEventRequestFileBlock;
                 OtaSendEvent_FreeRTOS( &nextEvent );
+                otaAgentState = OtaAgentStateCreatingFile;
             }
             else
             {
                 printf( "This is not an OTA job \n" );
+                freeJobDocBuffer();
+                otaAgentState = OtaAgentStateWaitingForJob;
+                scheduleJobPoll();
             }
 
-            otaAgentState = OtaAgentStateCreatingFile;
             break;
 
         case OtaAgentEventRequestFileBlock:
+
+            /* Blocks are only requested once their topic is subscribed. */
+            if( subscriptionsPending )
+            {
+                blockRequestDeferred = true;
+                break;
+            }
+
             otaAgentState = OtaAgentStateRequestingFileBlock;
             printf( "Request File Block event Received \n" );
             printf( "-----------------------------------\n" );
@@ -335,7 +728,29 @@ static void processOTAEvents()
                 printf( "Starting The Download. \n" );
             }
 
+            /* Blocks below the highest one requested were requested before. */
+            if( startingBlock < nextUnrequestedBlock )
+            {
+                jobReport.retransmits++;
+            }
+            else
+            {
+                nextUnrequestedBlock = startingBlock + numberOfBlocksToRequest;
+            }
+
             requestDataBlock( startingBlock, numberOfBlocksToRequest );
+
+            /* Reports go out while the requested block is in flight. */
+            if( jobProgressActive )
+            {
+                ( void ) JobProgress_Service( &jobProgress, Clock_GetTimeMs() );
+            }
+
+            /* Let the flash erase upcoming sectors while the block is in
+             * flight. */
+            OtaStorage_Service( &otaStorage,
+                                startingBlock * mqttFileDownloader_CONFIG_BLOCK_SIZE );
+
             break;
 
         case OtaAgentEventReceivedFileBlock:
@@ -368,6 +783,25 @@ static void processOTAEvents()
             handleMqttStreamsBlockArrived( blockId, decodedData, decodedDataLength );
             freeOtaDataEventBuffer( recvEvent.dataEvent );
 
+            if( reconnectDataPending )
+            {
+                reconnectDataPending = false;
+                OTA_STATS_PRINTF( "Reconnect: first block %u ms after the connection was lost, with the session %s. \n",
+                                  Clock_GetTimeMs() - connectionLostTimeMs,
+                                  sessionResumed ? "resumed" : "lost, after subscribing again" );
+            }
+
+            /* Look up the next job while the last blocks are in flight. */
+            if( !downloadingDigests && ( numOfBlocksRemaining <= OTA_PREFETCH_BLOCKS ) )
+            {
+                requestNextJob();
+            }
+
+            if( jobProgressActive && !downloadingDigests )
+            {
+                JobProgress_Record( &jobProgress, totalBytesReceived, numOfBlocksRemaining );
+            }
+
             if( numOfBlocksRemaining == 0 )
             {
                 nextEvent.eventId = OtaAgentEventCloseFile;
@@ -384,8 +818,142 @@ static void processOTAEvents()
         case OtaAgentEventCloseFile:
             printf( "Close file event Received \n" );
             printf( "-----------------------\n" );
-            printf( "Downloaded Data %s \n", ( char * ) downloadedData );
-            finishDownload();
+
+            if( downloadingDigests )
+            {
+                startImageDownload();
+                break;
+            }
+
+            /* An image taken from the chunk store has no last blocks. */
+            requestNextJob();
+
+            JobReport_End( &jobReport, JOB_REPORT_DOWNLOAD, Clock_GetTimeMs() );
+            JobReport_Begin( &jobReport, JOB_REPORT_VERIFY, Clock_GetTimeMs() );
+            downloadContextSwitches = getContextSwitches() - downloadContextSwitches;
+
+            finishDownload( OtaStorage_Close( &otaStorage ) );
+            startNextJob();
+            break;
+
+        case OtaAgentEventRequestNextJob:
+
+            if( nextJobRequested && !nextJobReady )
+            {
+                ( void ) strncpy( nextJobId, recvEvent.jobId, sizeof( nextJobId ) - 1U );
+                requestNextJobDocument();
+            }
+
+            break;
+
+        case OtaAgentEventReceivedNextJob:
+
+            if( receivedNextJobHandler( recvEvent.jobEvent ) )
+            {
+                printf( "Prefetched the document of job %s, it starts when the current job is done. \n", nextJobId );
+            }
+            else
+            {
+                freeNextJobDocBuffer();
+            }
+
+            break;
+
+        case OtaAgentEventSubscribed:
+            OTA_STATS_PRINTF( "Subscribed to %u topic filters with one SUBSCRIBE, SUBACK after %u ms%s. \n",
+                              ( unsigned int ) subscribedFilters,
+                              Clock_GetTimeMs() - subscribeTimeMs,
+                              subscriptionsGranted ? "" : ", the broker refused some of them" );
+            subscriptionsPending = false;
+
+            if( !subscriptionsGranted )
+            {
+                printf( "The broker refused some of the OTA topic filters. \n" );
+            }
+
+            if( blockRequestDeferred )
+            {
+                blockRequestDeferred = false;
+                nextEvent.eventId = OtaAgentEventRequestFileBlock;
+                OtaSendEvent_FreeRTOS( &nextEvent );
+            }
+
+            break;
+
+        case OtaAgentEventReconnected:
+            jobReport.reconnects++;
+            sessionResumed = recvEvent.connection.sessionPresent;
+            connectionLostTimeMs = recvEvent.connection.lostTimeMs;
+
+            /* A resumed session kept the subscriptions, unless they were
+             * not acknowledged before the connection was lost. */
+            if( !sessionResumed || subscriptionsPending )
+            {
+                subscribeToOtaTopics();
+            }
+
+            /* Blocks sent while the connection was down are lost, the
+             * download goes on from the bitmap. */
+            if( ( blockBitmap != NULL ) &&
+                ( numOfBlocksRemaining > 0U ) &&
+                ( ( otaAgentState == OtaAgentStateRequestingFileBlock ) ||
+                  ( otaAgentState == OtaAgentStateWaitingForFileBlock ) ) )
+            {
+                reconnectDataPending = true;
+                nextEvent.eventId = OtaAgentEventRequestFileBlock;
+                OtaSendEvent_FreeRTOS( &nextEvent );
+            }
+            else if( otaAgentState == OtaAgentStateRequestingJob )
+            {
+                nextEvent.eventId = OtaAgentEventRequestJobDocument;
+                OtaSendEvent_FreeRTOS( &nextEvent );
+            }
+            else
+            {
+                /* Empty else. */
+            }
+
+            break;
+
+        case OtaAgentEventJobStatusResponse:
+
+            if( recvEvent.jobStatus.token != 0U )
+            {
+                if( jobProgressActive )
+                {
+                    JobProgress_Acknowledge( &jobProgress,
+                                             recvEvent.jobStatus.token,
+                                             recvEvent.jobStatus.accepted,
+                                             recvEvent.jobStatus.version );
+                }
+            }
+            else
+            {
+                handleFinalStatusResponse( recvEvent.jobId, &recvEvent.jobStatus );
+            }
+
+            break;
+
+        case OtaAgentEventConnectionFailed:
+            printf( "The connection to IoT Core could not be established. Stopping the OTA agent. \n" );
+
+            if( jobPollTimer != NULL )
+            {
+                ( void ) xTimerStop( jobPollTimer, 0U );
+            }
+
+            otaAgentState = OtaAgentStateStopped;
+            break;
+
+        case OtaAgentEventShutdown:
+            printf( "Shutdown Event Received \n" );
+            printf( "-----------------------\n" );
+
+            if( jobPollTimer != NULL )
+            {
+                ( void ) xTimerStop( jobPollTimer, 0U );
+            }
+
             otaAgentState = OtaAgentStateStopped;
             break;
 
@@ -407,101 +975,793 @@ static void processOTAEvents()
     }
 }
 
-/* Implemented for use by the MQTT library */
-bool otaDemo_handleIncomingMQTTMessage( char * topic,
-                                        size_t topicLength,
-                                        uint8_t * message,
-                                        size_t messageLength )
+/* Registers the topics the agent handles once, so incoming messages are
+ * routed without rebuilding and comparing topic strings. */
+static void registerTopicRoutes( void )
 {
-    OtaEventMsg_t nextEvent = { 0 };
-    char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+    const char * thingName = NULL;
     size_t thingNameLength = 0U;
+    char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
+    size_t topicLength = 0U;
+    bool registered = false;
 
-    mqttWrapper_getThingName( thingName, &thingNameLength );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
+    mqttWrapper_clearRoutes();
 
     /*
      * AWS IoT Jobs library:
-     * Checks if a message comes from the start-next/accepted reserved topic.
+     * Creates the start-next/accepted reserved topic, which carries job documents.
      */
-    bool handled = Jobs_IsStartNextAccepted( topic,
-                                             topicLength,
-                                             thingName,
-                                             thingNameLength );
+    registered = ( Jobs_GetTopic( topicBuffer,
+                                  TOPIC_BUFFER_SIZE,
+                                  thingName,
+                                  thingNameLength,
+                                  JobsStartNextSuccess,
+                                  &topicLength ) == JobsSuccess ) &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, false, handleStartNextAccepted, NULL );
+
+    registered = registered &&
+                 ( Jobs_GetTopic( topicBuffer,
+                                  TOPIC_BUFFER_SIZE,
+                                  thingName,
+                                  thingNameLength,
+                                  JobsNextJobChanged,
+                                  &topicLength ) == JobsSuccess ) &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, false, handleNotifyNext, NULL );
+
+    registered = registered &&
+                 ( Jobs_GetTopic( topicBuffer,
+                                  TOPIC_BUFFER_SIZE,
+                                  thingName,
+                                  thingNameLength,
+                                  JobsGetPendingSuccess,
+                                  &topicLength ) == JobsSuccess ) &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, false, handleGetPendingAccepted, NULL );
+
+    /* The stream changes with every job, its data blocks share a prefix. */
+    topicLength = ( size_t ) snprintf( topicBuffer, sizeof( topicBuffer ), "$aws/things/%s/streams/", thingName );
+    registered = registered &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, true, handleStreamData, NULL );
+
+    /* DescribeJobExecution and UpdateJobExecution answer on topics holding
+     * the job ID. The exact jobs topics above take precedence over this
+     * prefix. */
+    topicLength = ( size_t ) snprintf( topicBuffer, sizeof( topicBuffer ), "$aws/things/%s/jobs/", thingName );
+    registered = registered &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, true, handleJobExecutionResponse, NULL );
+
+    if( !registered )
+    {
+        printf( "Failed to register the MQTT topic routes. \n" );
+    }
+}
 
-    if( handled )
+static bool handleStartNextAccepted( char * topic,
+                                     size_t topicLength,
+                                     uint8_t * message,
+                                     size_t messageLength,
+                                     void * context )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+    OtaJobEventData_t * jobDoc = NULL;
+
+    ( void ) topic;
+    ( void ) topicLength;
+    ( void ) context;
+
+    /* The buffer is only written while the agent has no job in it. */
+    if( messageLength <= JOB_DOC_SIZE )
     {
-        memcpy( jobDocBuffer.jobData, message, messageLength );
-        nextEvent.jobEvent = &jobDocBuffer;
-        jobDocBuffer.jobDataLength = messageLength;
+        jobDoc = getJobDocBuffer();
+    }
+
+    if( jobDoc != NULL )
+    {
+        memcpy( jobDoc->jobData, message, messageLength );
+        jobDoc->jobDataLength = messageLength;
+        nextEvent.jobEvent = jobDoc;
         nextEvent.eventId = OtaAgentEventReceivedJobDocument;
         OtaSendEvent_FreeRTOS( &nextEvent );
     }
     else
     {
-        /*
-         * MQTT streams Library:
-         * Checks if the incoming message contains the requested data block. It is performed by
-         * comparing the incoming MQTT message topic with MQTT streams topics.
-         */
-        handled = mqttDownloader_isDataBlockReceived( &mqttFileDownloaderContext, topic, topicLength );
-
-        if( handled )
-        {
-            nextEvent.eventId = OtaAgentEventReceivedFileBlock;
-            OtaDataEvent_t * dataBuf = getOtaDataEventBuffer();
-            memcpy( dataBuf->data, message, messageLength );
-            nextEvent.dataEvent = dataBuf;
-            dataBuf->dataLength = messageLength;
-            OtaSendEvent_FreeRTOS( &nextEvent );
-        }
-    }
-
-    if( !handled )
-    {
-        printf( "Unrecognized incoming MQTT message received on topic: "
-                "%.*s\nMessage: %.*s\n",
-                ( unsigned int ) topicLength,
-                topic,
+        printf( "Job document of %u bytes dropped, %s. \n",
                 ( unsigned int ) messageLength,
-                ( char * ) message );
+                ( messageLength <= JOB_DOC_SIZE ) ? "the agent is busy with a job" : "it does not fit the buffer" );
     }
 
-    return handled;
+    return true;
 }
 
-static bool jobDocumentParser( char * message,
-                               size_t messageLength,
-                               AfrOtaJobDocumentFields_t * jobFields )
+static bool handleStreamData( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              void * context )
 {
-    char * jobDoc;
-    size_t jobDocLength = 0U;
-    int8_t fileIndex = 0;
+    OtaEventMsg_t nextEvent = { 0 };
+    OtaDataEvent_t * dataBuf = NULL;
+
+    ( void ) context;
 
     /*
-     * AWS IoT Jobs library:
-     * Extracting the OTA job document from the jobs message recevied from AWS IoT core.
+     * MQTT streams Library:
+     * Checks if the incoming message carries a data block of the stream of
+     * the current job.
      */
-    jobDocLength = Jobs_GetJobDocument( message, messageLength, ( const char ** ) &jobDoc );
+    bool handled = mqttDownloader_isDataBlockReceived( &mqttFileDownloaderContext, topic, topicLength );
 
-    if( jobDocLength != 0U )
+    if( handled )
     {
-        do
+        if( messageLength <= sizeof( dataBuf->data ) )
         {
-            /*
-             * AWS IoT Jobs library:
-             * Parsing the OTA job document to extract all of the parameters needed to download
-             * the new firmware.
-             */
-            fileIndex = otaParser_parseJobDocFile( jobDoc,
-                                                   jobDocLength,
-                                                   fileIndex,
-                                                   jobFields );
-        } while( fileIndex > 0 );
+            dataBuf = getOtaDataEventBuffer();
+        }
+
+        if( dataBuf != NULL )
+        {
+            nextEvent.eventId = OtaAgentEventReceivedFileBlock;
+            memcpy( dataBuf->data, message, messageLength );
+            nextEvent.dataEvent = dataBuf;
+            dataBuf->dataLength = messageLength;
+            OtaSendEvent_FreeRTOS( &nextEvent );
+        }
+        else
+        {
+            printf( "Data block of %u bytes dropped, %s. \n",
+                    ( unsigned int ) messageLength,
+                    ( messageLength <= sizeof( dataBuf->data ) ) ? "no data buffer is free" : "it does not fit a data buffer" );
+
+            /* The agent requests the missing block again from the bitmap. */
+            nextEvent.eventId = OtaAgentEventRequestFileBlock;
+            OtaSendEvent_FreeRTOS( &nextEvent );
+        }
+    }
+
+    return handled;
+}
+
+/* Subscribes to every topic the agent needs in a single SUBSCRIBE. Through
+ * notify-next the agent learns about a new job as soon as it is queued
+ * instead of when it next asks. */
+static void subscribeToOtaTopics( void )
+{
+    static const JobsTopic_t jobsTopics[] =
+    {
+        JobsNextJobChanged,
+        JobsStartNextSuccess,
+        JobsGetPendingSuccess,
+        JobsDescribeSuccess,
+        JobsUpdateSuccess,
+        JobsUpdateFailed
+    };
+    const size_t jobsTopicCount = sizeof( jobsTopics ) / sizeof( jobsTopics[ 0 ] );
+    const char * thingName = NULL;
+    size_t thingNameLength = 0U;
+    char filterBuffers[ OTA_SUBSCRIBE_FILTER_COUNT ][ TOPIC_BUFFER_SIZE + 1 ];
+    char * filters[ OTA_SUBSCRIBE_FILTER_COUNT ] = { 0 };
+    size_t filterLengths[ OTA_SUBSCRIBE_FILTER_COUNT ] = { 0 };
+    uint16_t packetId = 0U;
+    bool built = true;
+    size_t i = 0U;
+
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
+
+    /*
+     * AWS IoT Jobs library:
+     * Creates the topic filters of the jobs topics. Topics of a single job
+     * execution get a wildcard in place of the job ID.
+     */
+    for( i = 0U; built && ( i < jobsTopicCount ); i++ )
+    {
+        filters[ i ] = filterBuffers[ i ];
+        built = Jobs_GetTopic( filters[ i ],
+                               TOPIC_BUFFER_SIZE,
+                               thingName,
+                               thingNameLength,
+                               jobsTopics[ i ],
+                               &filterLengths[ i ] ) == JobsSuccess;
+    }
+
+    /* Data blocks of any stream, so the first block cannot overtake the
+     * subscription of its stream. */
+    filters[ jobsTopicCount ] = filterBuffers[ jobsTopicCount ];
+    filterLengths[ jobsTopicCount ] = ( size_t ) snprintf( filters[ jobsTopicCount ],
+                                                           TOPIC_BUFFER_SIZE,
+                                                           "$aws/things/%s/streams/+/data/json",
+                                                           thingName );
+
+    subscribeTimeMs = Clock_GetTimeMs();
+    subscribedFilters = jobsTopicCount + 1U;
+    subscriptionsPending = built &&
+                           mqttWrapper_subscribeMany( filters,
+                                                      filterLengths,
+                                                      subscribedFilters,
+                                                      handleSubAck,
+                                                      NULL,
+                                                      &packetId );
+
+    if( !subscriptionsPending )
+    {
+        printf( "Failed to subscribe to the OTA topics. New jobs are only found by polling. \n" );
+    }
+}
+
+static void handleSubAck( uint16_t packetId,
+                          bool granted,
+                          void * context )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    ( void ) packetId;
+    ( void ) context;
+
+    subscriptionsGranted = granted;
+    nextEvent.eventId = OtaAgentEventSubscribed;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
+/* Polls StartNext again after a growing, jittered delay, in case a
+ * notification was missed. */
+static void scheduleJobPoll( void )
+{
+    uint16_t delayMs = 0U;
+
+    if( ( jobPollTimer != NULL ) &&
+        ( BackoffAlgorithm_GetNextBackoff( &jobPollBackoff, ( uint32_t ) rand(), &delayMs ) == BackoffAlgorithmSuccess ) )
+    {
+        printf( "No pending job. Waiting for notify-next, polling again in %u ms. \n", delayMs );
+        ( void ) xTimerChangePeriod( jobPollTimer, pdMS_TO_TICKS( delayMs ), 0U );
+    }
+}
+
+static void jobPollTimerCallback( TimerHandle_t timer )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    ( void ) timer;
+
+    nextEvent.eventId = OtaAgentEventRequestJobDocument;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
+static bool handleNotifyNext( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              void * context )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+    const char * jobId = NULL;
+
+    ( void ) topic;
+    ( void ) topicLength;
+    ( void ) context;
+
+    /* An empty notification means the queue of the thing is empty. Jobs
+     * queued while one is being downloaded are started after it. */
+    if( ( Jobs_GetJobId( ( const char * ) message, messageLength, &jobId ) > 0U ) &&
+        ( ( otaAgentState == OtaAgentStateInit ) ||
+          ( otaAgentState == OtaAgentStateRequestingJob ) ||
+          ( otaAgentState == OtaAgentStateWaitingForJob ) ) )
+    {
+        printf( "notify-next announced a job, starting it. \n" );
+
+        if( jobPollTimer != NULL )
+        {
+            ( void ) xTimerStop( jobPollTimer, 0U );
+        }
+
+        jobNotifiedTimeMs = Clock_GetTimeMs();
+        jobNotified = true;
+        nextEvent.eventId = OtaAgentEventRequestJobDocument;
+        OtaSendEvent_FreeRTOS( &nextEvent );
+    }
+
+    return true;
+}
+
+/* Picks the oldest queued job from the GetPendingJobExecutions response. The
+ * job in progress is the current one. */
+static bool handleGetPendingAccepted( char * topic,
+                                      size_t topicLength,
+                                      uint8_t * message,
+                                      size_t messageLength,
+                                      void * context )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+    char * jobId = NULL;
+    size_t jobIdLength = 0U;
+
+    ( void ) topic;
+    ( void ) topicLength;
+    ( void ) context;
+
+    if( ( JSON_Search( ( char * ) message,
+                       messageLength,
+                       "queuedJobs[0].jobId",
+                       sizeof( "queuedJobs[0].jobId" ) - 1U,
+                       &jobId,
+                       &jobIdLength ) == JSONSuccess ) &&
+        ( jobIdLength < MAX_JOB_ID_LENGTH ) )
+    {
+        /* The agent decides whether it still wants the job. */
+        memcpy( nextEvent.jobId, jobId, jobIdLength );
+        nextEvent.eventId = OtaAgentEventRequestNextJob;
+        OtaSendEvent_FreeRTOS( &nextEvent );
+    }
+
+    return true;
+}
+
+/* Tells the responses to requests on a single job execution apart by the
+ * end of their topic. The job ID sits between the jobs prefix and the
+ * suffix. */
+static bool handleJobExecutionResponse( char * topic,
+                                        size_t topicLength,
+                                        uint8_t * message,
+                                        size_t messageLength,
+                                        void * context )
+{
+    bool handled = false;
+    size_t thingNameLength = 0U;
+    size_t prefixLength = 0U;
+    size_t jobIdLength = 0U;
+
+    ( void ) context;
+
+    ( void ) mqttWrapper_getThingNameView( &thingNameLength );
+    prefixLength = ( sizeof( "$aws/things/" ) - 1U ) + thingNameLength + ( sizeof( "/jobs/" ) - 1U );
+
+    if( topicEndsWith( topic, topicLength, "/get/accepted" ) )
+    {
+        handled = handleDescribeAccepted( message, messageLength );
+    }
+    else if( topicEndsWith( topic, topicLength, "/update/accepted" ) )
+    {
+        jobIdLength = topicLength - ( sizeof( "/update/accepted" ) - 1U );
+        jobIdLength = ( jobIdLength > prefixLength ) ? jobIdLength - prefixLength : 0U;
+        handled = handleUpdateResponse( topic + prefixLength, jobIdLength, message, messageLength, true );
+    }
+    else if( topicEndsWith( topic, topicLength, "/update/rejected" ) )
+    {
+        jobIdLength = topicLength - ( sizeof( "/update/rejected" ) - 1U );
+        jobIdLength = ( jobIdLength > prefixLength ) ? jobIdLength - prefixLength : 0U;
+        handled = handleUpdateResponse( topic + prefixLength, jobIdLength, message, messageLength, false );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return handled;
+}
+
+static bool topicEndsWith( const char * topic,
+                           size_t topicLength,
+                           const char * suffix )
+{
+    size_t suffixLength = strlen( suffix );
+
+    return ( topicLength > suffixLength ) &&
+           ( memcmp( topic + topicLength - suffixLength, suffix, suffixLength ) == 0 );
+}
+
+static bool handleDescribeAccepted( uint8_t * message,
+                                    size_t messageLength )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+    OtaJobEventData_t * jobDoc = NULL;
+
+    /* The buffer is only written while no document is waiting in it. */
+    if( messageLength <= JOB_DOC_SIZE )
+    {
+        jobDoc = getNextJobDocBuffer();
+    }
+
+    if( jobDoc != NULL )
+    {
+        memcpy( jobDoc->jobData, message, messageLength );
+        jobDoc->jobDataLength = messageLength;
+        nextEvent.jobEvent = jobDoc;
+        nextEvent.eventId = OtaAgentEventReceivedNextJob;
+        OtaSendEvent_FreeRTOS( &nextEvent );
+    }
+
+    return true;
+}
+
+/* Passes the answer to a status update on to the agent. Progress reports
+ * are told apart by their client token. A rejection for a version mismatch
+ * carries the execution state, so its version is passed on as well. */
+static bool handleUpdateResponse( const char * jobId,
+                                  size_t jobIdLength,
+                                  uint8_t * message,
+                                  size_t messageLength,
+                                  bool accepted )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+    char * token = NULL;
+    size_t tokenLength = 0U;
+    char * version = NULL;
+    size_t versionLength = 0U;
+    const size_t prefixLength = sizeof( JOB_PROGRESS_TOKEN_PREFIX ) - 1U;
+
+    if( ( jobIdLength > 0U ) && ( jobIdLength < MAX_JOB_ID_LENGTH ) )
+    {
+        memcpy( nextEvent.jobId, jobId, jobIdLength );
+        nextEvent.jobStatus.accepted = accepted;
+
+        if( ( JSON_Search( ( char * ) message,
+                           messageLength,
+                           "clientToken",
+                           sizeof( "clientToken" ) - 1U,
+                           &token,
+                           &tokenLength ) == JSONSuccess ) &&
+            ( tokenLength > prefixLength ) &&
+            ( memcmp( token, JOB_PROGRESS_TOKEN_PREFIX, prefixLength ) == 0 ) )
+        {
+            nextEvent.jobStatus.token = ( uint32_t ) strtoul( token + prefixLength, NULL, 10 );
+        }
+
+        if( JSON_Search( ( char * ) message,
+                         messageLength,
+                         "executionState.versionNumber",
+                         sizeof( "executionState.versionNumber" ) - 1U,
+                         &version,
+                         &versionLength ) == JSONSuccess )
+        {
+            nextEvent.jobStatus.version = ( uint32_t ) strtoul( version, NULL, 10 );
+        }
+        else
+        {
+            /* A report accepted without the execution state is of no use
+             * for the version. */
+            nextEvent.jobStatus.accepted = accepted && ( nextEvent.jobStatus.token == 0U );
+        }
+
+        nextEvent.eventId = OtaAgentEventJobStatusResponse;
+        OtaSendEvent_FreeRTOS( &nextEvent );
+    }
+
+    return true;
+}
+
+/* The final status of a job is sent once more, with the version from the
+ * answer, when the service rejects it. Answers to the IN_PROGRESS update of
+ * a prefetched job are only logged. */
+static void handleFinalStatusResponse( const char * jobId,
+                                       const OtaJobStatusEvent_t * response )
+{
+    char expectedVersion[ MAX_JOB_VERSION_LENGTH + 1 ] = { 0 };
+
+    if( !finalStatusPending ||
+        ( strncmp( jobId, finalStatusJobId, MAX_JOB_ID_LENGTH ) != 0 ) )
+    {
+        if( !response->accepted )
+        {
+            printf( "Status update of job %s rejected. \n", jobId );
+        }
+    }
+    else if( response->accepted )
+    {
+        printf( "Final status of job %s accepted after %u attempts. \n",
+                finalStatusJobId,
+                finalStatusAttempts );
+        finalStatusPending = false;
+    }
+    else if( finalStatusAttempts < OTA_FINAL_STATUS_MAX_ATTEMPTS )
+    {
+        /* Without the execution state in the answer the update is sent
+         * without an expected version. */
+        if( response->version != 0U )
+        {
+            ( void ) snprintf( expectedVersion, sizeof( expectedVersion ), "%u", response->version );
+        }
+
+        printf( "Final status of job %s rejected, sending it again with version %s. \n",
+                finalStatusJobId,
+                ( expectedVersion[ 0 ] != '\0' ) ? expectedVersion : "(none)" );
+        finalStatusAttempts++;
+        updateJobStatus( finalStatusJobId, finalStatus, expectedVersion, finalStatusDetails );
+    }
+    else
+    {
+        printf( "Final status of job %s rejected %u times, giving up. \n",
+                finalStatusJobId,
+                finalStatusAttempts );
+        finalStatusPending = false;
+    }
+}
+
+/* Publishes a progress report on the update topic of the current job. */
+static bool sendProgressReport( void * sendContext,
+                                const char * message,
+                                size_t messageLength )
+{
+    const char * thingName = NULL;
+    size_t thingNameLength = 0U;
+    char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
+    size_t topicLength = 0U;
+
+    bool sent = false;
+
+    ( void ) sendContext;
+
+    JobReport_Begin( &jobReport, JOB_REPORT_STATUS, Clock_GetTimeMs() );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
+
+    sent = ( Jobs_Update( topicBuffer,
+                          TOPIC_BUFFER_SIZE,
+                          thingName,
+                          thingNameLength,
+                          globalJobId,
+                          strnlen( globalJobId, MAX_JOB_ID_LENGTH ),
+                          &topicLength ) == JobsSuccess ) &&
+           mqttWrapper_publish( topicBuffer,
+                                topicLength,
+                                ( uint8_t * ) message,
+                                messageLength );
+
+    JobReport_End( &jobReport, JOB_REPORT_STATUS, Clock_GetTimeMs() );
+
+    return sent;
+}
+
+/* Reports are rate limited, the download only records its progress. */
+static void startProgressReports( OtaJobEventData_t * jobDoc )
+{
+    JobProgressConfig_t progressConfig = {
+        .minIntervalMs = OTA_PROGRESS_MIN_INTERVAL_MS,
+        .minPercentDelta = OTA_PROGRESS_MIN_PERCENT,
+        .heartbeatMs = OTA_PROGRESS_HEARTBEAT_MS,
+        .retryMs = OTA_PROGRESS_RETRY_MS,
+        .send = sendProgressReport,
+        .sendContext = NULL
+    };
+    char * version = NULL;
+    size_t versionLength = 0U;
+    uint32_t jobVersion = 2U;
+
+    /* StartNext answers with the version after starting the job. A
+     * prefetched document predates the IN_PROGRESS update startNextJob sent
+     * for it. */
+    if( JSON_Search( ( char * ) jobDoc->jobData,
+                     jobDoc->jobDataLength,
+                     "execution.versionNumber",
+                     sizeof( "execution.versionNumber" ) - 1U,
+                     &version,
+                     &versionLength ) == JSONSuccess )
+    {
+        jobVersion = ( uint32_t ) strtoul( version, NULL, 10 ) + ( prefetchedJobStarting ? 1U : 0U );
+    }
+
+    prefetchedJobStarting = false;
+    JobProgress_Init( &jobProgress, &progressConfig, imageFileFields.fileSize, jobVersion, Clock_GetTimeMs() );
+    jobProgressActive = true;
+}
+
+/* Asks for the pending jobs once per job, so the next one can be fetched
+ * before the current one is done. */
+static void requestNextJob( void )
+{
+    const char * thingName = NULL;
+    size_t thingNameLength = 0U;
+    char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
+    size_t topicLength = 0U;
+
+    if( !nextJobRequested )
+    {
+        nextJobRequested = true;
+        nextJobFetchStartMs = Clock_GetTimeMs();
+        thingName = mqttWrapper_getThingNameView( &thingNameLength );
+
+        /*
+         * AWS IoT Jobs library:
+         * Creates the topic string for a GetPendingJobExecutions request.
+         */
+        if( Jobs_GetPending( topicBuffer,
+                             TOPIC_BUFFER_SIZE,
+                             thingName,
+                             thingNameLength,
+                             &topicLength ) == JobsSuccess )
+        {
+            ( void ) publishControlMessage( topicBuffer,
+                                            topicLength,
+                                            ( uint8_t * ) GET_PENDING_JOBS_MSG,
+                                            sizeof( GET_PENDING_JOBS_MSG ) - 1U,
+                                            NULL );
+        }
+    }
+}
+
+static void requestNextJobDocument( void )
+{
+    const char * thingName = NULL;
+    size_t thingNameLength = 0U;
+    char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
+    size_t topicLength = 0U;
+
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
+
+    /*
+     * AWS IoT Jobs library:
+     * Creates the topic string for a DescribeJobExecution request of the
+     * next queued job. Unlike StartNext, it leaves the job queued.
+     */
+    if( nextJobRequested &&
+        ( Jobs_Describe( topicBuffer,
+                         TOPIC_BUFFER_SIZE,
+                         thingName,
+                         thingNameLength,
+                         nextJobId,
+                         strnlen( nextJobId, MAX_JOB_ID_LENGTH ),
+                         &topicLength ) == JobsSuccess ) )
+    {
+        ( void ) publishControlMessage( topicBuffer,
+                                        topicLength,
+                                        ( uint8_t * ) DESCRIBE_JOB_MSG,
+                                        sizeof( DESCRIBE_JOB_MSG ) - 1U,
+                                        NULL );
+    }
+}
+
+/* Validates the prefetched document as far as possible without starting the
+ * job, so a broken next job is not found out only after the current one. */
+static bool receivedNextJobHandler( OtaJobEventData_t * jobDoc )
+{
+    AfrOtaJobDocumentFields_t fileFields = { 0 };
+    const char * jobId = NULL;
+    char * version = NULL;
+    size_t versionLength = 0U;
+    uint32_t fileIndex = 0U;
+    bool valid = false;
+
+    if( nextJobRequested && !nextJobReady &&
+        JobIndex_Build( &nextJobIndex, ( const char * ) jobDoc->jobData, jobDoc->jobDataLength ) )
+    {
+        valid = ( JobIndex_GetJobId( &nextJobIndex, &jobId ) == strnlen( nextJobId, MAX_JOB_ID_LENGTH ) ) &&
+                ( strncmp( jobId, nextJobId, strnlen( nextJobId, MAX_JOB_ID_LENGTH ) ) == 0 ) &&
+                ( JobIndex_GetFileCount( &nextJobIndex ) > 0U );
+
+        for( fileIndex = 0U; valid && ( fileIndex < JobIndex_GetFileCount( &nextJobIndex ) ); fileIndex++ )
+        {
+            valid = JobIndex_GetFile( &nextJobIndex, fileIndex, &fileFields );
+        }
+    }
+
+    /* The status update starting the job has to name the current version. */
+    if( valid )
+    {
+        valid = ( JSON_Search( ( char * ) jobDoc->jobData,
+                               jobDoc->jobDataLength,
+                               "execution.versionNumber",
+                               sizeof( "execution.versionNumber" ) - 1U,
+                               &version,
+                               &versionLength ) == JSONSuccess ) &&
+                ( versionLength <= MAX_JOB_VERSION_LENGTH );
+    }
+
+    if( valid )
+    {
+        memcpy( nextJobVersion, version, versionLength );
+        nextJobVersion[ versionLength ] = '\0';
+        nextJobFetchMs = Clock_GetTimeMs() - nextJobFetchStartMs;
+        nextJobReady = true;
+    }
+    else if( nextJobRequested && !nextJobReady )
+    {
+        printf( "The document of job %s is not a valid OTA job, it is left to StartNext. \n", nextJobId );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return valid;
+}
+
+/* Starts the prefetched job right away, or asks for the next one. */
+static void startNextJob( void )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    free( blockBitmap );
+    blockBitmap = NULL;
+    jobEndTimeMs = Clock_GetTimeMs();
+    jobEnded = true;
+    nextJobPrefetched = nextJobReady;
+
+    if( nextJobReady )
+    {
+        /* Marks the job IN_PROGRESS, as StartNext would have. */
+        updateJobStatus( nextJobId, InProgress, nextJobVersion, NULL );
+        prefetchedJobStarting = true;
+
+        /* The agent still owns the document buffer of the job which ended,
+         * so the MQTT task cannot write it meanwhile. */
+        memcpy( jobDocBuffer.jobData, nextJobDocBuffer.jobData, nextJobDocBuffer.jobDataLength );
+        jobDocBuffer.jobDataLength = nextJobDocBuffer.jobDataLength;
+        freeNextJobDocBuffer();
+        nextEvent.jobEvent = &jobDocBuffer;
+        nextEvent.eventId = OtaAgentEventReceivedJobDocument;
+    }
+    else
+    {
+        freeJobDocBuffer();
+        nextEvent.eventId = OtaAgentEventRequestJobDocument;
     }
 
-    /* File index will be -1 if an error occured, and 0 if all files were
-     * processed */
-    return fileIndex == 0;
+    /* A document arriving from now on is stale, StartNext covers it. */
+    nextJobRequested = false;
+    nextJobReady = false;
+    otaAgentState = OtaAgentStateWaitingForJob;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
+/* Implemented for use by the MQTT library */
+bool otaDemo_handleIncomingMQTTMessage( char * topic,
+                                        size_t topicLength,
+                                        uint8_t * message,
+                                        size_t messageLength )
+{
+    uint64_t startTimeNs = Clock_GetTimeNs();
+    bool handled = mqttWrapper_routeMessage( topic, topicLength, message, messageLength );
+
+    routingTimeNs += Clock_GetTimeNs() - startTimeNs;
+    messagesRouted++;
+
+    if( !handled )
+    {
+        printf( "Unrecognized incoming MQTT message received on topic: "
+                "%.*s\nMessage: %.*s\n",
+                ( unsigned int ) topicLength,
+                topic,
+                ( unsigned int ) messageLength,
+                ( char * ) message );
+    }
+
+    return handled;
+}
+
+static bool jobDocumentParser( const JobIndex_t * index,
+                               AfrOtaJobDocumentFields_t * jobFields )
+{
+    const char * jobDoc;
+    uint32_t fileIndex = 0U;
+    bool parsed = false;
+    AfrOtaJobDocumentFields_t fileFields = { 0 };
+
+    digestFileListed = false;
+
+    if( JobIndex_GetJobDocument( index, &jobDoc ) != 0U )
+    {
+        parsed = JobIndex_GetFileCount( index ) > 0U;
+
+        for( fileIndex = 0U; parsed && ( fileIndex < JobIndex_GetFileCount( index ) ); fileIndex++ )
+        {
+            /*
+             * Reading the parameters needed to download the new firmware
+             * from the index, as the OTA job parser would extract them.
+             */
+            parsed = JobIndex_GetFile( index, fileIndex, &fileFields );
+
+            if( parsed )
+            {
+                if( fileFields.fileType == OTA_BLOCK_DIGEST_FILE_TYPE )
+                {
+                    digestFileFields = fileFields;
+                    digestFileListed = true;
+                }
+                else
+                {
+                    *jobFields = fileFields;
+                }
+            }
+        }
+    }
+
+    return parsed;
 }
 
 /* Stores the received data blocks in the flash partition reserved for OTA */
@@ -517,29 +1777,256 @@ static void handleMqttStreamsBlockArrived( int32_t blockId,
     {
         printf( "Downloaded block %u. Remaining blocks to download: %u. \n", blockId, numOfBlocksRemaining );
 
-        memcpy( downloadedData + ( blockId * mqttFileDownloader_CONFIG_BLOCK_SIZE ), data, dataLength );
+        if( ( jobReport.runningPhases & ( 1U << JOB_REPORT_FIRST_BLOCK ) ) != 0U )
+        {
+            JobReport_End( &jobReport, JOB_REPORT_FIRST_BLOCK, Clock_GetTimeMs() );
+            JobReport_Begin( &jobReport, JOB_REPORT_DOWNLOAD, Clock_GetTimeMs() );
+            downloadContextSwitches = getContextSwitches();
+
+            if( !startupReported )
+            {
+                OTA_STATS_PRINTF( "Startup: first block %u ms after the process started, connecting took %u ms. \n",
+                                  Clock_GetTimeMs() - processStartTimeMs,
+                                  connectTimeMs );
+                startupReported = true;
+            }
+        }
+
+        if( jobEnded )
+        {
+            OTA_STATS_PRINTF( "Pipeline: first block of job %s %u ms after the previous job ended, its document was %s. \n",
+                              globalJobId,
+                              Clock_GetTimeMs() - jobEndTimeMs,
+                              nextJobPrefetched ? "prefetched" : "requested afterwards" );
+            jobEnded = false;
+        }
+
+        if( downloadingDigests )
+        {
+            ( void ) OtaStorage_WriteDigests( &otaStorage,
+                                              blockId * mqttFileDownloader_CONFIG_BLOCK_SIZE,
+                                              data,
+                                              dataLength );
+        }
+        else
+        {
+            memcpy( downloadedData + ( blockId * mqttFileDownloader_CONFIG_BLOCK_SIZE ), data, dataLength );
+            ( void ) OtaStorage_WriteBlock( &otaStorage, blockId, data, dataLength );
+        }
 
         totalBytesReceived += dataLength;
+        jobReport.bytesDownloaded += dataLength;
         markBlockDownloaded( blockId );
         numOfBlocksRemaining--;
     }
     else
     {
         printf( "Received already downloaded block: %u\n", blockId );
+        jobReport.duplicates++;
+    }
+}
+
+static bool isImageBlockNeeded( void * blockContext,
+                                uint32_t blockId )
+{
+    ( void ) blockContext;
+
+    return isBlockNeeded( blockId );
+}
+
+/* A block found in storage is not downloaded. The journal and the sparse
+ * install only have it in the update slot, not in RAM. */
+static void handleStoredBlock( void * blockContext,
+                               uint32_t blockId,
+                               const uint8_t * data,
+                               size_t length )
+{
+    ( void ) blockContext;
+
+    if( isBlockNeeded( blockId ) )
+    {
+        if( data != NULL )
+        {
+            memcpy( downloadedData + ( blockId * mqttFileDownloader_CONFIG_BLOCK_SIZE ), data, length );
+        }
+
+        markBlockDownloaded( blockId );
+        numOfBlocksRemaining--;
+    }
+}
+
+/* The signature identifies the image, unsigned images their stream. */
+static void computeFileDigest( uint8_t * fileDigest )
+{
+    if( imageFileFields.signatureLen > 0U )
+    {
+        ( void ) SHA256( ( const uint8_t * ) imageFileFields.signature, imageFileFields.signatureLen, fileDigest );
+    }
+    else
+    {
+        ( void ) SHA256( ( const uint8_t * ) imageFileFields.imageRef, imageFileFields.imageRefLen, fileDigest );
+    }
+}
+
+/* Starts downloading the image once its block digests have arrived. */
+static void startImageDownload( void )
+{
+    OtaEventMsg_t nextEvent = { 0 };
+
+    if( !OtaStorage_AcceptDigests( &otaStorage, digestFileFields.fileSize ) )
+    {
+        printf( "The block digest list does not match the image. Downloading the whole image. \n" );
+    }
+
+    downloadingDigests = false;
+    free( blockBitmap );
+    initMqttDownloader( &imageFileFields );
+
+    nextEvent.eventId = ( numOfBlocksRemaining == 0U ) ? OtaAgentEventCloseFile
+                                                       : OtaAgentEventRequestFileBlock;
+    OtaSendEvent_FreeRTOS( &nextEvent );
+}
+
+/* Passes the installed image to the installer process as a sealed memory
+ * file. */
+static void handOffImage( void )
+{
+    ImageHandoffStats_t handoffStats = { 0 };
+
+    if( ImageHandoff_Send( OTA_INSTALLER_SOCKET_PATH,
+                           ImageSlots_GetActivePath( &otaStorage.imageSlots ),
+                           otaStorage.imageSize,
+                           &handoffStats ) )
+    {
+        OTA_STATS_PRINTF( "Handoff: passed the %s image to the installer in %llu us "
+                          "(%llu us filling, %llu us sealing, %llu us sending). \n",
+                          handoffStats.sealed ? "sealed" : "unsealed",
+                          ( unsigned long long ) ( handoffStats.fillTimeUs + handoffStats.sealTimeUs + handoffStats.sendTimeUs ),
+                          ( unsigned long long ) handoffStats.fillTimeUs,
+                          ( unsigned long long ) handoffStats.sealTimeUs,
+                          ( unsigned long long ) handoffStats.sendTimeUs );
     }
 }
 
-static void finishDownload()
+static void finishDownload( bool imageStored )
 {
-    /* TODO: Do something with the completed download */
-    /* Start the bootloader */
-    char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+    bool installed = imageStored && OtaStorage_Install( &otaStorage );
+    char expectedVersion[ MAX_JOB_VERSION_LENGTH + 1 ] = { 0 };
+    MqttWrapperPublishStats_t publishStats = { 0 };
+    MqttWrapperCommandStats_t commandStats = { 0 };
+
+    JobReport_End( &jobReport, JOB_REPORT_VERIFY, Clock_GetTimeMs() );
+
+    if( installed )
+    {
+        ( void ) OtaStorage_StoreChunks( &otaStorage );
+    }
+
+    if( installed )
+    {
+        handOffImage();
+    }
+
+    OTA_STATS_PRINTF( "Routing: %u messages dispatched through %u routes, %llu ns each on average including the handlers. \n",
+                      messagesRouted,
+                      ( unsigned int ) mqttWrapper_getRouteCount(),
+                      ( unsigned long long ) ( ( messagesRouted > 0U ) ? routingTimeNs / messagesRouted : 0U ) );
+
+    /* The job ends here either way, nothing is left to resume. */
+    OtaStorage_EndJob( &otaStorage );
+
+    messagesRouted = 0U;
+    routingTimeNs = 0U;
+
+    OTA_STATS_PRINTF( "Progress: %u updates recorded, %u reports sent, %u retried, %u accepted, %u rejected. \n",
+                      jobProgress.stats.recorded,
+                      jobProgress.stats.sent,
+                      jobProgress.stats.retries,
+                      jobProgress.stats.accepted,
+                      jobProgress.stats.rejected );
+
+    mqttWrapper_getPublishStats( &publishStats );
+    mqttWrapper_getCommandStats( &commandStats );
+    OTA_STATS_PRINTF( "QoS 1 since start: %u control messages sent, %u acknowledged, %u resent, %u in flight, "
+                      "%u sent at QoS 0 with the window full, "
+                      "PUBACK after %llu ms on average and %u ms at most. \n",
+                      publishStats.sent,
+                      publishStats.acknowledged,
+                      publishStats.resent,
+                      publishStats.inFlight,
+                      commandStats.downgraded,
+                      ( unsigned long long ) ( ( publishStats.acknowledged > 0U ) ? publishStats.totalAckTimeMs / publishStats.acknowledged : 0U ),
+                      publishStats.maxAckTimeMs );
+
+    OTA_STATS_PRINTF( "Command queue since start: %u commands queued, %u sent, %u failed, %u downgraded to QoS 0, "
+                      "%u found the queue full, %u deep at most. %ld context switches during the download, %ld per block. \n",
+                      commandStats.queued,
+                      commandStats.executed,
+                      commandStats.failed,
+                      commandStats.downgraded,
+                      commandStats.queueFull,
+                      commandStats.maxDepth,
+                      downloadContextSwitches,
+                      downloadContextSwitches / ( long ) ( ( totalBlocks > 0U ) ? totalBlocks : 1U ) );
+
+    /* Every accepted progress report raised the version of the execution.
+     * The answer to a report still in flight is not waited for; its version
+     * is unknown, so the final status expects none. A rejected final status
+     * is sent again with the version from the answer. */
+    if( JobProgress_IsVersionKnown( &jobProgress ) )
+    {
+        ( void ) snprintf( expectedVersion, sizeof( expectedVersion ), "%u", JobProgress_GetVersion( &jobProgress ) );
+    }
+
+    jobProgressActive = false;
+
+    /* The time of this last update is not part of its own report. */
+    if( JobReport_Format( &jobReport, finalStatusDetails, sizeof( finalStatusDetails ) ) > 0U )
+    {
+        OTA_STATS_PRINTF( "Job report: %s \n", finalStatusDetails );
+    }
+    else
+    {
+        finalStatusDetails[ 0 ] = '\0';
+    }
+
+    ( void ) strncpy( finalStatusJobId, globalJobId, sizeof( finalStatusJobId ) - 1U );
+    finalStatus = installed ? Succeeded : Failed;
+    finalStatusAttempts = 1U;
+    finalStatusPending = true;
+    updateJobStatus( finalStatusJobId, finalStatus, expectedVersion, finalStatusDetails );
+    JobReport_Reset( &jobReport );
+
+    if( installed )
+    {
+        printf( "\033[1;32mOTA Completed successfully!\033[0m\n" );
+    }
+    else
+    {
+        printf( "\033[1;31mOTA Failed, the image could not be installed.\033[0m\n" );
+    }
+
+    globalJobId[ 0 ] = 0U;
+}
+
+static void updateJobStatus( const char * jobId,
+                             JobCurrentStatus_t status,
+                             const char * expectedVersion,
+                             const char * statusDetails )
+{
+    const char * thingName = NULL;
     size_t thingNameLength = 0U;
     char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
     size_t topicBufferLength = 0U;
-    char messageBuffer[ UPDATE_JOB_MSG_LENGTH ] = { 0 };
+    char messageBuffer[ UPDATE_JOB_MSG_LENGTH + JOB_REPORT_DETAILS_SIZE ] = { 0 };
+    size_t messageBufferLength = 0U;
+    int length = 0;
+    bool hasVersion = ( expectedVersion[ 0 ] != '\0' );
+    bool hasDetails = ( statusDetails != NULL ) && ( statusDetails[ 0 ] != '\0' );
+    static const char * const jobStatusNames[] = { "QUEUED", "IN_PROGRESS", "FAILED", "SUCCEEDED", "REJECTED" };
 
-    mqttWrapper_getThingName( thingName, &thingNameLength );
+    JobReport_Begin( &jobReport, JOB_REPORT_STATUS, Clock_GetTimeMs() );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
 
     /*
      * AWS IoT Jobs library:
@@ -549,8 +2036,8 @@ static void finishDownload()
                  TOPIC_BUFFER_SIZE,
                  thingName,
                  thingNameLength,
-                 globalJobId,
-                 strnlen( globalJobId, 1000U ),
+                 jobId,
+                 strnlen( jobId, MAX_JOB_ID_LENGTH ),
                  &topicBufferLength );
 
     /*
@@ -558,18 +2045,108 @@ static void finishDownload()
      * Creating the message which contains the status of OTA job.
      * It will be published on the topic created in the previous step.
      */
-    size_t messageBufferLength = Jobs_UpdateMsg( Succeeded,
-                                                 "2",
-                                                 1U,
-                                                 messageBuffer,
-                                                 UPDATE_JOB_MSG_LENGTH );
-
-    mqttWrapper_publish( topicBuffer,
-                         topicBufferLength,
-                         ( uint8_t * ) messageBuffer,
-                         messageBufferLength );
-    printf( "\033[1;32mOTA Completed successfully!\033[0m\n" );
-    globalJobId[ 0 ] = 0U;
+    if( hasVersion && !hasDetails )
+    {
+        messageBufferLength = Jobs_UpdateMsg( status,
+                                              expectedVersion,
+                                              strlen( expectedVersion ),
+                                              messageBuffer,
+                                              UPDATE_JOB_MSG_LENGTH );
+    }
+    else
+    {
+        /* The Jobs library message has no statusDetails and always expects
+         * a version. */
+        length = snprintf( messageBuffer,
+                           sizeof( messageBuffer ),
+                           "{\"status\":\"%s\"%s%s%s%s%s}",
+                           jobStatusNames[ status ],
+                           hasVersion ? ",\"expectedVersion\":\"" : "",
+                           expectedVersion,
+                           hasVersion ? "\"" : "",
+                           hasDetails ? ",\"statusDetails\":" : "",
+                           hasDetails ? statusDetails : "" );
+        messageBufferLength = ( ( length > 0 ) && ( ( size_t ) length < sizeof( messageBuffer ) ) ) ? ( size_t ) length : 0U;
+    }
+
+    /* Details which do not fit are left out rather than the status. */
+    if( ( messageBufferLength == 0U ) && hasDetails )
+    {
+        printf( "Status details of job %s do not fit, sending the status without them. \n", jobId );
+
+        if( hasVersion )
+        {
+            messageBufferLength = Jobs_UpdateMsg( status,
+                                                  expectedVersion,
+                                                  strlen( expectedVersion ),
+                                                  messageBuffer,
+                                                  UPDATE_JOB_MSG_LENGTH );
+        }
+        else
+        {
+            length = snprintf( messageBuffer, sizeof( messageBuffer ), "{\"status\":\"%s\"}", jobStatusNames[ status ] );
+            messageBufferLength = ( length > 0 ) ? ( size_t ) length : 0U;
+        }
+    }
+
+    /* An empty update would only be rejected by the service. */
+    if( messageBufferLength > 0U )
+    {
+        ( void ) publishControlMessage( topicBuffer,
+                                        topicBufferLength,
+                                        ( uint8_t * ) messageBuffer,
+                                        messageBufferLength,
+                                        ( status == InProgress ) ? NULL : handleFinalStatusAck );
+    }
+    else
+    {
+        printf( "Failed to build the status update of job %s. \n", jobId );
+    }
+
+    JobReport_End( &jobReport, JOB_REPORT_STATUS, Clock_GetTimeMs() );
+}
+
+/* Control messages go out at QoS 1, so the wrapper sends a lost one again
+ * long before the timeouts of the agent would notice. The MQTT task sends
+ * them at QoS 0 only when it finds the in-flight window full; one caught by
+ * a broken connection is replayed after the reconnect. */
+static bool publishControlMessage( char * topic,
+                                   size_t topicLength,
+                                   uint8_t * message,
+                                   size_t messageLength,
+                                   MqttWrapperPubAckHandler_t handler )
+{
+    uint16_t packetId = 0U;
+
+    return mqttWrapper_publishQos1( topic,
+                                    topicLength,
+                                    message,
+                                    messageLength,
+                                    handler,
+                                    NULL,
+                                    &packetId );
+}
+
+/* Voluntary and involuntary switches of all threads, the tasks included. */
+static long getContextSwitches( void )
+{
+    struct rusage usage;
+
+    memset( &usage, 0x00, sizeof( usage ) );
+    ( void ) getrusage( RUSAGE_SELF, &usage );
+
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static void handleFinalStatusAck( uint16_t packetId,
+                                  uint32_t ackTimeMs,
+                                  void * context )
+{
+    ( void ) context;
+
+    OTA_STATS_PRINTF( "Final job status (packet id %u) acknowledged after %u ms. \n",
+                      ( unsigned int ) packetId,
+                      ackTimeMs );
 }
 
 static bool isBlockNeeded( uint32_t blockId )
@@ -14,7 +14,27 @@
 #include <stdbool.h>
 #include "MQTTFileDownloader_config.h"
 
-#define JOB_DOC_SIZE    2048U
+#define JOB_DOC_SIZE          2048U
+#define MAX_JOB_ID_LENGTH     64U
+
+/**
+ * @brief Set to 1 to print the performance figures of the demo.
+ */
+#ifndef OTA_DEMO_STATS
+    #define OTA_DEMO_STATS    0
+#endif
+
+/**
+ * @brief printf for a performance figure, it prints nothing unless
+ * OTA_DEMO_STATS is set.
+ */
+#define OTA_STATS_PRINTF( ... )      \
+    do {                             \
+        if( OTA_DEMO_STATS )         \
+        {                            \
+            printf( __VA_ARGS__ );   \
+        }                            \
+    } while( 0 )
 
 typedef enum OtaEvent
 {
@@ -29,6 +49,12 @@ typedef enum OtaEvent
     OtaAgentEventResume,              /*!< @brief Event to resume suspended task */
     OtaAgentEventUserAbort,           /*!< @brief Event triggered by user to stop agent. */
     OtaAgentEventShutdown,            /*!< @brief Event to trigger ota shutdown */
+    OtaAgentEventRequestNextJob,      /*!< @brief Event for requesting the document of the next queued job. */
+    OtaAgentEventReceivedNextJob,     /*!< @brief Event when the document of the next queued job is received. */
+    OtaAgentEventJobStatusResponse,   /*!< @brief Event when the service answered a job status update. */
+    OtaAgentEventSubscribed,          /*!< @brief Event when the OTA topic subscriptions are acknowledged. */
+    OtaAgentEventReconnected,         /*!< @brief Event when the MQTT connection was established again. */
+    OtaAgentEventConnectionFailed,    /*!< @brief Event when the MQTT connection could not be established. */
     OtaAgentEventMax                  /*!< @brief Last event specifier */
 } OtaEvent_t;
 
@@ -71,15 +97,35 @@ typedef struct OtaJobEventData
     size_t jobDataLength;
 } OtaJobEventData_t;
 
+/**
+ * @brief Answer of the service to a job status update.
+ */
+typedef struct OtaJobStatusEvent
+{
+    uint32_t token;   /*!< Sequence number of a progress report, 0 for other updates. */
+    uint32_t version; /*!< Version of the job execution, 0 if the answer has none. */
+    bool accepted;    /*!< The update was accepted. */
+} OtaJobStatusEvent_t;
+
 /**
  * @brief Stores information about the event message.
  *
  */
+typedef struct OtaConnectionEvent
+{
+    uint32_t connectTimeMs; /*!< Time it took to connect. */
+    uint32_t lostTimeMs;    /*!< When the connection was lost, 0 for the first one. */
+    bool sessionPresent;    /*!< The broker resumed the session. */
+} OtaConnectionEvent_t;
+
 typedef struct OtaEventMsg
 {
-    OtaDataEvent_t * dataEvent;   /*!< Data Event message. */
-    OtaJobEventData_t * jobEvent; /*!< Job Event message. */
-    OtaEvent_t eventId;           /*!< Identifier for the event. */
+    OtaDataEvent_t * dataEvent;      /*!< Data Event message. */
+    OtaJobEventData_t * jobEvent;    /*!< Job Event message. */
+    char jobId[ MAX_JOB_ID_LENGTH ]; /*!< Job the event refers to. */
+    OtaJobStatusEvent_t jobStatus;   /*!< Answer to a job status update. */
+    OtaConnectionEvent_t connection; /*!< State of the MQTT connection. */
+    OtaEvent_t eventId;              /*!< Identifier for the event. */
 } OtaEventMsg_t;
 
 
@@ -91,4 +137,14 @@ bool otaDemo_handleIncomingMQTTMessage( char * topic,
                                         size_t messageLength );
 
 OtaState_t getOtaAgentState();
+
+void otaDemo_setProcessStartTime( uint32_t processStartMs );
+
+void otaDemo_handleConnect( bool sessionPresent,
+                            uint32_t connectTimeMs );
+
+void otaDemo_handleReconnect( bool sessionPresent,
+                              uint32_t lostTimeMs );
+
+void otaDemo_handleConnectionFailed( void );
 #endif /* ifndef OTA_DEMO_H */
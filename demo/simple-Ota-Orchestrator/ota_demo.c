@@ -17,9 +17,10 @@
 #include "mqtt_wrapper.h"
 #include "ota_demo.h"
 #include "ota_job_processor.h"
+#include "utils/clock.h"
+#include "utils/job_index.h"
 
 #define CONFIG_MAX_FILE_SIZE     65536U
-#define MAX_THING_NAME_SIZE      128U
 #define MAX_JOB_ID_LENGTH        64U
 #define START_JOB_MSG_LENGTH     147U
 #define UPDATE_JOB_MSG_LENGTH    48U
@@ -31,6 +32,7 @@ static uint8_t currentFileId = 0;
 static uint32_t totalBytesReceived = 0;
 static uint8_t downloadedData[ CONFIG_MAX_FILE_SIZE ] = { 0 };
 char globalJobId[ MAX_JOB_ID_LENGTH ] = { 0 };
+static JobIndex_t jobIndex = { 0 };
 
 static void handleMqttStreamsBlockArrived( uint8_t * data,
                                            size_t dataLength );
@@ -40,17 +42,34 @@ static bool jobMetadataHandlerChain( char * topic,
                                      size_t topicLength );
 static bool jobHandlerChain( char * message,
                              size_t messageLength );
+static void registerTopicRoutes( void );
+static bool handleJobsTopic( char * topic,
+                             size_t topicLength,
+                             uint8_t * message,
+                             size_t messageLength,
+                             void * context );
+static bool handleStartNextAccepted( char * topic,
+                                     size_t topicLength,
+                                     uint8_t * message,
+                                     size_t messageLength,
+                                     void * context );
+static bool handleStreamData( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              void * context );
 
 void otaDemo_start( void )
 {
     if( mqttWrapper_isConnected() )
     {
-        char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+        const char * thingName = NULL;
         size_t thingNameLength = 0U;
         char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
         char messageBuffer[ START_JOB_MSG_LENGTH ] = { 0 };
         size_t topicLength = 0U;
-        mqttWrapper_getThingName( thingName, &thingNameLength );
+        thingName = mqttWrapper_getThingNameView( &thingNameLength );
+        registerTopicRoutes();
 
         /*
          * AWS IoT Jobs library:
@@ -80,69 +99,126 @@ void otaDemo_start( void )
     }
 }
 
-/* Implemented for use by the MQTT library */
-bool otaDemo_handleIncomingMQTTMessage( char * topic,
-                                        size_t topicLength,
-                                        uint8_t * message,
-                                        size_t messageLength )
+/* Registers the topics the demo handles once, so incoming messages are
+ * routed without rebuilding and comparing topic strings. */
+static void registerTopicRoutes( void )
+{
+    const char * thingName = NULL;
+    size_t thingNameLength = 0U;
+    char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
+    size_t topicLength = 0U;
+    bool registered = false;
+
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
+    mqttWrapper_clearRoutes();
+
+    /*
+     * AWS IoT Jobs library:
+     * Creates the start-next/accepted reserved topic, which carries job documents.
+     */
+    registered = ( Jobs_GetTopic( topicBuffer,
+                                  TOPIC_BUFFER_SIZE,
+                                  thingName,
+                                  thingNameLength,
+                                  JobsStartNextSuccess,
+                                  &topicLength ) == JobsSuccess ) &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, false, handleStartNextAccepted, NULL );
+
+    /* The job ID and the stream change with every job, so the update
+     * responses and the data blocks are routed by prefix. */
+    topicLength = ( size_t ) snprintf( topicBuffer, sizeof( topicBuffer ), "$aws/things/%s/jobs/", thingName );
+    registered = registered &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, true, handleJobsTopic, NULL );
+
+    topicLength = ( size_t ) snprintf( topicBuffer, sizeof( topicBuffer ), "$aws/things/%s/streams/", thingName );
+    registered = registered &&
+                 mqttWrapper_addRoute( topicBuffer, topicLength, true, handleStreamData, NULL );
+
+    if( !registered )
+    {
+        printf( "Failed to register the MQTT topic routes. \n" );
+    }
+}
+
+static bool handleJobsTopic( char * topic,
+                             size_t topicLength,
+                             uint8_t * message,
+                             size_t messageLength,
+                             void * context )
+{
+    ( void ) message;
+    ( void ) messageLength;
+    ( void ) context;
+
+    return jobMetadataHandlerChain( topic, topicLength );
+}
+
+static bool handleStartNextAccepted( char * topic,
+                                     size_t topicLength,
+                                     uint8_t * message,
+                                     size_t messageLength,
+                                     void * context )
+{
+    ( void ) topic;
+    ( void ) topicLength;
+    ( void ) context;
+
+    return jobHandlerChain( ( char * ) message, messageLength );
+}
+
+static bool handleStreamData( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              void * context )
 {
     bool handled = false;
     int32_t fileId = 0;
     int32_t blockId = 0;
     int32_t blockSize = 0;
 
-    handled = jobMetadataHandlerChain( topic, topicLength );
+    ( void ) context;
 
-    if( !handled )
-    {
-        char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
-        size_t thingNameLength = 0U;
+    /*
+     * MQTT streams Library:
+     * Checks if the incoming message carries a data block of the stream of
+     * the current job.
+     */
+    handled = mqttDownloader_isDataBlockReceived( &mqttFileDownloaderContext,
+                                                  topic,
+                                                  topicLength );
 
-        mqttWrapper_getThingName( thingName, &thingNameLength );
+    if( handled )
+    {
+        uint8_t decodedData[ mqttFileDownloader_CONFIG_BLOCK_SIZE ];
+        size_t decodedDataLength = 0;
 
         /*
-         * AWS IoT Jobs library:
-         * Checks if a message comes from the start-next/accepted reserved topic.
+         * MQTT streams Library:
+         * Extracting and decoding the received data block from the incoming MQTT message.
          */
-        handled = Jobs_IsStartNextAccepted( topic, topicLength, thingName, thingNameLength );
+        handled = mqttDownloader_processReceivedDataBlock(
+            &mqttFileDownloaderContext,
+            message,
+            messageLength,
+            &fileId,
+            &blockId,
+            &blockSize,
+            decodedData,
+            &decodedDataLength );
+        handleMqttStreamsBlockArrived( decodedData, decodedDataLength );
+    }
 
-        if( handled )
-        {
-            handled = jobHandlerChain( ( char * ) message, messageLength );
-        }
-        else
-        {
-            /*
-             * MQTT streams Library:
-             * Checks if the incoming message contains the requested data block. It is performed by
-             * comparing the incoming MQTT message topic with MQTT streams topics.
-             */
-            handled = mqttDownloader_isDataBlockReceived( &mqttFileDownloaderContext,
-                                                          topic,
-                                                          topicLength );
+    return handled;
+}
 
-            if( handled )
-            {
-                uint8_t decodedData[ mqttFileDownloader_CONFIG_BLOCK_SIZE ];
-                size_t decodedDataLength = 0;
-
-                /*
-                 * MQTT streams Library:
-                 * Extracting and decoding the received data block from the incoming MQTT message.
-                 */
-                handled = mqttDownloader_processReceivedDataBlock(
-                    &mqttFileDownloaderContext,
-                    message,
-                    messageLength,
-                    &fileId,
-                    &blockId,
-                    &blockSize,
-                    decodedData,
-                    &decodedDataLength );
-                handleMqttStreamsBlockArrived( decodedData, decodedDataLength );
-            }
-        }
-    }
+/* Implemented for use by the MQTT library */
+bool otaDemo_handleIncomingMQTTMessage( char * topic,
+                                        size_t topicLength,
+                                        uint8_t * message,
+                                        size_t messageLength )
+{
+    bool handled = mqttWrapper_routeMessage( topic, topicLength, message, messageLength );
 
     if( !handled )
     {
@@ -164,10 +240,10 @@ static bool jobMetadataHandlerChain( char * topic,
 
     if( globalJobId[ 0 ] != 0 )
     {
-        char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+        const char * thingName = NULL;
         size_t thingNameLength = 0U;
 
-        mqttWrapper_getThingName( thingName, &thingNameLength );
+        thingName = mqttWrapper_getThingNameView( &thingNameLength );
         handled = Jobs_IsJobUpdateStatus( topic,
                                           topicLength,
                                           ( const char * ) &globalJobId,
@@ -207,25 +283,30 @@ static bool jobMetadataHandlerChain( char * topic,
 static bool jobHandlerChain( char * message,
                              size_t messageLength )
 {
-    char * jobDoc;
+    const char * jobDoc;
     size_t jobDocLength = 0U;
-    char * jobId;
+    const char * jobId;
     size_t jobIdLength = 0U;
-    int8_t fileIndex = 0;
+    uint32_t fileIndex = 0U;
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    bool handled = false;
 
     /*
-     * AWS IoT Jobs library:
-     * Extracting the OTA job document from the jobs message recevied from AWS IoT core.
+     * A single pass over the message finds the job ID, the OTA job document
+     * and every file of the document, instead of one coreJSON search each.
      */
-    jobDocLength = Jobs_GetJobDocument( message, messageLength, ( const char ** ) &jobDoc );
+    handled = JobIndex_Build( &jobIndex, message, messageLength );
 
-    /*
-     * AWS IoT Jobs library:
-     * Extracting the job ID from the received OTA job document.
-     */
-    jobIdLength = Jobs_GetJobId( message, messageLength, ( const char ** ) &jobId );
+    if( handled )
+    {
+        printf( "Indexed the job message with %u files in %llu us. \n",
+                JobIndex_GetFileCount( &jobIndex ),
+                ( unsigned long long ) ( Clock_GetTimeUs() - startTimeUs ) );
+        jobDocLength = JobIndex_GetJobDocument( &jobIndex, &jobDoc );
+        jobIdLength = JobIndex_GetJobId( &jobIndex, &jobId );
+    }
 
-    if( globalJobId[ 0 ] == 0 )
+    if( ( globalJobId[ 0 ] == 0 ) && ( jobIdLength != 0U ) )
     {
         strncpy( globalJobId, jobId, jobIdLength );
     }
@@ -234,29 +315,26 @@ static bool jobHandlerChain( char * message,
     {
         AfrOtaJobDocumentFields_t jobFields = { 0 };
 
-        do
+        handled = JobIndex_GetFileCount( &jobIndex ) > 0U;
+
+        for( fileIndex = 0U; handled && ( fileIndex < JobIndex_GetFileCount( &jobIndex ) ); fileIndex++ )
         {
             /*
-             * AWS IoT Jobs library:
-             * Parsing the OTA job document to extract all of the parameters needed to download
-             * the new firmware.
+             * Reading the parameters needed to download the new firmware
+             * from the index, as the OTA job parser would extract them.
              */
-            fileIndex = otaParser_parseJobDocFile( jobDoc,
-                                                   jobDocLength,
-                                                   fileIndex,
-                                                   &jobFields );
+            handled = JobIndex_GetFile( &jobIndex, fileIndex, &jobFields );
 
-            if( fileIndex >= 0 )
+            if( handled )
             {
                 printf( "Received OTA Job \n" );
                 processJobFile( &jobFields );
             }
-        } while( fileIndex > 0 );
+        }
     }
 
-    /* File index will be -1 if an error occured, and 0 if all files were */
-    /* processed */
-    return fileIndex == 0;
+    /* Fails if the message is not valid JSON or a file could not be read. */
+    return handled;
 }
 
 static void requestDataBlock( void )
@@ -287,10 +365,10 @@ static void requestDataBlock( void )
 /* AFR OTA library callback */
 static void processJobFile( AfrOtaJobDocumentFields_t * params )
 {
-    char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+    const char * thingName = NULL;
     size_t thingNameLength = 0U;
 
-    mqttWrapper_getThingName( thingName, &thingNameLength );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
 
     numOfBlocksRemaining = params->fileSize /
                            mqttFileDownloader_CONFIG_BLOCK_SIZE;
@@ -353,13 +431,13 @@ static void finishDownload()
 {
     /* TODO: Do something with the completed download */
     /* Start the bootloader */
-    char thingName[ MAX_THING_NAME_SIZE + 1 ] = { 0 };
+    const char * thingName = NULL;
     size_t thingNameLength = 0U;
     char topicBuffer[ TOPIC_BUFFER_SIZE + 1 ] = { 0 };
     size_t topicBufferLength = 0U;
     char messageBuffer[ UPDATE_JOB_MSG_LENGTH ] = { 0 };
 
-    mqttWrapper_getThingName( thingName, &thingNameLength );
+    thingName = mqttWrapper_getThingNameView( &thingNameLength );
 
     /*
      * AWS IoT Jobs library:
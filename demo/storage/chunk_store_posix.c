@@ -0,0 +1,617 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file chunk_store_posix.c
+ * @brief Implementation of the content-addressed chunk store for POSIX
+ * systems.
+ */
+
+#define LIBRARY_LOG_NAME  "ChunkStore"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX includes. */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* OpenSSL includes. */
+#include <openssl/sha.h>
+
+#include "chunk_store_posix.h"
+#include "utils/atomic_file_posix.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Suffix of the files holding file manifests.
+ */
+#define MANIFEST_SUFFIX       ".manifest"
+
+/**
+ * @brief Suffix of files being written.
+ */
+#define TEMP_SUFFIX           ".tmp"
+
+/**
+ * @brief Length of a digest in hex.
+ */
+#define DIGEST_HEX_LENGTH     ( CHUNK_STORE_DIGEST_SIZE * 2U )
+
+/**
+ * @brief Size of the path of an entry.
+ */
+#define ENTRY_PATH_SIZE       ATOMIC_FILE_MAX_PATH_SIZE
+
+/**
+ * @brief Number of index entries allocated at once.
+ */
+#define INDEX_GROWTH          64U
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Build the path of an entry.
+ *
+ * @return true if the path fits.
+ */
+static bool entryPath( const ChunkStoreContext_t * store,
+                       const uint8_t * digest,
+                       bool manifest,
+                       char * path );
+
+/**
+ * @brief Parse the file name of an entry.
+ *
+ * @return true if the name is the name of an entry.
+ */
+static bool parseName( const char * name,
+                       uint8_t * digest,
+                       bool * manifest );
+
+/**
+ * @brief Find an entry in the index.
+ *
+ * @return The entry or NULL.
+ */
+static ChunkStoreEntry_t * findEntry( ChunkStoreContext_t * store,
+                                      const uint8_t * digest,
+                                      bool manifest );
+
+/**
+ * @brief Add an entry to the index.
+ *
+ * @return true on success.
+ */
+static bool addEntry( ChunkStoreContext_t * store,
+                      const uint8_t * digest,
+                      bool manifest,
+                      uint32_t size,
+                      uint64_t lastUsedNs );
+
+/**
+ * @brief Delete an entry from disk and the index.
+ */
+static void removeEntry( ChunkStoreContext_t * store,
+                         ChunkStoreEntry_t * entry );
+
+/**
+ * @brief Remove least recently used entries until an entry of the given size
+ * fits the budget.
+ */
+static void makeRoom( ChunkStoreContext_t * store,
+                      uint64_t size );
+
+/**
+ * @brief Read an entry into a buffer and mark it as used.
+ *
+ * @return true if the whole entry was read.
+ */
+static bool readEntry( ChunkStoreContext_t * store,
+                       ChunkStoreEntry_t * entry,
+                       uint8_t * buffer,
+                       size_t bufferSize,
+                       size_t * length );
+
+/**
+ * @brief Write an entry and add it to the index.
+ *
+ * Chunks are verified when read, so they are not synced. Manifests are
+ * written atomically because they are trusted.
+ *
+ * @return true on success.
+ */
+static bool writeEntry( ChunkStoreContext_t * store,
+                        const uint8_t * digest,
+                        bool manifest,
+                        const uint8_t * data,
+                        size_t length );
+
+/**
+ * @brief Current wall clock time, comparable to file modification times.
+ */
+static uint64_t nowNs( void );
+
+/*-----------------------------------------------------------*/
+
+static uint64_t nowNs( void )
+{
+    struct timespec now = { 0 };
+
+    ( void ) clock_gettime( CLOCK_REALTIME, &now );
+
+    return ( ( uint64_t ) now.tv_sec * 1000000000U ) + ( uint64_t ) now.tv_nsec;
+}
+
+static bool entryPath( const ChunkStoreContext_t * store,
+                       const uint8_t * digest,
+                       bool manifest,
+                       char * path )
+{
+    char hex[ DIGEST_HEX_LENGTH + 1U ] = { 0 };
+    uint32_t i = 0U;
+    int length = 0;
+
+    for( i = 0U; i < CHUNK_STORE_DIGEST_SIZE; i++ )
+    {
+        ( void ) snprintf( &hex[ i * 2U ], 3U, "%02x", digest[ i ] );
+    }
+
+    length = snprintf( path,
+                       ENTRY_PATH_SIZE,
+                       "%s/%s%s",
+                       store->directory,
+                       hex,
+                       manifest ? MANIFEST_SUFFIX : "" );
+
+    return ( length > 0 ) && ( ( size_t ) length < ENTRY_PATH_SIZE );
+}
+
+static bool parseName( const char * name,
+                       uint8_t * digest,
+                       bool * manifest )
+{
+    bool valid = true;
+    unsigned int byte = 0U;
+    uint32_t i = 0U;
+
+    for( i = 0U; valid && ( i < DIGEST_HEX_LENGTH ); i++ )
+    {
+        valid = ( ( name[ i ] >= '0' ) && ( name[ i ] <= '9' ) ) ||
+                ( ( name[ i ] >= 'a' ) && ( name[ i ] <= 'f' ) );
+    }
+
+    if( valid )
+    {
+        *manifest = strcmp( &name[ DIGEST_HEX_LENGTH ], MANIFEST_SUFFIX ) == 0;
+        valid = *manifest || ( name[ DIGEST_HEX_LENGTH ] == '\0' );
+    }
+
+    for( i = 0U; valid && ( i < CHUNK_STORE_DIGEST_SIZE ); i++ )
+    {
+        ( void ) sscanf( &name[ i * 2U ], "%2x", &byte );
+        digest[ i ] = ( uint8_t ) byte;
+    }
+
+    return valid;
+}
+
+static ChunkStoreEntry_t * findEntry( ChunkStoreContext_t * store,
+                                      const uint8_t * digest,
+                                      bool manifest )
+{
+    ChunkStoreEntry_t * entry = NULL;
+    uint32_t i = 0U;
+
+    for( i = 0U; i < store->entryCount; i++ )
+    {
+        if( ( store->entries[ i ].manifest == manifest ) &&
+            ( memcmp( store->entries[ i ].digest,
+                      digest,
+                      CHUNK_STORE_DIGEST_SIZE ) == 0 ) )
+        {
+            entry = &store->entries[ i ];
+            break;
+        }
+    }
+
+    return entry;
+}
+
+static bool addEntry( ChunkStoreContext_t * store,
+                      const uint8_t * digest,
+                      bool manifest,
+                      uint32_t size,
+                      uint64_t lastUsedNs )
+{
+    ChunkStoreEntry_t * entries = NULL;
+    bool success = true;
+
+    if( store->entryCount == store->entryCapacity )
+    {
+        entries = ( ChunkStoreEntry_t * ) realloc(
+            store->entries,
+            ( store->entryCapacity + INDEX_GROWTH ) *
+            sizeof( ChunkStoreEntry_t ) );
+
+        if( entries == NULL )
+        {
+            success = false;
+        }
+        else
+        {
+            store->entries = entries;
+            store->entryCapacity += INDEX_GROWTH;
+        }
+    }
+
+    if( success )
+    {
+        entries = &store->entries[ store->entryCount ];
+        memcpy( entries->digest, digest, CHUNK_STORE_DIGEST_SIZE );
+        entries->manifest = manifest;
+        entries->size = size;
+        entries->lastUsedNs = lastUsedNs;
+        store->entryCount++;
+        store->totalSize += size;
+    }
+
+    return success;
+}
+
+static void removeEntry( ChunkStoreContext_t * store,
+                         ChunkStoreEntry_t * entry )
+{
+    char path[ ENTRY_PATH_SIZE ];
+
+    if( entryPath( store, entry->digest, entry->manifest, path ) )
+    {
+        ( void ) unlink( path );
+    }
+
+    store->totalSize -= entry->size;
+    *entry = store->entries[ store->entryCount - 1U ];
+    store->entryCount--;
+}
+
+static void makeRoom( ChunkStoreContext_t * store,
+                      uint64_t size )
+{
+    ChunkStoreEntry_t * oldest = NULL;
+    uint32_t i = 0U;
+
+    while( ( store->entryCount > 0U ) &&
+           ( ( store->totalSize + size ) > store->budget ) )
+    {
+        oldest = &store->entries[ 0 ];
+
+        for( i = 1U; i < store->entryCount; i++ )
+        {
+            if( store->entries[ i ].lastUsedNs < oldest->lastUsedNs )
+            {
+                oldest = &store->entries[ i ];
+            }
+        }
+
+        store->stats.evictions++;
+        store->stats.bytesEvicted += oldest->size;
+        removeEntry( store, oldest );
+    }
+}
+
+static bool readEntry( ChunkStoreContext_t * store,
+                       ChunkStoreEntry_t * entry,
+                       uint8_t * buffer,
+                       size_t bufferSize,
+                       size_t * length )
+{
+    char path[ ENTRY_PATH_SIZE ];
+    ssize_t bytesRead = 0;
+    bool success = false;
+    int fd = -1;
+
+    if( ( entry->size <= bufferSize ) &&
+        entryPath( store, entry->digest, entry->manifest, path ) )
+    {
+        fd = open( path, O_RDONLY );
+    }
+
+    if( fd >= 0 )
+    {
+        bytesRead = read( fd, buffer, entry->size );
+        ( void ) close( fd );
+        success = bytesRead == ( ssize_t ) entry->size;
+    }
+
+    if( success )
+    {
+        *length = entry->size;
+        entry->lastUsedNs = nowNs();
+        ( void ) utimensat( AT_FDCWD, path, NULL, 0 );
+    }
+
+    return success;
+}
+
+static bool writeEntry( ChunkStoreContext_t * store,
+                        const uint8_t * digest,
+                        bool manifest,
+                        const uint8_t * data,
+                        size_t length )
+{
+    char path[ ENTRY_PATH_SIZE ];
+    char tempPath[ ENTRY_PATH_SIZE + sizeof( TEMP_SUFFIX ) ];
+    bool success = false;
+    int fd = -1;
+
+    if( length <= store->budget )
+    {
+        success = entryPath( store, digest, manifest, path );
+    }
+
+    if( success )
+    {
+        makeRoom( store, length );
+
+        if( manifest )
+        {
+            success = AtomicFile_Write( path, data, length );
+        }
+        else
+        {
+            ( void ) snprintf( tempPath, sizeof( tempPath ), "%s" TEMP_SUFFIX, path );
+            fd = open( tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+            success = ( fd >= 0 ) &&
+                      ( write( fd, data, length ) == ( ssize_t ) length );
+            success = ( fd >= 0 ) && ( close( fd ) == 0 ) && success;
+            success = success && ( rename( tempPath, path ) == 0 );
+
+            if( !success )
+            {
+                ( void ) unlink( tempPath );
+            }
+        }
+    }
+
+    if( success )
+    {
+        success = addEntry( store, digest, manifest, ( uint32_t ) length, nowNs() );
+        store->stats.bytesAdded += length;
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+bool ChunkStore_Open( ChunkStoreContext_t * store,
+                      const char * directory,
+                      uint64_t budget )
+{
+    char path[ ENTRY_PATH_SIZE ];
+    uint8_t digest[ CHUNK_STORE_DIGEST_SIZE ];
+    struct dirent * dirEntry = NULL;
+    struct stat fileStat;
+    bool manifest = false;
+    bool success = true;
+    DIR * dir = NULL;
+
+    assert( store != NULL );
+    assert( directory != NULL );
+
+    memset( store, 0x00, sizeof( ChunkStoreContext_t ) );
+    store->directory = directory;
+    store->budget = budget;
+
+    if( ( mkdir( directory, 0755 ) != 0 ) && ( errno != EEXIST ) )
+    {
+        success = false;
+    }
+    else
+    {
+        dir = opendir( directory );
+        success = dir != NULL;
+    }
+
+    while( success && ( ( dirEntry = readdir( dir ) ) != NULL ) )
+    {
+        if( ( strlen( dirEntry->d_name ) < DIGEST_HEX_LENGTH ) ||
+            ( ( size_t ) snprintf( path, sizeof( path ), "%s/%s",
+                                   directory, dirEntry->d_name ) >= sizeof( path ) ) )
+        {
+            continue;
+        }
+
+        if( !parseName( dirEntry->d_name, digest, &manifest ) )
+        {
+            /* Left behind by a crash while an entry was written. */
+            if( strstr( dirEntry->d_name, TEMP_SUFFIX ) != NULL )
+            {
+                ( void ) unlink( path );
+            }
+        }
+        else if( stat( path, &fileStat ) == 0 )
+        {
+            success = addEntry( store,
+                                digest,
+                                manifest,
+                                ( uint32_t ) fileStat.st_size,
+                                ( ( uint64_t ) fileStat.st_mtim.tv_sec * 1000000000U ) +
+                                ( uint64_t ) fileStat.st_mtim.tv_nsec );
+        }
+        else
+        {
+            /* Empty else. */
+        }
+    }
+
+    if( dir != NULL )
+    {
+        ( void ) closedir( dir );
+    }
+
+    if( success )
+    {
+        makeRoom( store, 0U );
+        LogInfo( ( "Opened chunk store %s: %u entries, %llu of %llu bytes.",
+                   directory,
+                   store->entryCount,
+                   ( unsigned long long ) store->totalSize,
+                   ( unsigned long long ) budget ) );
+    }
+    else
+    {
+        LogError( ( "Failed to open chunk store %s: errno=%d.",
+                    directory,
+                    errno ) );
+        ChunkStore_Close( store );
+    }
+
+    return success;
+}
+
+bool ChunkStore_GetChunk( ChunkStoreContext_t * store,
+                          const uint8_t * digest,
+                          uint8_t * buffer,
+                          size_t bufferSize,
+                          size_t * length )
+{
+    uint8_t actual[ SHA256_DIGEST_LENGTH ];
+    ChunkStoreEntry_t * entry = NULL;
+    bool found = false;
+
+    assert( store != NULL );
+    assert( digest != NULL );
+    assert( buffer != NULL );
+    assert( length != NULL );
+
+    entry = findEntry( store, digest, false );
+
+    if( ( entry != NULL ) &&
+        readEntry( store, entry, buffer, bufferSize, length ) )
+    {
+        ( void ) SHA256( buffer, *length, actual );
+        found = memcmp( actual, digest, CHUNK_STORE_DIGEST_SIZE ) == 0;
+
+        if( !found )
+        {
+            LogWarn( ( "Removing corrupt chunk." ) );
+            removeEntry( store, entry );
+        }
+    }
+
+    if( found )
+    {
+        store->stats.hits++;
+        store->stats.bytesServed += *length;
+    }
+    else
+    {
+        store->stats.misses++;
+    }
+
+    return found;
+}
+
+bool ChunkStore_PutChunk( ChunkStoreContext_t * store,
+                          const uint8_t * data,
+                          size_t length,
+                          uint8_t * digest )
+{
+    uint8_t key[ SHA256_DIGEST_LENGTH ];
+    ChunkStoreEntry_t * entry = NULL;
+    bool success = true;
+
+    assert( store != NULL );
+    assert( data != NULL );
+
+    ( void ) SHA256( data, length, key );
+    entry = findEntry( store, key, false );
+
+    if( entry != NULL )
+    {
+        entry->lastUsedNs = nowNs();
+    }
+    else
+    {
+        success = writeEntry( store, key, false, data, length );
+
+        if( success )
+        {
+            store->stats.chunksAdded++;
+        }
+    }
+
+    if( digest != NULL )
+    {
+        memcpy( digest, key, CHUNK_STORE_DIGEST_SIZE );
+    }
+
+    return success;
+}
+
+bool ChunkStore_GetManifest( ChunkStoreContext_t * store,
+                             const uint8_t * fileDigest,
+                             uint8_t * buffer,
+                             size_t bufferSize,
+                             size_t * length )
+{
+    ChunkStoreEntry_t * entry = NULL;
+
+    assert( store != NULL );
+    assert( fileDigest != NULL );
+    assert( buffer != NULL );
+    assert( length != NULL );
+
+    entry = findEntry( store, fileDigest, true );
+
+    return ( entry != NULL ) &&
+           readEntry( store, entry, buffer, bufferSize, length );
+}
+
+bool ChunkStore_PutManifest( ChunkStoreContext_t * store,
+                             const uint8_t * fileDigest,
+                             const uint8_t * chunkDigests,
+                             size_t length )
+{
+    ChunkStoreEntry_t * entry = NULL;
+
+    assert( store != NULL );
+    assert( fileDigest != NULL );
+    assert( chunkDigests != NULL );
+
+    entry = findEntry( store, fileDigest, true );
+
+    if( entry != NULL )
+    {
+        removeEntry( store, entry );
+    }
+
+    return writeEntry( store, fileDigest, true, chunkDigests, length );
+}
+
+void ChunkStore_Close( ChunkStoreContext_t * store )
+{
+    assert( store != NULL );
+
+    free( store->entries );
+    store->entries = NULL;
+    store->entryCount = 0U;
+    store->entryCapacity = 0U;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file chunk_store_posix.h
+ * @brief Content-addressed store of chunks of previously downloaded files.
+ *
+ * Every chunk is kept in a file of the store directory named after the hex
+ * SHA-256 digest of its contents, so the same bytes are stored once no matter
+ * which job delivered them. A file manifest, named after a digest
+ * identifying a whole file, lists the chunk digests of that file, which lets
+ * a file be found without a digest list from the cloud.
+ *
+ * The store keeps its total size under a budget by removing the least
+ * recently used entries. Recency is kept in the file modification times so it
+ * survives restarts.
+ */
+
+#ifndef CHUNK_STORE_POSIX_H_
+#define CHUNK_STORE_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of a chunk digest.
+ */
+#define CHUNK_STORE_DIGEST_SIZE 32U
+
+/**
+ * @brief An entry of the store.
+ */
+typedef struct ChunkStoreEntry
+{
+    uint8_t digest[ CHUNK_STORE_DIGEST_SIZE ]; /**< @brief Key of the entry. */
+    bool manifest;                             /**< @brief File manifest
+                                                  rather than a chunk. */
+    uint32_t size;                             /**< @brief Size in bytes. */
+    uint64_t lastUsedNs;                       /**< @brief Time of the last
+                                                  lookup or store. */
+} ChunkStoreEntry_t;
+
+/**
+ * @brief Counters describing the use of the store.
+ */
+typedef struct ChunkStoreStats
+{
+    uint32_t hits;         /**< @brief Chunks found in the store. */
+    uint32_t misses;       /**< @brief Chunks not in the store. */
+    uint64_t bytesServed;  /**< @brief Bytes of chunks found. */
+    uint32_t chunksAdded;  /**< @brief New chunks stored. */
+    uint64_t bytesAdded;   /**< @brief Bytes of new chunks and manifests. */
+    uint32_t evictions;    /**< @brief Entries removed to meet the budget. */
+    uint64_t bytesEvicted; /**< @brief Bytes of removed entries. */
+} ChunkStoreStats_t;
+
+/**
+ * @brief State of an open store.
+ */
+typedef struct ChunkStoreContext
+{
+    const char * directory;      /**< @brief Directory holding the entries. */
+    uint64_t budget;             /**< @brief Maximum total size. */
+    uint64_t totalSize;          /**< @brief Size of all entries. */
+    ChunkStoreEntry_t * entries; /**< @brief Index of the entries. */
+    uint32_t entryCount;         /**< @brief Entries in the index. */
+    uint32_t entryCapacity;      /**< @brief Allocated index entries. */
+    ChunkStoreStats_t stats;     /**< @brief Use counters. */
+} ChunkStoreContext_t;
+
+/**
+ * @brief Open a store, creating its directory if needed.
+ *
+ * @param[out] store Context to initialize.
+ * @param[in] directory Directory of the store. Referenced, not copied.
+ * @param[in] budget Maximum total size of all entries in bytes.
+ *
+ * @return true on success.
+ */
+bool ChunkStore_Open( ChunkStoreContext_t * store,
+                      const char * directory,
+                      uint64_t budget );
+
+/**
+ * @brief Look up a chunk by the digest of its contents.
+ *
+ * The chunk is verified against its digest; a corrupt chunk is removed and
+ * reported as missing.
+ *
+ * @param[in] store Chunk store.
+ * @param[in] digest SHA-256 digest of the chunk.
+ * @param[out] buffer Buffer receiving the chunk.
+ * @param[in] bufferSize Size of the buffer.
+ * @param[out] length Length of the chunk.
+ *
+ * @return true if the chunk was found.
+ */
+bool ChunkStore_GetChunk( ChunkStoreContext_t * store,
+                          const uint8_t * digest,
+                          uint8_t * buffer,
+                          size_t bufferSize,
+                          size_t * length );
+
+/**
+ * @brief Add a chunk to the store.
+ *
+ * @param[in] store Chunk store.
+ * @param[in] data Contents of the chunk.
+ * @param[in] length Length of the chunk.
+ * @param[out] digest Receives the SHA-256 digest of the chunk. Optional.
+ *
+ * @return true if the chunk is in the store.
+ */
+bool ChunkStore_PutChunk( ChunkStoreContext_t * store,
+                          const uint8_t * data,
+                          size_t length,
+                          uint8_t * digest );
+
+/**
+ * @brief Look up the manifest of a file.
+ *
+ * @param[in] store Chunk store.
+ * @param[in] fileDigest Digest identifying the file.
+ * @param[out] buffer Buffer receiving the chunk digests of the file.
+ * @param[in] bufferSize Size of the buffer.
+ * @param[out] length Length of the manifest.
+ *
+ * @return true if the manifest was found.
+ */
+bool ChunkStore_GetManifest( ChunkStoreContext_t * store,
+                             const uint8_t * fileDigest,
+                             uint8_t * buffer,
+                             size_t bufferSize,
+                             size_t * length );
+
+/**
+ * @brief Store the manifest of a file.
+ *
+ * @param[in] store Chunk store.
+ * @param[in] fileDigest Digest identifying the file.
+ * @param[in] chunkDigests Digests of the chunks of the file, in order.
+ * @param[in] length Length of the digest list.
+ *
+ * @return true on success.
+ */
+bool ChunkStore_PutManifest( ChunkStoreContext_t * store,
+                             const uint8_t * fileDigest,
+                             const uint8_t * chunkDigests,
+                             size_t length );
+
+/**
+ * @brief Release the index of the store.
+ *
+ * @param[in] store Chunk store.
+ */
+void ChunkStore_Close( ChunkStoreContext_t * store );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef CHUNK_STORE_POSIX_H_ */
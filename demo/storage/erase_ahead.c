@@ -0,0 +1,194 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file erase_ahead.c
+ * @brief Implementation of the erase-ahead scheduler.
+ */
+
+#define LIBRARY_LOG_NAME  "EraseAhead"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdlib.h>
+
+#include "erase_ahead.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Get a sector ready to receive data of the image.
+ *
+ * Blank sectors are used as they are, others are erased.
+ *
+ * @param[in] eraseAhead Scheduler.
+ * @param[in] sector Sector to prepare.
+ * @param[in] wait Wait for the erase to finish instead of only starting it.
+ *
+ * @return true if the sector is ready, or its erase was started.
+ */
+static bool prepareSector( EraseAheadContext_t * eraseAhead,
+                           uint32_t sector,
+                           bool wait );
+
+/*-----------------------------------------------------------*/
+
+static bool prepareSector( EraseAheadContext_t * eraseAhead,
+                           uint32_t sector,
+                           bool wait )
+{
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+
+    if( eraseAhead->sectorReady[ sector ] == 0U )
+    {
+        if( !FlashSim_IsSectorErased( eraseAhead->flash, sector ) )
+        {
+            status = wait ? FlashSim_Erase( eraseAhead->flash, sector )
+                          : FlashSim_StartErase( eraseAhead->flash, sector );
+        }
+
+        if( status == FLASH_SIM_SUCCESS )
+        {
+            eraseAhead->sectorReady[ sector ] = 1U;
+        }
+    }
+
+    return status == FLASH_SIM_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+bool EraseAhead_Init( EraseAheadContext_t * eraseAhead,
+                      FlashSimContext_t * flash,
+                      uint32_t imageSize,
+                      uint32_t lookahead )
+{
+    bool success = false;
+    uint32_t sectorSize = 0U;
+
+    assert( eraseAhead != NULL );
+    assert( flash != NULL );
+
+    sectorSize = flash->geometry.sectorSize;
+    eraseAhead->flash = flash;
+    eraseAhead->sectorCount = ( imageSize + sectorSize - 1U ) / sectorSize;
+    eraseAhead->lookahead = lookahead;
+    eraseAhead->sectorReady = NULL;
+
+    if( eraseAhead->sectorCount > flash->geometry.sectorCount )
+    {
+        LogError( ( "Image of %u bytes does not fit the flash partition.",
+                    imageSize ) );
+    }
+    else
+    {
+        eraseAhead->sectorReady = ( uint8_t * ) calloc(
+            eraseAhead->sectorCount,
+            sizeof( uint8_t ) );
+        success = eraseAhead->sectorReady != NULL;
+    }
+
+    return success;
+}
+
+void EraseAhead_Deinit( EraseAheadContext_t * eraseAhead )
+{
+    assert( eraseAhead != NULL );
+
+    free( eraseAhead->sectorReady );
+    eraseAhead->sectorReady = NULL;
+}
+
+void EraseAhead_Service( EraseAheadContext_t * eraseAhead,
+                         uint32_t writeCursor )
+{
+    uint32_t sector = 0U;
+    uint32_t lastSector = 0U;
+    bool started = false;
+
+    assert( eraseAhead != NULL );
+
+    if( ( eraseAhead->sectorReady != NULL ) &&
+        !FlashSim_IsBusy( eraseAhead->flash ) )
+    {
+        sector = writeCursor / eraseAhead->flash->geometry.sectorSize;
+        lastSector = sector + eraseAhead->lookahead;
+
+        if( lastSector > eraseAhead->sectorCount )
+        {
+            lastSector = eraseAhead->sectorCount;
+        }
+
+        /* Only one erase can run at a time, so stop after the first erase
+         * that was started. Blank sectors are skipped without device work. */
+        for( ; !started && ( sector < lastSector ); sector++ )
+        {
+            if( eraseAhead->sectorReady[ sector ] == 0U )
+            {
+                started = !FlashSim_IsSectorErased( eraseAhead->flash,
+                                                    sector );
+                ( void ) prepareSector( eraseAhead, sector, false );
+            }
+        }
+    }
+}
+
+bool EraseAhead_PrepareRange( EraseAheadContext_t * eraseAhead,
+                              uint32_t offset,
+                              uint32_t length )
+{
+    uint32_t sectorSize = 0U;
+    uint32_t sector = 0U;
+    uint32_t lastSector = 0U;
+    bool success = true;
+
+    assert( eraseAhead != NULL );
+    assert( eraseAhead->sectorReady != NULL );
+
+    sectorSize = eraseAhead->flash->geometry.sectorSize;
+    lastSector = ( offset + length - 1U ) / sectorSize;
+
+    if( ( length == 0U ) || ( lastSector >= eraseAhead->sectorCount ) )
+    {
+        success = false;
+    }
+
+    for( sector = offset / sectorSize; success && ( sector <= lastSector );
+         sector++ )
+    {
+        success = prepareSector( eraseAhead, sector, true );
+    }
+
+    return success;
+}
+
+void EraseAhead_MarkReady( EraseAheadContext_t * eraseAhead,
+                           uint32_t offset,
+                           uint32_t length )
+{
+    uint32_t sectorSize = 0U;
+    uint32_t sector = 0U;
+    uint32_t lastSector = 0U;
+
+    assert( eraseAhead != NULL );
+    assert( eraseAhead->sectorReady != NULL );
+
+    sectorSize = eraseAhead->flash->geometry.sectorSize;
+    lastSector = ( offset + length - 1U ) / sectorSize;
+
+    for( sector = offset / sectorSize;
+         ( length > 0U ) && ( sector <= lastSector ) &&
+         ( sector < eraseAhead->sectorCount );
+         sector++ )
+    {
+        eraseAhead->sectorReady[ sector ] = 1U;
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file erase_ahead.h
+ * @brief Erases flash sectors ahead of the write cursor of a download.
+ *
+ * Erasing a sector takes far longer than programming it. The scheduler starts
+ * sector erases while the device would otherwise sit idle waiting for the next
+ * block from the network, so that the sectors are already blank once the
+ * blocks for them arrive.
+ */
+
+#ifndef ERASE_AHEAD_H_
+#define ERASE_AHEAD_H_
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flash_sim_posix.h"
+
+/**
+ * @brief State of the erase-ahead scheduler for one image.
+ */
+typedef struct EraseAheadContext
+{
+    FlashSimContext_t * flash; /**< @brief Partition receiving the image. */
+    uint32_t sectorCount;      /**< @brief Number of sectors of the image. */
+    uint32_t lookahead;        /**< @brief Sectors to keep erased ahead of the
+                                  write cursor. */
+    uint8_t * sectorReady;     /**< @brief Per sector flag set once it has been
+                                  erased for, or holds data of, this image. */
+} EraseAheadContext_t;
+
+/**
+ * @brief Start scheduling erases for an image written to a partition.
+ *
+ * @param[out] eraseAhead Scheduler to initialize.
+ * @param[in] flash Partition the image is written to, from offset zero.
+ * @param[in] imageSize Size of the image in bytes.
+ * @param[in] lookahead Number of sectors to erase ahead of the write cursor.
+ *
+ * @return true on success; false if the image does not fit the partition.
+ */
+bool EraseAhead_Init( EraseAheadContext_t * eraseAhead,
+                      FlashSimContext_t * flash,
+                      uint32_t imageSize,
+                      uint32_t lookahead );
+
+/**
+ * @brief Release the resources of the scheduler.
+ *
+ * @param[in] eraseAhead Scheduler to release.
+ */
+void EraseAhead_Deinit( EraseAheadContext_t * eraseAhead );
+
+/**
+ * @brief Start the next erase ahead of the write cursor if the device is idle.
+ *
+ * Call this whenever the writer is about to wait, e.g. right after requesting
+ * more data. At most one erase is started and the call never blocks.
+ *
+ * @param[in] eraseAhead Scheduler.
+ * @param[in] writeCursor Offset of the next data expected to be written.
+ */
+void EraseAhead_Service( EraseAheadContext_t * eraseAhead,
+                         uint32_t writeCursor );
+
+/**
+ * @brief Make sure every sector of a range is ready to be programmed.
+ *
+ * Sectors the scheduler did not get to yet are erased synchronously.
+ *
+ * @param[in] eraseAhead Scheduler.
+ * @param[in] offset Offset of the range.
+ * @param[in] length Length of the range.
+ *
+ * @return true if the range can be programmed.
+ */
+bool EraseAhead_PrepareRange( EraseAheadContext_t * eraseAhead,
+                              uint32_t offset,
+                              uint32_t length );
+
+/**
+ * @brief Mark the sectors of a range as holding data of this image.
+ *
+ * Used when a download is resumed: sectors which already received blocks
+ * must not be erased again.
+ *
+ * @param[in] eraseAhead Scheduler.
+ * @param[in] offset Offset of the range.
+ * @param[in] length Length of the range.
+ */
+void EraseAhead_MarkReady( EraseAheadContext_t * eraseAhead,
+                           uint32_t offset,
+                           uint32_t length );
+
+#endif /* ifndef ERASE_AHEAD_H_ */
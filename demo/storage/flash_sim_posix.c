@@ -0,0 +1,598 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file flash_sim_posix.c
+ * @brief Implementation of the simulated flash partition for POSIX systems.
+ */
+
+#define LIBRARY_LOG_NAME  "FlashSim"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash_sim_posix.h"
+#include "utils/clock.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sleep for the given number of microseconds.
+ *
+ * @param[in] timeUs Microseconds to sleep.
+ */
+static void sleepUs( uint64_t timeUs );
+
+/**
+ * @brief Block until the running erase or program operation has finished.
+ *
+ * Time spent waiting on an erase is accounted as an erase stall.
+ *
+ * @param[in] flash Flash partition.
+ */
+static void waitForDevice( FlashSimContext_t * flash );
+
+/**
+ * @brief Write a whole buffer to the backing file.
+ *
+ * @return true if all bytes were written.
+ */
+static bool writeAll( int fd, const uint8_t * data, size_t length, off_t offset );
+
+/**
+ * @brief Read a whole buffer from the backing file.
+ *
+ * @return true if all bytes were read.
+ */
+static bool readAll( int fd, uint8_t * data, size_t length, off_t offset );
+
+/**
+ * @brief Fill a range of the backing file with erased bytes.
+ *
+ * @return true on success.
+ */
+static bool fillErased( FlashSimContext_t * flash,
+                        uint32_t offset,
+                        uint32_t length );
+
+/**
+ * @brief Check that a program operation does not violate flash rules.
+ *
+ * @return #FLASH_SIM_SUCCESS if the data can be programmed.
+ */
+static FlashSimStatus_t checkProgram( FlashSimContext_t * flash,
+                                      uint32_t offset,
+                                      const uint8_t * data,
+                                      size_t length );
+
+/*-----------------------------------------------------------*/
+
+static void sleepUs( uint64_t timeUs )
+{
+    struct timespec sleepTime = { 0 };
+
+    sleepTime.tv_sec = ( time_t ) ( timeUs / 1000000U );
+    sleepTime.tv_nsec = ( long ) ( ( timeUs % 1000000U ) * 1000U );
+
+    while( ( nanosleep( &sleepTime, &sleepTime ) != 0 ) && ( errno == EINTR ) )
+    {
+    }
+}
+
+static void waitForDevice( FlashSimContext_t * flash )
+{
+    uint64_t now = Clock_GetTimeUs();
+
+    if( now < flash->busyUntilUs )
+    {
+        sleepUs( flash->busyUntilUs - now );
+
+        if( flash->eraseInProgress )
+        {
+            flash->stats.eraseStallUs += flash->busyUntilUs - now;
+        }
+    }
+
+    flash->eraseInProgress = false;
+}
+
+static bool writeAll( int fd, const uint8_t * data, size_t length, off_t offset )
+{
+    ssize_t written = 0;
+
+    while( length > 0U )
+    {
+        written = pwrite( fd, data, length, offset );
+
+        if( written <= 0 )
+        {
+            if( ( written < 0 ) && ( errno == EINTR ) )
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        data += written;
+        offset += written;
+        length -= ( size_t ) written;
+    }
+
+    return length == 0U;
+}
+
+static bool readAll( int fd, uint8_t * data, size_t length, off_t offset )
+{
+    ssize_t bytesRead = 0;
+
+    while( length > 0U )
+    {
+        bytesRead = pread( fd, data, length, offset );
+
+        if( bytesRead <= 0 )
+        {
+            if( ( bytesRead < 0 ) && ( errno == EINTR ) )
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        data += bytesRead;
+        offset += bytesRead;
+        length -= ( size_t ) bytesRead;
+    }
+
+    return length == 0U;
+}
+
+static bool fillErased( FlashSimContext_t * flash,
+                        uint32_t offset,
+                        uint32_t length )
+{
+    uint32_t pageSize = flash->geometry.pageSize;
+    uint32_t chunk = 0U;
+    bool success = true;
+
+    memset( flash->pageBuffer, FLASH_SIM_ERASED_BYTE, pageSize );
+
+    while( success && ( length > 0U ) )
+    {
+        chunk = ( length < pageSize ) ? length : pageSize;
+        success = writeAll( flash->fd, flash->pageBuffer, chunk, offset );
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return success;
+}
+
+static FlashSimStatus_t checkProgram( FlashSimContext_t * flash,
+                                      uint32_t offset,
+                                      const uint8_t * data,
+                                      size_t length )
+{
+    const FlashSimGeometry_t * geometry = &flash->geometry;
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+    uint32_t page = offset / geometry->pageSize;
+    uint32_t lastPage = ( uint32_t ) ( ( offset + length - 1U ) /
+                                       geometry->pageSize );
+    uint32_t pageOffset = 0U;
+    uint32_t chunk = 0U;
+    size_t checked = 0U;
+    size_t i = 0U;
+
+    if( geometry->singleProgramPerPage )
+    {
+        if( ( ( offset % geometry->pageSize ) != 0U ) ||
+            ( ( length % geometry->pageSize ) != 0U ) )
+        {
+            LogError( ( "Unaligned program of %lu bytes at offset %u.",
+                        ( unsigned long ) length,
+                        offset ) );
+            status = FLASH_SIM_INVALID_PARAMETER;
+        }
+
+        for( ; ( status == FLASH_SIM_SUCCESS ) && ( page <= lastPage ); page++ )
+        {
+            if( flash->pageErased[ page ] == 0U )
+            {
+                status = FLASH_SIM_NOT_ERASED;
+            }
+        }
+    }
+    else
+    {
+        /* NOR flash can only clear bits, so every bit set in the new data
+         * must still be set in the flash. */
+        for( ; ( status == FLASH_SIM_SUCCESS ) && ( page <= lastPage ); page++ )
+        {
+            pageOffset = ( offset + ( uint32_t ) checked ) % geometry->pageSize;
+            chunk = geometry->pageSize - pageOffset;
+
+            if( chunk > ( length - checked ) )
+            {
+                chunk = ( uint32_t ) ( length - checked );
+            }
+
+            /* Erased pages accept any data. */
+            if( flash->pageErased[ page ] != 0U )
+            {
+                checked += chunk;
+                continue;
+            }
+
+            if( !readAll( flash->fd,
+                          flash->pageBuffer,
+                          chunk,
+                          ( off_t ) offset + ( off_t ) checked ) )
+            {
+                status = FLASH_SIM_IO_ERROR;
+            }
+
+            for( i = 0U; ( status == FLASH_SIM_SUCCESS ) && ( i < chunk ); i++ )
+            {
+                if( ( flash->pageBuffer[ i ] & data[ checked + i ] ) !=
+                    data[ checked + i ] )
+                {
+                    status = FLASH_SIM_NOT_ERASED;
+                }
+            }
+
+            checked += chunk;
+        }
+    }
+
+    if( status == FLASH_SIM_NOT_ERASED )
+    {
+        LogError( ( "Program of %lu bytes at offset %u targets memory which "
+                    "was not erased.",
+                    ( unsigned long ) length,
+                    offset ) );
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+FlashSimStatus_t FlashSim_Open( FlashSimContext_t * flash,
+                                const char * path,
+                                const FlashSimGeometry_t * geometry )
+{
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+    struct stat fileStat;
+    uint32_t partitionSize = 0U;
+    uint32_t pageCount = 0U;
+    uint32_t page = 0U;
+    uint32_t i = 0U;
+
+    if( ( flash == NULL ) || ( path == NULL ) || ( geometry == NULL ) ||
+        ( geometry->pageSize == 0U ) || ( geometry->sectorCount == 0U ) ||
+        ( geometry->sectorSize < geometry->pageSize ) ||
+        ( ( geometry->sectorSize % geometry->pageSize ) != 0U ) )
+    {
+        LogError( ( "Invalid flash partition parameters." ) );
+        status = FLASH_SIM_INVALID_PARAMETER;
+    }
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        memset( flash, 0x00, sizeof( FlashSimContext_t ) );
+        flash->geometry = *geometry;
+        partitionSize = geometry->sectorSize * geometry->sectorCount;
+        pageCount = partitionSize / geometry->pageSize;
+
+        flash->pageErased = ( uint8_t * ) calloc( pageCount,
+                                                  sizeof( uint8_t ) );
+        flash->pageBuffer = ( uint8_t * ) malloc( geometry->pageSize );
+        flash->fd = open( path, O_RDWR | O_CREAT, 0644 );
+
+        if( ( flash->pageErased == NULL ) || ( flash->pageBuffer == NULL ) ||
+            ( flash->fd < 0 ) || ( fstat( flash->fd, &fileStat ) != 0 ) )
+        {
+            LogError( ( "Failed to open flash partition %s.", path ) );
+            status = FLASH_SIM_IO_ERROR;
+        }
+    }
+
+    /* A new or short backing file is extended with erased memory. */
+    if( ( status == FLASH_SIM_SUCCESS ) &&
+        ( fileStat.st_size < ( off_t ) partitionSize ) )
+    {
+        if( !fillErased( flash,
+                         ( uint32_t ) fileStat.st_size,
+                         partitionSize - ( uint32_t ) fileStat.st_size ) )
+        {
+            status = FLASH_SIM_IO_ERROR;
+        }
+    }
+
+    /* Blank check every page to recover the erase state. */
+    for( page = 0U; ( status == FLASH_SIM_SUCCESS ) && ( page < pageCount );
+         page++ )
+    {
+        if( !readAll( flash->fd,
+                      flash->pageBuffer,
+                      geometry->pageSize,
+                      ( off_t ) page * geometry->pageSize ) )
+        {
+            status = FLASH_SIM_IO_ERROR;
+            break;
+        }
+
+        flash->pageErased[ page ] = 1U;
+
+        for( i = 0U; i < geometry->pageSize; i++ )
+        {
+            if( flash->pageBuffer[ i ] != FLASH_SIM_ERASED_BYTE )
+            {
+                flash->pageErased[ page ] = 0U;
+                break;
+            }
+        }
+    }
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        LogInfo( ( "Opened %u byte flash partition %s: %u B pages, %u B "
+                   "sectors.",
+                   partitionSize,
+                   path,
+                   geometry->pageSize,
+                   geometry->sectorSize ) );
+    }
+    else if( status == FLASH_SIM_IO_ERROR )
+    {
+        FlashSim_Close( flash );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return status;
+}
+
+void FlashSim_Close( FlashSimContext_t * flash )
+{
+    if( flash != NULL )
+    {
+        if( flash->fd >= 0 )
+        {
+            waitForDevice( flash );
+            ( void ) close( flash->fd );
+        }
+
+        free( flash->pageErased );
+        free( flash->pageBuffer );
+        flash->pageErased = NULL;
+        flash->pageBuffer = NULL;
+        flash->fd = -1;
+    }
+}
+
+FlashSimStatus_t FlashSim_StartErase( FlashSimContext_t * flash,
+                                      uint32_t sector )
+{
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+    uint32_t pagesPerSector = 0U;
+
+    assert( flash != NULL );
+
+    if( sector >= flash->geometry.sectorCount )
+    {
+        status = FLASH_SIM_INVALID_PARAMETER;
+    }
+    else if( FlashSim_IsBusy( flash ) )
+    {
+        status = FLASH_SIM_BUSY;
+    }
+    else
+    {
+        /* The previous operation is finished, so nothing is waited for. */
+        flash->eraseInProgress = false;
+    }
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        if( !fillErased( flash,
+                         sector * flash->geometry.sectorSize,
+                         flash->geometry.sectorSize ) )
+        {
+            status = FLASH_SIM_IO_ERROR;
+        }
+    }
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        pagesPerSector = flash->geometry.sectorSize / flash->geometry.pageSize;
+        memset( &flash->pageErased[ sector * pagesPerSector ],
+                1,
+                pagesPerSector );
+
+        flash->busyUntilUs = Clock_GetTimeUs() + flash->geometry.eraseTimeUs;
+        flash->eraseInProgress = true;
+        flash->stats.sectorErases++;
+        flash->stats.bytesErased += flash->geometry.sectorSize;
+        flash->stats.eraseTimeUs += flash->geometry.eraseTimeUs;
+    }
+
+    return status;
+}
+
+FlashSimStatus_t FlashSim_Erase( FlashSimContext_t * flash, uint32_t sector )
+{
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+
+    assert( flash != NULL );
+
+    waitForDevice( flash );
+    status = FlashSim_StartErase( flash, sector );
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        waitForDevice( flash );
+    }
+
+    return status;
+}
+
+FlashSimStatus_t FlashSim_StartProgram( FlashSimContext_t * flash,
+                                        uint32_t offset,
+                                        const uint8_t * data,
+                                        size_t length )
+{
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+    uint32_t firstPage = 0U;
+    uint32_t lastPage = 0U;
+    uint32_t pages = 0U;
+    uint64_t programTimeUs = 0U;
+
+    assert( flash != NULL );
+
+    if( ( data == NULL ) || ( length == 0U ) ||
+        ( ( ( uint64_t ) offset + length ) > FlashSim_GetSize( flash ) ) )
+    {
+        status = FLASH_SIM_INVALID_PARAMETER;
+    }
+    else
+    {
+        waitForDevice( flash );
+        status = checkProgram( flash, offset, data, length );
+    }
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        if( !writeAll( flash->fd, data, length, ( off_t ) offset ) )
+        {
+            status = FLASH_SIM_IO_ERROR;
+        }
+    }
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        firstPage = offset / flash->geometry.pageSize;
+        lastPage = ( uint32_t ) ( ( offset + length - 1U ) /
+                                  flash->geometry.pageSize );
+        pages = lastPage - firstPage + 1U;
+        memset( &flash->pageErased[ firstPage ], 0, pages );
+
+        programTimeUs = ( uint64_t ) pages * flash->geometry.programTimeUs;
+        flash->busyUntilUs = Clock_GetTimeUs() + programTimeUs;
+
+        flash->stats.bytesRequested += length;
+        flash->stats.bytesProgrammed += ( uint64_t ) pages *
+                                        flash->geometry.pageSize;
+        flash->stats.pagePrograms += pages;
+        flash->stats.programTimeUs += programTimeUs;
+    }
+
+    return status;
+}
+
+FlashSimStatus_t FlashSim_Program( FlashSimContext_t * flash,
+                                   uint32_t offset,
+                                   const uint8_t * data,
+                                   size_t length )
+{
+    FlashSimStatus_t status = FlashSim_StartProgram( flash,
+                                                     offset,
+                                                     data,
+                                                     length );
+
+    if( status == FLASH_SIM_SUCCESS )
+    {
+        waitForDevice( flash );
+    }
+
+    return status;
+}
+
+void FlashSim_WaitIdle( FlashSimContext_t * flash )
+{
+    assert( flash != NULL );
+
+    waitForDevice( flash );
+}
+
+FlashSimStatus_t FlashSim_Read( FlashSimContext_t * flash,
+                                uint32_t offset,
+                                uint8_t * data,
+                                size_t length )
+{
+    FlashSimStatus_t status = FLASH_SIM_SUCCESS;
+
+    assert( flash != NULL );
+
+    if( ( data == NULL ) ||
+        ( ( ( uint64_t ) offset + length ) > FlashSim_GetSize( flash ) ) )
+    {
+        status = FLASH_SIM_INVALID_PARAMETER;
+    }
+    else if( !readAll( flash->fd, data, length, ( off_t ) offset ) )
+    {
+        status = FLASH_SIM_IO_ERROR;
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return status;
+}
+
+bool FlashSim_IsBusy( const FlashSimContext_t * flash )
+{
+    assert( flash != NULL );
+
+    return Clock_GetTimeUs() < flash->busyUntilUs;
+}
+
+bool FlashSim_IsSectorErased( const FlashSimContext_t * flash,
+                              uint32_t sector )
+{
+    uint32_t pagesPerSector = 0U;
+    uint32_t page = 0U;
+    bool erased = true;
+
+    assert( flash != NULL );
+    assert( sector < flash->geometry.sectorCount );
+
+    pagesPerSector = flash->geometry.sectorSize / flash->geometry.pageSize;
+
+    for( page = sector * pagesPerSector;
+         erased && ( page < ( ( sector + 1U ) * pagesPerSector ) );
+         page++ )
+    {
+        erased = flash->pageErased[ page ] != 0U;
+    }
+
+    return erased;
+}
+
+uint32_t FlashSim_GetSize( const FlashSimContext_t * flash )
+{
+    assert( flash != NULL );
+
+    return flash->geometry.sectorSize * flash->geometry.sectorCount;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file flash_sim_posix.h
+ * @brief A file backed simulation of a NOR or NAND flash partition.
+ *
+ * The simulated device enforces the rules of real flash: data can only be
+ * programmed into erased memory, programming happens in pages and erasing
+ * happens in whole sectors. Erase and program operations take a configurable
+ * amount of time. They can run "in the background" like on a real flash
+ * controller, so a caller only pays for an operation when it has to wait for
+ * the device to become idle again.
+ */
+
+#ifndef FLASH_SIM_POSIX_H_
+#define FLASH_SIM_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Value of every byte of an erased flash page.
+ */
+#define FLASH_SIM_ERASED_BYTE 0xFFU
+
+/**
+ * @brief Geometry of a small serial NOR flash (4 KB sectors, 256 B pages).
+ *
+ * @param[in] sectors Number of sectors in the partition.
+ */
+#define FLASH_SIM_NOR_GEOMETRY( sectors )                                  \
+    {                                                                      \
+        .pageSize = 256U, .sectorSize = 4096U, .sectorCount = ( sectors ), \
+        .eraseTimeUs = 45000U, .programTimeUs = 700U,                      \
+        .singleProgramPerPage = false                                      \
+    }
+
+/**
+ * @brief Geometry of a small SLC NAND flash (128 KB blocks, 2 KB pages).
+ *
+ * @param[in] sectors Number of erase blocks in the partition.
+ */
+#define FLASH_SIM_NAND_GEOMETRY( sectors )                                   \
+    {                                                                        \
+        .pageSize = 2048U, .sectorSize = 131072U, .sectorCount = ( sectors ), \
+        .eraseTimeUs = 2000U, .programTimeUs = 250U,                         \
+        .singleProgramPerPage = true                                         \
+    }
+
+/**
+ * @brief Flash simulator return status.
+ */
+typedef enum FlashSimStatus
+{
+    FLASH_SIM_SUCCESS = 0,       /**< Function successfully completed. */
+    FLASH_SIM_INVALID_PARAMETER, /**< At least one parameter was invalid. */
+    FLASH_SIM_NOT_ERASED,        /**< Target memory was not erased before it
+                                    was programmed. */
+    FLASH_SIM_BUSY,     /**< The device is busy with another operation. */
+    FLASH_SIM_IO_ERROR  /**< Accessing the backing file failed. */
+} FlashSimStatus_t;
+
+/**
+ * @brief Physical layout and timing of the simulated device.
+ */
+typedef struct FlashSimGeometry
+{
+    uint32_t pageSize;      /**< @brief Size of the program unit in bytes. */
+    uint32_t sectorSize;    /**< @brief Size of the erase unit in bytes. */
+    uint32_t sectorCount;   /**< @brief Number of sectors in the partition. */
+    uint32_t eraseTimeUs;   /**< @brief Time to erase one sector. */
+    uint32_t programTimeUs; /**< @brief Time to program one page. */
+
+    /**
+     * @brief Set for NAND style devices where every page can be programmed
+     * only once between erases, and only as a whole.
+     *
+     * When cleared the device behaves like NOR flash: any byte range can be
+     * programmed as long as programming only clears bits.
+     */
+    bool singleProgramPerPage;
+} FlashSimGeometry_t;
+
+/**
+ * @brief Counters describing the work done by the simulated device.
+ */
+typedef struct FlashSimStats
+{
+    uint64_t bytesRequested;  /**< @brief Bytes handed to #FlashSim_Program. */
+    uint64_t bytesProgrammed; /**< @brief Bytes of all pages programmed. */
+    uint64_t bytesErased;     /**< @brief Bytes of all sectors erased. */
+    uint32_t pagePrograms;    /**< @brief Number of page program operations. */
+    uint32_t sectorErases;    /**< @brief Number of sector erase operations. */
+    uint64_t programTimeUs;   /**< @brief Device time spent programming. */
+    uint64_t eraseTimeUs;     /**< @brief Device time spent erasing. */
+    uint64_t eraseStallUs;    /**< @brief Time callers spent waiting for an
+                                 erase to finish. */
+} FlashSimStats_t;
+
+/**
+ * @brief State of one simulated flash partition.
+ */
+typedef struct FlashSimContext
+{
+    int fd;                      /**< @brief Descriptor of the backing file. */
+    FlashSimGeometry_t geometry; /**< @brief Layout of the partition. */
+    uint8_t * pageErased;        /**< @brief Per page erased flag. */
+    uint8_t * pageBuffer;        /**< @brief Scratch buffer of one page. */
+    uint64_t busyUntilUs;        /**< @brief End of the running operation. */
+    bool eraseInProgress;        /**< @brief Running operation is an erase. */
+    FlashSimStats_t stats;       /**< @brief Work counters. */
+} FlashSimContext_t;
+
+/**
+ * @brief Open, and create if needed, a file backed flash partition.
+ *
+ * A newly created partition starts fully erased. When an existing file is
+ * opened, every page which is not blank is considered programmed.
+ *
+ * @param[out] flash Context to initialize.
+ * @param[in] path Path of the backing file.
+ * @param[in] geometry Layout and timing of the simulated device.
+ *
+ * @return #FLASH_SIM_SUCCESS on success; #FLASH_SIM_INVALID_PARAMETER or
+ * #FLASH_SIM_IO_ERROR on failure.
+ */
+FlashSimStatus_t FlashSim_Open( FlashSimContext_t * flash,
+                                const char * path,
+                                const FlashSimGeometry_t * geometry );
+
+/**
+ * @brief Wait for the device to become idle and close the backing file.
+ *
+ * @param[in] flash Context to close.
+ */
+void FlashSim_Close( FlashSimContext_t * flash );
+
+/**
+ * @brief Start erasing a sector without waiting for the erase to finish.
+ *
+ * @param[in] flash Flash partition.
+ * @param[in] sector Index of the sector to erase.
+ *
+ * @return #FLASH_SIM_SUCCESS when the erase was started; #FLASH_SIM_BUSY when
+ * the device is still executing another operation.
+ */
+FlashSimStatus_t FlashSim_StartErase( FlashSimContext_t * flash,
+                                      uint32_t sector );
+
+/**
+ * @brief Erase a sector and wait for the erase to finish.
+ *
+ * @param[in] flash Flash partition.
+ * @param[in] sector Index of the sector to erase.
+ *
+ * @return #FLASH_SIM_SUCCESS on success; #FLASH_SIM_INVALID_PARAMETER or
+ * #FLASH_SIM_IO_ERROR on failure.
+ */
+FlashSimStatus_t FlashSim_Erase( FlashSimContext_t * flash, uint32_t sector );
+
+/**
+ * @brief Start programming data into erased flash.
+ *
+ * Waits for the previous operation to finish, then hands the data to the
+ * device and returns while the device is still programming it. The caller
+ * must not reuse the buffer of the data until the device is idle again, as
+ * it would with a DMA transfer.
+ *
+ * On NAND style devices the offset and length must be page aligned.
+ *
+ * @param[in] flash Flash partition.
+ * @param[in] offset Byte offset of the data in the partition.
+ * @param[in] data Data to program.
+ * @param[in] length Length of the data.
+ *
+ * @return #FLASH_SIM_SUCCESS on success; #FLASH_SIM_NOT_ERASED when the target
+ * memory was not erased; #FLASH_SIM_INVALID_PARAMETER or #FLASH_SIM_IO_ERROR on
+ * other failures.
+ */
+FlashSimStatus_t FlashSim_StartProgram( FlashSimContext_t * flash,
+                                        uint32_t offset,
+                                        const uint8_t * data,
+                                        size_t length );
+
+/**
+ * @brief Program data into erased flash and wait for it to finish.
+ *
+ * Same as #FlashSim_StartProgram followed by #FlashSim_WaitIdle.
+ *
+ * @param[in] flash Flash partition.
+ * @param[in] offset Byte offset of the data in the partition.
+ * @param[in] data Data to program.
+ * @param[in] length Length of the data.
+ *
+ * @return See #FlashSim_StartProgram.
+ */
+FlashSimStatus_t FlashSim_Program( FlashSimContext_t * flash,
+                                   uint32_t offset,
+                                   const uint8_t * data,
+                                   size_t length );
+
+/**
+ * @brief Wait until the running erase or program operation has finished.
+ *
+ * @param[in] flash Flash partition.
+ */
+void FlashSim_WaitIdle( FlashSimContext_t * flash );
+
+/**
+ * @brief Read data from the partition.
+ *
+ * @param[in] flash Flash partition.
+ * @param[in] offset Byte offset of the data in the partition.
+ * @param[out] data Buffer to read into.
+ * @param[in] length Number of bytes to read.
+ *
+ * @return #FLASH_SIM_SUCCESS on success; #FLASH_SIM_INVALID_PARAMETER or
+ * #FLASH_SIM_IO_ERROR on failure.
+ */
+FlashSimStatus_t FlashSim_Read( FlashSimContext_t * flash,
+                                uint32_t offset,
+                                uint8_t * data,
+                                size_t length );
+
+/**
+ * @brief Check if the device is still executing an operation.
+ *
+ * @param[in] flash Flash partition.
+ *
+ * @return true while an erase or program operation is running.
+ */
+bool FlashSim_IsBusy( const FlashSimContext_t * flash );
+
+/**
+ * @brief Check if every page of a sector is erased.
+ *
+ * @param[in] flash Flash partition.
+ * @param[in] sector Index of the sector.
+ *
+ * @return true if the sector can be programmed without erasing it first.
+ */
+bool FlashSim_IsSectorErased( const FlashSimContext_t * flash,
+                              uint32_t sector );
+
+/**
+ * @brief Size of the partition in bytes.
+ *
+ * @param[in] flash Flash partition.
+ *
+ * @return Number of bytes in the partition.
+ */
+uint32_t FlashSim_GetSize( const FlashSimContext_t * flash );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef FLASH_SIM_POSIX_H_ */
@@ -0,0 +1,258 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file image_handoff_posix.c
+ * @brief Implementation of the image handoff for Linux.
+ */
+
+/* memfd_create() and file seals are GNU extensions. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#define LIBRARY_LOG_NAME  "ImageHandoff"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "image_handoff_posix.h"
+#include "utils/clock.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Name of the memory file, shown in /proc/<pid>/fd.
+ */
+#define MEMFD_NAME          "ota-image"
+
+/**
+ * @brief Directory of the unsealed fallback file.
+ */
+#define FALLBACK_DIRECTORY  "/dev/shm"
+
+/**
+ * @brief Seals protecting the image from any change.
+ */
+#define IMAGE_SEALS         ( F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Connect to the installer.
+ *
+ * @return Socket descriptor, or -1.
+ */
+static int connectInstaller( const char * socketPath );
+
+/**
+ * @brief Create a memory file holding a copy of the image.
+ *
+ * @return File descriptor, or -1.
+ */
+static int createImageFile( int imageFd,
+                            uint32_t imageSize,
+                            ImageHandoffStats_t * stats );
+
+/**
+ * @brief Send the image file and wait for the answer of the installer.
+ *
+ * @return true if the installer accepted the image.
+ */
+static bool sendImageFile( int socketFd,
+                           int memFd,
+                           uint32_t imageSize,
+                           bool sealed );
+
+/*-----------------------------------------------------------*/
+
+static int connectInstaller( const char * socketPath )
+{
+    struct sockaddr_un address;
+    struct timeval timeout = { 0 };
+    int socketFd = -1;
+
+    memset( &address, 0x00, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+
+    if( strlen( socketPath ) < sizeof( address.sun_path ) )
+    {
+        strncpy( address.sun_path, socketPath, sizeof( address.sun_path ) - 1U );
+        socketFd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    }
+
+    if( socketFd >= 0 )
+    {
+        /* A stuck installer must not hold up the agent. */
+        timeout.tv_sec = IMAGE_HANDOFF_TIMEOUT_MS / 1000U;
+        timeout.tv_usec = ( IMAGE_HANDOFF_TIMEOUT_MS % 1000U ) * 1000U;
+        ( void ) setsockopt( socketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+        ( void ) setsockopt( socketFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+
+        if( connect( socketFd, ( struct sockaddr * ) &address, sizeof( address ) ) != 0 )
+        {
+            ( void ) close( socketFd );
+            socketFd = -1;
+        }
+    }
+
+    return socketFd;
+}
+
+static int createImageFile( int imageFd,
+                            uint32_t imageSize,
+                            ImageHandoffStats_t * stats )
+{
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    off_t offset = 0;
+    ssize_t copied = 0;
+    int memFd = memfd_create( MEMFD_NAME, MFD_CLOEXEC | MFD_ALLOW_SEALING );
+
+    if( memFd < 0 )
+    {
+        LogWarn( ( "memfd_create failed, errno=%d. The image is passed unsealed.", errno ) );
+        memFd = open( FALLBACK_DIRECTORY, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 );
+    }
+
+    /* sendfile copies the image from the page cache in the kernel. */
+    while( ( memFd >= 0 ) && ( offset < ( off_t ) imageSize ) )
+    {
+        copied = sendfile( memFd, imageFd, &offset, imageSize - ( size_t ) offset );
+
+        if( ( copied == 0 ) || ( ( copied < 0 ) && ( errno != EINTR ) ) )
+        {
+            LogError( ( "Failed to copy the image: errno=%d.", errno ) );
+            ( void ) close( memFd );
+            memFd = -1;
+        }
+    }
+
+    stats->fillTimeUs = Clock_GetTimeUs() - startTimeUs;
+
+    if( memFd >= 0 )
+    {
+        startTimeUs = Clock_GetTimeUs();
+        stats->sealed = fcntl( memFd, F_ADD_SEALS, IMAGE_SEALS ) == 0;
+        stats->sealTimeUs = Clock_GetTimeUs() - startTimeUs;
+    }
+
+    return memFd;
+}
+
+static bool sendImageFile( int socketFd,
+                           int memFd,
+                           uint32_t imageSize,
+                           bool sealed )
+{
+    ImageHandoffMessage_t message = {
+        .magic = IMAGE_HANDOFF_MAGIC,
+        .imageSize = imageSize,
+        .seals = sealed ? IMAGE_SEALS : 0U
+    };
+    union
+    {
+        char buffer[ CMSG_SPACE( sizeof( int ) ) ];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = &message, .iov_len = sizeof( message ) };
+    struct msghdr header;
+    struct cmsghdr * cmsg = NULL;
+    uint8_t answer = 0xFFU;
+
+    memset( &control, 0x00, sizeof( control ) );
+    memset( &header, 0x00, sizeof( header ) );
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1U;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof( control.buffer );
+
+    cmsg = CMSG_FIRSTHDR( &header );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+    memcpy( CMSG_DATA( cmsg ), &memFd, sizeof( int ) );
+
+    return ( sendmsg( socketFd, &header, MSG_NOSIGNAL ) == ( ssize_t ) sizeof( message ) ) &&
+           ( recv( socketFd, &answer, sizeof( answer ), 0 ) == ( ssize_t ) sizeof( answer ) ) &&
+           ( answer == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+bool ImageHandoff_Send( const char * socketPath,
+                        const char * imagePath,
+                        uint32_t imageSize,
+                        ImageHandoffStats_t * stats )
+{
+    uint64_t startTimeUs = 0U;
+    bool accepted = false;
+    int socketFd = -1;
+    int imageFd = -1;
+    int memFd = -1;
+
+    assert( socketPath != NULL );
+    assert( imagePath != NULL );
+    assert( stats != NULL );
+
+    memset( stats, 0x00, sizeof( ImageHandoffStats_t ) );
+
+    /* Connect first so nothing is copied when there is no installer. */
+    startTimeUs = Clock_GetTimeUs();
+    socketFd = connectInstaller( socketPath );
+    stats->sendTimeUs = Clock_GetTimeUs() - startTimeUs;
+
+    if( socketFd < 0 )
+    {
+        LogInfo( ( "No installer listening on %s.", socketPath ) );
+    }
+    else
+    {
+        imageFd = open( imagePath, O_RDONLY | O_CLOEXEC );
+    }
+
+    if( imageFd >= 0 )
+    {
+        memFd = createImageFile( imageFd, imageSize, stats );
+        ( void ) close( imageFd );
+    }
+
+    if( memFd >= 0 )
+    {
+        startTimeUs = Clock_GetTimeUs();
+        accepted = sendImageFile( socketFd, memFd, imageSize, stats->sealed );
+        stats->sendTimeUs += Clock_GetTimeUs() - startTimeUs;
+
+        /* The installer holds its own reference now. */
+        ( void ) close( memFd );
+
+        if( !accepted )
+        {
+            LogError( ( "The installer did not accept the image: errno=%d.", errno ) );
+        }
+    }
+
+    if( socketFd >= 0 )
+    {
+        ( void ) close( socketFd );
+    }
+
+    return accepted;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file image_handoff_posix.h
+ * @brief Passes a downloaded image to an installer process without copying
+ * it through user space.
+ *
+ * The image is copied in the kernel into an anonymous memory file created
+ * with memfd_create. The file is then sealed against writes, resizing and
+ * further seal changes, and its descriptor is sent to the installer over a
+ * UNIX domain socket with SCM_RIGHTS. The installer can mmap the sealed file
+ * read-only and trust that its contents no longer change.
+ *
+ * Where memfd_create is not available, an unnamed file on /dev/shm is used
+ * instead. It cannot be sealed; the installer can tell from the seals field
+ * of the message.
+ *
+ * Protocol, over a SOCK_SEQPACKET socket: the agent sends one
+ * #ImageHandoffMessage_t carrying the descriptor, the installer answers with
+ * one byte, zero if it accepted the image.
+ */
+
+#ifndef IMAGE_HANDOFF_POSIX_H_
+#define IMAGE_HANDOFF_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Value of #ImageHandoffMessage_t.magic.
+ */
+#define IMAGE_HANDOFF_MAGIC      0x4F544148U /* "OTAH" */
+
+/**
+ * @brief Time the installer gets to accept or answer, in milliseconds.
+ */
+#define IMAGE_HANDOFF_TIMEOUT_MS 1000U
+
+/**
+ * @brief Message sent along with the image descriptor.
+ */
+typedef struct ImageHandoffMessage
+{
+    uint32_t magic;     /**< @brief #IMAGE_HANDOFF_MAGIC. */
+    uint32_t imageSize; /**< @brief Size of the image. */
+    uint32_t seals;     /**< @brief Seals applied to the file, F_SEAL_*
+                           flags; zero for an unsealed file. */
+} ImageHandoffMessage_t;
+
+/**
+ * @brief Cost of handing an image over.
+ */
+typedef struct ImageHandoffStats
+{
+    uint64_t fillTimeUs; /**< @brief Time spent copying the image. */
+    uint64_t sealTimeUs; /**< @brief Time spent sealing the file. */
+    uint64_t sendTimeUs; /**< @brief Time from connecting to the installer
+                            until it answered. */
+    bool sealed;         /**< @brief The file was sealed. */
+} ImageHandoffStats_t;
+
+/**
+ * @brief Hand an image over to the installer.
+ *
+ * Nothing is copied when no installer listens on the socket.
+ *
+ * @param[in] socketPath Path of the UNIX socket of the installer.
+ * @param[in] imagePath File holding the image.
+ * @param[in] imageSize Size of the image.
+ * @param[out] stats Cost of the handoff.
+ *
+ * @return true if the installer accepted the image.
+ */
+bool ImageHandoff_Send( const char * socketPath,
+                        const char * imagePath,
+                        uint32_t imageSize,
+                        ImageHandoffStats_t * stats );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef IMAGE_HANDOFF_POSIX_H_ */
@@ -0,0 +1,397 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file image_slots_posix.c
+ * @brief Implementation of the A/B image slots for POSIX systems.
+ */
+
+#define LIBRARY_LOG_NAME  "ImageSlots"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "image_slots_posix.h"
+#include "utils/atomic_file_posix.h"
+#include "utils/crc32.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Value of #ImageSlotsRecord_t.magic.
+ */
+#define IMAGE_SLOTS_MAGIC          0x4F544153U /* "OTAS" */
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief CRC-32 over all fields of a record except the CRC itself.
+ */
+static uint32_t recordCrc( const ImageSlotsRecord_t * record );
+
+/**
+ * @brief Read the record from disk.
+ *
+ * @return true if a valid record was read.
+ */
+static bool loadRecord( ImageSlotsContext_t * slots );
+
+/**
+ * @brief Atomically replace the record on disk.
+ *
+ * The in-memory record is only updated on success.
+ *
+ * @param[in] slots Slot manager.
+ * @param[in] record New record.
+ *
+ * @return true on success.
+ */
+static bool commitRecord( ImageSlotsContext_t * slots,
+                          const ImageSlotsRecord_t * record );
+
+/**
+ * @brief Sync the contents of a file.
+ *
+ * @return true on success.
+ */
+static bool syncFile( const char * path );
+
+/*-----------------------------------------------------------*/
+
+static uint32_t recordCrc( const ImageSlotsRecord_t * record )
+{
+    return Crc32_Update( 0U, record, offsetof( ImageSlotsRecord_t, crc ) );
+}
+
+static bool loadRecord( ImageSlotsContext_t * slots )
+{
+    ImageSlotsRecord_t record = { 0 };
+    ssize_t bytesRead = 0;
+    bool valid = false;
+    int fd = -1;
+
+    fd = open( slots->metadataPath, O_RDONLY );
+
+    if( fd >= 0 )
+    {
+        bytesRead = read( fd, &record, sizeof( record ) );
+        ( void ) close( fd );
+
+        valid = ( bytesRead == ( ssize_t ) sizeof( record ) ) &&
+                ( record.magic == IMAGE_SLOTS_MAGIC ) &&
+                ( record.crc == recordCrc( &record ) ) &&
+                ( record.activeSlot < IMAGE_SLOT_COUNT ) &&
+                ( record.previousSlot < IMAGE_SLOT_COUNT ) &&
+                ( record.state <= ( uint32_t ) IMAGE_SLOTS_ROLLED_BACK );
+
+        if( valid )
+        {
+            slots->record = record;
+        }
+        else
+        {
+            LogWarn( ( "Ignoring corrupt slot metadata in %s.",
+                       slots->metadataPath ) );
+        }
+    }
+    else if( errno != ENOENT )
+    {
+        LogError( ( "Failed to open slot metadata %s: errno=%d.",
+                    slots->metadataPath,
+                    errno ) );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return valid;
+}
+
+static bool syncFile( const char * path )
+{
+    bool success = false;
+    int fd = open( path, O_RDWR );
+
+    if( fd >= 0 )
+    {
+        success = fsync( fd ) == 0;
+        ( void ) close( fd );
+    }
+
+    return success;
+}
+
+static bool commitRecord( ImageSlotsContext_t * slots,
+                          const ImageSlotsRecord_t * record )
+{
+    ImageSlotsRecord_t newRecord = *record;
+    bool success = true;
+
+    newRecord.magic = IMAGE_SLOTS_MAGIC;
+    newRecord.sequence = slots->record.sequence + 1U;
+    newRecord.crc = recordCrc( &newRecord );
+
+    success = AtomicFile_Write( slots->metadataPath,
+                                &newRecord,
+                                sizeof( newRecord ) );
+
+    if( success )
+    {
+        slots->record = newRecord;
+    }
+    else
+    {
+        LogError( ( "Failed to write slot metadata %s: errno=%d.",
+                    slots->metadataPath,
+                    errno ) );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+bool ImageSlots_Open( ImageSlotsContext_t * slots,
+                      const char * metadataPath,
+                      const char * slotPathA,
+                      const char * slotPathB )
+{
+    ImageSlotsRecord_t record = { 0 };
+    bool success = true;
+
+    assert( slots != NULL );
+    assert( metadataPath != NULL );
+    assert( slotPathA != NULL );
+    assert( slotPathB != NULL );
+
+    memset( slots, 0x00, sizeof( ImageSlotsContext_t ) );
+    slots->metadataPath = metadataPath;
+    slots->slotPaths[ 0 ] = slotPathA;
+    slots->slotPaths[ 1 ] = slotPathB;
+
+    if( !loadRecord( slots ) )
+    {
+        LogInfo( ( "Creating slot metadata %s.", metadataPath ) );
+        success = commitRecord( slots, &record );
+    }
+    else if( slots->record.state == ( uint32_t ) IMAGE_SLOTS_PENDING )
+    {
+        record = slots->record;
+
+        if( record.bootAttempts >= IMAGE_SLOTS_MAX_BOOT_ATTEMPTS )
+        {
+            LogWarn( ( "Image in slot %c was not confirmed after %u boots.",
+                       'A' + record.activeSlot,
+                       record.bootAttempts ) );
+            success = ImageSlots_Rollback( slots );
+        }
+        else
+        {
+            record.bootAttempts++;
+            success = commitRecord( slots, &record );
+        }
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    if( success )
+    {
+        LogInfo( ( "Active slot %c, state %u, sequence %u.",
+                   'A' + slots->record.activeSlot,
+                   slots->record.state,
+                   slots->record.sequence ) );
+    }
+
+    return success;
+}
+
+bool ImageSlots_BeginUpdate( ImageSlotsContext_t * slots )
+{
+    ImageSlotsRecord_t record = { 0 };
+    uint32_t inactiveSlot = 0U;
+    bool success = true;
+
+    assert( slots != NULL );
+
+    record = slots->record;
+    inactiveSlot = 1U - record.activeSlot;
+
+    if( ( record.state == ( uint32_t ) IMAGE_SLOTS_PENDING ) &&
+        ( record.bootAttempts == 0U ) )
+    {
+        /* The pending image was installed by this process and never ran.
+         * The previous image is still running, so the new image replaces
+         * the pending one instead. */
+        LogInfo( ( "Superseding the image in slot %c, it was never booted.",
+                   'A' + record.activeSlot ) );
+        record.imageSize[ record.activeSlot ] = 0U;
+        inactiveSlot = record.activeSlot;
+        record.activeSlot = record.previousSlot;
+        record.state = ( uint32_t ) IMAGE_SLOTS_CONFIRMED;
+        success = commitRecord( slots, &record );
+    }
+    else if( record.state == ( uint32_t ) IMAGE_SLOTS_PENDING )
+    {
+        LogError( ( "Refusing to overwrite slot %c while the image in slot %c "
+                    "is not confirmed.",
+                    'A' + inactiveSlot,
+                    'A' + record.activeSlot ) );
+        success = false;
+    }
+    else if( record.imageSize[ inactiveSlot ] != 0U )
+    {
+        /* Once writing starts, the slot no longer holds a usable image. */
+        record.imageSize[ inactiveSlot ] = 0U;
+        success = commitRecord( slots, &record );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return success;
+}
+
+const char * ImageSlots_GetUpdatePath( const ImageSlotsContext_t * slots )
+{
+    assert( slots != NULL );
+
+    return slots->slotPaths[ 1U - slots->record.activeSlot ];
+}
+
+const char * ImageSlots_GetActivePath( const ImageSlotsContext_t * slots )
+{
+    assert( slots != NULL );
+
+    return slots->slotPaths[ slots->record.activeSlot ];
+}
+
+uint32_t ImageSlots_GetActiveImageSize( const ImageSlotsContext_t * slots )
+{
+    assert( slots != NULL );
+
+    return slots->record.imageSize[ slots->record.activeSlot ];
+}
+
+bool ImageSlots_Activate( ImageSlotsContext_t * slots,
+                          uint32_t imageSize )
+{
+    ImageSlotsRecord_t record = { 0 };
+    uint32_t newSlot = 0U;
+    bool success = true;
+
+    assert( slots != NULL );
+
+    record = slots->record;
+    newSlot = 1U - record.activeSlot;
+
+    /* The image must be on disk before the record points at it. */
+    if( !syncFile( slots->slotPaths[ newSlot ] ) )
+    {
+        LogError( ( "Failed to sync slot %s.", slots->slotPaths[ newSlot ] ) );
+        success = false;
+    }
+
+    if( success )
+    {
+        record.previousSlot = record.activeSlot;
+        record.activeSlot = newSlot;
+        record.state = ( uint32_t ) IMAGE_SLOTS_PENDING;
+        record.bootAttempts = 0U;
+        record.imageSize[ newSlot ] = imageSize;
+
+        success = commitRecord( slots, &record );
+    }
+
+    if( success )
+    {
+        LogInfo( ( "Activated %u byte image in slot %c.",
+                   imageSize,
+                   'A' + newSlot ) );
+    }
+
+    return success;
+}
+
+bool ImageSlots_Confirm( ImageSlotsContext_t * slots )
+{
+    ImageSlotsRecord_t record = { 0 };
+    bool success = true;
+
+    assert( slots != NULL );
+
+    if( slots->record.state != ( uint32_t ) IMAGE_SLOTS_CONFIRMED )
+    {
+        record = slots->record;
+        record.state = ( uint32_t ) IMAGE_SLOTS_CONFIRMED;
+        record.bootAttempts = 0U;
+        success = commitRecord( slots, &record );
+    }
+
+    return success;
+}
+
+bool ImageSlots_Rollback( ImageSlotsContext_t * slots )
+{
+    ImageSlotsRecord_t record = { 0 };
+    bool success = true;
+
+    assert( slots != NULL );
+
+    record = slots->record;
+
+    /* While an image is pending, the previous slot still holds the image
+     * that ran before it. */
+    if( record.state != ( uint32_t ) IMAGE_SLOTS_PENDING )
+    {
+        LogError( ( "No image to roll back to." ) );
+        success = false;
+    }
+    else
+    {
+        LogWarn( ( "Rolling back from slot %c to slot %c.",
+                   'A' + record.activeSlot,
+                   'A' + record.previousSlot ) );
+
+        /* The rejected image stays in its slot, but is not used again. */
+        record.imageSize[ record.activeSlot ] = 0U;
+        record.activeSlot = record.previousSlot;
+        record.state = ( uint32_t ) IMAGE_SLOTS_ROLLED_BACK;
+        record.bootAttempts = 0U;
+        success = commitRecord( slots, &record );
+    }
+
+    return success;
+}
+
+uint32_t ImageSlots_GetActiveSlot( const ImageSlotsContext_t * slots )
+{
+    assert( slots != NULL );
+
+    return slots->record.activeSlot;
+}
+
+ImageSlotsState_t ImageSlots_GetState( const ImageSlotsContext_t * slots )
+{
+    assert( slots != NULL );
+
+    return ( ImageSlotsState_t ) slots->record.state;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file image_slots_posix.h
+ * @brief A/B image slots on file backed storage.
+ *
+ * Two slots hold firmware images. The active slot holds the running image, a
+ * new image is downloaded straight into the inactive one. Installing the new
+ * image only rewrites a small metadata record, so it takes the same time for
+ * any image size. The record is replaced atomically: the new version is
+ * written to a temporary file, synced, and renamed over the old one.
+ *
+ * A newly installed image is on trial until it is confirmed. Each start of
+ * the process counts as a boot; if the image is not confirmed within
+ * #IMAGE_SLOTS_MAX_BOOT_ATTEMPTS boots, the previous image is made active
+ * again.
+ */
+
+#ifndef IMAGE_SLOTS_POSIX_H_
+#define IMAGE_SLOTS_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of image slots.
+ */
+#define IMAGE_SLOT_COUNT              2U
+
+/**
+ * @brief Boots a new image gets to confirm itself before it is rolled back.
+ */
+#define IMAGE_SLOTS_MAX_BOOT_ATTEMPTS 3U
+
+/**
+ * @brief State of the active slot.
+ */
+typedef enum ImageSlotsState
+{
+    IMAGE_SLOTS_CONFIRMED = 0, /**< The active image is trusted. */
+    IMAGE_SLOTS_PENDING,       /**< The active image was just installed and
+                                  has not been confirmed yet. */
+    IMAGE_SLOTS_ROLLED_BACK    /**< The last installed image was never
+                                  confirmed; the previous one is active. */
+} ImageSlotsState_t;
+
+/**
+ * @brief Metadata record describing the slots, as stored on disk.
+ */
+typedef struct ImageSlotsRecord
+{
+    uint32_t magic;        /**< @brief Identifies a slot metadata record. */
+    uint32_t sequence;     /**< @brief Incremented on every update. */
+    uint32_t activeSlot;   /**< @brief Slot holding the image to boot. */
+    uint32_t previousSlot; /**< @brief Slot to roll back to. */
+    uint32_t state;        /**< @brief One of #ImageSlotsState_t. */
+    uint32_t bootAttempts; /**< @brief Boots of a pending image so far. */
+
+    /**
+     * @brief Size of the image in each slot, zero when the slot does not
+     * hold a complete image.
+     */
+    uint32_t imageSize[ IMAGE_SLOT_COUNT ];
+    uint32_t crc;          /**< @brief CRC-32 of all fields above. */
+} ImageSlotsRecord_t;
+
+/**
+ * @brief State of the slot manager.
+ */
+typedef struct ImageSlotsContext
+{
+    const char * metadataPath;                  /**< @brief Record file. */
+    const char * slotPaths[ IMAGE_SLOT_COUNT ]; /**< @brief Slot files. */
+    ImageSlotsRecord_t record;                  /**< @brief Current record. */
+} ImageSlotsContext_t;
+
+/**
+ * @brief Load the slot metadata and account for a boot.
+ *
+ * A missing or corrupt record is replaced by one with an empty, confirmed
+ * slot A. When the active image is pending and has used up its boot
+ * attempts, the previous image is made active again.
+ *
+ * The paths are referenced, not copied, and must stay valid.
+ *
+ * @param[out] slots Context to initialize.
+ * @param[in] metadataPath Path of the metadata record.
+ * @param[in] slotPathA Path of the file backing slot A.
+ * @param[in] slotPathB Path of the file backing slot B.
+ *
+ * @return true on success; false if the record could not be written.
+ */
+bool ImageSlots_Open( ImageSlotsContext_t * slots,
+                      const char * metadataPath,
+                      const char * slotPathA,
+                      const char * slotPathB );
+
+/**
+ * @brief Prepare the inactive slot to receive a new image.
+ *
+ * The slot is marked as not holding an image before it is overwritten. This
+ * is refused while the active image is pending, because the inactive slot
+ * then holds the image to roll back to. A pending image which was installed
+ * since the last boot never ran; it is dropped and its slot is reused.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return true if the inactive slot can be written.
+ */
+bool ImageSlots_BeginUpdate( ImageSlotsContext_t * slots );
+
+/**
+ * @brief Path of the file backing the inactive slot.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return Path new images are written to.
+ */
+const char * ImageSlots_GetUpdatePath( const ImageSlotsContext_t * slots );
+
+/**
+ * @brief Path of the file backing the active slot.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return Path of the running image.
+ */
+const char * ImageSlots_GetActivePath( const ImageSlotsContext_t * slots );
+
+/**
+ * @brief Size of the image in the active slot.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return Size of the running image, zero if it was not installed through
+ * the slot manager.
+ */
+uint32_t ImageSlots_GetActiveImageSize( const ImageSlotsContext_t * slots );
+
+/**
+ * @brief Make the image in the inactive slot the active one.
+ *
+ * The slot file is synced first, then the metadata record is switched. The
+ * new image stays pending until #ImageSlots_Confirm is called.
+ *
+ * @param[in] slots Slot manager.
+ * @param[in] imageSize Size of the image written to the inactive slot.
+ *
+ * @return true on success; false if the record could not be written, in which
+ * case the previous image stays active.
+ */
+bool ImageSlots_Activate( ImageSlotsContext_t * slots,
+                          uint32_t imageSize );
+
+/**
+ * @brief Mark a pending image as good, which ends its trial.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return true on success or if there was nothing to confirm.
+ */
+bool ImageSlots_Confirm( ImageSlotsContext_t * slots );
+
+/**
+ * @brief Reject a pending image and make the previous one active again.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return true on success; false if no image is pending or the record could
+ * not be written.
+ */
+bool ImageSlots_Rollback( ImageSlotsContext_t * slots );
+
+/**
+ * @brief Index of the active slot.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return 0 for slot A, 1 for slot B.
+ */
+uint32_t ImageSlots_GetActiveSlot( const ImageSlotsContext_t * slots );
+
+/**
+ * @brief State of the active slot.
+ *
+ * @param[in] slots Slot manager.
+ *
+ * @return See #ImageSlotsState_t.
+ */
+ImageSlotsState_t ImageSlots_GetState( const ImageSlotsContext_t * slots );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef IMAGE_SLOTS_POSIX_H_ */
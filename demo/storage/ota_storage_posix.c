@@ -0,0 +1,770 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file ota_storage_posix.c
+ * @brief Implementation of the OTA image storage pipeline.
+ */
+
+#define LIBRARY_LOG_NAME  "OtaStorage"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_storage_posix.h"
+#include "utils/clock.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Set to 1 to log the performance figures of the pipeline.
+ */
+#ifndef OTA_DEMO_STATS
+    #define OTA_DEMO_STATS    0
+#endif
+
+/**
+ * @brief LogInfo for a performance figure, it logs nothing unless
+ * OTA_DEMO_STATS is set.
+ */
+#define LogStats( message )     \
+    do {                        \
+        if( OTA_DEMO_STATS )    \
+        {                       \
+            LogInfo( message ); \
+        }                       \
+    } while( 0 )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Start programming a write unit into the partition. The flash keeps
+ * programming in the background while the next unit is filled.
+ */
+static bool programPartition( void * sinkContext,
+                              uint32_t offset,
+                              const uint8_t * data,
+                              size_t length );
+
+/**
+ * @brief Wait for the partition to finish programming.
+ */
+static void waitForPartition( void * sinkContext );
+
+/**
+ * @brief Open the partition, its erase scheduling, write coalescer and
+ * resume journal.
+ */
+static bool openPartition( OtaStorageContext_t * storage,
+                           const char * jobId,
+                           size_t jobIdLength );
+
+/**
+ * @brief Replay the journal of an interrupted download of the same job and
+ * image, so only the blocks which are not stored yet get requested.
+ */
+static void openResumeJournal( OtaStorageContext_t * storage,
+                               const char * jobId,
+                               size_t jobIdLength );
+
+/**
+ * @brief Clone the running image into the update slot and report every
+ * block whose digest matches the new image.
+ */
+static bool openSparseInstall( OtaStorageContext_t * storage );
+
+/**
+ * @brief Take every block still needed whose digest is in the chunk store
+ * from there instead of the network.
+ */
+static void loadBlocksFromChunkStore( OtaStorageContext_t * storage );
+
+/**
+ * @brief Flush and close the partition.
+ */
+static void closePartition( OtaStorageContext_t * storage );
+
+/**
+ * @brief Close the sparse install.
+ */
+static void closeSparseInstall( OtaStorageContext_t * storage );
+
+/**
+ * @brief Get the length of a block of the current image.
+ */
+static uint32_t getBlockLength( const OtaStorageContext_t * storage,
+                                uint32_t blockId );
+
+/*-----------------------------------------------------------*/
+
+static bool programPartition( void * sinkContext,
+                              uint32_t offset,
+                              const uint8_t * data,
+                              size_t length )
+{
+    OtaStorageContext_t * storage = ( OtaStorageContext_t * ) sinkContext;
+    uint32_t blockSize = storage->config.blockSize;
+    uint32_t end = ( ( offset + length ) < storage->imageSize ) ? offset + length : storage->imageSize;
+    bool programmed = EraseAhead_PrepareRange( &storage->eraseAhead, offset, length ) &&
+                      ( FlashSim_StartProgram( &storage->partition, offset, data, length ) == FLASH_SIM_SUCCESS );
+
+    /* Losing the journal only costs the ability to resume. */
+    if( programmed && storage->resumeJournalReady &&
+        !ResumeJournal_RecordBlocks( &storage->resumeJournal,
+                                     offset / blockSize,
+                                     ( end - offset + blockSize - 1U ) / blockSize ) )
+    {
+        LogError( ( "Failed to write the resume journal." ) );
+        ResumeJournal_Close( &storage->resumeJournal, true );
+        storage->resumeJournalReady = false;
+    }
+
+    return programmed;
+}
+
+/*-----------------------------------------------------------*/
+
+static void waitForPartition( void * sinkContext )
+{
+    OtaStorageContext_t * storage = ( OtaStorageContext_t * ) sinkContext;
+
+    FlashSim_WaitIdle( &storage->partition );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool openPartition( OtaStorageContext_t * storage,
+                           const char * jobId,
+                           size_t jobIdLength )
+{
+    WriteCoalescerConfig_t coalescerConfig = {
+        .unitSize = storage->config.writeUnitSize,
+        .blockSize = storage->config.blockSize,
+        .writeAlignment = storage->config.geometry.pageSize,
+        .imageSize = storage->imageSize,
+        .openUnits = storage->config.writeOpenUnits,
+        .padByte = FLASH_SIM_ERASED_BYTE,
+        .write = programPartition,
+        .wait = waitForPartition,
+        .sinkContext = storage
+    };
+    bool opened = FlashSim_Open( &storage->partition,
+                                 ImageSlots_GetUpdatePath( &storage->imageSlots ),
+                                 &storage->config.geometry ) == FLASH_SIM_SUCCESS;
+
+    if( opened )
+    {
+        opened = EraseAhead_Init( &storage->eraseAhead,
+                                  &storage->partition,
+                                  storage->imageSize,
+                                  storage->config.eraseAheadSectors );
+
+        if( opened )
+        {
+            opened = WriteCoalescer_Init( &storage->writeCoalescer, &coalescerConfig );
+
+            if( !opened )
+            {
+                EraseAhead_Deinit( &storage->eraseAhead );
+            }
+        }
+
+        if( opened )
+        {
+            openResumeJournal( storage, jobId, jobIdLength );
+        }
+        else
+        {
+            FlashSim_Close( &storage->partition );
+        }
+    }
+
+    return opened;
+}
+
+/*-----------------------------------------------------------*/
+
+static void openResumeJournal( OtaStorageContext_t * storage,
+                               const char * jobId,
+                               size_t jobIdLength )
+{
+    uint32_t blockId = 0;
+    ResumeJournalConfig_t journalConfig = {
+        .path = storage->config.journalPath,
+        .jobId = jobId,
+        .jobIdLength = jobIdLength,
+        .fileDigest = storage->fileDigest,
+        .fileSize = storage->imageSize,
+        .blockCount = storage->blockCount,
+        .syncBlocks = storage->config.journalSyncBlocks,
+        .snapshotRecords = storage->config.journalSnapshotRecords,
+        .dataFd = storage->partition.fd
+    };
+
+    storage->resumeJournalReady = ResumeJournal_Open( &storage->resumeJournal, &journalConfig );
+
+    for( blockId = 0; storage->resumeJournalReady && ( blockId < storage->blockCount ); blockId++ )
+    {
+        if( ResumeJournal_IsBlockStored( &storage->resumeJournal, blockId ) )
+        {
+            storage->config.blockStored( storage->config.blockContext, blockId, NULL, 0U );
+            EraseAhead_MarkReady( &storage->eraseAhead,
+                                  blockId * storage->config.blockSize,
+                                  storage->config.blockSize );
+        }
+    }
+
+    if( !storage->resumeJournalReady )
+    {
+        LogError( ( "Failed to open the resume journal. The download restarts from scratch after a crash." ) );
+    }
+    else if( storage->resumeJournal.stats.blocksRecovered > 0U )
+    {
+        LogInfo( ( "Resuming the download, %u of %u blocks are already stored.",
+                   storage->resumeJournal.stats.blocksRecovered,
+                   storage->blockCount ) );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool openSparseInstall( OtaStorageContext_t * storage )
+{
+    uint32_t blockId = 0;
+    bool opened = SparseInstall_Open( &storage->sparseInstall,
+                                      ImageSlots_GetActivePath( &storage->imageSlots ),
+                                      ImageSlots_GetUpdatePath( &storage->imageSlots ),
+                                      storage->imageSize,
+                                      storage->config.blockSize );
+
+    if( opened )
+    {
+        for( blockId = 0; blockId < storage->blockCount; blockId++ )
+        {
+            if( SparseInstall_IsBlockCurrent( &storage->sparseInstall,
+                                              blockId,
+                                              &storage->blockDigests[ blockId * OTA_STORAGE_DIGEST_SIZE ] ) )
+            {
+                storage->config.blockStored( storage->config.blockContext, blockId, NULL, 0U );
+            }
+        }
+
+        LogInfo( ( "Sparse install: %u of %u blocks are unchanged, downloading %u.",
+                   storage->sparseInstall.stats.blocksReused,
+                   storage->blockCount,
+                   storage->sparseInstall.stats.blocksChanged ) );
+    }
+    else
+    {
+        LogWarn( ( "Failed to clone the running image. Downloading the whole image." ) );
+    }
+
+    return opened;
+}
+
+/*-----------------------------------------------------------*/
+
+static void loadBlocksFromChunkStore( OtaStorageContext_t * storage )
+{
+    uint32_t blockId = 0;
+    uint32_t blockLength = 0;
+    size_t length = 0U;
+    uint32_t blocksLoaded = 0U;
+    uint8_t * block = malloc( storage->config.blockSize );
+
+    for( blockId = 0; ( block != NULL ) && ( blockId < storage->blockCount ); blockId++ )
+    {
+        blockLength = getBlockLength( storage, blockId );
+
+        if( storage->config.isBlockNeeded( storage->config.blockContext, blockId ) &&
+            ChunkStore_GetChunk( &storage->chunkStore,
+                                 &storage->blockDigests[ blockId * OTA_STORAGE_DIGEST_SIZE ],
+                                 block,
+                                 blockLength,
+                                 &length ) &&
+            ( length == blockLength ) )
+        {
+            ( void ) OtaStorage_WriteBlock( storage, blockId, block, length );
+            storage->config.blockStored( storage->config.blockContext, blockId, block, length );
+            blocksLoaded++;
+        }
+    }
+
+    free( block );
+
+    LogInfo( ( "Chunk store: %u blocks found locally.", blocksLoaded ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void closePartition( OtaStorageContext_t * storage )
+{
+    const FlashSimStats_t * stats = &storage->partition.stats;
+    const WriteCoalescerStats_t * writeStats = &storage->writeCoalescer.stats;
+    const ResumeJournalStats_t * journalStats = &storage->resumeJournal.stats;
+    uint32_t downloadTimeMs = Clock_GetTimeMs() - storage->openTimeMs;
+    uint64_t eraseHiddenUs = 0U;
+    uint32_t unitWrites = 0U;
+
+    if( !WriteCoalescer_Flush( &storage->writeCoalescer ) )
+    {
+        storage->writeFailed = true;
+        LogError( ( "Failed to flush the last blocks to the OTA flash partition." ) );
+    }
+
+    WriteCoalescer_Deinit( &storage->writeCoalescer );
+    EraseAhead_Deinit( &storage->eraseAhead );
+
+    if( storage->resumeJournalReady && !ResumeJournal_Sync( &storage->resumeJournal ) )
+    {
+        LogError( ( "Failed to write the resume journal." ) );
+    }
+
+    FlashSim_Close( &storage->partition );
+    eraseHiddenUs = stats->eraseTimeUs - stats->eraseStallUs;
+
+    LogStats( ( "Flash: %llu bytes written, %llu bytes programmed in %u page programs, "
+                "%llu bytes erased in %u sector erases.",
+                ( unsigned long long ) storage->bytesWritten,
+                ( unsigned long long ) stats->bytesProgrammed,
+                stats->pagePrograms,
+                ( unsigned long long ) stats->bytesErased,
+                stats->sectorErases ) );
+    LogStats( ( "Flash: write amplification %.2f (programmed / written), %.2f (erased / written).",
+                ( storage->bytesWritten > 0U ) ? ( double ) stats->bytesProgrammed / storage->bytesWritten : 0.0,
+                ( storage->bytesWritten > 0U ) ? ( double ) stats->bytesErased / storage->bytesWritten : 0.0 ) );
+    LogStats( ( "Flash: %llu ms of %llu ms erase time hidden behind the %u ms download, "
+                "%llu ms spent programming.",
+                ( unsigned long long ) ( eraseHiddenUs / 1000U ),
+                ( unsigned long long ) ( stats->eraseTimeUs / 1000U ),
+                downloadTimeMs,
+                ( unsigned long long ) ( stats->programTimeUs / 1000U ) ) );
+
+    unitWrites = writeStats->fullUnitWrites + writeStats->partialUnitWrites;
+    LogStats( ( "Flash: %u blocks coalesced into %u full and %u partial unit writes, "
+                "%u units evicted before they were complete, "
+                "%u blocks rejected for arriving after their page was written.",
+                writeStats->blocksReceived,
+                writeStats->fullUnitWrites,
+                writeStats->partialUnitWrites,
+                writeStats->evictions,
+                writeStats->rejectedBlocks ) );
+    LogStats( ( "Flash: flush latency %llu us average, %llu us max, "
+                "%llu ms waiting for a free buffer.",
+                ( unsigned long long ) ( ( unitWrites > 0U ) ? writeStats->writeTimeUs / unitWrites : 0U ),
+                ( unsigned long long ) writeStats->maxWriteTimeUs,
+                ( unsigned long long ) ( writeStats->bufferWaitUs / 1000U ) ) );
+
+    if( storage->resumeJournalReady )
+    {
+        LogStats( ( "Journal: %u blocks recovered, %u range records in %u syncs, %u snapshots, "
+                    "%llu bytes written, %llu ms writing.",
+                    journalStats->blocksRecovered,
+                    journalStats->rangeRecords,
+                    journalStats->syncs,
+                    journalStats->snapshots,
+                    ( unsigned long long ) journalStats->bytesWritten,
+                    ( unsigned long long ) ( journalStats->syncTimeUs / 1000U ) ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void closeSparseInstall( OtaStorageContext_t * storage )
+{
+    static const char * const cloneMethods[] = { "none", "reflink", "copy_file_range", "read/write" };
+    const SparseInstallStats_t * stats = &storage->sparseInstall.stats;
+
+    SparseInstall_Close( &storage->sparseInstall );
+
+    LogStats( ( "Sparse install: cloned the running image with %s in %llu us, %llu bytes copied; "
+                "compared block digests in %llu us.",
+                cloneMethods[ stats->method ],
+                ( unsigned long long ) stats->cloneTimeUs,
+                ( unsigned long long ) stats->bytesCopied,
+                ( unsigned long long ) stats->digestTimeUs ) );
+    LogStats( ( "Sparse install: %llu bytes written for %u changed blocks, a full install writes %u bytes.",
+                ( unsigned long long ) stats->bytesWritten,
+                stats->blocksChanged,
+                storage->imageSize ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getBlockLength( const OtaStorageContext_t * storage,
+                                uint32_t blockId )
+{
+    uint32_t offset = blockId * storage->config.blockSize;
+
+    return ( ( storage->imageSize - offset ) < storage->config.blockSize ) ?
+           storage->imageSize - offset : storage->config.blockSize;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_Init( OtaStorageContext_t * storage,
+                      const OtaStorageConfig_t * config )
+{
+    assert( storage != NULL );
+    assert( config != NULL );
+    assert( config->isBlockNeeded != NULL );
+    assert( config->blockStored != NULL );
+    assert( config->blockSize > 0U );
+
+    memset( storage, 0x00, sizeof( OtaStorageContext_t ) );
+    storage->config = *config;
+    storage->partition.fd = -1;
+    storage->sparseInstall.fd = -1;
+    storage->resumeJournal.fd = -1;
+
+    storage->imageSlotsReady = ImageSlots_Open( &storage->imageSlots,
+                                                config->slotMetadataPath,
+                                                config->slotPaths[ 0 ],
+                                                config->slotPaths[ 1 ] );
+
+    /* Reaching this point is the self-test of a newly installed image. */
+    if( storage->imageSlotsReady &&
+        ( ImageSlots_GetState( &storage->imageSlots ) == IMAGE_SLOTS_PENDING ) )
+    {
+        LogInfo( ( "Confirming the image in slot %c.",
+                   'A' + ImageSlots_GetActiveSlot( &storage->imageSlots ) ) );
+        storage->imageSlotsReady = ImageSlots_Confirm( &storage->imageSlots );
+    }
+
+    storage->chunkStoreReady = ChunkStore_Open( &storage->chunkStore,
+                                                config->chunkStoreDir,
+                                                config->chunkStoreBudget );
+
+    return storage->imageSlotsReady;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_BeginImage( OtaStorageContext_t * storage,
+                            const uint8_t * fileDigest,
+                            uint32_t imageSize )
+{
+    size_t length = 0U;
+
+    assert( storage != NULL );
+    assert( fileDigest != NULL );
+
+    memcpy( storage->fileDigest, fileDigest, sizeof( storage->fileDigest ) );
+    storage->imageSize = imageSize;
+    storage->blockCount = ( imageSize + storage->config.blockSize - 1U ) / storage->config.blockSize;
+    storage->blockDigestsReady = false;
+
+    /* An image seen before, under any job, is described by its manifest. */
+    if( storage->chunkStoreReady )
+    {
+        memset( &storage->chunkStore.stats, 0x00, sizeof( storage->chunkStore.stats ) );
+        storage->blockDigestsReady = ( storage->blockCount <= OTA_STORAGE_MAX_BLOCKS ) &&
+                                     ChunkStore_GetManifest( &storage->chunkStore,
+                                                             fileDigest,
+                                                             storage->blockDigests,
+                                                             sizeof( storage->blockDigests ),
+                                                             &length ) &&
+                                     ( length == storage->blockCount * OTA_STORAGE_DIGEST_SIZE );
+    }
+
+    if( storage->blockDigestsReady )
+    {
+        LogInfo( ( "Chunk store: found the manifest of the image, skipping the digest list." ) );
+    }
+
+    return storage->blockDigestsReady;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_CanUseBlockDigests( const OtaStorageContext_t * storage )
+{
+    assert( storage != NULL );
+
+    return storage->imageSlotsReady &&
+           ( storage->chunkStoreReady ||
+             ( ImageSlots_GetActiveImageSize( &storage->imageSlots ) > 0U ) );
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_WriteDigests( OtaStorageContext_t * storage,
+                              uint32_t offset,
+                              const uint8_t * data,
+                              size_t length )
+{
+    bool written = false;
+
+    assert( storage != NULL );
+    assert( data != NULL );
+
+    if( ( offset <= sizeof( storage->blockDigests ) ) &&
+        ( length <= sizeof( storage->blockDigests ) - offset ) )
+    {
+        memcpy( &storage->blockDigests[ offset ], data, length );
+        written = true;
+    }
+
+    return written;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_AcceptDigests( OtaStorageContext_t * storage,
+                               uint32_t length )
+{
+    assert( storage != NULL );
+
+    storage->blockDigestsReady = ( length <= sizeof( storage->blockDigests ) ) &&
+                                 ( length == storage->blockCount * OTA_STORAGE_DIGEST_SIZE );
+
+    return storage->blockDigestsReady;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_Open( OtaStorageContext_t * storage,
+                      const char * jobId,
+                      size_t jobIdLength )
+{
+    bool slotReady = false;
+
+    assert( storage != NULL );
+    assert( jobId != NULL );
+
+    storage->target = OTA_STORAGE_NONE;
+    storage->writeFailed = false;
+    storage->bytesWritten = 0U;
+    storage->openTimeMs = Clock_GetTimeMs();
+
+    /* The image is downloaded straight into the inactive slot. */
+    slotReady = storage->imageSlotsReady && ImageSlots_BeginUpdate( &storage->imageSlots );
+
+    if( slotReady && storage->blockDigestsReady &&
+        ( ImageSlots_GetActiveImageSize( &storage->imageSlots ) > 0U ) &&
+        openSparseInstall( storage ) )
+    {
+        storage->target = OTA_STORAGE_SPARSE;
+    }
+    else if( slotReady && openPartition( storage, jobId, jobIdLength ) )
+    {
+        storage->target = OTA_STORAGE_PARTITION;
+    }
+    else
+    {
+        LogError( ( "Failed to open the OTA flash partition. The image is only kept in RAM." ) );
+    }
+
+    if( storage->blockDigestsReady && storage->chunkStoreReady )
+    {
+        loadBlocksFromChunkStore( storage );
+    }
+
+    return storage->target != OTA_STORAGE_NONE;
+}
+
+/*-----------------------------------------------------------*/
+
+void OtaStorage_Service( OtaStorageContext_t * storage,
+                         uint32_t offset )
+{
+    assert( storage != NULL );
+
+    if( storage->target == OTA_STORAGE_PARTITION )
+    {
+        EraseAhead_Service( &storage->eraseAhead, offset );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_WriteBlock( OtaStorageContext_t * storage,
+                            uint32_t blockId,
+                            const uint8_t * data,
+                            size_t length )
+{
+    bool written = true;
+
+    assert( storage != NULL );
+    assert( data != NULL );
+
+    if( storage->target == OTA_STORAGE_SPARSE )
+    {
+        written = SparseInstall_WriteBlock( &storage->sparseInstall, blockId, data, length );
+    }
+    else if( storage->target == OTA_STORAGE_PARTITION )
+    {
+        written = WriteCoalescer_Write( &storage->writeCoalescer,
+                                        blockId * storage->config.blockSize,
+                                        data,
+                                        length );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    if( written )
+    {
+        storage->bytesWritten += length;
+    }
+    else
+    {
+        storage->writeFailed = true;
+        LogError( ( "Failed to write block %u to the update slot.", blockId ) );
+    }
+
+    return written;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_Close( OtaStorageContext_t * storage )
+{
+    bool imageStored = false;
+
+    assert( storage != NULL );
+
+    if( storage->target == OTA_STORAGE_SPARSE )
+    {
+        closeSparseInstall( storage );
+        imageStored = !storage->writeFailed;
+    }
+    else if( storage->target == OTA_STORAGE_PARTITION )
+    {
+        closePartition( storage );
+        imageStored = !storage->writeFailed;
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    storage->target = OTA_STORAGE_NONE;
+
+    return imageStored;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_Install( OtaStorageContext_t * storage )
+{
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    bool installed = false;
+
+    assert( storage != NULL );
+
+    /* The image already sits in its slot, only the slot metadata is
+     * rewritten. */
+    installed = ImageSlots_Activate( &storage->imageSlots, storage->imageSize );
+
+    if( installed )
+    {
+        LogInfo( ( "Installed the image into slot %c in %llu us. "
+                   "It is confirmed once it connects to AWS IoT.",
+                   'A' + ImageSlots_GetActiveSlot( &storage->imageSlots ),
+                   ( unsigned long long ) ( Clock_GetTimeUs() - startTimeUs ) ) );
+    }
+    else
+    {
+        LogError( ( "Failed to install the image." ) );
+    }
+
+    return installed;
+}
+
+/*-----------------------------------------------------------*/
+
+bool OtaStorage_StoreChunks( OtaStorageContext_t * storage )
+{
+    uint32_t blockId = 0;
+    size_t length = 0U;
+    bool stored = false;
+    uint8_t * block = NULL;
+    FILE * image = NULL;
+
+    assert( storage != NULL );
+
+    if( storage->chunkStoreReady && ( storage->blockCount <= OTA_STORAGE_MAX_BLOCKS ) )
+    {
+        block = malloc( storage->config.blockSize );
+        image = fopen( ImageSlots_GetActivePath( &storage->imageSlots ), "rb" );
+        stored = ( block != NULL ) && ( image != NULL );
+    }
+
+    /* The digests of the manifest replace the digest list of the job. */
+    for( blockId = 0; stored && ( blockId < storage->blockCount ); blockId++ )
+    {
+        length = getBlockLength( storage, blockId );
+        stored = ( fread( block, 1U, length, image ) == length ) &&
+                 ChunkStore_PutChunk( &storage->chunkStore,
+                                      block,
+                                      length,
+                                      &storage->blockDigests[ blockId * OTA_STORAGE_DIGEST_SIZE ] );
+    }
+
+    if( image != NULL )
+    {
+        ( void ) fclose( image );
+    }
+
+    free( block );
+
+    if( stored )
+    {
+        stored = ChunkStore_PutManifest( &storage->chunkStore,
+                                         storage->fileDigest,
+                                         storage->blockDigests,
+                                         storage->blockCount * OTA_STORAGE_DIGEST_SIZE );
+    }
+
+    if( !stored )
+    {
+        LogError( ( "Failed to add the image to the chunk store." ) );
+    }
+
+    LogStats( ( "Chunk store: %u of %u blocks served locally, %llu bytes of download saved.",
+                storage->chunkStore.stats.hits,
+                storage->blockCount,
+                ( unsigned long long ) storage->chunkStore.stats.bytesServed ) );
+    LogStats( ( "Chunk store: %u new chunks, %llu bytes added, %u entries (%llu bytes) evicted, "
+                "%llu of %llu bytes used.",
+                storage->chunkStore.stats.chunksAdded,
+                ( unsigned long long ) storage->chunkStore.stats.bytesAdded,
+                storage->chunkStore.stats.evictions,
+                ( unsigned long long ) storage->chunkStore.stats.bytesEvicted,
+                ( unsigned long long ) storage->chunkStore.totalSize,
+                ( unsigned long long ) storage->chunkStore.budget ) );
+
+    return stored;
+}
+
+/*-----------------------------------------------------------*/
+
+void OtaStorage_EndJob( OtaStorageContext_t * storage )
+{
+    assert( storage != NULL );
+
+    if( storage->resumeJournalReady )
+    {
+        ResumeJournal_Close( &storage->resumeJournal, true );
+        storage->resumeJournalReady = false;
+    }
+}
+
+/*-----------------------------------------------------------*/
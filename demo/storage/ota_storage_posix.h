@@ -0,0 +1,329 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file ota_storage_posix.h
+ * @brief Storage pipeline of a downloaded OTA image.
+ *
+ * Ties the storage modules together for one image at a time. The image is
+ * written straight into the inactive slot of #ImageSlotsContext_t, either
+ * over a clone of the running image (sparse install) or through the write
+ * coalescer into a simulated flash partition which is erased ahead of the
+ * download. A resume journal records the stored blocks of the partition, and
+ * a chunk store keeps the blocks of installed images. With the SHA-256
+ * digests of the image blocks, unchanged blocks and blocks found in the
+ * chunk store are not downloaded.
+ *
+ * Blocks found in storage are passed back through
+ * #OtaStorageBlockStored_t, so the caller can drop them from the download.
+ */
+
+#ifndef OTA_STORAGE_POSIX_H_
+#define OTA_STORAGE_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunk_store_posix.h"
+#include "erase_ahead.h"
+#include "flash_sim_posix.h"
+#include "image_slots_posix.h"
+#include "resume_journal_posix.h"
+#include "sparse_install_posix.h"
+#include "write_coalescer.h"
+
+/**
+ * @brief Maximum number of blocks of an image.
+ */
+#define OTA_STORAGE_MAX_BLOCKS      256U
+
+/**
+ * @brief Size of the SHA-256 digest of a block.
+ */
+#define OTA_STORAGE_DIGEST_SIZE     32U
+
+/**
+ * @brief Size of the digest list of an image with the most blocks.
+ */
+#define OTA_STORAGE_DIGESTS_SIZE    ( OTA_STORAGE_MAX_BLOCKS * OTA_STORAGE_DIGEST_SIZE )
+
+/**
+ * @brief Check whether a block still has to be downloaded.
+ *
+ * @param[in] blockContext Context given in #OtaStorageConfig_t.
+ * @param[in] blockId Index of the block.
+ *
+ * @return true if the block is still missing.
+ */
+typedef bool ( * OtaStorageIsBlockNeeded_t )( void * blockContext,
+                                              uint32_t blockId );
+
+/**
+ * @brief Report a block which was found in storage.
+ *
+ * @param[in] blockContext Context given in #OtaStorageConfig_t.
+ * @param[in] blockId Index of the block.
+ * @param[in] data Data of the block, or NULL if the block only sits in the
+ * update slot.
+ * @param[in] length Length of the data.
+ */
+typedef void ( * OtaStorageBlockStored_t )( void * blockContext,
+                                            uint32_t blockId,
+                                            const uint8_t * data,
+                                            size_t length );
+
+/**
+ * @brief Where the image being downloaded is written.
+ */
+typedef enum OtaStorageTarget
+{
+    OTA_STORAGE_NONE = 0,  /**< The image is not stored. */
+    OTA_STORAGE_PARTITION, /**< Through the coalescer into the partition. */
+    OTA_STORAGE_SPARSE     /**< Over a clone of the running image. */
+} OtaStorageTarget_t;
+
+/**
+ * @brief Configuration of the storage pipeline.
+ */
+typedef struct OtaStorageConfig
+{
+    const char * slotMetadataPath;          /**< @brief Slot metadata file. */
+    const char * slotPaths[ IMAGE_SLOT_COUNT ]; /**< @brief Image slot files. */
+    const char * journalPath;               /**< @brief Resume journal file. */
+    const char * chunkStoreDir;             /**< @brief Chunk store
+                                               directory. */
+    uint64_t chunkStoreBudget;              /**< @brief Maximum size of the
+                                               chunk store. */
+    FlashSimGeometry_t geometry;            /**< @brief Geometry of the
+                                               partition. */
+    uint32_t blockSize;                     /**< @brief Size of the download
+                                               blocks. */
+    uint32_t eraseAheadSectors;             /**< @brief Sectors erased ahead
+                                               of the download. */
+    uint32_t writeUnitSize;                 /**< @brief Size of a coalesced
+                                               write. */
+    uint32_t writeOpenUnits;                /**< @brief Partially filled
+                                               units kept open. */
+    uint32_t journalSyncBlocks;             /**< @brief Blocks between two
+                                               journal syncs. */
+    uint32_t journalSnapshotRecords;        /**< @brief Records between two
+                                               journal snapshots. */
+    OtaStorageIsBlockNeeded_t isBlockNeeded; /**< @brief Asks whether a block
+                                                is still missing. */
+    OtaStorageBlockStored_t blockStored;    /**< @brief Reports a block found
+                                               in storage. */
+    void * blockContext;                    /**< @brief Passed to the block
+                                               functions. */
+} OtaStorageConfig_t;
+
+/**
+ * @brief State of the storage pipeline.
+ */
+typedef struct OtaStorageContext
+{
+    OtaStorageConfig_t config;              /**< @brief Configuration. */
+    ImageSlotsContext_t imageSlots;         /**< @brief A/B image slots. */
+    ChunkStoreContext_t chunkStore;         /**< @brief Blocks of installed
+                                               images. */
+    FlashSimContext_t partition;            /**< @brief Update slot as a
+                                               flash partition. */
+    EraseAheadContext_t eraseAhead;         /**< @brief Erase scheduling of
+                                               the partition. */
+    WriteCoalescerContext_t writeCoalescer; /**< @brief Write units of the
+                                               partition. */
+    SparseInstallContext_t sparseInstall;   /**< @brief Clone of the running
+                                               image. */
+    ResumeJournalContext_t resumeJournal;   /**< @brief Blocks stored in the
+                                               partition. */
+    OtaStorageTarget_t target;              /**< @brief Where the current
+                                               image is written. */
+    uint32_t imageSize;                     /**< @brief Size of the current
+                                               image. */
+    uint32_t blockCount;                    /**< @brief Blocks of the current
+                                               image. */
+    uint32_t openTimeMs;                    /**< @brief When the image was
+                                               opened. */
+    uint64_t bytesWritten;                  /**< @brief Bytes of downloaded
+                                               blocks written. */
+    bool imageSlotsReady;                   /**< @brief The slots are
+                                               usable. */
+    bool chunkStoreReady;                   /**< @brief The chunk store is
+                                               usable. */
+    bool resumeJournalReady;                /**< @brief The journal is
+                                               usable. */
+    bool blockDigestsReady;                 /**< @brief The block digests of
+                                               the image are known. */
+    bool writeFailed;                       /**< @brief A block could not be
+                                               written. */
+    uint8_t fileDigest[ OTA_STORAGE_DIGEST_SIZE ]; /**< @brief Identifies the
+                                                      current image. */
+    uint8_t blockDigests[ OTA_STORAGE_DIGESTS_SIZE ]; /**< @brief Digests of
+                                                         the image blocks. */
+} OtaStorageContext_t;
+
+/**
+ * @brief Open the image slots and the chunk store.
+ *
+ * A newly installed image is confirmed, reaching this point is its
+ * self-test.
+ *
+ * @param[out] storage Storage pipeline to initialize.
+ * @param[in] config Configuration, copied into the pipeline.
+ *
+ * @return true if the image slots can be used. Without them no image is
+ * stored.
+ */
+bool OtaStorage_Init( OtaStorageContext_t * storage,
+                      const OtaStorageConfig_t * config );
+
+/**
+ * @brief Start a new image and look up its block digests in the chunk
+ * store.
+ *
+ * @param[in] storage Storage pipeline.
+ * @param[in] fileDigest #OTA_STORAGE_DIGEST_SIZE bytes identifying the
+ * image.
+ * @param[in] imageSize Size of the image.
+ *
+ * @return true if the block digests of the image were found.
+ */
+bool OtaStorage_BeginImage( OtaStorageContext_t * storage,
+                            const uint8_t * fileDigest,
+                            uint32_t imageSize );
+
+/**
+ * @brief Check whether the block digests of the image would save blocks.
+ *
+ * @param[in] storage Storage pipeline.
+ *
+ * @return true if there is a running image or a chunk store to compare the
+ * digests with.
+ */
+bool OtaStorage_CanUseBlockDigests( const OtaStorageContext_t * storage );
+
+/**
+ * @brief Store a block of the downloaded digest list.
+ *
+ * @param[in] storage Storage pipeline.
+ * @param[in] offset Offset of the block in the digest list.
+ * @param[in] data Data of the block.
+ * @param[in] length Length of the block.
+ *
+ * @return true if the block fits the digest list.
+ */
+bool OtaStorage_WriteDigests( OtaStorageContext_t * storage,
+                              uint32_t offset,
+                              const uint8_t * data,
+                              size_t length );
+
+/**
+ * @brief Accept the downloaded digest list.
+ *
+ * @param[in] storage Storage pipeline.
+ * @param[in] length Length of the digest list.
+ *
+ * @return true if the list holds a digest for every block of the image.
+ */
+bool OtaStorage_AcceptDigests( OtaStorageContext_t * storage,
+                               uint32_t length );
+
+/**
+ * @brief Open the update slot for the image.
+ *
+ * Blocks already stored, by an interrupted download of the same image, in
+ * the running image or in the chunk store, are reported through
+ * #OtaStorageBlockStored_t.
+ *
+ * @param[in] storage Storage pipeline.
+ * @param[in] jobId ID of the job, recorded in the journal.
+ * @param[in] jobIdLength Length of the job ID.
+ *
+ * @return true if the image is stored; false if it is only kept by the
+ * caller.
+ */
+bool OtaStorage_Open( OtaStorageContext_t * storage,
+                      const char * jobId,
+                      size_t jobIdLength );
+
+/**
+ * @brief Let the flash erase the sectors ahead of a download offset.
+ *
+ * @param[in] storage Storage pipeline.
+ * @param[in] offset Offset of the block being downloaded.
+ */
+void OtaStorage_Service( OtaStorageContext_t * storage,
+                         uint32_t offset );
+
+/**
+ * @brief Write a downloaded block of the image.
+ *
+ * @param[in] storage Storage pipeline.
+ * @param[in] blockId Index of the block.
+ * @param[in] data Data of the block.
+ * @param[in] length Length of the block.
+ *
+ * @return true on success, or if the image is not stored.
+ */
+bool OtaStorage_WriteBlock( OtaStorageContext_t * storage,
+                            uint32_t blockId,
+                            const uint8_t * data,
+                            size_t length );
+
+/**
+ * @brief Write the last blocks and close the update slot.
+ *
+ * The journal is synced but kept, until #OtaStorage_EndJob.
+ *
+ * @param[in] storage Storage pipeline.
+ *
+ * @return true if the whole image is stored in the update slot.
+ */
+bool OtaStorage_Close( OtaStorageContext_t * storage );
+
+/**
+ * @brief Make the image in the update slot the active one.
+ *
+ * @param[in] storage Storage pipeline.
+ *
+ * @return true on success.
+ */
+bool OtaStorage_Install( OtaStorageContext_t * storage );
+
+/**
+ * @brief Add the blocks and the digest list of the installed image to the
+ * chunk store.
+ *
+ * @param[in] storage Storage pipeline.
+ *
+ * @return true on success.
+ */
+bool OtaStorage_StoreChunks( OtaStorageContext_t * storage );
+
+/**
+ * @brief Remove the resume journal once the job is over.
+ *
+ * @param[in] storage Storage pipeline.
+ */
+void OtaStorage_EndJob( OtaStorageContext_t * storage );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef OTA_STORAGE_POSIX_H_ */
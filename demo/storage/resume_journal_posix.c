@@ -0,0 +1,541 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file resume_journal_posix.c
+ * @brief Implementation of the download resume journal for POSIX systems.
+ */
+
+#define LIBRARY_LOG_NAME  "ResumeJournal"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "resume_journal_posix.h"
+#include "utils/atomic_file_posix.h"
+#include "utils/clock.h"
+#include "utils/crc32.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Value of #JournalHeader_t.magic.
+ */
+#define JOURNAL_MAGIC           0x4F54414AU /* "OTAJ" */
+
+/**
+ * @brief Types of journal records.
+ */
+#define JOURNAL_RECORD_RANGE    1U
+#define JOURNAL_RECORD_SNAPSHOT 2U
+
+/**
+ * @brief Number of bytes of a bitmap of a number of blocks.
+ */
+#define BITMAP_SIZE( blocks )    ( ( ( blocks ) + 7U ) / 8U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief First bytes of a journal file.
+ */
+typedef struct JournalHeader
+{
+    uint32_t magic;
+    uint32_t fileSize;
+    uint32_t blockCount;
+    char jobId[ RESUME_JOURNAL_MAX_JOB_ID_LENGTH ];
+    uint8_t fileDigest[ RESUME_JOURNAL_DIGEST_SIZE ];
+    uint32_t crc;
+} JournalHeader_t;
+
+/**
+ * @brief A journal record. Snapshot records are followed by the bitmap, which
+ * is covered by their CRC.
+ */
+typedef struct JournalRecord
+{
+    uint32_t type;
+    uint32_t firstBlock;
+    uint32_t blockCount;
+    uint32_t crc;
+} JournalRecord_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Fill in the header describing the download of the journal.
+ */
+static void makeHeader( const ResumeJournalContext_t * journal,
+                        JournalHeader_t * header );
+
+/**
+ * @brief Apply the records of an existing journal to the bitmap.
+ *
+ * A torn or corrupt tail is cut off.
+ *
+ * @return true if the journal belongs to this download.
+ */
+static bool replay( ResumeJournalContext_t * journal );
+
+/**
+ * @brief Replace the journal with a header and a snapshot of the bitmap.
+ *
+ * @return true on success.
+ */
+static bool compact( ResumeJournalContext_t * journal );
+
+/**
+ * @brief Mark a run of blocks in the bitmap.
+ */
+static void markBlocks( ResumeJournalContext_t * journal,
+                        uint32_t firstBlock,
+                        uint32_t blockCount );
+
+/*-----------------------------------------------------------*/
+
+static void makeHeader( const ResumeJournalContext_t * journal,
+                        JournalHeader_t * header )
+{
+    memset( header, 0x00, sizeof( JournalHeader_t ) );
+    header->magic = JOURNAL_MAGIC;
+    header->fileSize = journal->config.fileSize;
+    header->blockCount = journal->config.blockCount;
+    memcpy( header->jobId, journal->jobId, sizeof( header->jobId ) );
+    memcpy( header->fileDigest,
+            journal->fileDigest,
+            sizeof( header->fileDigest ) );
+    header->crc = Crc32_Update( 0U,
+                                header,
+                                offsetof( JournalHeader_t, crc ) );
+}
+
+static void markBlocks( ResumeJournalContext_t * journal,
+                        uint32_t firstBlock,
+                        uint32_t blockCount )
+{
+    uint32_t block = 0U;
+
+    for( block = firstBlock; block < ( firstBlock + blockCount ); block++ )
+    {
+        journal->bitmap[ block / 8U ] |= ( uint8_t ) ( 1U << ( block % 8U ) );
+    }
+}
+
+static bool replay( ResumeJournalContext_t * journal )
+{
+    const uint32_t blockCount = journal->config.blockCount;
+    const size_t bitmapSize = BITMAP_SIZE( blockCount );
+    JournalHeader_t expected = { 0 };
+    JournalHeader_t header = { 0 };
+    JournalRecord_t record = { 0 };
+    uint8_t * snapshot = NULL;
+    off_t validEnd = 0;
+    uint32_t crc = 0U;
+    uint32_t block = 0U;
+    bool matches = false;
+    bool valid = true;
+
+    journal->fd = open( journal->config.path, O_RDWR | O_APPEND );
+
+    if( journal->fd >= 0 )
+    {
+        makeHeader( journal, &expected );
+        matches = ( read( journal->fd, &header, sizeof( header ) ) ==
+                    ( ssize_t ) sizeof( header ) ) &&
+                  ( memcmp( &header, &expected, sizeof( header ) ) == 0 );
+        snapshot = ( uint8_t * ) malloc( bitmapSize );
+    }
+
+    if( matches && ( snapshot != NULL ) )
+    {
+        validEnd = ( off_t ) sizeof( header );
+
+        while( valid &&
+               ( read( journal->fd, &record, sizeof( record ) ) ==
+                 ( ssize_t ) sizeof( record ) ) )
+        {
+            crc = Crc32_Update( 0U, &record, offsetof( JournalRecord_t, crc ) );
+
+            if( record.type == JOURNAL_RECORD_SNAPSHOT )
+            {
+                valid = ( record.firstBlock == 0U ) &&
+                        ( record.blockCount == blockCount ) &&
+                        ( read( journal->fd, snapshot, bitmapSize ) ==
+                          ( ssize_t ) bitmapSize ) &&
+                        ( Crc32_Update( crc, snapshot, bitmapSize ) ==
+                          record.crc );
+
+                if( valid )
+                {
+                    memcpy( journal->bitmap, snapshot, bitmapSize );
+                    journal->recordsSinceSnapshot = 0U;
+                    validEnd += ( off_t ) ( sizeof( record ) + bitmapSize );
+                }
+            }
+            else
+            {
+                valid = ( record.type == JOURNAL_RECORD_RANGE ) &&
+                        ( crc == record.crc ) &&
+                        ( record.firstBlock < blockCount ) &&
+                        ( record.blockCount <=
+                          blockCount - record.firstBlock );
+
+                if( valid )
+                {
+                    markBlocks( journal, record.firstBlock, record.blockCount );
+                    journal->recordsSinceSnapshot++;
+                    validEnd += ( off_t ) sizeof( record );
+                }
+            }
+        }
+
+        /* Drop a torn record left by a crash so new records follow the last
+         * good one. */
+        if( ( lseek( journal->fd, 0, SEEK_END ) != validEnd ) &&
+            ( ftruncate( journal->fd, validEnd ) != 0 ) )
+        {
+            LogError( ( "Failed to cut the journal at %ld.",
+                        ( long ) validEnd ) );
+            matches = false;
+        }
+    }
+    else if( journal->fd >= 0 )
+    {
+        LogInfo( ( "Journal %s belongs to another download.",
+                   journal->config.path ) );
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    free( snapshot );
+
+    if( matches )
+    {
+        for( block = 0U; block < blockCount; block++ )
+        {
+            if( ResumeJournal_IsBlockStored( journal, block ) )
+            {
+                journal->stats.blocksRecovered++;
+            }
+        }
+    }
+    else
+    {
+        memset( journal->bitmap, 0x00, bitmapSize );
+        journal->recordsSinceSnapshot = 0U;
+
+        if( journal->fd >= 0 )
+        {
+            ( void ) close( journal->fd );
+            journal->fd = -1;
+        }
+    }
+
+    return matches;
+}
+
+static bool compact( ResumeJournalContext_t * journal )
+{
+    const size_t bitmapSize = BITMAP_SIZE( journal->config.blockCount );
+    const size_t length = sizeof( JournalHeader_t ) + sizeof( JournalRecord_t ) +
+                          bitmapSize;
+    uint8_t * buffer = NULL;
+    JournalRecord_t record = { 0 };
+    bool success = false;
+
+    buffer = ( uint8_t * ) malloc( length );
+
+    if( buffer != NULL )
+    {
+        record.type = JOURNAL_RECORD_SNAPSHOT;
+        record.firstBlock = 0U;
+        record.blockCount = journal->config.blockCount;
+        record.crc = Crc32_Update( 0U,
+                                   &record,
+                                   offsetof( JournalRecord_t, crc ) );
+        record.crc = Crc32_Update( record.crc, journal->bitmap, bitmapSize );
+
+        makeHeader( journal, ( JournalHeader_t * ) buffer );
+        memcpy( &buffer[ sizeof( JournalHeader_t ) ], &record, sizeof( record ) );
+        memcpy( &buffer[ sizeof( JournalHeader_t ) + sizeof( record ) ],
+                journal->bitmap,
+                bitmapSize );
+
+        success = AtomicFile_Write( journal->config.path, buffer, length );
+        free( buffer );
+    }
+
+    if( journal->fd >= 0 )
+    {
+        ( void ) close( journal->fd );
+        journal->fd = -1;
+    }
+
+    if( success )
+    {
+        journal->fd = open( journal->config.path, O_WRONLY | O_APPEND );
+        success = journal->fd >= 0;
+    }
+
+    if( success )
+    {
+        journal->recordsSinceSnapshot = 0U;
+        journal->stats.snapshots++;
+        journal->stats.bytesWritten += length;
+    }
+    else
+    {
+        LogError( ( "Failed to compact journal %s: errno=%d.",
+                    journal->config.path,
+                    errno ) );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+bool ResumeJournal_Open( ResumeJournalContext_t * journal,
+                         const ResumeJournalConfig_t * config )
+{
+    bool success = true;
+
+    assert( journal != NULL );
+    assert( config != NULL );
+
+    memset( journal, 0x00, sizeof( ResumeJournalContext_t ) );
+    journal->fd = -1;
+
+    if( ( config->path == NULL ) || ( config->jobId == NULL ) ||
+        ( config->fileDigest == NULL ) || ( config->blockCount == 0U ) ||
+        ( config->jobIdLength >= RESUME_JOURNAL_MAX_JOB_ID_LENGTH ) )
+    {
+        LogError( ( "Invalid journal parameters." ) );
+        success = false;
+    }
+
+    if( success )
+    {
+        journal->config = *config;
+        memcpy( journal->jobId, config->jobId, config->jobIdLength );
+        memcpy( journal->fileDigest,
+                config->fileDigest,
+                RESUME_JOURNAL_DIGEST_SIZE );
+
+        if( journal->config.syncBlocks == 0U )
+        {
+            journal->config.syncBlocks = 1U;
+        }
+
+        journal->bitmap = ( uint8_t * ) calloc(
+            BITMAP_SIZE( config->blockCount ),
+            sizeof( uint8_t ) );
+        success = journal->bitmap != NULL;
+    }
+
+    /* A new journal starts out compacted, with an empty snapshot. */
+    if( success && !replay( journal ) )
+    {
+        success = compact( journal );
+    }
+
+    if( success )
+    {
+        LogInfo( ( "Opened journal %s: %u of %u blocks already stored.",
+                   config->path,
+                   journal->stats.blocksRecovered,
+                   config->blockCount ) );
+    }
+    else
+    {
+        free( journal->bitmap );
+        journal->bitmap = NULL;
+    }
+
+    return success;
+}
+
+bool ResumeJournal_IsBlockStored( const ResumeJournalContext_t * journal,
+                                  uint32_t blockId )
+{
+    assert( journal != NULL );
+
+    return ( blockId < journal->config.blockCount ) &&
+           ( ( journal->bitmap[ blockId / 8U ] &
+               ( 1U << ( blockId % 8U ) ) ) != 0U );
+}
+
+bool ResumeJournal_RecordBlocks( ResumeJournalContext_t * journal,
+                                 uint32_t firstBlock,
+                                 uint32_t blockCount )
+{
+    ResumeJournalRange_t * last = NULL;
+    bool success = true;
+
+    assert( journal != NULL );
+
+    if( ( blockCount == 0U ) ||
+        ( firstBlock >= journal->config.blockCount ) ||
+        ( blockCount > journal->config.blockCount - firstBlock ) )
+    {
+        LogError( ( "Invalid block range %u+%u.", firstBlock, blockCount ) );
+        success = false;
+    }
+
+    if( success )
+    {
+        markBlocks( journal, firstBlock, blockCount );
+
+        if( journal->pendingCount > 0U )
+        {
+            last = &journal->pending[ journal->pendingCount - 1U ];
+        }
+
+        /* Blocks usually arrive in order, so most ranges extend the last. */
+        if( ( last != NULL ) &&
+            ( ( last->firstBlock + last->blockCount ) == firstBlock ) )
+        {
+            last->blockCount += blockCount;
+        }
+        else
+        {
+            if( journal->pendingCount == RESUME_JOURNAL_MAX_PENDING )
+            {
+                success = ResumeJournal_Sync( journal );
+            }
+
+            if( success )
+            {
+                journal->pending[ journal->pendingCount ].firstBlock = firstBlock;
+                journal->pending[ journal->pendingCount ].blockCount = blockCount;
+                journal->pendingCount++;
+            }
+        }
+
+        if( success )
+        {
+            journal->pendingBlocks += blockCount;
+        }
+    }
+
+    if( success && ( journal->pendingBlocks >= journal->config.syncBlocks ) )
+    {
+        success = ResumeJournal_Sync( journal );
+    }
+
+    return success;
+}
+
+bool ResumeJournal_Sync( ResumeJournalContext_t * journal )
+{
+    JournalRecord_t records[ RESUME_JOURNAL_MAX_PENDING ];
+    const size_t length = journal->pendingCount * sizeof( JournalRecord_t );
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    ssize_t written = 0;
+    bool success = true;
+    uint32_t i = 0U;
+
+    assert( journal != NULL );
+
+    if( ( journal->pendingCount > 0U ) && ( journal->fd >= 0 ) )
+    {
+        for( i = 0U; i < journal->pendingCount; i++ )
+        {
+            records[ i ].type = JOURNAL_RECORD_RANGE;
+            records[ i ].firstBlock = journal->pending[ i ].firstBlock;
+            records[ i ].blockCount = journal->pending[ i ].blockCount;
+            records[ i ].crc = Crc32_Update( 0U,
+                                             &records[ i ],
+                                             offsetof( JournalRecord_t, crc ) );
+        }
+
+        /* The blocks must be on disk before the records claiming them. */
+        if( journal->config.dataFd >= 0 )
+        {
+            success = fdatasync( journal->config.dataFd ) == 0;
+        }
+
+        if( success )
+        {
+            do
+            {
+                written = write( journal->fd, records, length );
+            } while( ( written < 0 ) && ( errno == EINTR ) );
+
+            success = ( written == ( ssize_t ) length ) &&
+                      ( fdatasync( journal->fd ) == 0 );
+        }
+
+        if( success )
+        {
+            journal->stats.rangeRecords += journal->pendingCount;
+            journal->stats.syncs++;
+            journal->stats.bytesWritten += length;
+            journal->recordsSinceSnapshot += journal->pendingCount;
+            journal->pendingCount = 0U;
+            journal->pendingBlocks = 0U;
+        }
+        else
+        {
+            LogError( ( "Failed to write journal %s: errno=%d.",
+                        journal->config.path,
+                        errno ) );
+        }
+
+        journal->stats.syncTimeUs += Clock_GetTimeUs() - startTimeUs;
+    }
+
+    if( success && ( journal->config.snapshotRecords > 0U ) &&
+        ( journal->recordsSinceSnapshot >= journal->config.snapshotRecords ) )
+    {
+        startTimeUs = Clock_GetTimeUs();
+        success = compact( journal );
+        journal->stats.syncTimeUs += Clock_GetTimeUs() - startTimeUs;
+    }
+
+    return success;
+}
+
+void ResumeJournal_Close( ResumeJournalContext_t * journal,
+                          bool remove )
+{
+    assert( journal != NULL );
+
+    if( !remove )
+    {
+        ( void ) ResumeJournal_Sync( journal );
+    }
+
+    if( journal->fd >= 0 )
+    {
+        ( void ) close( journal->fd );
+        journal->fd = -1;
+    }
+
+    if( remove && ( unlink( journal->config.path ) != 0 ) &&
+        ( errno != ENOENT ) )
+    {
+        LogWarn( ( "Failed to remove journal %s.", journal->config.path ) );
+    }
+
+    free( journal->bitmap );
+    journal->bitmap = NULL;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file resume_journal_posix.h
+ * @brief Crash-consistent record of the blocks of a download already stored.
+ *
+ * The journal starts with a header naming the job and the file being
+ * downloaded. It is followed by an append-only sequence of records, each
+ * protected by a CRC:
+ * - range records, each marking a run of blocks as stored, and
+ * - snapshot records, each holding the whole block bitmap.
+ *
+ * Records are batched in memory and written with a single write followed by
+ * one fdatasync. This trades the number of blocks that may have to be
+ * downloaded again after a crash against the cost of syncing. After a number
+ * of range records the journal is compacted: a new file holding the header
+ * and one snapshot is written and renamed over the old one.
+ *
+ * A crash can leave a torn record at the end of the journal. Replay stops at
+ * the first record that fails its CRC check and drops everything after it.
+ */
+
+#ifndef RESUME_JOURNAL_POSIX_H_
+#define RESUME_JOURNAL_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Maximum length of the job ID stored in the journal.
+ */
+#define RESUME_JOURNAL_MAX_JOB_ID_LENGTH 64U
+
+/**
+ * @brief Size of the digest identifying the downloaded file.
+ */
+#define RESUME_JOURNAL_DIGEST_SIZE       32U
+
+/**
+ * @brief Maximum number of range records batched in memory.
+ */
+#define RESUME_JOURNAL_MAX_PENDING       32U
+
+/**
+ * @brief Settings of a journal.
+ */
+typedef struct ResumeJournalConfig
+{
+    const char * path;          /**< @brief Path of the journal file. */
+    const char * jobId;         /**< @brief ID of the job. */
+    size_t jobIdLength;         /**< @brief Length of the job ID. */
+    const uint8_t * fileDigest; /**< @brief #RESUME_JOURNAL_DIGEST_SIZE byte
+                                   digest identifying the file. */
+    uint32_t fileSize;          /**< @brief Size of the file. */
+    uint32_t blockCount;        /**< @brief Number of blocks of the file. */
+    uint32_t syncBlocks;        /**< @brief Blocks recorded before the
+                                   journal is synced; 1 syncs every record. */
+    uint32_t snapshotRecords;   /**< @brief Range records written before the
+                                   journal is compacted. */
+    int dataFd;                 /**< @brief File holding the blocks, synced
+                                   before the records describing them; -1 if
+                                   there is none. */
+} ResumeJournalConfig_t;
+
+/**
+ * @brief Counters describing the work done by the journal.
+ */
+typedef struct ResumeJournalStats
+{
+    uint32_t blocksRecovered; /**< @brief Blocks found stored on open. */
+    uint32_t rangeRecords;    /**< @brief Range records written. */
+    uint32_t snapshots;       /**< @brief Compactions into a snapshot. */
+    uint32_t syncs;           /**< @brief Batches synced to disk. */
+    uint64_t bytesWritten;    /**< @brief Bytes written to journal files. */
+    uint64_t syncTimeUs;      /**< @brief Time spent writing and syncing. */
+} ResumeJournalStats_t;
+
+/**
+ * @brief A run of blocks marked as stored.
+ */
+typedef struct ResumeJournalRange
+{
+    uint32_t firstBlock; /**< @brief First block of the run. */
+    uint32_t blockCount; /**< @brief Number of blocks in the run. */
+} ResumeJournalRange_t;
+
+/**
+ * @brief State of an open journal.
+ */
+typedef struct ResumeJournalContext
+{
+    ResumeJournalConfig_t config;                     /**< @brief Settings. */
+    char jobId[ RESUME_JOURNAL_MAX_JOB_ID_LENGTH ];   /**< @brief Job ID. */
+    uint8_t fileDigest[ RESUME_JOURNAL_DIGEST_SIZE ]; /**< @brief File digest. */
+    int fd;                                           /**< @brief Journal file. */
+    uint8_t * bitmap;                                 /**< @brief Bit per block
+                                                         stored. */
+
+    /**
+     * @brief Records not written to the journal yet.
+     */
+    ResumeJournalRange_t pending[ RESUME_JOURNAL_MAX_PENDING ];
+    uint32_t pendingCount;         /**< @brief Number of pending records. */
+    uint32_t pendingBlocks;        /**< @brief Blocks in pending records. */
+    uint32_t recordsSinceSnapshot; /**< @brief Range records in the file. */
+    ResumeJournalStats_t stats;    /**< @brief Work counters. */
+} ResumeJournalContext_t;
+
+/**
+ * @brief Open the journal of a download, replaying what it recorded.
+ *
+ * An existing journal is only replayed when it belongs to the same job and
+ * file, otherwise it is replaced by an empty one.
+ *
+ * @param[out] journal Context to initialize.
+ * @param[in] config Settings, copied into the context. The path must stay
+ * valid.
+ *
+ * @return true on success.
+ */
+bool ResumeJournal_Open( ResumeJournalContext_t * journal,
+                         const ResumeJournalConfig_t * config );
+
+/**
+ * @brief Check if a block was recorded as stored.
+ *
+ * @param[in] journal Journal.
+ * @param[in] blockId Index of the block.
+ *
+ * @return true if the block does not need to be downloaded again.
+ */
+bool ResumeJournal_IsBlockStored( const ResumeJournalContext_t * journal,
+                                  uint32_t blockId );
+
+/**
+ * @brief Record a run of blocks as stored.
+ *
+ * The record is written once enough blocks are batched.
+ *
+ * @param[in] journal Journal.
+ * @param[in] firstBlock First block of the run.
+ * @param[in] blockCount Number of blocks in the run.
+ *
+ * @return true on success; false if writing the journal failed.
+ */
+bool ResumeJournal_RecordBlocks( ResumeJournalContext_t * journal,
+                                 uint32_t firstBlock,
+                                 uint32_t blockCount );
+
+/**
+ * @brief Write and sync all batched records.
+ *
+ * @param[in] journal Journal.
+ *
+ * @return true on success.
+ */
+bool ResumeJournal_Sync( ResumeJournalContext_t * journal );
+
+/**
+ * @brief Sync and close the journal.
+ *
+ * @param[in] journal Journal.
+ * @param[in] remove Delete the journal file, e.g. once the download is
+ * installed.
+ */
+void ResumeJournal_Close( ResumeJournalContext_t * journal,
+                          bool remove );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef RESUME_JOURNAL_POSIX_H_ */
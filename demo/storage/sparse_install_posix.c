@@ -0,0 +1,370 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file sparse_install_posix.c
+ * @brief Implementation of the sparse install for Linux.
+ */
+
+/* copy_file_range() is a GNU extension. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#define LIBRARY_LOG_NAME  "SparseInstall"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/* Linux includes. */
+#include <linux/fs.h>
+
+/* OpenSSL includes. */
+#include <openssl/sha.h>
+
+#include "sparse_install_posix.h"
+#include "utils/clock.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Size of the buffer used when the kernel cannot copy the file.
+ */
+#define SPARSE_INSTALL_COPY_BUFFER_SIZE 4096U
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Copy a file with copy_file_range.
+ *
+ * @return true if the whole file was copied.
+ */
+static bool copyInKernel( SparseInstallContext_t * install,
+                          int sourceFd );
+
+/**
+ * @brief Copy a file through a user space buffer.
+ *
+ * @return true if the whole file was copied.
+ */
+static bool copyInUserSpace( SparseInstallContext_t * install,
+                             int sourceFd );
+
+/**
+ * @brief Make the update slot a copy of the running image.
+ *
+ * Tries the cheapest method first.
+ *
+ * @return true on success.
+ */
+static bool cloneImage( SparseInstallContext_t * install,
+                        int sourceFd );
+
+/*-----------------------------------------------------------*/
+
+static bool copyInKernel( SparseInstallContext_t * install,
+                          int sourceFd )
+{
+    ssize_t copied = 0;
+    bool success = true;
+
+    do
+    {
+        copied = copy_file_range( sourceFd, NULL, install->fd, NULL,
+                                  SIZE_MAX >> 1, 0U );
+
+        if( copied > 0 )
+        {
+            install->stats.bytesCopied += ( uint64_t ) copied;
+        }
+        else if( ( copied < 0 ) && ( errno != EINTR ) )
+        {
+            success = false;
+        }
+        else
+        {
+            /* Empty else. */
+        }
+    } while( success && ( copied != 0 ) );
+
+    return success;
+}
+
+static bool copyInUserSpace( SparseInstallContext_t * install,
+                             int sourceFd )
+{
+    uint8_t buffer[ SPARSE_INSTALL_COPY_BUFFER_SIZE ];
+    ssize_t bytesRead = 0;
+    ssize_t written = 0;
+    bool success = true;
+
+    /* A failed copy_file_range may have moved the file offsets. */
+    success = ( lseek( sourceFd, 0, SEEK_SET ) == 0 ) &&
+              ( lseek( install->fd, 0, SEEK_SET ) == 0 ) &&
+              ( ftruncate( install->fd, 0 ) == 0 );
+    install->stats.bytesCopied = 0U;
+
+    while( success )
+    {
+        bytesRead = read( sourceFd, buffer, sizeof( buffer ) );
+
+        if( bytesRead == 0 )
+        {
+            break;
+        }
+        else if( bytesRead < 0 )
+        {
+            success = ( errno == EINTR );
+            continue;
+        }
+        else
+        {
+            /* Empty else. */
+        }
+
+        written = 0;
+
+        while( success && ( written < bytesRead ) )
+        {
+            ssize_t result = write( install->fd,
+                                    &buffer[ written ],
+                                    ( size_t ) ( bytesRead - written ) );
+
+            if( result > 0 )
+            {
+                written += result;
+            }
+            else
+            {
+                success = ( result < 0 ) && ( errno == EINTR );
+            }
+        }
+
+        install->stats.bytesCopied += ( uint64_t ) written;
+    }
+
+    return success;
+}
+
+static bool cloneImage( SparseInstallContext_t * install,
+                        int sourceFd )
+{
+    bool success = false;
+
+    #ifdef FICLONE
+        if( ioctl( install->fd, FICLONE, sourceFd ) == 0 )
+        {
+            install->stats.method = SPARSE_CLONE_REFLINK;
+            success = true;
+        }
+        else
+        {
+            LogDebug( ( "FICLONE not supported: errno=%d.", errno ) );
+        }
+    #endif
+
+    if( !success && copyInKernel( install, sourceFd ) )
+    {
+        install->stats.method = SPARSE_CLONE_COPY_FILE_RANGE;
+        success = true;
+    }
+
+    if( !success && copyInUserSpace( install, sourceFd ) )
+    {
+        install->stats.method = SPARSE_CLONE_READ_WRITE;
+        success = true;
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+bool SparseInstall_Open( SparseInstallContext_t * install,
+                         const char * activePath,
+                         const char * updatePath,
+                         uint32_t imageSize,
+                         uint32_t blockSize )
+{
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    bool success = true;
+    int sourceFd = -1;
+
+    assert( install != NULL );
+    assert( activePath != NULL );
+    assert( updatePath != NULL );
+
+    memset( install, 0x00, sizeof( SparseInstallContext_t ) );
+    install->fd = -1;
+    install->blockSize = blockSize;
+    install->imageSize = imageSize;
+
+    if( blockSize == 0U )
+    {
+        LogError( ( "Invalid block size." ) );
+        success = false;
+    }
+
+    if( success )
+    {
+        install->blockBuffer = ( uint8_t * ) malloc( blockSize );
+        sourceFd = open( activePath, O_RDONLY );
+        install->fd = open( updatePath, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+
+        if( ( install->blockBuffer == NULL ) || ( sourceFd < 0 ) ||
+            ( install->fd < 0 ) )
+        {
+            LogError( ( "Failed to open %s and %s: errno=%d.",
+                        activePath,
+                        updatePath,
+                        errno ) );
+            success = false;
+        }
+    }
+
+    if( success )
+    {
+        success = cloneImage( install, sourceFd );
+        install->stats.cloneTimeUs = Clock_GetTimeUs() - startTimeUs;
+
+        if( success )
+        {
+            LogInfo( ( "Cloned %s into %s in %llu us, %llu bytes copied.",
+                       activePath,
+                       updatePath,
+                       ( unsigned long long ) install->stats.cloneTimeUs,
+                       ( unsigned long long ) install->stats.bytesCopied ) );
+        }
+        else
+        {
+            LogError( ( "Failed to clone %s: errno=%d.", activePath, errno ) );
+        }
+    }
+
+    if( sourceFd >= 0 )
+    {
+        ( void ) close( sourceFd );
+    }
+
+    if( !success )
+    {
+        SparseInstall_Close( install );
+    }
+
+    return success;
+}
+
+bool SparseInstall_IsBlockCurrent( SparseInstallContext_t * install,
+                                   uint32_t blockId,
+                                   const uint8_t * digest )
+{
+    uint8_t localDigest[ SHA256_DIGEST_LENGTH ];
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    uint64_t offset = ( uint64_t ) blockId * install->blockSize;
+    size_t length = install->blockSize;
+    ssize_t bytesRead = 0;
+    bool current = false;
+
+    assert( install != NULL );
+    assert( digest != NULL );
+
+    if( offset < install->imageSize )
+    {
+        if( ( offset + length ) > install->imageSize )
+        {
+            length = ( size_t ) ( install->imageSize - offset );
+        }
+
+        bytesRead = pread( install->fd,
+                           install->blockBuffer,
+                           length,
+                           ( off_t ) offset );
+
+        /* Blocks past the end of the old image never match. */
+        if( bytesRead == ( ssize_t ) length )
+        {
+            ( void ) SHA256( install->blockBuffer, length, localDigest );
+            current = memcmp( localDigest,
+                              digest,
+                              SPARSE_INSTALL_DIGEST_SIZE ) == 0;
+        }
+    }
+
+    if( current )
+    {
+        install->stats.blocksReused++;
+    }
+    else
+    {
+        install->stats.blocksChanged++;
+    }
+
+    install->stats.digestTimeUs += Clock_GetTimeUs() - startTimeUs;
+
+    return current;
+}
+
+bool SparseInstall_WriteBlock( SparseInstallContext_t * install,
+                               uint32_t blockId,
+                               const uint8_t * data,
+                               size_t length )
+{
+    off_t offset = ( off_t ) blockId * install->blockSize;
+    ssize_t written = 0;
+    bool success = false;
+
+    assert( install != NULL );
+    assert( data != NULL );
+
+    if( ( length <= install->blockSize ) &&
+        ( ( uint64_t ) offset + length <= install->imageSize ) )
+    {
+        do
+        {
+            written = pwrite( install->fd, data, length, offset );
+        } while( ( written < 0 ) && ( errno == EINTR ) );
+
+        success = written == ( ssize_t ) length;
+    }
+
+    if( success )
+    {
+        install->stats.bytesWritten += length;
+    }
+    else
+    {
+        LogError( ( "Failed to write block %u.", blockId ) );
+    }
+
+    return success;
+}
+
+void SparseInstall_Close( SparseInstallContext_t * install )
+{
+    assert( install != NULL );
+
+    if( install->fd >= 0 )
+    {
+        ( void ) close( install->fd );
+        install->fd = -1;
+    }
+
+    free( install->blockBuffer );
+    install->blockBuffer = NULL;
+}
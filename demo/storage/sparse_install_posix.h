@@ -0,0 +1,138 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file sparse_install_posix.h
+ * @brief Installs an image by patching a clone of the running image.
+ *
+ * When a new image differs from the running one in only a few blocks, the
+ * running image is cloned into the update slot and only the blocks whose
+ * SHA-256 digest differs are downloaded and written over the clone. On
+ * filesystems with shared extents (btrfs, XFS) the clone is a reflink and
+ * copies no data at all. Other filesystems fall back to copy_file_range, and
+ * finally to a plain read/write copy.
+ */
+
+#ifndef SPARSE_INSTALL_POSIX_H_
+#define SPARSE_INSTALL_POSIX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of the digest of one block.
+ */
+#define SPARSE_INSTALL_DIGEST_SIZE 32U
+
+/**
+ * @brief How the running image was cloned.
+ */
+typedef enum SparseCloneMethod
+{
+    SPARSE_CLONE_NONE = 0,        /**< Nothing was cloned. */
+    SPARSE_CLONE_REFLINK,         /**< Extents shared with FICLONE. */
+    SPARSE_CLONE_COPY_FILE_RANGE, /**< Copied in the kernel. */
+    SPARSE_CLONE_READ_WRITE       /**< Copied through a user buffer. */
+} SparseCloneMethod_t;
+
+/**
+ * @brief Counters describing a sparse install.
+ */
+typedef struct SparseInstallStats
+{
+    SparseCloneMethod_t method; /**< @brief How the clone was made. */
+    uint64_t cloneTimeUs;       /**< @brief Time spent cloning. */
+    uint64_t bytesCopied;       /**< @brief Bytes copied to make the clone,
+                                   zero for a reflink. */
+    uint64_t digestTimeUs;      /**< @brief Time spent hashing blocks. */
+    uint32_t blocksReused;      /**< @brief Blocks kept from the clone. */
+    uint32_t blocksChanged;     /**< @brief Blocks that must be downloaded. */
+    uint64_t bytesWritten;      /**< @brief Bytes of downloaded blocks. */
+} SparseInstallStats_t;
+
+/**
+ * @brief State of one sparse install.
+ */
+typedef struct SparseInstallContext
+{
+    int fd;                     /**< @brief Descriptor of the update slot. */
+    uint32_t blockSize;         /**< @brief Size of a digest block. */
+    uint32_t imageSize;         /**< @brief Size of the new image. */
+    uint8_t * blockBuffer;      /**< @brief Scratch buffer of one block. */
+    SparseInstallStats_t stats; /**< @brief Work counters. */
+} SparseInstallContext_t;
+
+/**
+ * @brief Clone the running image into the update slot.
+ *
+ * @param[out] install Context to initialize.
+ * @param[in] activePath File holding the running image.
+ * @param[in] updatePath File receiving the new image. Its contents are
+ * replaced.
+ * @param[in] imageSize Size of the new image.
+ * @param[in] blockSize Size of the blocks the digests are computed over.
+ *
+ * @return true on success.
+ */
+bool SparseInstall_Open( SparseInstallContext_t * install,
+                         const char * activePath,
+                         const char * updatePath,
+                         uint32_t imageSize,
+                         uint32_t blockSize );
+
+/**
+ * @brief Check if a block of the clone already holds the new data.
+ *
+ * @param[in] install Sparse install.
+ * @param[in] blockId Index of the block.
+ * @param[in] digest Expected SHA-256 digest of the block.
+ *
+ * @return true if the block can be kept; false if it must be downloaded.
+ */
+bool SparseInstall_IsBlockCurrent( SparseInstallContext_t * install,
+                                   uint32_t blockId,
+                                   const uint8_t * digest );
+
+/**
+ * @brief Write a downloaded block over the clone.
+ *
+ * @param[in] install Sparse install.
+ * @param[in] blockId Index of the block.
+ * @param[in] data Block data.
+ * @param[in] length Length of the block.
+ *
+ * @return true on success.
+ */
+bool SparseInstall_WriteBlock( SparseInstallContext_t * install,
+                               uint32_t blockId,
+                               const uint8_t * data,
+                               size_t length );
+
+/**
+ * @brief Close the update slot.
+ *
+ * @param[in] install Sparse install.
+ */
+void SparseInstall_Close( SparseInstallContext_t * install );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef SPARSE_INSTALL_POSIX_H_ */
@@ -0,0 +1,497 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file write_coalescer.c
+ * @brief Implementation of the write coalescer.
+ */
+
+#define LIBRARY_LOG_NAME  "WriteCoalescer"
+#define LIBRARY_LOG_LEVEL LOG_INFO
+#include "csdk_logging/logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/clock.h"
+#include "write_coalescer.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief States of a coalescer buffer.
+ */
+#define UNIT_FREE    0U
+#define UNIT_FILLING 1U
+#define UNIT_WRITING 2U
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Hand a range of a unit to the sink and account for it.
+ *
+ * @return true if the write was started.
+ */
+static bool writeRange( WriteCoalescerContext_t * coalescer,
+                        WriteCoalescerUnit_t * unit,
+                        uint32_t start,
+                        uint32_t length,
+                        bool partial );
+
+/**
+ * @brief Write a unit to the sink.
+ *
+ * Complete units are written with a single aligned write. Of partially filled
+ * units only the aligned pages holding received blocks are written, one write
+ * per contiguous run of such pages.
+ *
+ * @return true if all writes were started.
+ */
+static bool writeUnit( WriteCoalescerContext_t * coalescer,
+                       WriteCoalescerUnit_t * unit );
+
+/**
+ * @brief Check whether any page of the write alignment in a range of the
+ * image was written already.
+ */
+static bool isRangeWritten( const WriteCoalescerContext_t * coalescer,
+                            uint32_t offset,
+                            size_t length );
+
+/**
+ * @brief Find the open unit covering an image offset, or open a new one.
+ *
+ * @return The unit, or NULL if a write to the sink failed.
+ */
+static WriteCoalescerUnit_t * getUnit( WriteCoalescerContext_t * coalescer,
+                                       uint32_t unitOffset );
+
+/*-----------------------------------------------------------*/
+
+static bool writeRange( WriteCoalescerContext_t * coalescer,
+                        WriteCoalescerUnit_t * unit,
+                        uint32_t start,
+                        uint32_t length,
+                        bool partial )
+{
+    uint64_t startTimeUs = Clock_GetTimeUs();
+    uint64_t writeTimeUs = 0U;
+    uint32_t page = 0U;
+    bool success = false;
+
+    for( page = ( unit->offset + start ) / coalescer->config.writeAlignment;
+         page < ( unit->offset + start + length ) / coalescer->config.writeAlignment;
+         page++ )
+    {
+        coalescer->writtenPages[ page / 8U ] |= ( uint8_t ) ( 1U << ( page % 8U ) );
+    }
+
+    success = coalescer->config.write( coalescer->config.sinkContext,
+                                       unit->offset + start,
+                                       &unit->buffer[ start ],
+                                       length );
+
+    writeTimeUs = Clock_GetTimeUs() - startTimeUs;
+    coalescer->stats.writeTimeUs += writeTimeUs;
+    coalescer->stats.bytesWritten += length;
+
+    if( writeTimeUs > coalescer->stats.maxWriteTimeUs )
+    {
+        coalescer->stats.maxWriteTimeUs = writeTimeUs;
+    }
+
+    if( partial )
+    {
+        coalescer->stats.partialUnitWrites++;
+    }
+    else
+    {
+        coalescer->stats.fullUnitWrites++;
+    }
+
+    if( !success )
+    {
+        LogError( ( "Failed to write %u bytes at offset %u.",
+                    length,
+                    unit->offset + start ) );
+    }
+
+    return success;
+}
+
+static bool writeUnit( WriteCoalescerContext_t * coalescer,
+                       WriteCoalescerUnit_t * unit )
+{
+    const WriteCoalescerConfig_t * config = &coalescer->config;
+    uint32_t blocks = config->unitSize / config->blockSize;
+    uint32_t length = 0U;
+    uint32_t block = 0U;
+    uint32_t runStart = 0U;
+    uint32_t start = 0U;
+    uint32_t end = 0U;
+    uint32_t pendingStart = 0U;
+    uint32_t pendingEnd = 0U;
+    bool success = true;
+
+    if( unit->filledMask == unit->expectedMask )
+    {
+        /* The last unit of the image may be shorter than a full unit. */
+        length = config->imageSize - unit->offset;
+        length = ( length < config->unitSize ) ? length : config->unitSize;
+        length = ( ( length + config->writeAlignment - 1U ) /
+                   config->writeAlignment ) *
+                 config->writeAlignment;
+        length = ( length < config->unitSize ) ? length : config->unitSize;
+
+        success = writeRange( coalescer, unit, 0U, length, false );
+    }
+    else
+    {
+        for( block = 0U; success && ( block < blocks ); block++ )
+        {
+            if( ( unit->filledMask & ( 1ULL << block ) ) == 0U )
+            {
+                continue;
+            }
+
+            runStart = block;
+
+            while( ( ( block + 1U ) < blocks ) &&
+                   ( ( unit->filledMask & ( 1ULL << ( block + 1U ) ) ) != 0U ) )
+            {
+                block++;
+            }
+
+            /* The run widened to whole pages, the missing blocks are
+             * padding. */
+            start = runStart * config->blockSize;
+            start -= start % config->writeAlignment;
+            end = ( block + 1U ) * config->blockSize;
+            end = ( ( unit->offset + end ) > config->imageSize ) ?
+                  config->imageSize - unit->offset : end;
+            end = ( ( end + config->writeAlignment - 1U ) /
+                    config->writeAlignment ) *
+                  config->writeAlignment;
+            end = ( end < config->unitSize ) ? end : config->unitSize;
+
+            /* Runs sharing a page go out in one write. */
+            if( ( pendingEnd > pendingStart ) && ( start <= pendingEnd ) )
+            {
+                pendingEnd = end;
+            }
+            else
+            {
+                if( pendingEnd > pendingStart )
+                {
+                    success = writeRange( coalescer,
+                                          unit,
+                                          pendingStart,
+                                          pendingEnd - pendingStart,
+                                          true );
+                }
+
+                pendingStart = start;
+                pendingEnd = end;
+            }
+        }
+
+        if( success && ( pendingEnd > pendingStart ) )
+        {
+            success = writeRange( coalescer,
+                                  unit,
+                                  pendingStart,
+                                  pendingEnd - pendingStart,
+                                  true );
+        }
+    }
+
+    unit->state = UNIT_WRITING;
+
+    return success;
+}
+
+static bool isRangeWritten( const WriteCoalescerContext_t * coalescer,
+                            uint32_t offset,
+                            size_t length )
+{
+    uint32_t page = offset / coalescer->config.writeAlignment;
+    uint32_t lastPage = ( uint32_t ) ( ( offset + length - 1U ) /
+                                       coalescer->config.writeAlignment );
+    bool written = false;
+
+    for( ; !written && ( page <= lastPage ); page++ )
+    {
+        written = ( coalescer->writtenPages[ page / 8U ] &
+                    ( 1U << ( page % 8U ) ) ) != 0U;
+    }
+
+    return written;
+}
+
+static WriteCoalescerUnit_t * getUnit( WriteCoalescerContext_t * coalescer,
+                                       uint32_t unitOffset )
+{
+    const WriteCoalescerConfig_t * config = &coalescer->config;
+    WriteCoalescerUnit_t * unit = NULL;
+    WriteCoalescerUnit_t * oldest = NULL;
+    uint32_t filling = 0U;
+    uint32_t blocks = 0U;
+    uint32_t unitLength = 0U;
+    uint64_t waitStartUs = 0U;
+    uint32_t i = 0U;
+    bool success = true;
+
+    for( i = 0U; i < coalescer->unitCount; i++ )
+    {
+        if( coalescer->units[ i ].state == UNIT_FILLING )
+        {
+            if( coalescer->units[ i ].offset == unitOffset )
+            {
+                unit = &coalescer->units[ i ];
+                break;
+            }
+
+            if( ( oldest == NULL ) ||
+                ( coalescer->units[ i ].offset < oldest->offset ) )
+            {
+                oldest = &coalescer->units[ i ];
+            }
+
+            filling++;
+        }
+    }
+
+    /* All open units are taken by blocks far apart, give up on the lowest
+     * one and write what it has. */
+    if( ( unit == NULL ) && ( filling >= config->openUnits ) )
+    {
+        LogDebug( ( "Evicting unit at offset %u.", oldest->offset ) );
+        coalescer->stats.evictions++;
+        success = writeUnit( coalescer, oldest );
+    }
+
+    for( i = 0U; ( unit == NULL ) && ( i < coalescer->unitCount ); i++ )
+    {
+        if( coalescer->units[ i ].state == UNIT_FREE )
+        {
+            unit = &coalescer->units[ i ];
+        }
+    }
+
+    /* Every other buffer is still being written, wait for the sink. */
+    if( unit == NULL )
+    {
+        waitStartUs = Clock_GetTimeUs();
+
+        if( config->wait != NULL )
+        {
+            config->wait( config->sinkContext );
+        }
+
+        coalescer->stats.bufferWaitUs += Clock_GetTimeUs() - waitStartUs;
+
+        for( i = 0U; i < coalescer->unitCount; i++ )
+        {
+            if( coalescer->units[ i ].state == UNIT_WRITING )
+            {
+                coalescer->units[ i ].state = UNIT_FREE;
+
+                if( unit == NULL )
+                {
+                    unit = &coalescer->units[ i ];
+                }
+            }
+        }
+    }
+
+    if( success && ( unit != NULL ) && ( unit->state == UNIT_FREE ) )
+    {
+        unitLength = config->imageSize - unitOffset;
+        unitLength = ( unitLength < config->unitSize ) ? unitLength
+                                                       : config->unitSize;
+        blocks = ( unitLength + config->blockSize - 1U ) / config->blockSize;
+
+        memset( unit->buffer, config->padByte, config->unitSize );
+        unit->offset = unitOffset;
+        unit->filledMask = 0U;
+        unit->expectedMask = ( blocks == 64U ) ? UINT64_MAX
+                                               : ( ( 1ULL << blocks ) - 1U );
+        unit->state = UNIT_FILLING;
+    }
+
+    return success ? unit : NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+bool WriteCoalescer_Init( WriteCoalescerContext_t * coalescer,
+                          const WriteCoalescerConfig_t * config )
+{
+    bool success = true;
+    uint32_t pageCount = 0U;
+    uint32_t i = 0U;
+
+    assert( coalescer != NULL );
+    assert( config != NULL );
+
+    memset( coalescer, 0x00, sizeof( WriteCoalescerContext_t ) );
+
+    if( ( config->write == NULL ) || ( config->blockSize == 0U ) ||
+        ( config->writeAlignment == 0U ) || ( config->openUnits == 0U ) ||
+        ( config->unitSize < config->blockSize ) ||
+        ( ( config->unitSize % config->blockSize ) != 0U ) ||
+        ( ( config->unitSize % config->writeAlignment ) != 0U ) ||
+        ( ( config->unitSize / config->blockSize ) >
+          WRITE_COALESCER_MAX_BLOCKS_PER_UNIT ) ||
+        ( config->openUnits >= WRITE_COALESCER_MAX_BUFFERS ) )
+    {
+        LogError( ( "Invalid write coalescer configuration." ) );
+        success = false;
+    }
+
+    if( success )
+    {
+        coalescer->config = *config;
+        coalescer->unitCount = config->openUnits + 1U;
+
+        /* Writes of the last unit may be padded past the end of the image. */
+        pageCount = ( ( config->imageSize + config->unitSize - 1U ) /
+                      config->unitSize ) *
+                    ( config->unitSize / config->writeAlignment );
+        coalescer->writtenPages = ( uint8_t * ) calloc( ( pageCount / 8U ) + 1U,
+                                                        sizeof( uint8_t ) );
+        success = coalescer->writtenPages != NULL;
+
+        for( i = 0U; success && ( i < coalescer->unitCount ); i++ )
+        {
+            coalescer->units[ i ].buffer = ( uint8_t * ) malloc(
+                config->unitSize );
+            success = coalescer->units[ i ].buffer != NULL;
+        }
+
+        if( !success )
+        {
+            WriteCoalescer_Deinit( coalescer );
+        }
+    }
+
+    return success;
+}
+
+bool WriteCoalescer_Write( WriteCoalescerContext_t * coalescer,
+                           uint32_t offset,
+                           const uint8_t * data,
+                           size_t length )
+{
+    const WriteCoalescerConfig_t * config = NULL;
+    WriteCoalescerUnit_t * unit = NULL;
+    uint32_t unitOffset = 0U;
+    uint32_t block = 0U;
+    bool success = true;
+
+    assert( coalescer != NULL );
+
+    config = &coalescer->config;
+
+    if( ( data == NULL ) || ( length == 0U ) ||
+        ( length > config->blockSize ) ||
+        ( ( offset % config->blockSize ) != 0U ) ||
+        ( ( ( uint64_t ) offset + length ) > config->imageSize ) )
+    {
+        LogError( ( "Invalid block of %lu bytes at offset %u.",
+                    ( unsigned long ) length,
+                    offset ) );
+        success = false;
+    }
+    else if( isRangeWritten( coalescer, offset, length ) )
+    {
+        /* Its unit was evicted and the page padded, programming it again
+         * is not allowed on every flash. */
+        LogError( ( "Block at offset %u arrived after its page was written.",
+                    offset ) );
+        coalescer->stats.rejectedBlocks++;
+        success = false;
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    if( success )
+    {
+        unitOffset = offset - ( offset % config->unitSize );
+        unit = getUnit( coalescer, unitOffset );
+        success = unit != NULL;
+    }
+
+    if( success )
+    {
+        block = ( offset - unitOffset ) / config->blockSize;
+        memcpy( &unit->buffer[ offset - unitOffset ], data, length );
+        unit->filledMask |= 1ULL << block;
+        coalescer->stats.blocksReceived++;
+
+        if( unit->filledMask == unit->expectedMask )
+        {
+            success = writeUnit( coalescer, unit );
+        }
+    }
+
+    return success;
+}
+
+bool WriteCoalescer_Flush( WriteCoalescerContext_t * coalescer )
+{
+    bool success = true;
+    uint32_t i = 0U;
+
+    assert( coalescer != NULL );
+
+    for( i = 0U; i < coalescer->unitCount; i++ )
+    {
+        if( coalescer->units[ i ].state == UNIT_FILLING )
+        {
+            success = writeUnit( coalescer, &coalescer->units[ i ] ) &&
+                      success;
+        }
+    }
+
+    if( coalescer->config.wait != NULL )
+    {
+        coalescer->config.wait( coalescer->config.sinkContext );
+    }
+
+    for( i = 0U; i < coalescer->unitCount; i++ )
+    {
+        coalescer->units[ i ].state = UNIT_FREE;
+    }
+
+    return success;
+}
+
+void WriteCoalescer_Deinit( WriteCoalescerContext_t * coalescer )
+{
+    uint32_t i = 0U;
+
+    assert( coalescer != NULL );
+
+    for( i = 0U; i < WRITE_COALESCER_MAX_BUFFERS; i++ )
+    {
+        free( coalescer->units[ i ].buffer );
+        coalescer->units[ i ].buffer = NULL;
+        coalescer->units[ i ].state = UNIT_FREE;
+    }
+
+    free( coalescer->writtenPages );
+    coalescer->writtenPages = NULL;
+
+    coalescer->unitCount = 0U;
+}
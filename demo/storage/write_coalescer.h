@@ -0,0 +1,183 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file write_coalescer.h
+ * @brief Assembles small download blocks into aligned write units.
+ *
+ * Blocks arrive in small, possibly out of order, pieces. The coalescer
+ * collects them in buffers of one write unit (a flash page, an erase unit or
+ * an eMMC sector group) and only hands complete, aligned units to the sink.
+ * One buffer more than the number of open units is kept, so a complete unit
+ * can be written while the next one is being filled.
+ */
+
+#ifndef WRITE_COALESCER_H_
+#define WRITE_COALESCER_H_
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Maximum number of buffers, open units and the write buffer.
+ */
+#define WRITE_COALESCER_MAX_BUFFERS 8U
+
+/**
+ * @brief Maximum number of blocks in one write unit.
+ */
+#define WRITE_COALESCER_MAX_BLOCKS_PER_UNIT 64U
+
+/**
+ * @brief Start writing data to the sink.
+ *
+ * The sink may return before the write has finished. The data buffer stays
+ * untouched until the next call of the #WriteCoalescerWait_t function.
+ *
+ * @param[in] sinkContext Context given in #WriteCoalescerConfig_t.
+ * @param[in] offset Offset of the data in the image.
+ * @param[in] data Data to write.
+ * @param[in] length Length of the data.
+ *
+ * @return true if the write was started.
+ */
+typedef bool ( * WriteCoalescerWrite_t )( void * sinkContext,
+                                          uint32_t offset,
+                                          const uint8_t * data,
+                                          size_t length );
+
+/**
+ * @brief Wait for all started writes of the sink to finish.
+ *
+ * @param[in] sinkContext Context given in #WriteCoalescerConfig_t.
+ */
+typedef void ( * WriteCoalescerWait_t )( void * sinkContext );
+
+/**
+ * @brief Configuration of a write coalescer.
+ */
+typedef struct WriteCoalescerConfig
+{
+    uint32_t unitSize;           /**< @brief Size of the aligned write
+                                    unit. */
+    uint32_t blockSize;          /**< @brief Size of the incoming blocks. */
+    uint32_t writeAlignment;     /**< @brief Every write starts and ends on
+                                    a multiple of this size, padded where
+                                    blocks are missing, e.g. the page size
+                                    of a NAND device. Each such page is
+                                    written at most once. */
+    uint32_t imageSize;          /**< @brief Size of the whole image. */
+    uint32_t openUnits;          /**< @brief Number of partially filled units
+                                    kept for out of order blocks. */
+    uint8_t padByte;             /**< @brief Value of padding bytes. */
+    WriteCoalescerWrite_t write; /**< @brief Starts a write to the sink. */
+    WriteCoalescerWait_t wait;   /**< @brief Waits for the sink to finish. */
+    void * sinkContext;          /**< @brief Passed to the sink functions. */
+} WriteCoalescerConfig_t;
+
+/**
+ * @brief Counters describing the writes issued to the sink.
+ */
+typedef struct WriteCoalescerStats
+{
+    uint32_t blocksReceived;    /**< @brief Blocks passed to the coalescer. */
+    uint32_t fullUnitWrites;    /**< @brief Writes of complete units. */
+    uint32_t partialUnitWrites; /**< @brief Writes of partially filled
+                                   units. */
+    uint32_t evictions;         /**< @brief Open units written early to make
+                                   room for another unit. */
+    uint32_t rejectedBlocks;    /**< @brief Blocks arriving for a page which
+                                   was written already. */
+    uint64_t bytesWritten;      /**< @brief Bytes handed to the sink. */
+    uint64_t writeTimeUs;       /**< @brief Time spent starting writes. */
+    uint64_t maxWriteTimeUs;    /**< @brief Longest time to start a write. */
+    uint64_t bufferWaitUs;      /**< @brief Time spent waiting for a buffer
+                                   still being written. */
+} WriteCoalescerStats_t;
+
+/**
+ * @brief One buffer of the coalescer.
+ */
+typedef struct WriteCoalescerUnit
+{
+    uint8_t * buffer;      /**< @brief Data of the unit. */
+    uint32_t offset;       /**< @brief Offset of the unit in the image. */
+    uint64_t filledMask;   /**< @brief Bit per block received. */
+    uint64_t expectedMask; /**< @brief Bit per block of the unit. */
+    uint8_t state;         /**< @brief Free, filling or being written. */
+} WriteCoalescerUnit_t;
+
+/**
+ * @brief State of a write coalescer.
+ */
+typedef struct WriteCoalescerContext
+{
+    WriteCoalescerConfig_t config; /**< @brief Configuration. */
+    uint32_t unitCount;            /**< @brief Number of buffers in use. */
+    uint8_t * writtenPages;        /**< @brief Bit per page of the write
+                                      alignment handed to the sink. */
+    WriteCoalescerStats_t stats;   /**< @brief Write counters. */
+
+    /**
+     * @brief Buffers of the open units and the unit being written.
+     */
+    WriteCoalescerUnit_t units[ WRITE_COALESCER_MAX_BUFFERS ];
+} WriteCoalescerContext_t;
+
+/**
+ * @brief Initialize a write coalescer and allocate its buffers.
+ *
+ * @param[out] coalescer Coalescer to initialize.
+ * @param[in] config Configuration, copied into the coalescer.
+ *
+ * @return true on success; false if the configuration is invalid or the
+ * buffers could not be allocated.
+ */
+bool WriteCoalescer_Init( WriteCoalescerContext_t * coalescer,
+                          const WriteCoalescerConfig_t * config );
+
+/**
+ * @brief Add a block to the coalescer.
+ *
+ * The block is written to the sink once its unit is complete. A block of
+ * a page which was written already, padded after its unit was evicted, can
+ * no longer be written and is rejected.
+ *
+ * @param[in] coalescer Coalescer.
+ * @param[in] offset Offset of the block in the image, block aligned.
+ * @param[in] data Data of the block.
+ * @param[in] length Length of the block, at most the block size.
+ *
+ * @return true on success; false if the block is invalid, its page was
+ * written already or a write to the sink failed.
+ */
+bool WriteCoalescer_Write( WriteCoalescerContext_t * coalescer,
+                           uint32_t offset,
+                           const uint8_t * data,
+                           size_t length );
+
+/**
+ * @brief Write all open units to the sink and wait for the sink to finish.
+ *
+ * @param[in] coalescer Coalescer.
+ *
+ * @return true if all writes succeeded.
+ */
+bool WriteCoalescer_Flush( WriteCoalescerContext_t * coalescer );
+
+/**
+ * @brief Release the buffers of the coalescer without writing them.
+ *
+ * @param[in] coalescer Coalescer.
+ */
+void WriteCoalescer_Deinit( WriteCoalescerContext_t * coalescer );
+
+#endif /* ifndef WRITE_COALESCER_H_ */
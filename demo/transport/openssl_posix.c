@@ -13,12 +13,18 @@
 
 /* Standard includes. */
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 
 /* POSIX socket includes. */
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 /* Transport interface include. */
@@ -28,6 +34,36 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 
+/**
+ * @brief Longest wait for the socket in #Openssl_Send on a non-blocking
+ * socket, before returning zero to be retried.
+ */
+#define OPENSSL_SEND_RETRY_WAIT_MS    10
+
+/**
+ * @brief Whether kTLS can be asked of OpenSSL and the kernel.
+ */
+#if defined( __linux__ ) && defined( SSL_OP_ENABLE_KTLS ) && !defined( OPENSSL_NO_KTLS )
+    #include <linux/tls.h>
+    #define OPENSSL_KTLS_SUPPORTED    1
+#else
+    #define OPENSSL_KTLS_SUPPORTED    0
+#endif
+
+/**
+ * @brief Most segments sent by one sendmsg() with kTLS; the rest are sent
+ * by the retry.
+ */
+#define OPENSSL_KTLS_MAX_VECTORS                 8U
+
+/**
+ * @brief TLS content types and the handshake message type looked at when
+ * receiving with kTLS.
+ */
+#define OPENSSL_KTLS_RECORD_HANDSHAKE            22U
+#define OPENSSL_KTLS_RECORD_APPLICATION_DATA     23U
+#define OPENSSL_KTLS_HANDSHAKE_SESSION_TICKET    4U
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -127,6 +163,37 @@ static OpensslStatus_t tlsHandshake(
     OpensslParams_t * opensslParams,
     const OpensslCredentials_t * opensslCredentials );
 
+/**
+ * @brief Receive from a socket whose records the kernel decrypts.
+ *
+ * The kernel only returns application data; any other record comes with
+ * its type and is left to the caller. A session ticket is dropped, as
+ * sessions are not resumed; an alert or a key update ends the connection.
+ *
+ * @param[in] opensslParams Parameters of the session.
+ * @param[out] buffer Buffer to receive network data into.
+ * @param[in] bytesToRecv Number of bytes requested from the network.
+ *
+ * @return As #Openssl_Recv.
+ */
+static int32_t recvKtls( const OpensslParams_t * opensslParams,
+                         void * buffer,
+                         size_t bytesToRecv );
+
+/**
+ * @brief Send segments over a socket whose sends the kernel encrypts. One
+ * call sends one TLS record.
+ *
+ * @param[in] opensslParams Parameters of the session.
+ * @param[in] pIoVec Segments to send.
+ * @param[in] ioVecCount Number of segments.
+ *
+ * @return As #Openssl_Writev.
+ */
+static int32_t sendKtls( const OpensslParams_t * opensslParams,
+                         const TransportOutVector_t * pIoVec,
+                         size_t ioVecCount );
+
 /*-----------------------------------------------------------*/
 
 static OpensslStatus_t convertToOpensslStatus( SocketStatus_t socketStatus )
@@ -477,6 +544,131 @@ static void setOptionalConfigurations(
 }
 /*-----------------------------------------------------------*/
 
+static int32_t recvKtls( const OpensslParams_t * opensslParams,
+                         void * buffer,
+                         size_t bytesToRecv )
+{
+    int32_t bytesReceived = -1;
+
+    #if OPENSSL_KTLS_SUPPORTED
+        struct msghdr message;
+        struct iovec vector;
+        struct cmsghdr * controlHeader = NULL;
+        ssize_t received = 0;
+        uint8_t recordType = OPENSSL_KTLS_RECORD_APPLICATION_DATA;
+        union
+        {
+            struct cmsghdr header;
+            uint8_t buffer[ CMSG_SPACE( sizeof( uint8_t ) ) ];
+        } control;
+
+        vector.iov_base = buffer;
+        vector.iov_len = bytesToRecv;
+        memset( &message, 0x00, sizeof( message ) );
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof( control.buffer );
+
+        received = recvmsg( opensslParams->socketDescriptor, &message, 0 );
+        controlHeader = ( received > 0 ) ? CMSG_FIRSTHDR( &message ) : NULL;
+
+        if( ( controlHeader != NULL ) && ( controlHeader->cmsg_level == SOL_TLS ) &&
+            ( controlHeader->cmsg_type == TLS_GET_RECORD_TYPE ) )
+        {
+            recordType = *CMSG_DATA( controlHeader );
+        }
+
+        if( ( received > 0 ) && ( recordType == OPENSSL_KTLS_RECORD_APPLICATION_DATA ) )
+        {
+            bytesReceived = ( int32_t ) received;
+        }
+        else if( ( received > 0 ) && ( recordType == OPENSSL_KTLS_RECORD_HANDSHAKE ) &&
+                 ( ( ( uint8_t * ) buffer )[ 0 ] == OPENSSL_KTLS_HANDSHAKE_SESSION_TICKET ) )
+        {
+            bytesReceived = 0;
+        }
+        else if( received > 0 )
+        {
+            LogError( ( "Received a TLS record of type %u, which kTLS leaves to "
+                        "OpenSSL.",
+                        recordType ) );
+        }
+        else if( received == 0 )
+        {
+            LogError( ( "Failed to receive data over network: the peer closed "
+                        "socket %d.",
+                        opensslParams->socketDescriptor ) );
+        }
+        else if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+        {
+            bytesReceived = 0;
+        }
+        else
+        {
+            LogError( ( "Failed to receive data over network: recvmsg failed: "
+                        "errno=%d.",
+                        errno ) );
+        }
+    #else /* if OPENSSL_KTLS_SUPPORTED */
+        ( void ) opensslParams;
+        ( void ) buffer;
+        ( void ) bytesToRecv;
+    #endif /* if OPENSSL_KTLS_SUPPORTED */
+
+    return bytesReceived;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t sendKtls( const OpensslParams_t * opensslParams,
+                         const TransportOutVector_t * pIoVec,
+                         size_t ioVecCount )
+{
+    struct iovec vectors[ OPENSSL_KTLS_MAX_VECTORS ];
+    struct msghdr message;
+    struct pollfd pollFds;
+    ssize_t sent = 0;
+    int32_t bytesSent = -1;
+    size_t count = ( ioVecCount < OPENSSL_KTLS_MAX_VECTORS ) ? ioVecCount : OPENSSL_KTLS_MAX_VECTORS;
+    size_t i = 0U;
+
+    for( i = 0U; i < count; i++ )
+    {
+        vectors[ i ].iov_base = ( void * ) pIoVec[ i ].iov_base;
+        vectors[ i ].iov_len = pIoVec[ i ].iov_len;
+    }
+
+    memset( &message, 0x00, sizeof( message ) );
+    message.msg_iov = vectors;
+    message.msg_iovlen = count;
+
+    /* The kernel closes the record at the end of the call. */
+    sent = sendmsg( opensslParams->socketDescriptor, &message, MSG_NOSIGNAL );
+
+    if( sent >= 0 )
+    {
+        bytesSent = ( int32_t ) sent;
+    }
+    else if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+    {
+        /* As for SSL_ERROR_WANT_WRITE in Openssl_Send. */
+        pollFds.fd = opensslParams->socketDescriptor;
+        pollFds.events = POLLOUT;
+        pollFds.revents = 0;
+        ( void ) poll( &pollFds, 1, OPENSSL_SEND_RETRY_WAIT_MS );
+        bytesSent = 0;
+    }
+    else
+    {
+        LogError( ( "Failed to send data over network: sendmsg failed: "
+                    "errno=%d.",
+                    errno ) );
+    }
+
+    return bytesSent;
+}
+/*-----------------------------------------------------------*/
+
 OpensslStatus_t Openssl_Connect( NetworkContext_t * networkContext,
                                  const ServerInfo_t * serverInfo,
                                  const OpensslCredentials_t * opensslCredentials,
@@ -519,6 +711,9 @@ OpensslStatus_t Openssl_Connect( NetworkContext_t * networkContext,
     if( returnStatus == OPENSSL_SUCCESS )
     {
         opensslParams = networkContext->params;
+        opensslParams->nonBlocking = false;
+        opensslParams->ktlsSend = false;
+        opensslParams->ktlsRecv = false;
         socketStatus = Sockets_Connect( &opensslParams->socketDescriptor,
                                         serverInfo,
                                         sendTimeoutMs,
@@ -554,6 +749,22 @@ OpensslStatus_t Openssl_Connect( NetworkContext_t * networkContext,
         ( void ) SSL_CTX_set_mode( sslContext,
                                    ( long ) SSL_MODE_ENABLE_PARTIAL_WRITE );
 
+        /* Read whatever the socket holds in one system call, instead of a
+         * record header and a record body at a time. The bytes read ahead
+         * are reported by SSL_has_pending, not by the socket. With kTLS,
+         * not before the handshake is done, as records OpenSSL read ahead
+         * keep the kernel from taking over the receive side. */
+        if( !opensslCredentials->enableKtls )
+        {
+            SSL_CTX_set_read_ahead( sslContext, 1 );
+        }
+        else
+        {
+            #if OPENSSL_KTLS_SUPPORTED
+                ( void ) SSL_CTX_set_options( sslContext, SSL_OP_ENABLE_KTLS );
+            #endif
+        }
+
         sslStatus = setCredentials( sslContext, opensslCredentials );
 
         if( sslStatus != 1 )
@@ -587,6 +798,25 @@ OpensslStatus_t Openssl_Connect( NetworkContext_t * networkContext,
                                      opensslCredentials );
     }
 
+    /* OpenSSL hands each direction to the kernel after the handshake, if
+     * the kernel has the tls module and supports the negotiated cipher. */
+    if( ( returnStatus == OPENSSL_SUCCESS ) && opensslCredentials->enableKtls )
+    {
+        #if OPENSSL_KTLS_SUPPORTED
+            opensslParams->ktlsSend = BIO_get_ktls_send( SSL_get_wbio( opensslParams->ssl ) ) > 0;
+            opensslParams->ktlsRecv = BIO_get_ktls_recv( SSL_get_rbio( opensslParams->ssl ) ) > 0;
+        #endif
+
+        if( !opensslParams->ktlsRecv )
+        {
+            SSL_set_read_ahead( opensslParams->ssl, 1 );
+        }
+
+        LogDebug( ( "kTLS: send %s, receive %s.",
+                    opensslParams->ktlsSend ? "in the kernel" : "in OpenSSL",
+                    opensslParams->ktlsRecv ? "in the kernel" : "in OpenSSL" ) );
+    }
+
     /* Free the SSL context. */
     if( sslContext != NULL )
     {
@@ -657,6 +887,9 @@ OpensslStatus_t Openssl_Disconnect( const NetworkContext_t * networkContext )
 
         /* Tear down the socket connection, networkContext != NULL here. */
         socketStatus = Sockets_Disconnect( opensslParams->socketDescriptor );
+
+        /* The descriptor may be reused, it must not be closed twice. */
+        opensslParams->socketDescriptor = -1;
         pthread_sigmask( SIG_SETMASK, &old_set, NULL );
     }
 
@@ -664,6 +897,81 @@ OpensslStatus_t Openssl_Disconnect( const NetworkContext_t * networkContext )
 }
 /*-----------------------------------------------------------*/
 
+OpensslStatus_t Openssl_SetNonBlocking( NetworkContext_t * networkContext,
+                                        bool nonBlocking )
+{
+    OpensslParams_t * opensslParams = NULL;
+    OpensslStatus_t returnStatus = OPENSSL_SUCCESS;
+    int flags = 0;
+
+    if( ( networkContext == NULL ) || ( networkContext->params == NULL ) ||
+        ( networkContext->params->ssl == NULL ) )
+    {
+        LogError( ( "Parameter check failed: no TLS session in networkContext." ) );
+        returnStatus = OPENSSL_INVALID_PARAMETER;
+    }
+    else
+    {
+        opensslParams = networkContext->params;
+        flags = fcntl( opensslParams->socketDescriptor, F_GETFL );
+
+        if( flags >= 0 )
+        {
+            flags = nonBlocking ? ( flags | O_NONBLOCK ) : ( flags & ~O_NONBLOCK );
+            flags = fcntl( opensslParams->socketDescriptor, F_SETFL, flags );
+        }
+
+        if( flags < 0 )
+        {
+            LogError( ( "Failed to change the blocking mode of socket %d.",
+                        opensslParams->socketDescriptor ) );
+            returnStatus = OPENSSL_API_ERROR;
+        }
+        else
+        {
+            opensslParams->nonBlocking = nonBlocking;
+        }
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+OpensslStatus_t Openssl_SetCork( NetworkContext_t * networkContext,
+                                 bool cork )
+{
+    OpensslStatus_t returnStatus = OPENSSL_SUCCESS;
+    int value = cork ? 1 : 0;
+
+    if( ( networkContext == NULL ) || ( networkContext->params == NULL ) ||
+        ( networkContext->params->ssl == NULL ) )
+    {
+        LogError( ( "Parameter check failed: no TLS session in networkContext." ) );
+        returnStatus = OPENSSL_INVALID_PARAMETER;
+    }
+    else
+    {
+        #ifdef TCP_CORK
+            if( setsockopt( networkContext->params->socketDescriptor,
+                            IPPROTO_TCP,
+                            TCP_CORK,
+                            &value,
+                            ( socklen_t ) sizeof( value ) ) != 0 )
+            {
+                LogError( ( "Failed to %s socket %d.",
+                            cork ? "cork" : "uncork",
+                            networkContext->params->socketDescriptor ) );
+                returnStatus = OPENSSL_API_ERROR;
+            }
+        #else
+            ( void ) value;
+        #endif
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
 /* MISRA Rule 8.13 flags the following line for not using the const qualifier
  * on `networkContext`. Indeed, the object pointed by it is not modified
  * by OpenSSL, but other implementations of `TransportRecv_t` may do so. */
@@ -694,9 +1002,13 @@ int32_t Openssl_Recv( NetworkContext_t * networkContext,
                     "SSL object in network context is NULL." ) );
         bytesReceived = -1;
     }
+    else if( networkContext->params->ktlsRecv )
+    {
+        bytesReceived = recvKtls( networkContext->params, buffer, bytesToRecv );
+    }
     else
     {
-        int32_t pollStatus = 1, readStatus = 1, sslError = 0;
+        int32_t pollStatus = 1, readStatus = 1, sslError = 0, drainStatus = 1;
         uint8_t shouldRead = 0U;
         struct pollfd pollFds;
         opensslParams = networkContext->params;
@@ -709,14 +1021,15 @@ int32_t Openssl_Recv( NetworkContext_t * networkContext,
         /* Set the file descriptor for poll. */
         pollFds.fd = opensslParams->socketDescriptor;
 
-        /* #SSL_pending returns a value > 0 if application data
-         * from the last processed TLS record remains to be read.
+        /* #SSL_has_pending returns 1 if data from the last processed TLS
+         * record, or records read ahead, remain to be read.
          * This implementation will ALWAYS block when the number of bytes
          * requested is greater than 1. Otherwise, poll the socket first
          * as blocking may negatively impact performance by waiting for the
          * entire duration of the socket timeout even when no data is available.
-         */
-        if( ( bytesToRecv > 1 ) || ( SSL_pending( opensslParams->ssl ) > 0 ) )
+         * A non-blocking socket never waits, so it is always read. */
+        if( ( bytesToRecv > 1 ) || opensslParams->nonBlocking ||
+            ( SSL_has_pending( opensslParams->ssl ) == 1 ) )
         {
             shouldRead = 1U;
         }
@@ -758,6 +1071,23 @@ int32_t Openssl_Recv( NetworkContext_t * networkContext,
             {
                 bytesReceived = readStatus;
             }
+
+            /* SSL_read() returns one record at a time. Take the others read
+             * ahead in the same call, which cannot wait on a non-blocking
+             * socket. A failure here is reported by the next call. */
+            while( opensslParams->nonBlocking && ( drainStatus > 0 ) &&
+                   ( readStatus > 0 ) && ( ( size_t ) bytesReceived < bytesToRecv ) &&
+                   ( SSL_has_pending( opensslParams->ssl ) == 1 ) )
+            {
+                drainStatus = ( int32_t ) SSL_read( opensslParams->ssl,
+                                                    ( uint8_t * ) buffer + bytesReceived,
+                                                    ( int32_t ) ( bytesToRecv - ( size_t ) bytesReceived ) );
+
+                if( drainStatus > 0 )
+                {
+                    bytesReceived += drainStatus;
+                }
+            }
         }
 
         /* Handle error return status if transport read did not succeed. */
@@ -765,12 +1095,16 @@ int32_t Openssl_Recv( NetworkContext_t * networkContext,
         {
             sslError = SSL_get_error( opensslParams->ssl, readStatus );
 
-            if( sslError == SSL_ERROR_WANT_READ )
+            if( ( sslError == SSL_ERROR_WANT_READ ) ||
+                ( sslError == SSL_ERROR_WANT_WRITE ) )
             {
                 /* The OpenSSL documentation mentions that SSL_Read can provide
                  * a return code of SSL_ERROR_WANT_READ in blocking mode, if the
                  * SSL context is not configured with the SSL_MODE_AUTO_RETRY.
-                 * This error code means that the SSL_read() operation needs to
+                 * On a non-blocking socket, it means the rest of the TLS record
+                 * has not arrived, and SSL_ERROR_WANT_WRITE that OpenSSL could
+                 * not send its own reply yet.
+                 * Either way the SSL_read() operation needs to
                  * be retried to complete the read operation. Thus, setting the
                  * return value of this function as zero to represent that no
                  * data was received from the network. */
@@ -821,10 +1155,17 @@ int32_t Openssl_Send( NetworkContext_t * networkContext,
         LogError( ( "Parameter check failed: networkContext is NULL." ) );
         bytesSent = -1; // No point retrying here
     }
+    else if( ( networkContext->params->ssl != NULL ) && networkContext->params->ktlsSend )
+    {
+        TransportOutVector_t segment = { buffer, bytesToSend };
+
+        bytesSent = sendKtls( networkContext->params, &segment, 1U );
+    }
     else if( networkContext->params->ssl != NULL )
     {
         struct pollfd pollFds;
-        int32_t pollStatus;
+        int32_t pollStatus = 1;
+        int32_t sslError = 0;
 
         opensslParams = networkContext->params;
 
@@ -837,8 +1178,12 @@ int32_t Openssl_Send( NetworkContext_t * networkContext,
         /* `poll` checks if the socket is ready to send data.
          * Note: This is done to avoid blocking on SSL_write()
          * when TCP socket is not ready to accept more data for
-         * network transmission (possibly due to a full TX buffer). */
-        pollStatus = poll( &pollFds, 1, 0 );
+         * network transmission (possibly due to a full TX buffer).
+         * A non-blocking SSL_write() reports that itself. */
+        if( !opensslParams->nonBlocking )
+        {
+            pollStatus = poll( &pollFds, 1, 0 );
+        }
 
         if( pollStatus > 0 )
         {
@@ -848,15 +1193,30 @@ int32_t Openssl_Send( NetworkContext_t * networkContext,
                                                ( int32_t ) bytesToSend );
 
             if( bytesSent <= 0 )
+            {
+                sslError = SSL_get_error( opensslParams->ssl, bytesSent );
+            }
+
+            if( ( bytesSent <= 0 ) && opensslParams->nonBlocking &&
+                ( ( sslError == SSL_ERROR_WANT_WRITE ) ||
+                  ( sslError == SSL_ERROR_WANT_READ ) ) )
+            {
+                /* The socket is full, or OpenSSL must read first. Wait for
+                 * that a little, so the retry does not spin, then return zero
+                 * for the same data to be sent again. */
+                pollFds.events = ( sslError == SSL_ERROR_WANT_WRITE ) ? POLLOUT : POLLIN;
+                ( void ) poll( &pollFds, 1, OPENSSL_SEND_RETRY_WAIT_MS );
+                bytesSent = 0;
+            }
+            else if( bytesSent <= 0 )
             {
                 LogError(
                     ( "Failed to send data over network: SSL_write of "
                       "OpenSSL failed: "
                       "ErrorStatus=%s.",
-                      ERR_reason_error_string(
-                          SSL_get_error( opensslParams->ssl, bytesSent ) ) ) );
+                      ERR_reason_error_string( sslError ) ) );
 
-                /* As the SSL context is configured for blocking mode, the
+                /* When the SSL context is in blocking mode, the
                  * SSL_write() function does not return an SSL_ERROR_WANT_READ
                  * or SSL_ERROR_WANT_WRITE error code. The SSL_ERROR_WANT_READ
                  * and SSL_ERROR_WANT_WRITE error codes signify that the write
@@ -905,3 +1265,56 @@ int32_t Openssl_Send( NetworkContext_t * networkContext,
     return bytesSent;
 }
 /*-----------------------------------------------------------*/
+
+int32_t Openssl_Writev( NetworkContext_t * networkContext,
+                        TransportOutVector_t * pIoVec,
+                        size_t ioVecCount )
+{
+    OpensslParams_t * opensslParams = NULL;
+    int32_t bytesSent = 0;
+    size_t gathered = 0U;
+    size_t bytes = 0U;
+    size_t i = 0U;
+
+    if( ( networkContext == NULL ) || ( networkContext->params == NULL ) ||
+        ( pIoVec == NULL ) || ( ioVecCount == 0U ) )
+    {
+        LogError( ( "Parameter check failed: networkContext or pIoVec is NULL." ) );
+        bytesSent = -1;
+    }
+    else if( ( networkContext->params->ssl != NULL ) && networkContext->params->ktlsSend )
+    {
+        /* The kernel gathers the segments into one record itself. */
+        bytesSent = sendKtls( networkContext->params, pIoVec, ioVecCount );
+    }
+    else if( ( networkContext->params->sendBuffer == NULL ) ||
+             ( pIoVec[ 0 ].iov_len >= networkContext->params->sendBufferSize ) )
+    {
+        bytesSent = Openssl_Send( networkContext,
+                                  pIoVec[ 0 ].iov_base,
+                                  pIoVec[ 0 ].iov_len );
+    }
+    else
+    {
+        opensslParams = networkContext->params;
+
+        /* A retry gathers the same segments again, so SSL_write() is
+         * retried with the same buffer and length, as OpenSSL requires. */
+        for( i = 0U; ( i < ioVecCount ) && ( gathered < opensslParams->sendBufferSize ); i++ )
+        {
+            bytes = opensslParams->sendBufferSize - gathered;
+            bytes = ( pIoVec[ i ].iov_len < bytes ) ? pIoVec[ i ].iov_len : bytes;
+
+            if( bytes > 0U )
+            {
+                memcpy( &opensslParams->sendBuffer[ gathered ], pIoVec[ i ].iov_base, bytes );
+                gathered += bytes;
+            }
+        }
+
+        bytesSent = Openssl_Send( networkContext, opensslParams->sendBuffer, gathered );
+    }
+
+    return bytesSent;
+}
+/*-----------------------------------------------------------*/
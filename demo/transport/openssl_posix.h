@@ -16,6 +16,9 @@ extern "C" {
 #endif
 /* *INDENT-ON* */
 
+/* Standard includes. */
+#include <stdbool.h>
+
 /* OpenSSL include. */
 #include <openssl/ssl.h>
 
@@ -36,6 +39,15 @@ typedef struct OpensslParams
 {
     int32_t socketDescriptor;
     SSL * ssl;
+    bool nonBlocking;      /**< @brief Set by #Openssl_SetNonBlocking. */
+    uint8_t * sendBuffer;  /**< @brief Storage #Openssl_Writev gathers the
+                              segments into, to send them as one TLS
+                              record; NULL to send a segment at a time. */
+    size_t sendBufferSize; /**< @brief Size of sendBuffer. */
+    bool ktlsSend;         /**< @brief The kernel encrypts what is sent,
+                              with plain socket calls. */
+    bool ktlsRecv;         /**< @brief The kernel decrypts what is
+                              received, with plain socket calls. */
 } OpensslParams_t;
 
 /* Each compilation unit must define the NetworkContext struct. */
@@ -100,6 +112,15 @@ typedef struct OpensslCredentials
      */
     uint16_t maxFragmentLength;
 
+    /**
+     * @brief Hand the TLS records to the kernel (kTLS) once the handshake
+     * is done, where OpenSSL, the kernel and the negotiated cipher allow.
+     *
+     * @note Each direction falls back to OpenSSL on its own; see
+     * OpensslParams_t for the directions the kernel took.
+     */
+    bool enableKtls;
+
     /**
      * @brief Filepaths to certificates and private key that are used when
      * performing the TLS handshake.
@@ -156,6 +177,44 @@ OpensslStatus_t Openssl_Connect( NetworkContext_t * networkContext,
  */
 OpensslStatus_t Openssl_Disconnect( const NetworkContext_t * networkContext );
 
+/**
+ * @brief Switches an established TLS session to a non-blocking socket, or
+ * back.
+ *
+ * Non-blocking, #Openssl_Recv returns zero at once when no complete TLS
+ * record has arrived, instead of waiting for the socket timeout, and both
+ * #Openssl_Recv and #Openssl_Send return zero to be retried when OpenSSL
+ * reports SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE. The caller waits for
+ * the socket to become readable itself, with poll or epoll. A new
+ * connection starts blocking.
+ *
+ * @param[in] networkContext The network context created using
+ * Openssl_Connect API.
+ * @param[in] nonBlocking true for a non-blocking socket.
+ *
+ * @return #OPENSSL_SUCCESS on success; #OPENSSL_INVALID_PARAMETER if there
+ * is no session; #OPENSSL_API_ERROR if the socket cannot be changed.
+ */
+OpensslStatus_t Openssl_SetNonBlocking( NetworkContext_t * networkContext,
+                                        bool nonBlocking );
+
+/**
+ * @brief Holds back partial TCP segments until uncorked, so that what is
+ * sent in between leaves in as few segments as possible.
+ *
+ * Uncorking sends what was held back. Does nothing where TCP_CORK is not
+ * available.
+ *
+ * @param[in] networkContext The network context created using
+ * Openssl_Connect API.
+ * @param[in] cork true to cork, false to uncork.
+ *
+ * @return #OPENSSL_SUCCESS on success; #OPENSSL_INVALID_PARAMETER if there
+ * is no session; #OPENSSL_API_ERROR if the socket cannot be changed.
+ */
+OpensslStatus_t Openssl_SetCork( NetworkContext_t * networkContext,
+                                 bool cork );
+
 /**
  * @brief Receives data over an established TLS session using the OpenSSL
  * API.
@@ -197,6 +256,28 @@ int32_t Openssl_Send( NetworkContext_t * networkContext,
                       const void * buffer,
                       size_t bytesToSend );
 
+/**
+ * @brief Sends a vector of segments over an established TLS session using
+ * the OpenSSL API.
+ *
+ * This can be used as #TransportInterface.writev function. The segments
+ * that fit in the send buffer of the session are copied there and sent
+ * with one SSL_write(), as one TLS record; a first segment that does not
+ * fit is sent alone, without copying.
+ *
+ * @param[in] networkContext The network context created using
+ * Openssl_Connect API.
+ * @param[in] pIoVec Segments to send.
+ * @param[in] ioVecCount Number of segments.
+ *
+ * @return Number of bytes sent from the start of the segments if
+ * successful; negative value on error; zero to be retried with the same
+ * segments.
+ */
+int32_t Openssl_Writev( NetworkContext_t * networkContext,
+                        TransportOutVector_t * pIoVec,
+                        size_t ioVecCount );
+
 /* *INDENT-OFF* */
 #ifdef __cplusplus
 }
@@ -0,0 +1,97 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file read_ahead.c
+ * @brief Implementation of the read-ahead buffer.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+#include "read_ahead.h"
+
+/*-----------------------------------------------------------*/
+
+static int32_t takeBuffered( ReadAheadContext_t * context,
+                             void * pBuffer,
+                             size_t bytesToRecv );
+
+/*-----------------------------------------------------------*/
+
+static int32_t takeBuffered( ReadAheadContext_t * context,
+                             void * pBuffer,
+                             size_t bytesToRecv )
+{
+    size_t bytes = ( bytesToRecv < context->count ) ? bytesToRecv : context->count;
+
+    memcpy( pBuffer, &context->buffer[ context->head ], bytes );
+    context->head += bytes;
+    context->count -= bytes;
+
+    return ( int32_t ) bytes;
+}
+
+/*-----------------------------------------------------------*/
+
+void ReadAhead_Init( ReadAheadContext_t * context,
+                     TransportRecv_t recv,
+                     NetworkContext_t * pNetworkContext,
+                     uint8_t * buffer,
+                     size_t size )
+{
+    assert( ( context != NULL ) && ( recv != NULL ) && ( buffer != NULL ) );
+    assert( ( size > 0U ) && ( size <= ( size_t ) INT32_MAX ) );
+
+    memset( context, 0x00, sizeof( ReadAheadContext_t ) );
+    context->recv = recv;
+    context->pNetworkContext = pNetworkContext;
+    context->buffer = buffer;
+    context->size = size;
+}
+
+int32_t ReadAhead_Recv( ReadAheadContext_t * context,
+                        void * pBuffer,
+                        size_t bytesToRecv )
+{
+    int32_t bytesReceived = 0;
+
+    assert( ( context != NULL ) && ( pBuffer != NULL ) );
+
+    if( context->count > 0U )
+    {
+        bytesReceived = takeBuffered( context, pBuffer, bytesToRecv );
+    }
+    else if( bytesToRecv >= context->size )
+    {
+        /* Copying through the buffer would not save a call. */
+        bytesReceived = context->recv( context->pNetworkContext, pBuffer, bytesToRecv );
+    }
+    else
+    {
+        bytesReceived = context->recv( context->pNetworkContext, context->buffer, context->size );
+
+        if( bytesReceived > 0 )
+        {
+            context->head = 0U;
+            context->count = ( size_t ) bytesReceived;
+            bytesReceived = takeBuffered( context, pBuffer, bytesToRecv );
+        }
+    }
+
+    return bytesReceived;
+}
+
+size_t ReadAhead_Buffered( const ReadAheadContext_t * context )
+{
+    assert( context != NULL );
+
+    return context->count;
+}
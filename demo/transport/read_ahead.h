@@ -0,0 +1,101 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file read_ahead.h
+ * @brief Read-ahead buffer in front of the receive function of a transport.
+ *
+ * coreMQTT receives some packets in small pieces: the type byte, then the
+ * remaining length a byte at a time, then the rest. Each piece is a call
+ * into the transport, and each call into OpenSSL costs system calls of its
+ * own. The buffer asks the transport for as much as it can hold and serves
+ * small receives from memory; receives as large as the buffer go straight
+ * to the transport.
+ *
+ * The wrapped receive must return what is there without waiting for more,
+ * as a refill asks for the whole buffer.
+ */
+
+#ifndef READ_AHEAD_H_
+#define READ_AHEAD_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Transport includes. */
+#include "transport_interface.h"
+
+/**
+ * @brief State of a read-ahead buffer.
+ */
+typedef struct ReadAheadContext
+{
+    TransportRecv_t recv;               /**< @brief Receive function of the
+                                           wrapped transport. */
+    NetworkContext_t * pNetworkContext; /**< @brief Its network context. */
+    uint8_t * buffer;                   /**< @brief Storage of the buffer. */
+    size_t size;                        /**< @brief Size of the storage. */
+    size_t head;                        /**< @brief Next byte to serve. */
+    size_t count;                       /**< @brief Bytes left to serve. */
+} ReadAheadContext_t;
+
+/**
+ * @brief Initialize an empty read-ahead buffer.
+ *
+ * @param[out] context Buffer to initialize.
+ * @param[in] recv Receive function of the wrapped transport.
+ * @param[in] pNetworkContext Network context of the wrapped transport.
+ * @param[in] buffer Storage of the buffer.
+ * @param[in] size Size of the storage.
+ */
+void ReadAhead_Init( ReadAheadContext_t * context,
+                     TransportRecv_t recv,
+                     NetworkContext_t * pNetworkContext,
+                     uint8_t * buffer,
+                     size_t size );
+
+/**
+ * @brief Receive through the buffer. Has the signature of a
+ * #TransportRecv_t, with the buffer in place of the network context.
+ *
+ * @param[in] context Read-ahead buffer.
+ * @param[out] pBuffer Buffer to receive into.
+ * @param[in] bytesToRecv Bytes requested.
+ *
+ * @return Bytes received, which may be fewer than requested; zero if
+ * nothing was there; negative on failure of the transport.
+ */
+int32_t ReadAhead_Recv( ReadAheadContext_t * context,
+                        void * pBuffer,
+                        size_t bytesToRecv );
+
+/**
+ * @brief Bytes received from the transport and not served yet. A socket
+ * does not signal them again.
+ *
+ * @param[in] context Read-ahead buffer.
+ *
+ * @return Bytes buffered.
+ */
+size_t ReadAhead_Buffered( const ReadAheadContext_t * context );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef READ_AHEAD_H_ */
@@ -266,6 +266,9 @@ static SocketStatus_t attemptConnection( struct addrinfo * listHead,
         LogError( ( "Could not connect to any resolved IP address from %.*s.",
                     ( int32_t ) hostNameLength,
                     hostName ) );
+
+        /* The socket of the last attempt is closed already. */
+        *tcpSocket = -1;
     }
 
     freeaddrinfo( listHead );
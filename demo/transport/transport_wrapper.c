@@ -14,19 +14,144 @@
 
 /* Transport includes. */
 #include "transport/openssl_posix.h"
+#include "transport/read_ahead.h"
 #include "transport_wrapper.h"
+#include "utils/clock.h"
+
+/* A receive on a blocking socket waits up to TRANSPORT_TIMEOUT_MS for the
+ * rest of a TLS record; a non-blocking one returns and is retried when the
+ * socket is readable again. */
+#ifndef TRANSPORT_NON_BLOCKING
+    #define TRANSPORT_NON_BLOCKING    1
+#endif
+
+/* Hand the TLS records to the kernel where it can take them; OpenSSL
+ * keeps them otherwise. */
+#ifndef TRANSPORT_KERNEL_TLS
+    #define TRANSPORT_KERNEL_TLS    1
+#endif
+
+#define TRANSPORT_TIMEOUT_MS    ( 750U )
+
+#define MAX_FILE_SIZE           4096U
+
+/* Receives smaller than this are served from a read-ahead buffer. Only
+ * used on a non-blocking socket, where a refill does not wait. */
+#define TRANSPORT_READ_AHEAD_SIZE    4096U
+
+/* Segments of a vectored send are gathered here into one TLS record. */
+#define TRANSPORT_SEND_BUFFER_SIZE    2048U
+
+/* Bucket i counts the calls that took less than 2^i us. */
+#define RECV_LATENCY_BUCKETS    32U
 
 static NetworkContext_t networkContext = { 0 };
 static OpensslParams_t opensslParams = { 0 };
+static ReadAheadContext_t readAhead = { 0 };
+static uint8_t readAheadBuffer[ TRANSPORT_READ_AHEAD_SIZE ];
+static uint8_t sendBuffer[ TRANSPORT_SEND_BUFFER_SIZE ];
+
+static uint32_t recvLatencyHistogram[ RECV_LATENCY_BUCKETS ] = { 0 };
+static uint32_t recvCalls = 0U;
+static uint32_t recvRetries = 0U;
+static uint32_t recvMaxUs = 0U;
+static uint32_t recvTransportReads = 0U;
+static uint64_t recvBytes = 0U;
+static uint32_t sendRecords = 0U;
+static uint64_t sendWireBytesClosed = 0U;
+static uint64_t sendWireBytesBase = 0U;
+static uint64_t sendKernelBytes = 0U;
+
+static int32_t countedRecv( NetworkContext_t * pNetworkContext,
+                            void * pBuffer,
+                            size_t bytesToRecv )
+{
+    recvTransportReads++;
+
+    return Openssl_Recv( pNetworkContext, pBuffer, bytesToRecv );
+}
+
+static int32_t countedSend( NetworkContext_t * pNetworkContext,
+                            const void * pBuffer,
+                            size_t bytesToSend )
+{
+    int32_t bytesSent = Openssl_Send( pNetworkContext, pBuffer, bytesToSend );
+
+    sendRecords += ( bytesSent > 0 ) ? 1U : 0U;
+    sendKernelBytes += ( opensslParams.ktlsSend && ( bytesSent > 0 ) ) ? ( uint64_t ) bytesSent : 0U;
+
+    return bytesSent;
+}
+
+static int32_t countedWritev( NetworkContext_t * pNetworkContext,
+                              TransportOutVector_t * pIoVec,
+                              size_t ioVecCount )
+{
+    int32_t bytesSent = Openssl_Writev( pNetworkContext, pIoVec, ioVecCount );
+
+    sendRecords += ( bytesSent > 0 ) ? 1U : 0U;
+    sendKernelBytes += ( opensslParams.ktlsSend && ( bytesSent > 0 ) ) ? ( uint64_t ) bytesSent : 0U;
+
+    return bytesSent;
+}
+
+/* Bytes OpenSSL wrote to the socket on this connection. What was sent
+ * with kTLS is counted by the callers, before the kernel adds the record
+ * headers and tags. */
+static uint64_t wireBytesWritten( void )
+{
+    return ( opensslParams.ssl != NULL ) ?
+           ( uint64_t ) BIO_number_written( SSL_get_wbio( opensslParams.ssl ) ) : 0U;
+}
+
+static int32_t timedRecv( NetworkContext_t * pNetworkContext,
+                          void * pBuffer,
+                          size_t bytesToRecv )
+{
+    uint64_t startUs = Clock_GetTimeUs();
+    int32_t bytesReceived = TRANSPORT_NON_BLOCKING ?
+                            ReadAhead_Recv( &readAhead, pBuffer, bytesToRecv ) :
+                            countedRecv( pNetworkContext, pBuffer, bytesToRecv );
+    uint64_t elapsedUs = Clock_GetTimeUs() - startUs;
+    uint32_t latencyUs = ( elapsedUs < UINT32_MAX ) ? ( uint32_t ) elapsedUs : UINT32_MAX;
+    uint32_t bucket = 0U;
+
+    while( ( bucket < ( RECV_LATENCY_BUCKETS - 1U ) ) && ( ( latencyUs >> bucket ) > 0U ) )
+    {
+        bucket++;
+    }
+
+    recvLatencyHistogram[ bucket ]++;
+    recvCalls++;
+    recvRetries += ( bytesReceived == 0 ) ? 1U : 0U;
+    recvBytes += ( bytesReceived > 0 ) ? ( uint64_t ) bytesReceived : 0U;
+    recvMaxUs = ( latencyUs > recvMaxUs ) ? latencyUs : recvMaxUs;
 
-#define TRANSPORT_TIMEOUT_MS ( 750U )
+    return bytesReceived;
+}
+
+static uint32_t recvLatencyPercentile( uint32_t percent )
+{
+    uint64_t wanted = ( ( uint64_t ) recvCalls * percent + 99U ) / 100U;
+    uint64_t counted = 0U;
+    uint32_t bucket = 0U;
+
+    while( ( bucket < ( RECV_LATENCY_BUCKETS - 1U ) ) &&
+           ( ( counted + recvLatencyHistogram[ bucket ] ) < wanted ) )
+    {
+        counted += recvLatencyHistogram[ bucket ];
+        bucket++;
+    }
 
-#define MAX_FILE_SIZE        4096U
+    /* The upper bound of the bucket, capped by what was seen. */
+    return ( ( ( uint32_t ) 1U << bucket ) < recvMaxUs ) ? ( ( uint32_t ) 1U << bucket ) : recvMaxUs;
+}
 
 void transport_tlsInit( TransportInterface_t * transport )
 {
-    transport->send = Openssl_Send;
-    transport->recv = Openssl_Recv;
+    transport->send = countedSend;
+    transport->recv = timedRecv;
+    transport->writev = countedWritev;
     transport->pNetworkContext = &networkContext;
 
     OPENSSL_init_crypto( OPENSSL_INIT_ADD_ALL_CIPHERS |
@@ -93,12 +218,20 @@ bool transport_tlsConnect( char * certificateFilePath,
     opensslCredentials.rootCaLength = rootCALength;
     opensslCredentials.privateKeyBuffer = privateKey;
     opensslCredentials.privateKeyLength = privateKeyLength;
+    opensslCredentials.enableKtls = TRANSPORT_KERNEL_TLS;
 
     serverInfo.hostName = endpoint;
     serverInfo.hostNameLength = strlen( endpoint );
     serverInfo.port = 8883U;
 
     networkContext.params = &opensslParams;
+    opensslParams.sendBuffer = sendBuffer;
+    opensslParams.sendBufferSize = sizeof( sendBuffer );
+    ReadAhead_Init( &readAhead,
+                    countedRecv,
+                    &networkContext,
+                    readAheadBuffer,
+                    sizeof( readAheadBuffer ) );
 
     opensslStatus = Openssl_Connect( &networkContext,
                                      &serverInfo,
@@ -106,6 +239,17 @@ bool transport_tlsConnect( char * certificateFilePath,
                                      TRANSPORT_TIMEOUT_MS,
                                      TRANSPORT_TIMEOUT_MS );
 
+    /* The handshake is done blocking, with the timeouts. */
+    if( ( opensslStatus == OPENSSL_SUCCESS ) && TRANSPORT_NON_BLOCKING )
+    {
+        opensslStatus = Openssl_SetNonBlocking( &networkContext, true );
+
+        if( opensslStatus != OPENSSL_SUCCESS )
+        {
+            ( void ) Openssl_Disconnect( &networkContext );
+        }
+    }
+
     return opensslStatus == OPENSSL_SUCCESS;
 }
 
@@ -113,6 +257,53 @@ void transport_tlsDisconnect( void )
 {
     if( networkContext.params != NULL )
     {
+        sendWireBytesClosed += wireBytesWritten();
         ( void ) Openssl_Disconnect( &networkContext );
     }
 }
+
+int32_t transport_tlsGetSocket( void )
+{
+    return ( opensslParams.ssl != NULL ) ? opensslParams.socketDescriptor : -1;
+}
+
+void transport_tlsGetRecvStats( TransportRecvStats_t * stats )
+{
+    stats->calls = recvCalls;
+    stats->retries = recvRetries;
+    stats->transportReads = recvTransportReads;
+    stats->bytes = recvBytes;
+    stats->p50Us = recvLatencyPercentile( 50U );
+    stats->p99Us = recvLatencyPercentile( 99U );
+    stats->maxUs = recvMaxUs;
+}
+
+void transport_tlsResetRecvStats( void )
+{
+    memset( recvLatencyHistogram, 0x00, sizeof( recvLatencyHistogram ) );
+    recvCalls = 0U;
+    recvRetries = 0U;
+    recvMaxUs = 0U;
+    recvTransportReads = 0U;
+    recvBytes = 0U;
+}
+
+void transport_tlsGetSendStats( TransportSendStats_t * stats )
+{
+    stats->records = sendRecords;
+    stats->wireBytes = sendWireBytesClosed + sendKernelBytes + wireBytesWritten() - sendWireBytesBase;
+}
+
+void transport_tlsResetSendStats( void )
+{
+    sendRecords = 0U;
+    sendWireBytesBase = sendWireBytesClosed + sendKernelBytes + wireBytesWritten();
+}
+
+void transport_tlsSetCork( bool cork )
+{
+    if( opensslParams.ssl != NULL )
+    {
+        ( void ) Openssl_SetCork( &networkContext, cork );
+    }
+}
@@ -10,8 +10,33 @@
 #ifndef TRANSPORT_WRAPPER_H
 #define TRANSPORT_WRAPPER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "transport_interface.h"
 
+/* How long receive calls took, from a histogram of power of two buckets,
+ * so the percentiles are bucket bounds. */
+typedef struct TransportRecvStats
+{
+    uint32_t calls;
+    uint32_t retries;        /* Calls that received nothing. */
+    uint32_t transportReads; /* Calls that reached OpenSSL, the rest being
+                              * served from the read-ahead buffer. */
+    uint64_t bytes;
+    uint32_t p50Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+} TransportRecvStats_t;
+
+/* What was sent. Every write sends one TLS record. */
+typedef struct TransportSendStats
+{
+    uint32_t records;
+    uint64_t wireBytes; /* TLS bytes given to the socket; with kTLS, the
+                         * bytes before the kernel made records of them. */
+} TransportSendStats_t;
+
 void transport_tlsInit( TransportInterface_t * transport );
 
 bool transport_tlsConnect( char * certificateFilePath,
@@ -21,4 +46,22 @@ bool transport_tlsConnect( char * certificateFilePath,
 
 void transport_tlsDisconnect( void );
 
+/* The socket of the connection, to wait on for data; -1 when there is
+ * none. */
+int32_t transport_tlsGetSocket( void );
+
+/* Statistics of the receive calls since the last reset. */
+void transport_tlsGetRecvStats( TransportRecvStats_t * stats );
+
+void transport_tlsResetRecvStats( void );
+
+/* Statistics of the sends since the last reset. */
+void transport_tlsGetSendStats( TransportSendStats_t * stats );
+
+void transport_tlsResetSendStats( void );
+
+/* While corked, partial TCP segments are held back, so back-to-back
+ * packets leave together when uncorked. */
+void transport_tlsSetCork( bool cork );
+
 #endif
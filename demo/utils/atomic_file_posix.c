@@ -0,0 +1,126 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file atomic_file_posix.c
+ * @brief Implementation of atomic file replacement for POSIX systems.
+ */
+
+/* Standard includes. */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "atomic_file_posix.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Suffix of the temporary file the new contents are written to.
+ */
+#define ATOMIC_FILE_TEMP_SUFFIX ".tmp"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sync the directory containing a file.
+ *
+ * @return true on success.
+ */
+static bool syncParentDirectory( const char * path );
+
+/*-----------------------------------------------------------*/
+
+static bool syncParentDirectory( const char * path )
+{
+    char directory[ ATOMIC_FILE_MAX_PATH_SIZE ] = ".";
+    const char * separator = strrchr( path, '/' );
+    size_t length = 0U;
+    bool success = false;
+    int fd = -1;
+
+    if( separator != NULL )
+    {
+        length = ( separator == path ) ? 1U : ( size_t ) ( separator - path );
+        memcpy( directory, path, length );
+        directory[ length ] = '\0';
+    }
+
+    fd = open( directory, O_RDONLY | O_DIRECTORY );
+
+    if( fd >= 0 )
+    {
+        success = fsync( fd ) == 0;
+        ( void ) close( fd );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+bool AtomicFile_Write( const char * path,
+                       const void * data,
+                       size_t length )
+{
+    char tempPath[ ATOMIC_FILE_MAX_PATH_SIZE ] = { 0 };
+    const uint8_t * bytes = ( const uint8_t * ) data;
+    ssize_t written = 0;
+    bool success = true;
+    int fd = -1;
+
+    if( ( size_t ) snprintf( tempPath,
+                             sizeof( tempPath ),
+                             "%s" ATOMIC_FILE_TEMP_SUFFIX,
+                             path ) >= sizeof( tempPath ) )
+    {
+        success = false;
+    }
+    else
+    {
+        fd = open( tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        success = fd >= 0;
+    }
+
+    while( success && ( length > 0U ) )
+    {
+        written = write( fd, bytes, length );
+
+        if( written > 0 )
+        {
+            bytes += written;
+            length -= ( size_t ) written;
+        }
+        else
+        {
+            success = ( written < 0 ) && ( errno == EINTR );
+        }
+    }
+
+    if( fd >= 0 )
+    {
+        success = success && ( fsync( fd ) == 0 );
+        success = ( close( fd ) == 0 ) && success;
+    }
+
+    success = success && ( rename( tempPath, path ) == 0 );
+    success = success && syncParentDirectory( path );
+
+    if( !success && ( fd >= 0 ) )
+    {
+        ( void ) unlink( tempPath );
+    }
+
+    return success;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file atomic_file_posix.h
+ * @brief Replaces small files so that a crash leaves either the old or the
+ * new contents, never a mix.
+ */
+
+#ifndef ATOMIC_FILE_POSIX_H_
+#define ATOMIC_FILE_POSIX_H_
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/**
+ * @brief Maximum length of a path passed to #AtomicFile_Write.
+ */
+#define ATOMIC_FILE_MAX_PATH_SIZE 256U
+
+/**
+ * @brief Atomically replace the contents of a file.
+ *
+ * The data is written to a temporary file next to the target, which is
+ * synced and renamed over the target. The directory is synced afterwards so
+ * the rename itself survives a power loss.
+ *
+ * @param[in] path Path of the file to replace.
+ * @param[in] data New contents.
+ * @param[in] length Length of the new contents.
+ *
+ * @return true on success; false if the old contents are still in place.
+ */
+bool AtomicFile_Write( const char * path,
+                       const void * data,
+                       size_t length );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef ATOMIC_FILE_POSIX_H_ */
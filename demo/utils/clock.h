@@ -33,6 +33,24 @@ extern "C" {
  */
 uint32_t Clock_GetTimeMs( void );
 
+/**
+ * @brief The high resolution timer query function.
+ *
+ * This function returns the elapsed time.
+ *
+ * @return Time in microseconds.
+ */
+uint64_t Clock_GetTimeUs( void );
+
+/**
+ * @brief The nanosecond timer query function, for timing short operations.
+ *
+ * This function returns the elapsed time.
+ *
+ * @return Time in nanoseconds.
+ */
+uint64_t Clock_GetTimeNs( void );
+
 /**
  * @brief Millisecond sleep function.
  *
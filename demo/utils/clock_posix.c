@@ -29,6 +29,10 @@
     ( 1000000L ) /**< @brief Nanoseconds per millisecond. */
 #define MILLISECONDS_PER_SECOND \
     ( 1000L ) /**< @brief Milliseconds per second. */
+#define NANOSECONDS_PER_MICROSECOND \
+    ( 1000L ) /**< @brief Nanoseconds per microsecond. */
+#define MICROSECONDS_PER_SECOND \
+    ( 1000000L ) /**< @brief Microseconds per second. */
 
 /*-----------------------------------------------------------*/
 
@@ -53,6 +57,32 @@ uint32_t Clock_GetTimeMs( void )
 
 /*-----------------------------------------------------------*/
 
+uint64_t Clock_GetTimeUs( void )
+{
+    struct timespec timeSpec;
+
+    /* Get the MONOTONIC time. */
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &timeSpec );
+
+    return ( ( uint64_t ) timeSpec.tv_sec * MICROSECONDS_PER_SECOND ) +
+           ( ( uint64_t ) timeSpec.tv_nsec / NANOSECONDS_PER_MICROSECOND );
+}
+
+/*-----------------------------------------------------------*/
+
+uint64_t Clock_GetTimeNs( void )
+{
+    struct timespec timeSpec;
+
+    /* Get the MONOTONIC time. */
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &timeSpec );
+
+    return ( ( uint64_t ) timeSpec.tv_sec * MICROSECONDS_PER_SECOND * NANOSECONDS_PER_MICROSECOND ) +
+           ( uint64_t ) timeSpec.tv_nsec;
+}
+
+/*-----------------------------------------------------------*/
+
 void Clock_SleepMs( uint32_t sleepTimeMs )
 {
     /* Convert parameter to timespec. */
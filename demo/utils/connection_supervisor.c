@@ -0,0 +1,132 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file connection_supervisor.c
+ * @brief Implementation of the connection supervisor.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backoff_algorithm.h"
+
+#include "clock.h"
+#include "connection_supervisor.h"
+
+/*-----------------------------------------------------------*/
+
+void ConnectionSupervisor_Init( ConnectionSupervisorContext_t * supervisor,
+                                const ConnectionSupervisorConfig_t * config )
+{
+    assert( supervisor != NULL );
+    assert( config != NULL );
+    assert( ( config->connect != NULL ) && ( config->teardown != NULL ) && ( config->delay != NULL ) );
+
+    memset( supervisor, 0x00, sizeof( ConnectionSupervisorContext_t ) );
+    supervisor->config = *config;
+}
+
+bool ConnectionSupervisor_Connect( ConnectionSupervisorContext_t * supervisor,
+                                   bool * sessionPresent )
+{
+    BackoffAlgorithmContext_t backoff;
+    BackoffAlgorithmStatus_t backoffStatus = BackoffAlgorithmSuccess;
+    uint16_t delayMs = 0U;
+    bool connected = false;
+
+    assert( supervisor != NULL );
+    assert( sessionPresent != NULL );
+
+    BackoffAlgorithm_InitializeParams( &backoff,
+                                       supervisor->config.baseBackoffMs,
+                                       supervisor->config.maxBackoffMs,
+                                       ( supervisor->config.maxAttempts > 0U ) ?
+                                       supervisor->config.maxAttempts - 1U :
+                                       BACKOFF_ALGORITHM_RETRY_FOREVER );
+
+    while( !connected && ( backoffStatus == BackoffAlgorithmSuccess ) )
+    {
+        *sessionPresent = false;
+        connected = supervisor->config.connect( supervisor->config.context, sessionPresent );
+
+        if( !connected )
+        {
+            supervisor->stats.failedAttempts++;
+
+            /* Nothing of a failed attempt may leak into the next one. */
+            supervisor->config.teardown( supervisor->config.context );
+            backoffStatus = BackoffAlgorithm_GetNextBackoff( &backoff, ( uint32_t ) rand(), &delayMs );
+
+            if( backoffStatus == BackoffAlgorithmSuccess )
+            {
+                printf( "Connecting failed, attempt %u again in %u ms. \n",
+                        ( unsigned int ) backoff.attemptsDone + 1U,
+                        ( unsigned int ) delayMs );
+                supervisor->config.delay( delayMs );
+            }
+        }
+    }
+
+    if( connected )
+    {
+        supervisor->stats.connects++;
+        supervisor->connectedAtMs = Clock_GetTimeMs();
+    }
+
+    supervisor->connected = connected;
+
+    return connected;
+}
+
+bool ConnectionSupervisor_Reconnect( ConnectionSupervisorContext_t * supervisor,
+                                     bool * sessionPresent )
+{
+    uint32_t lostTimeMs = Clock_GetTimeMs();
+    uint32_t downtimeMs = 0U;
+    bool connected = false;
+
+    assert( supervisor != NULL );
+
+    supervisor->config.teardown( supervisor->config.context );
+    supervisor->connected = false;
+
+    connected = ConnectionSupervisor_Connect( supervisor, sessionPresent );
+
+    if( connected )
+    {
+        downtimeMs = Clock_GetTimeMs() - lostTimeMs;
+        supervisor->stats.reconnects++;
+        supervisor->stats.sessionsResumed += *sessionPresent ? 1U : 0U;
+        supervisor->stats.downtimeMs += downtimeMs;
+        supervisor->stats.longestDowntimeMs = ( downtimeMs > supervisor->stats.longestDowntimeMs ) ?
+                                              downtimeMs : supervisor->stats.longestDowntimeMs;
+    }
+
+    return connected;
+}
+
+bool ConnectionSupervisor_FaultDue( ConnectionSupervisorContext_t * supervisor )
+{
+    bool due = false;
+
+    assert( supervisor != NULL );
+
+    if( supervisor->connected && ( supervisor->config.faultIntervalMs > 0U ) &&
+        ( ( Clock_GetTimeMs() - supervisor->connectedAtMs ) >= supervisor->config.faultIntervalMs ) )
+    {
+        supervisor->stats.faultsInjected++;
+        due = true;
+    }
+
+    return due;
+}
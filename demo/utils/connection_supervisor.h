@@ -0,0 +1,167 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file connection_supervisor.h
+ * @brief Keeps the connection to the broker up, retrying with jittered
+ * exponential backoff.
+ *
+ * The supervisor does not know about TLS or MQTT. It calls back to tear
+ * down whatever is left of a connection and to build a new one, and waits
+ * between attempts as the backoffAlgorithm library decides, so a fleet
+ * losing the same cell does not reconnect in lockstep.
+ *
+ * For testing, the supervisor can also cut a healthy connection at a fixed
+ * interval, so recovery is exercised without a flaky network.
+ */
+
+#ifndef CONNECTION_SUPERVISOR_H_
+#define CONNECTION_SUPERVISOR_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Build a new connection.
+ *
+ * @param[in] context Context given in #ConnectionSupervisorConfig_t.
+ * @param[out] sessionPresent Set if the broker resumed the session.
+ *
+ * @return true if connected.
+ */
+typedef bool ( * ConnectionSupervisorConnect_t )( void * context,
+                                                  bool * sessionPresent );
+
+/**
+ * @brief Release whatever is left of a connection. Must not block on the
+ * peer.
+ *
+ * @param[in] context Context given in #ConnectionSupervisorConfig_t.
+ */
+typedef void ( * ConnectionSupervisorTeardown_t )( void * context );
+
+/**
+ * @brief Wait before the next attempt, letting other tasks run.
+ *
+ * @param[in] delayMs Time to wait.
+ */
+typedef void ( * ConnectionSupervisorDelay_t )( uint32_t delayMs );
+
+/**
+ * @brief Configuration of a supervisor.
+ */
+typedef struct ConnectionSupervisorConfig
+{
+    uint16_t baseBackoffMs;                  /**< @brief Wait after the first
+                                                failed attempt. */
+    uint16_t maxBackoffMs;                   /**< @brief Longest wait between
+                                                two attempts. */
+    uint32_t maxAttempts;                    /**< @brief Attempts per
+                                                connect; zero to retry
+                                                forever. */
+    uint32_t faultIntervalMs;                /**< @brief Cut the connection
+                                                after it was up this long;
+                                                zero to never. */
+    ConnectionSupervisorConnect_t connect;   /**< @brief Builds a
+                                                connection. */
+    ConnectionSupervisorTeardown_t teardown; /**< @brief Releases a
+                                                connection. */
+    ConnectionSupervisorDelay_t delay;       /**< @brief Waits between
+                                                attempts. */
+    void * context;                          /**< @brief Passed to connect
+                                                and teardown. */
+} ConnectionSupervisorConfig_t;
+
+/**
+ * @brief Counters describing the connection.
+ */
+typedef struct ConnectionSupervisorStats
+{
+    uint32_t connects;          /**< @brief Connections built. */
+    uint32_t reconnects;        /**< @brief Connections built again after a
+                                   loss. */
+    uint32_t failedAttempts;    /**< @brief Attempts which did not
+                                   connect. */
+    uint32_t faultsInjected;    /**< @brief Connections cut on purpose. */
+    uint32_t sessionsResumed;   /**< @brief Reconnects into the old
+                                   session. */
+    uint32_t downtimeMs;        /**< @brief Time spent reconnecting. */
+    uint32_t longestDowntimeMs; /**< @brief Longest single reconnect. */
+} ConnectionSupervisorStats_t;
+
+/**
+ * @brief State of a supervisor.
+ */
+typedef struct ConnectionSupervisorContext
+{
+    ConnectionSupervisorConfig_t config; /**< @brief Configuration. */
+    ConnectionSupervisorStats_t stats;   /**< @brief Connection counters. */
+    uint32_t connectedAtMs;              /**< @brief When the connection was
+                                            built. */
+    bool connected;                      /**< @brief A connection is up. */
+} ConnectionSupervisorContext_t;
+
+/**
+ * @brief Initialize a supervisor. Nothing is connected.
+ *
+ * @param[out] supervisor Supervisor to initialize.
+ * @param[in] config Configuration, copied into the supervisor.
+ */
+void ConnectionSupervisor_Init( ConnectionSupervisorContext_t * supervisor,
+                                const ConnectionSupervisorConfig_t * config );
+
+/**
+ * @brief Connect, retrying with backoff.
+ *
+ * @param[in] supervisor Supervisor.
+ * @param[out] sessionPresent Set if the broker resumed the session.
+ *
+ * @return true if connected; false once the attempts ran out.
+ */
+bool ConnectionSupervisor_Connect( ConnectionSupervisorContext_t * supervisor,
+                                   bool * sessionPresent );
+
+/**
+ * @brief Tear down a lost connection and connect again, retrying with
+ * backoff.
+ *
+ * @param[in] supervisor Supervisor.
+ * @param[out] sessionPresent Set if the broker resumed the session.
+ *
+ * @return true if connected; false once the attempts ran out.
+ */
+bool ConnectionSupervisor_Reconnect( ConnectionSupervisorContext_t * supervisor,
+                                     bool * sessionPresent );
+
+/**
+ * @brief Decide whether to cut the connection for fault injection.
+ *
+ * Cheap, so it can be called from the loop servicing the connection.
+ *
+ * @param[in] supervisor Supervisor.
+ *
+ * @return true if the connection is due to be cut; the caller then treats
+ * it as lost and calls #ConnectionSupervisor_Reconnect.
+ */
+bool ConnectionSupervisor_FaultDue( ConnectionSupervisorContext_t * supervisor );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef CONNECTION_SUPERVISOR_H_ */
@@ -0,0 +1,40 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file crc32.c
+ * @brief Bitwise CRC-32, small rather than fast; records are tiny.
+ */
+
+#include "crc32.h"
+
+/*-----------------------------------------------------------*/
+
+uint32_t Crc32_Update( uint32_t crc,
+                       const void * data,
+                       size_t length )
+{
+    const uint8_t * bytes = ( const uint8_t * ) data;
+    size_t i = 0U;
+    uint32_t bit = 0U;
+
+    crc = ~crc;
+
+    for( i = 0U; i < length; i++ )
+    {
+        crc ^= bytes[ i ];
+
+        for( bit = 0U; bit < 8U; bit++ )
+        {
+            crc = ( crc >> 1 ) ^ ( 0xEDB88320U & ( 0U - ( crc & 1U ) ) );
+        }
+    }
+
+    return ~crc;
+}
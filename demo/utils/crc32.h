@@ -0,0 +1,47 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file crc32.h
+ * @brief CRC-32 used to detect torn or corrupt records on disk.
+ */
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/**
+ * @brief Compute the CRC-32 (IEEE 802.3) of a buffer.
+ *
+ * @param[in] crc CRC of the preceding data, or 0 for the first buffer.
+ * @param[in] data Data to add to the CRC.
+ * @param[in] length Length of the data.
+ *
+ * @return CRC of all data so far.
+ */
+uint32_t Crc32_Update( uint32_t crc,
+                       const void * data,
+                       size_t length );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef CRC32_H_ */
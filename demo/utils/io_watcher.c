@@ -0,0 +1,127 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file io_watcher.c
+ * @brief Implementation of the socket watcher on Linux epoll.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include "clock.h"
+#include "io_watcher.h"
+
+#define IO_WATCHER_IDLE        0U
+#define IO_WATCHER_READABLE    1U
+
+/*-----------------------------------------------------------*/
+
+bool IoWatcher_Init( IoWatcherContext_t * watcher )
+{
+    assert( watcher != NULL );
+
+    memset( watcher, 0x00, sizeof( IoWatcherContext_t ) );
+    watcher->fd = -1;
+    watcher->epollFd = epoll_create1( EPOLL_CLOEXEC );
+
+    return watcher->epollFd >= 0;
+}
+
+bool IoWatcher_Watch( IoWatcherContext_t * watcher,
+                      int fd )
+{
+    struct epoll_event event;
+    bool watching = false;
+
+    assert( watcher != NULL );
+
+    if( watcher->fd >= 0 )
+    {
+        ( void ) epoll_ctl( watcher->epollFd, EPOLL_CTL_DEL, watcher->fd, NULL );
+    }
+
+    watcher->fd = -1;
+    __atomic_store_n( &watcher->state, IO_WATCHER_IDLE, __ATOMIC_RELAXED );
+
+    if( fd >= 0 )
+    {
+        memset( &event, 0x00, sizeof( event ) );
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.fd = fd;
+        watching = epoll_ctl( watcher->epollFd, EPOLL_CTL_ADD, fd, &event ) == 0;
+        watcher->fd = watching ? fd : -1;
+    }
+
+    return watching;
+}
+
+bool IoWatcher_Wait( IoWatcherContext_t * watcher )
+{
+    struct epoll_event event;
+    int result = -1;
+
+    assert( watcher != NULL );
+
+    /* The tick of the FreeRTOS POSIX port is a signal, which interrupts
+     * the wait whenever it lands on this task. */
+    do
+    {
+        result = epoll_wait( watcher->epollFd, &event, 1, -1 );
+    } while( ( result < 0 ) && ( errno == EINTR ) );
+
+    if( result == 1 )
+    {
+        /* The time is published by the release of the state. */
+        watcher->readableAtUs = Clock_GetTimeUs();
+        ( void ) __atomic_fetch_add( &watcher->stats.readableEvents, 1U, __ATOMIC_RELAXED );
+        __atomic_store_n( &watcher->state, IO_WATCHER_READABLE, __ATOMIC_RELEASE );
+    }
+
+    return result == 1;
+}
+
+bool IoWatcher_Claim( IoWatcherContext_t * watcher )
+{
+    uint64_t latencyUs = 0U;
+    bool readable = false;
+
+    assert( watcher != NULL );
+
+    readable = __atomic_exchange_n( &watcher->state, IO_WATCHER_IDLE, __ATOMIC_ACQUIRE ) == IO_WATCHER_READABLE;
+
+    if( readable )
+    {
+        latencyUs = Clock_GetTimeUs() - watcher->readableAtUs;
+        watcher->stats.claimed++;
+        watcher->stats.totalLatencyUs += latencyUs;
+        watcher->stats.maxLatencyUs = ( latencyUs > watcher->stats.maxLatencyUs ) ?
+                                      ( uint32_t ) latencyUs : watcher->stats.maxLatencyUs;
+    }
+
+    return readable;
+}
+
+void IoWatcher_Rearm( IoWatcherContext_t * watcher )
+{
+    struct epoll_event event;
+
+    assert( watcher != NULL );
+
+    if( watcher->fd >= 0 )
+    {
+        memset( &event, 0x00, sizeof( event ) );
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.fd = watcher->fd;
+        ( void ) epoll_ctl( watcher->epollFd, EPOLL_CTL_MOD, watcher->fd, &event );
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file io_watcher.h
+ * @brief Watches a socket for readable data, so the task reading it can
+ * sleep until there is something to read.
+ *
+ * A FreeRTOS task of its own waits in epoll with #IoWatcher_Wait and
+ * notifies the reading task as soon as the socket is readable. Being a
+ * FreeRTOS task, unlike a native thread, it may notify with the ordinary
+ * FreeRTOS calls. It runs at the idle priority: it only waits in epoll
+ * when no other task is ready, and the tick still preempts it. The reading
+ * task claims the event with #IoWatcher_Claim. The socket is watched one
+ * shot at a time: after reading, the task re-arms the watch with
+ * #IoWatcher_Rearm, which reports at once if data is still waiting.
+ */
+
+#ifndef IO_WATCHER_H_
+#define IO_WATCHER_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Counters describing the watched socket.
+ */
+typedef struct IoWatcherStats
+{
+    uint32_t readableEvents; /**< @brief Times the socket became readable. */
+    uint32_t claimed;        /**< @brief Readable events claimed by the
+                                reading task. */
+    uint64_t totalLatencyUs; /**< @brief Sum of the times from readable to
+                                claimed. */
+    uint32_t maxLatencyUs;   /**< @brief Longest time from readable to
+                                claimed. */
+} IoWatcherStats_t;
+
+/**
+ * @brief State of a watcher.
+ */
+typedef struct IoWatcherContext
+{
+    int epollFd;            /**< @brief The epoll instance. */
+    int fd;                 /**< @brief Socket watched; -1 for none. */
+    uint32_t state;         /**< @brief Idle or readable. */
+    uint64_t readableAtUs;  /**< @brief When the socket became readable. */
+    IoWatcherStats_t stats; /**< @brief Socket counters. */
+} IoWatcherContext_t;
+
+/**
+ * @brief Initialize a watcher. No socket is watched.
+ *
+ * @param[out] watcher Watcher to initialize.
+ *
+ * @return true if the epoll instance was created.
+ */
+bool IoWatcher_Init( IoWatcherContext_t * watcher );
+
+/**
+ * @brief Watch another socket, or none.
+ *
+ * Call before the old socket is closed.
+ *
+ * @param[in] watcher Watcher.
+ * @param[in] fd Socket to watch; -1 to watch none.
+ *
+ * @return true if the socket is watched.
+ */
+bool IoWatcher_Watch( IoWatcherContext_t * watcher,
+                      int fd );
+
+/**
+ * @brief Wait until the watched socket is readable.
+ *
+ * Only for the watching task. Interrupted waits are resumed.
+ *
+ * @param[in] watcher Watcher.
+ *
+ * @return true if the socket became readable; false if epoll failed.
+ */
+bool IoWatcher_Wait( IoWatcherContext_t * watcher );
+
+/**
+ * @brief Claim the readable event for the reading task.
+ *
+ * @param[in] watcher Watcher.
+ *
+ * @return true if the socket became readable since the last claim.
+ */
+bool IoWatcher_Claim( IoWatcherContext_t * watcher );
+
+/**
+ * @brief Watch for the next readable event, after reading what was there.
+ *
+ * @param[in] watcher Watcher.
+ */
+void IoWatcher_Rearm( IoWatcherContext_t * watcher );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef IO_WATCHER_H_ */
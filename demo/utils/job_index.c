@@ -0,0 +1,689 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file job_index.c
+ * @brief Implementation of the single-pass jobs message index.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+#include "job_index.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Bits of #JobIndex_t.found.
+ */
+#define FOUND_JOB_ID          ( 1U << 0 )
+#define FOUND_JOB_DOCUMENT    ( 1U << 1 )
+#define FOUND_PROTOCOLS       ( 1U << 2 )
+#define FOUND_STREAM_NAME     ( 1U << 3 )
+
+/**
+ * @brief Fields a file entry must have.
+ */
+#define REQUIRED_FILE_FIELDS                 \
+    ( ( 1U << JOB_INDEX_FILE_PATH ) |        \
+      ( 1U << JOB_INDEX_FILE_SIZE ) |        \
+      ( 1U << JOB_INDEX_FILE_ID ) |          \
+      ( 1U << JOB_INDEX_FILE_CERT ) |        \
+      ( 1U << JOB_INDEX_FILE_SIGNATURE ) )
+
+/**
+ * @brief Fields a file entry downloaded over HTTP must have in addition.
+ */
+#define REQUIRED_HTTP_FIELDS                 \
+    ( ( 1U << JOB_INDEX_FILE_URL ) |         \
+      ( 1U << JOB_INDEX_FILE_AUTH_SCHEME ) )
+
+/**
+ * @brief Where in the message a value is.
+ */
+typedef enum JobIndexScope
+{
+    SCOPE_OTHER = 0, /**< A value the index does not look into. */
+    SCOPE_ROOT,      /**< The message. */
+    SCOPE_EXECUTION, /**< execution */
+    SCOPE_DOCUMENT,  /**< execution.jobDocument */
+    SCOPE_AFR_OTA,   /**< execution.jobDocument.afr_ota */
+    SCOPE_FILES,     /**< afr_ota.files */
+    SCOPE_FILE       /**< afr_ota.files[i] */
+} JobIndexScope_t;
+
+/**
+ * @brief State of the walk over the message.
+ */
+typedef struct JobIndexScanner
+{
+    const char * json;  /**< @brief Message. */
+    size_t length;      /**< @brief Length of the message. */
+    size_t position;    /**< @brief Next character to read. */
+    JobIndex_t * index; /**< @brief Index being filled. */
+} JobIndexScanner_t;
+
+/**
+ * @brief Keys of the file fields, in #JobIndexFileField_t order.
+ */
+static const char * const fileFieldKeys[ JOB_INDEX_FILE_FIELD_COUNT ] =
+{
+    "filepath",
+    "filesize",
+    "fileid",
+    "certfile",
+    "sig-sha256-ecdsa",
+    "fileType",
+    "update_data_url",
+    "auth_scheme"
+};
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Skip whitespace.
+ */
+static void skipWhitespace( JobIndexScanner_t * scanner );
+
+/**
+ * @brief Check if a span of the message equals a string.
+ */
+static bool spanEquals( const JobIndexScanner_t * scanner,
+                        const JobIndexSpan_t * span,
+                        const char * string );
+
+/**
+ * @brief Scan a string, recording its contents without the quotes.
+ *
+ * @return true if the string is terminated.
+ */
+static bool scanString( JobIndexScanner_t * scanner,
+                        JobIndexSpan_t * span );
+
+/**
+ * @brief Scan a number or a literal.
+ *
+ * @return true if a scalar was found.
+ */
+static bool scanScalar( JobIndexScanner_t * scanner,
+                        JobIndexSpan_t * span );
+
+/**
+ * @brief Scan an object, recording the members of interest in its scope.
+ *
+ * @return true if the object is valid.
+ */
+static bool scanObject( JobIndexScanner_t * scanner,
+                        JobIndexScope_t scope,
+                        uint32_t depth );
+
+/**
+ * @brief Scan an array, recording the files of the job document.
+ *
+ * @return true if the array is valid.
+ */
+static bool scanArray( JobIndexScanner_t * scanner,
+                       JobIndexScope_t scope,
+                       uint32_t depth );
+
+/**
+ * @brief Scan any value.
+ *
+ * @return true if the value is valid.
+ */
+static bool scanValue( JobIndexScanner_t * scanner,
+                       JobIndexScope_t scope,
+                       uint32_t depth,
+                       JobIndexSpan_t * span );
+
+/**
+ * @brief Find where a member of an object of the given scope goes.
+ *
+ * @param[in] scanner Scanner.
+ * @param[in] scope Scope of the object.
+ * @param[in] key Key of the member.
+ * @param[out] span Span to record the value in, or NULL.
+ * @param[out] found Found flags to update.
+ * @param[out] flag Flag of the member in found.
+ *
+ * @return Scope of the value.
+ */
+static JobIndexScope_t memberScope( JobIndexScanner_t * scanner,
+                                    JobIndexScope_t scope,
+                                    const JobIndexSpan_t * key,
+                                    JobIndexSpan_t ** span,
+                                    uint32_t ** found,
+                                    uint32_t * flag );
+
+/**
+ * @brief Parse an unsigned decimal number.
+ *
+ * @return true if the span holds a number that fits.
+ */
+static bool parseUint( const char * message,
+                       const JobIndexSpan_t * span,
+                       uint32_t * value );
+
+/*-----------------------------------------------------------*/
+
+static void skipWhitespace( JobIndexScanner_t * scanner )
+{
+    while( ( scanner->position < scanner->length ) &&
+           ( ( scanner->json[ scanner->position ] == ' ' ) ||
+             ( scanner->json[ scanner->position ] == '\t' ) ||
+             ( scanner->json[ scanner->position ] == '\r' ) ||
+             ( scanner->json[ scanner->position ] == '\n' ) ) )
+    {
+        scanner->position++;
+    }
+}
+
+static bool spanEquals( const JobIndexScanner_t * scanner,
+                        const JobIndexSpan_t * span,
+                        const char * string )
+{
+    return ( strlen( string ) == span->length ) &&
+           ( memcmp( &scanner->json[ span->offset ], string, span->length ) == 0 );
+}
+
+static bool scanString( JobIndexScanner_t * scanner,
+                        JobIndexSpan_t * span )
+{
+    bool terminated = false;
+
+    /* Skip the opening quote. */
+    scanner->position++;
+    span->offset = ( uint32_t ) scanner->position;
+
+    while( !terminated && ( scanner->position < scanner->length ) )
+    {
+        if( scanner->json[ scanner->position ] == '\\' )
+        {
+            scanner->position++;
+        }
+        else if( scanner->json[ scanner->position ] == '"' )
+        {
+            span->length = ( uint32_t ) ( scanner->position - span->offset );
+            terminated = true;
+        }
+        else
+        {
+            /* Empty else. */
+        }
+
+        scanner->position++;
+    }
+
+    return terminated;
+}
+
+static bool scanScalar( JobIndexScanner_t * scanner,
+                        JobIndexSpan_t * span )
+{
+    char c = '\0';
+
+    span->offset = ( uint32_t ) scanner->position;
+
+    while( scanner->position < scanner->length )
+    {
+        c = scanner->json[ scanner->position ];
+
+        if( ( c == ',' ) || ( c == '}' ) || ( c == ']' ) || ( c == ' ' ) ||
+            ( c == '\t' ) || ( c == '\r' ) || ( c == '\n' ) )
+        {
+            break;
+        }
+
+        scanner->position++;
+    }
+
+    span->length = ( uint32_t ) ( scanner->position - span->offset );
+
+    return span->length > 0U;
+}
+
+static JobIndexScope_t memberScope( JobIndexScanner_t * scanner,
+                                    JobIndexScope_t scope,
+                                    const JobIndexSpan_t * key,
+                                    JobIndexSpan_t ** span,
+                                    uint32_t ** found,
+                                    uint32_t * flag )
+{
+    JobIndex_t * index = scanner->index;
+    JobIndexFile_t * file = NULL;
+    JobIndexScope_t valueScope = SCOPE_OTHER;
+    uint32_t field = 0U;
+
+    *span = NULL;
+    *found = &index->found;
+    *flag = 0U;
+
+    switch( scope )
+    {
+        case SCOPE_ROOT:
+
+            if( spanEquals( scanner, key, "execution" ) )
+            {
+                valueScope = SCOPE_EXECUTION;
+            }
+
+            break;
+
+        case SCOPE_EXECUTION:
+
+            if( spanEquals( scanner, key, "jobId" ) )
+            {
+                *span = &index->jobId;
+                *flag = FOUND_JOB_ID;
+            }
+            else if( spanEquals( scanner, key, "jobDocument" ) )
+            {
+                valueScope = SCOPE_DOCUMENT;
+                *span = &index->jobDocument;
+                *flag = FOUND_JOB_DOCUMENT;
+            }
+            else
+            {
+                /* Empty else. */
+            }
+
+            break;
+
+        case SCOPE_DOCUMENT:
+
+            if( spanEquals( scanner, key, "afr_ota" ) )
+            {
+                valueScope = SCOPE_AFR_OTA;
+            }
+
+            break;
+
+        case SCOPE_AFR_OTA:
+
+            if( spanEquals( scanner, key, "protocols" ) )
+            {
+                *span = &index->protocols;
+                *flag = FOUND_PROTOCOLS;
+            }
+            else if( spanEquals( scanner, key, "streamname" ) )
+            {
+                *span = &index->streamName;
+                *flag = FOUND_STREAM_NAME;
+            }
+            else if( spanEquals( scanner, key, "files" ) )
+            {
+                valueScope = SCOPE_FILES;
+            }
+            else
+            {
+                /* Empty else. */
+            }
+
+            break;
+
+        case SCOPE_FILE:
+            file = &index->files[ index->fileCount - 1U ];
+
+            for( field = 0U; field < JOB_INDEX_FILE_FIELD_COUNT; field++ )
+            {
+                if( spanEquals( scanner, key, fileFieldKeys[ field ] ) )
+                {
+                    *span = &file->fields[ field ];
+                    *found = &file->found;
+                    *flag = 1U << field;
+                    break;
+                }
+            }
+
+            break;
+
+        default:
+            break;
+    }
+
+    return valueScope;
+}
+
+static bool scanObject( JobIndexScanner_t * scanner,
+                        JobIndexScope_t scope,
+                        uint32_t depth )
+{
+    JobIndexSpan_t key = { 0 };
+    JobIndexSpan_t value = { 0 };
+    JobIndexSpan_t * span = NULL;
+    uint32_t * found = NULL;
+    uint32_t flag = 0U;
+    JobIndexScope_t valueScope = SCOPE_OTHER;
+    bool valid = true;
+    bool done = false;
+
+    /* Skip the opening brace. */
+    scanner->position++;
+    skipWhitespace( scanner );
+
+    if( ( scanner->position < scanner->length ) &&
+        ( scanner->json[ scanner->position ] == '}' ) )
+    {
+        scanner->position++;
+        done = true;
+    }
+
+    while( valid && !done )
+    {
+        skipWhitespace( scanner );
+        valid = ( scanner->position < scanner->length ) &&
+                ( scanner->json[ scanner->position ] == '"' ) &&
+                scanString( scanner, &key );
+
+        if( valid )
+        {
+            skipWhitespace( scanner );
+            valid = ( scanner->position < scanner->length ) &&
+                    ( scanner->json[ scanner->position ] == ':' );
+            scanner->position++;
+        }
+
+        if( valid )
+        {
+            valueScope = memberScope( scanner, scope, &key, &span, &found, &flag );
+            valid = scanValue( scanner, valueScope, depth + 1U, &value );
+        }
+
+        if( valid && ( span != NULL ) )
+        {
+            *span = value;
+            *found |= flag;
+        }
+
+        if( valid )
+        {
+            skipWhitespace( scanner );
+            valid = scanner->position < scanner->length;
+        }
+
+        if( valid )
+        {
+            done = scanner->json[ scanner->position ] == '}';
+            valid = done || ( scanner->json[ scanner->position ] == ',' );
+            scanner->position++;
+        }
+    }
+
+    return valid;
+}
+
+static bool scanArray( JobIndexScanner_t * scanner,
+                       JobIndexScope_t scope,
+                       uint32_t depth )
+{
+    JobIndexSpan_t value = { 0 };
+    JobIndexScope_t elementScope = SCOPE_OTHER;
+    bool valid = true;
+    bool done = false;
+
+    /* Skip the opening bracket. */
+    scanner->position++;
+    skipWhitespace( scanner );
+
+    if( ( scanner->position < scanner->length ) &&
+        ( scanner->json[ scanner->position ] == ']' ) )
+    {
+        scanner->position++;
+        done = true;
+    }
+
+    while( valid && !done )
+    {
+        if( scope == SCOPE_FILES )
+        {
+            valid = scanner->index->fileCount < JOB_INDEX_MAX_FILES;
+
+            if( valid )
+            {
+                scanner->index->files[ scanner->index->fileCount ].found = 0U;
+                scanner->index->fileCount++;
+                elementScope = SCOPE_FILE;
+            }
+        }
+
+        valid = valid && scanValue( scanner, elementScope, depth + 1U, &value );
+
+        if( valid )
+        {
+            skipWhitespace( scanner );
+            valid = scanner->position < scanner->length;
+        }
+
+        if( valid )
+        {
+            done = scanner->json[ scanner->position ] == ']';
+            valid = done || ( scanner->json[ scanner->position ] == ',' );
+            scanner->position++;
+        }
+    }
+
+    return valid;
+}
+
+static bool scanValue( JobIndexScanner_t * scanner,
+                       JobIndexScope_t scope,
+                       uint32_t depth,
+                       JobIndexSpan_t * span )
+{
+    bool valid = depth <= JOB_INDEX_MAX_DEPTH;
+
+    skipWhitespace( scanner );
+    valid = valid && ( scanner->position < scanner->length );
+
+    if( valid )
+    {
+        span->offset = ( uint32_t ) scanner->position;
+
+        switch( scanner->json[ scanner->position ] )
+        {
+            case '{':
+                valid = scanObject( scanner, scope, depth );
+                span->length = ( uint32_t ) ( scanner->position - span->offset );
+                break;
+
+            case '[':
+                valid = scanArray( scanner, scope, depth );
+                span->length = ( uint32_t ) ( scanner->position - span->offset );
+                break;
+
+            case '"':
+                valid = scanString( scanner, span );
+                break;
+
+            default:
+                valid = scanScalar( scanner, span );
+                break;
+        }
+    }
+
+    return valid;
+}
+
+static bool parseUint( const char * message,
+                       const JobIndexSpan_t * span,
+                       uint32_t * value )
+{
+    uint64_t result = 0U;
+    uint32_t i = 0U;
+    bool valid = span->length > 0U;
+
+    for( i = 0U; valid && ( i < span->length ); i++ )
+    {
+        valid = ( message[ span->offset + i ] >= '0' ) &&
+                ( message[ span->offset + i ] <= '9' );
+        result = ( result * 10U ) + ( uint64_t ) ( message[ span->offset + i ] - '0' );
+        valid = valid && ( result <= UINT32_MAX );
+    }
+
+    if( valid )
+    {
+        *value = ( uint32_t ) result;
+    }
+
+    return valid;
+}
+
+/*-----------------------------------------------------------*/
+
+bool JobIndex_Build( JobIndex_t * index,
+                     const char * message,
+                     size_t messageLength )
+{
+    JobIndexScanner_t scanner = { 0 };
+    JobIndexSpan_t root = { 0 };
+    bool valid = false;
+
+    assert( index != NULL );
+    assert( message != NULL );
+
+    index->message = message;
+    index->found = 0U;
+    index->fileCount = 0U;
+
+    /* Offsets are stored in 32 bits. */
+    if( messageLength <= UINT32_MAX )
+    {
+        scanner.json = message;
+        scanner.length = messageLength;
+        scanner.index = index;
+
+        valid = scanValue( &scanner, SCOPE_ROOT, 0U, &root );
+        skipWhitespace( &scanner );
+        valid = valid && ( scanner.position == scanner.length );
+    }
+
+    if( !valid )
+    {
+        index->found = 0U;
+        index->fileCount = 0U;
+    }
+
+    return valid;
+}
+
+size_t JobIndex_GetJobId( const JobIndex_t * index,
+                          const char ** jobId )
+{
+    size_t length = 0U;
+
+    assert( index != NULL );
+    assert( jobId != NULL );
+
+    if( ( index->found & FOUND_JOB_ID ) != 0U )
+    {
+        *jobId = &index->message[ index->jobId.offset ];
+        length = index->jobId.length;
+    }
+
+    return length;
+}
+
+size_t JobIndex_GetJobDocument( const JobIndex_t * index,
+                                const char ** jobDocument )
+{
+    size_t length = 0U;
+
+    assert( index != NULL );
+    assert( jobDocument != NULL );
+
+    if( ( index->found & FOUND_JOB_DOCUMENT ) != 0U )
+    {
+        *jobDocument = &index->message[ index->jobDocument.offset ];
+        length = index->jobDocument.length;
+    }
+
+    return length;
+}
+
+uint32_t JobIndex_GetFileCount( const JobIndex_t * index )
+{
+    assert( index != NULL );
+
+    return index->fileCount;
+}
+
+bool JobIndex_GetFile( const JobIndex_t * index,
+                       uint32_t fileIndex,
+                       AfrOtaJobDocumentFields_t * fields )
+{
+    const JobIndexFile_t * file = NULL;
+    const JobIndexSpan_t * protocols = &index->protocols;
+    bool mqtt = false;
+    bool valid = false;
+    uint32_t i = 0U;
+
+    assert( index != NULL );
+    assert( fields != NULL );
+
+    if( fileIndex < index->fileCount )
+    {
+        file = &index->files[ fileIndex ];
+        valid = ( file->found & REQUIRED_FILE_FIELDS ) == REQUIRED_FILE_FIELDS;
+    }
+
+    /* The protocols array is short; look for the "MQTT" entry. */
+    for( i = 0U; ( ( index->found & FOUND_PROTOCOLS ) != 0U ) &&
+         ( i + 6U <= protocols->length ); i++ )
+    {
+        if( memcmp( &index->message[ protocols->offset + i ], "\"MQTT\"", 6U ) == 0 )
+        {
+            mqtt = true;
+            break;
+        }
+    }
+
+    if( valid )
+    {
+        valid = mqtt ? ( ( index->found & FOUND_STREAM_NAME ) != 0U )
+                     : ( ( file->found & REQUIRED_HTTP_FIELDS ) == REQUIRED_HTTP_FIELDS );
+    }
+
+    if( valid )
+    {
+        memset( fields, 0x00, sizeof( AfrOtaJobDocumentFields_t ) );
+        valid = parseUint( index->message, &file->fields[ JOB_INDEX_FILE_SIZE ], &fields->fileSize ) &&
+                parseUint( index->message, &file->fields[ JOB_INDEX_FILE_ID ], &fields->fileId );
+    }
+
+    if( valid && ( ( file->found & ( 1U << JOB_INDEX_FILE_TYPE ) ) != 0U ) )
+    {
+        valid = parseUint( index->message, &file->fields[ JOB_INDEX_FILE_TYPE ], &fields->fileType );
+    }
+
+    if( valid )
+    {
+        fields->filepath = &index->message[ file->fields[ JOB_INDEX_FILE_PATH ].offset ];
+        fields->filepathLen = file->fields[ JOB_INDEX_FILE_PATH ].length;
+        fields->certfile = &index->message[ file->fields[ JOB_INDEX_FILE_CERT ].offset ];
+        fields->certfileLen = file->fields[ JOB_INDEX_FILE_CERT ].length;
+        fields->signature = &index->message[ file->fields[ JOB_INDEX_FILE_SIGNATURE ].offset ];
+        fields->signatureLen = file->fields[ JOB_INDEX_FILE_SIGNATURE ].length;
+
+        if( mqtt )
+        {
+            fields->imageRef = &index->message[ index->streamName.offset ];
+            fields->imageRefLen = index->streamName.length;
+        }
+        else
+        {
+            fields->imageRef = &index->message[ file->fields[ JOB_INDEX_FILE_URL ].offset ];
+            fields->imageRefLen = file->fields[ JOB_INDEX_FILE_URL ].length;
+            fields->authScheme = &index->message[ file->fields[ JOB_INDEX_FILE_AUTH_SCHEME ].offset ];
+            fields->authSchemeLen = file->fields[ JOB_INDEX_FILE_AUTH_SCHEME ].length;
+        }
+    }
+
+    return valid;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file job_index.h
+ * @brief Single-pass index of an AWS IoT Jobs message carrying an OTA job
+ * document.
+ *
+ * Looking up the job ID, the job document and every file of the document
+ * with coreJSON scans the message once per lookup, and the lookups of file N
+ * rescan files 0 to N-1. The index instead walks the message once and
+ * records where the job ID, the job document and the fields of each file
+ * are. Later lookups only read the recorded spans.
+ *
+ * The message is referenced, not copied, and must outlive the index.
+ */
+
+#ifndef JOB_INDEX_H_
+#define JOB_INDEX_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ota_job_processor.h"
+
+/**
+ * @brief Maximum number of files of an indexed job document.
+ */
+#ifndef JOB_INDEX_MAX_FILES
+    #define JOB_INDEX_MAX_FILES 128U
+#endif
+
+/**
+ * @brief Maximum nesting depth of the indexed JSON.
+ */
+#define JOB_INDEX_MAX_DEPTH     16U
+
+/**
+ * @brief Fields of a file entry of the job document.
+ */
+typedef enum JobIndexFileField
+{
+    JOB_INDEX_FILE_PATH = 0,     /**< "filepath" */
+    JOB_INDEX_FILE_SIZE,         /**< "filesize" */
+    JOB_INDEX_FILE_ID,           /**< "fileid" */
+    JOB_INDEX_FILE_CERT,         /**< "certfile" */
+    JOB_INDEX_FILE_SIGNATURE,    /**< "sig-sha256-ecdsa" */
+    JOB_INDEX_FILE_TYPE,         /**< "fileType" */
+    JOB_INDEX_FILE_URL,          /**< "update_data_url" */
+    JOB_INDEX_FILE_AUTH_SCHEME,  /**< "auth_scheme" */
+    JOB_INDEX_FILE_FIELD_COUNT
+} JobIndexFileField_t;
+
+/**
+ * @brief Location of a value in the message. Strings exclude their quotes.
+ */
+typedef struct JobIndexSpan
+{
+    uint32_t offset; /**< @brief Offset of the value. */
+    uint32_t length; /**< @brief Length of the value. */
+} JobIndexSpan_t;
+
+/**
+ * @brief Index of one file entry.
+ */
+typedef struct JobIndexFile
+{
+    uint32_t found;                                      /**< @brief Bit per
+                                                            field present. */
+    JobIndexSpan_t fields[ JOB_INDEX_FILE_FIELD_COUNT ]; /**< @brief Values. */
+} JobIndexFile_t;
+
+/**
+ * @brief Index of a jobs message.
+ */
+typedef struct JobIndex
+{
+    const char * message;                     /**< @brief Indexed message. */
+    uint32_t found;                           /**< @brief Bit per top level
+                                                 value present. */
+    JobIndexSpan_t jobId;                     /**< @brief execution.jobId */
+    JobIndexSpan_t jobDocument;               /**< @brief execution.jobDocument */
+    JobIndexSpan_t protocols;                 /**< @brief afr_ota.protocols */
+    JobIndexSpan_t streamName;                /**< @brief afr_ota.streamname */
+    uint32_t fileCount;                       /**< @brief Files indexed. */
+    JobIndexFile_t files[ JOB_INDEX_MAX_FILES ]; /**< @brief afr_ota.files */
+} JobIndex_t;
+
+/**
+ * @brief Index a jobs message in a single pass.
+ *
+ * @param[out] index Index to fill.
+ * @param[in] message Jobs message, e.g. a StartNext response.
+ * @param[in] messageLength Length of the message.
+ *
+ * @return true on success; false if the message is not valid JSON, nests
+ * deeper than #JOB_INDEX_MAX_DEPTH or lists more than #JOB_INDEX_MAX_FILES
+ * files.
+ */
+bool JobIndex_Build( JobIndex_t * index,
+                     const char * message,
+                     size_t messageLength );
+
+/**
+ * @brief Get the ID of the job.
+ *
+ * @param[in] index Index of the message.
+ * @param[out] jobId Start of the job ID in the message.
+ *
+ * @return Length of the job ID; zero if there is none.
+ */
+size_t JobIndex_GetJobId( const JobIndex_t * index,
+                          const char ** jobId );
+
+/**
+ * @brief Get the job document.
+ *
+ * @param[in] index Index of the message.
+ * @param[out] jobDocument Start of the job document in the message.
+ *
+ * @return Length of the job document; zero if there is none.
+ */
+size_t JobIndex_GetJobDocument( const JobIndex_t * index,
+                                const char ** jobDocument );
+
+/**
+ * @brief Get the number of files of the job document.
+ *
+ * @param[in] index Index of the message.
+ *
+ * @return Number of file entries.
+ */
+uint32_t JobIndex_GetFileCount( const JobIndex_t * index );
+
+/**
+ * @brief Get the fields of one file, as otaParser_parseJobDocFile would.
+ *
+ * @param[in] index Index of the message.
+ * @param[in] fileIndex Index of the file.
+ * @param[out] fields Fields of the file, pointing into the message.
+ *
+ * @return true if the file has all required fields.
+ */
+bool JobIndex_GetFile( const JobIndex_t * index,
+                       uint32_t fileIndex,
+                       AfrOtaJobDocumentFields_t * fields );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef JOB_INDEX_H_ */
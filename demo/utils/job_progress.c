@@ -0,0 +1,213 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file job_progress.c
+ * @brief Implementation of the IN_PROGRESS job reporter.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "job_progress.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Decide whether a report is due.
+ */
+static bool isReportDue( const JobProgressContext_t * progress,
+                         uint32_t nowMs );
+
+/**
+ * @brief Build and send a report of the latest progress.
+ */
+static bool sendReport( JobProgressContext_t * progress,
+                        uint32_t nowMs );
+
+/*-----------------------------------------------------------*/
+
+static bool isReportDue( const JobProgressContext_t * progress,
+                         uint32_t nowMs )
+{
+    uint32_t elapsedMs = nowMs - progress->reportTimeMs;
+    uint64_t deltaPercent = 0U;
+    bool due = false;
+
+    if( progress->retryPending )
+    {
+        due = elapsedMs >= progress->config.retryMs;
+    }
+    else if( elapsedMs >= progress->config.heartbeatMs )
+    {
+        due = true;
+    }
+    else if( elapsedMs >= progress->config.minIntervalMs )
+    {
+        deltaPercent = ( ( uint64_t ) ( progress->bytesReceived - progress->reportedBytes ) * 100U ) /
+                       progress->totalBytes;
+        due = deltaPercent >= progress->config.minPercentDelta;
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return due;
+}
+
+static bool sendReport( JobProgressContext_t * progress,
+                        uint32_t nowMs )
+{
+    uint32_t elapsedMs = nowMs - progress->startTimeMs;
+    uint64_t throughput = 0U;
+    int length = 0;
+    bool sent = false;
+
+    if( elapsedMs > 0U )
+    {
+        throughput = ( ( uint64_t ) progress->bytesReceived * 1000U ) / elapsedMs;
+    }
+
+    /* statusDetails only holds strings. The version is not expected, so a
+     * report sent again after a lost answer is not rejected. */
+    length = snprintf( progress->message,
+                       sizeof( progress->message ),
+                       "{\"status\":\"IN_PROGRESS\",\"statusDetails\":{"
+                       "\"bytesReceived\":\"%u\",\"blocksRemaining\":\"%u\","
+                       "\"throughputBps\":\"%llu\"},"
+                       "\"includeJobExecutionState\":true,"
+                       "\"clientToken\":\"" JOB_PROGRESS_TOKEN_PREFIX "%u\"}",
+                       progress->bytesReceived,
+                       progress->blocksRemaining,
+                       ( unsigned long long ) throughput,
+                       progress->token + 1U );
+
+    if( ( length > 0 ) && ( ( size_t ) length < sizeof( progress->message ) ) )
+    {
+        progress->token++;
+        sent = progress->config.send( progress->config.sendContext,
+                                      progress->message,
+                                      ( size_t ) length );
+    }
+
+    /* A report which could not be sent is retried like a lost one. */
+    progress->reportTimeMs = nowMs;
+    progress->inFlight = sent;
+    progress->retryPending = !sent;
+
+    if( sent )
+    {
+        progress->reportedBytes = progress->bytesReceived;
+        progress->stats.sent++;
+    }
+
+    return sent;
+}
+
+/*-----------------------------------------------------------*/
+
+void JobProgress_Init( JobProgressContext_t * progress,
+                       const JobProgressConfig_t * config,
+                       uint32_t totalBytes,
+                       uint32_t version,
+                       uint32_t nowMs )
+{
+    assert( progress != NULL );
+    assert( config != NULL );
+    assert( config->send != NULL );
+
+    memset( progress, 0x00, sizeof( JobProgressContext_t ) );
+    progress->config = *config;
+    progress->totalBytes = ( totalBytes > 0U ) ? totalBytes : 1U;
+    progress->version = version;
+    progress->startTimeMs = nowMs;
+    progress->reportTimeMs = nowMs;
+}
+
+void JobProgress_Record( JobProgressContext_t * progress,
+                         uint32_t bytesReceived,
+                         uint32_t blocksRemaining )
+{
+    assert( progress != NULL );
+
+    progress->bytesReceived = bytesReceived;
+    progress->blocksRemaining = blocksRemaining;
+    progress->stats.recorded++;
+}
+
+bool JobProgress_Service( JobProgressContext_t * progress,
+                          uint32_t nowMs )
+{
+    bool sent = false;
+
+    assert( progress != NULL );
+
+    /* An unanswered report is taken as lost after the retry interval. */
+    if( progress->inFlight && ( ( nowMs - progress->reportTimeMs ) >= progress->config.retryMs ) )
+    {
+        progress->inFlight = false;
+        progress->retryPending = true;
+        progress->versionUnknown = true;
+        progress->reportTimeMs = nowMs - progress->config.retryMs;
+    }
+
+    if( !progress->inFlight && isReportDue( progress, nowMs ) )
+    {
+        if( progress->retryPending )
+        {
+            progress->stats.retries++;
+        }
+
+        sent = sendReport( progress, nowMs );
+    }
+
+    return sent;
+}
+
+void JobProgress_Acknowledge( JobProgressContext_t * progress,
+                              uint32_t token,
+                              bool accepted,
+                              uint32_t version )
+{
+    assert( progress != NULL );
+
+    if( progress->inFlight && ( token == progress->token ) )
+    {
+        progress->inFlight = false;
+
+        if( accepted )
+        {
+            progress->version = version;
+            progress->versionUnknown = false;
+            progress->stats.accepted++;
+        }
+        else
+        {
+            progress->retryPending = true;
+            progress->stats.rejected++;
+        }
+    }
+}
+
+uint32_t JobProgress_GetVersion( const JobProgressContext_t * progress )
+{
+    assert( progress != NULL );
+
+    return progress->version;
+}
+
+bool JobProgress_IsVersionKnown( const JobProgressContext_t * progress )
+{
+    assert( progress != NULL );
+
+    return !progress->inFlight && !progress->versionUnknown;
+}
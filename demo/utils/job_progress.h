@@ -0,0 +1,205 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file job_progress.h
+ * @brief Rate-limited IN_PROGRESS reports of a running job.
+ *
+ * The download records its progress with every block, which only updates a
+ * few counters. A report carrying the latest counters in statusDetails is
+ * sent once enough time has passed and the download has advanced by enough
+ * percent, or when no report was sent for a heartbeat interval. Every
+ * report in between is coalesced into the next one.
+ *
+ * Only one report is in flight at a time. A report which the service
+ * rejects or does not answer within the retry interval is sent again, with
+ * the counters of that time. Reports ask for the execution state in the
+ * response, so the reporter knows the version the final status update has
+ * to expect.
+ */
+
+#ifndef JOB_PROGRESS_H_
+#define JOB_PROGRESS_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of the report message buffer.
+ */
+#define JOB_PROGRESS_MESSAGE_SIZE     256U
+
+/**
+ * @brief Prefix of the client token of a report, followed by its sequence
+ * number.
+ */
+#define JOB_PROGRESS_TOKEN_PREFIX     "progress-"
+
+/**
+ * @brief Publish a report on the update topic of the job.
+ *
+ * @param[in] sendContext Context given in #JobProgressConfig_t.
+ * @param[in] message UpdateJobExecution request.
+ * @param[in] messageLength Length of the request.
+ *
+ * @return true if the report was sent.
+ */
+typedef bool ( * JobProgressSend_t )( void * sendContext,
+                                      const char * message,
+                                      size_t messageLength );
+
+/**
+ * @brief Configuration of a reporter.
+ */
+typedef struct JobProgressConfig
+{
+    uint32_t minIntervalMs;   /**< @brief Least time between two reports. */
+    uint32_t minPercentDelta; /**< @brief Least progress between two
+                                 reports, in percent of the file. */
+    uint32_t heartbeatMs;     /**< @brief Report after this long even
+                                 without progress, so step timeouts do not
+                                 expire. */
+    uint32_t retryMs;         /**< @brief Send a report again when it was
+                                 not answered within this time. */
+    JobProgressSend_t send;   /**< @brief Publishes a report. */
+    void * sendContext;       /**< @brief Passed to the send function. */
+} JobProgressConfig_t;
+
+/**
+ * @brief Counters describing the reports.
+ */
+typedef struct JobProgressStats
+{
+    uint32_t recorded; /**< @brief Progress updates recorded. */
+    uint32_t sent;     /**< @brief Reports sent, including retries. */
+    uint32_t retries;  /**< @brief Reports sent again. */
+    uint32_t accepted; /**< @brief Reports the service accepted. */
+    uint32_t rejected; /**< @brief Reports the service rejected. */
+} JobProgressStats_t;
+
+/**
+ * @brief State of a reporter.
+ */
+typedef struct JobProgressContext
+{
+    JobProgressConfig_t config;    /**< @brief Configuration. */
+    uint32_t totalBytes;           /**< @brief Size of the file. */
+    uint32_t bytesReceived;        /**< @brief Latest recorded progress. */
+    uint32_t blocksRemaining;      /**< @brief Latest recorded progress. */
+    uint32_t startTimeMs;          /**< @brief Start of the download. */
+    uint32_t reportTimeMs;         /**< @brief When the last report was
+                                      sent. */
+    uint32_t reportedBytes;        /**< @brief Bytes in the last report. */
+    uint32_t token;                /**< @brief Sequence number of the last
+                                      report. */
+    uint32_t version;              /**< @brief Version of the job
+                                      execution. */
+    bool inFlight;                 /**< @brief The last report is not
+                                      answered yet. */
+    bool retryPending;             /**< @brief The last report has to be
+                                      sent again. */
+    bool versionUnknown;           /**< @brief A report was taken as lost,
+                                      the service may have applied it. */
+    JobProgressStats_t stats;      /**< @brief Report counters. */
+    char message[ JOB_PROGRESS_MESSAGE_SIZE ]; /**< @brief Last report. */
+} JobProgressContext_t;
+
+/**
+ * @brief Initialize a reporter for a download.
+ *
+ * @param[out] progress Reporter to initialize.
+ * @param[in] config Configuration, copied into the reporter.
+ * @param[in] totalBytes Size of the file being downloaded.
+ * @param[in] version Current version of the job execution.
+ * @param[in] nowMs Current time.
+ */
+void JobProgress_Init( JobProgressContext_t * progress,
+                       const JobProgressConfig_t * config,
+                       uint32_t totalBytes,
+                       uint32_t version,
+                       uint32_t nowMs );
+
+/**
+ * @brief Record the progress of the download. Nothing is sent.
+ *
+ * @param[in] progress Reporter.
+ * @param[in] bytesReceived Bytes of the file received so far.
+ * @param[in] blocksRemaining Blocks still to download.
+ */
+void JobProgress_Record( JobProgressContext_t * progress,
+                         uint32_t bytesReceived,
+                         uint32_t blocksRemaining );
+
+/**
+ * @brief Send a report if one is due.
+ *
+ * Cheap when no report is due, so it can be called for every block.
+ *
+ * @param[in] progress Reporter.
+ * @param[in] nowMs Current time.
+ *
+ * @return true if a report was sent.
+ */
+bool JobProgress_Service( JobProgressContext_t * progress,
+                          uint32_t nowMs );
+
+/**
+ * @brief Pass the answer of the service to a report.
+ *
+ * Answers to other requests, or to reports which were already sent again,
+ * are ignored.
+ *
+ * @param[in] progress Reporter.
+ * @param[in] token Sequence number from the client token of the answer.
+ * @param[in] accepted The report was accepted.
+ * @param[in] version Version of the job execution from the answer; only
+ * used when the report was accepted.
+ */
+void JobProgress_Acknowledge( JobProgressContext_t * progress,
+                              uint32_t token,
+                              bool accepted,
+                              uint32_t version );
+
+/**
+ * @brief Get the version a status update of the job has to expect.
+ *
+ * @param[in] progress Reporter.
+ *
+ * @return Version of the job execution, as last reported by the service.
+ */
+uint32_t JobProgress_GetVersion( const JobProgressContext_t * progress );
+
+/**
+ * @brief Check whether the version of the job execution is known.
+ *
+ * The version is not known while a report is unanswered, or after a report
+ * was taken as lost until a later one is accepted; the service may have
+ * applied such a report and raised the version.
+ *
+ * @param[in] progress Reporter.
+ *
+ * @return true if #JobProgress_GetVersion returns the current version.
+ */
+bool JobProgress_IsVersionKnown( const JobProgressContext_t * progress );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef JOB_PROGRESS_H_ */
@@ -0,0 +1,108 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file job_report.c
+ * @brief Implementation of the per-job performance report.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <sys/resource.h>
+
+#include "job_report.h"
+
+/*-----------------------------------------------------------*/
+
+void JobReport_Reset( JobReport_t * report )
+{
+    assert( report != NULL );
+
+    memset( report, 0x00, sizeof( JobReport_t ) );
+}
+
+void JobReport_Begin( JobReport_t * report,
+                      JobReportPhase_t phase,
+                      uint32_t nowMs )
+{
+    assert( report != NULL );
+    assert( phase < JOB_REPORT_PHASE_COUNT );
+
+    report->phaseStartMs[ phase ] = nowMs;
+    report->runningPhases |= 1U << phase;
+}
+
+void JobReport_End( JobReport_t * report,
+                    JobReportPhase_t phase,
+                    uint32_t nowMs )
+{
+    assert( report != NULL );
+    assert( phase < JOB_REPORT_PHASE_COUNT );
+
+    if( ( report->runningPhases & ( 1U << phase ) ) != 0U )
+    {
+        report->phaseMs[ phase ] += nowMs - report->phaseStartMs[ phase ];
+        report->runningPhases &= ~( 1U << phase );
+    }
+}
+
+void JobReport_SetPhase( JobReport_t * report,
+                         JobReportPhase_t phase,
+                         uint32_t timeMs )
+{
+    assert( report != NULL );
+    assert( phase < JOB_REPORT_PHASE_COUNT );
+
+    report->phaseMs[ phase ] = timeMs;
+}
+
+size_t JobReport_Format( const JobReport_t * report,
+                         char * buffer,
+                         size_t bufferSize )
+{
+    struct rusage usage;
+    uint64_t throughput = 0U;
+    int length = 0;
+
+    assert( report != NULL );
+    assert( buffer != NULL );
+
+    memset( &usage, 0x00, sizeof( usage ) );
+    ( void ) getrusage( RUSAGE_SELF, &usage );
+
+    if( report->phaseMs[ JOB_REPORT_DOWNLOAD ] > 0U )
+    {
+        throughput = ( report->bytesDownloaded * 1000U ) / report->phaseMs[ JOB_REPORT_DOWNLOAD ];
+    }
+
+    /* Short keys keep the report within one small status update. */
+    length = snprintf( buffer,
+                       bufferSize,
+                       "{\"connectMs\":\"%u\",\"fetchMs\":\"%u\",\"firstBlockMs\":\"%u\","
+                       "\"downloadMs\":\"%u\",\"verifyMs\":\"%u\",\"statusMs\":\"%u\","
+                       "\"retransmits\":\"%u\",\"duplicates\":\"%u\",\"reconnects\":\"%u\","
+                       "\"throughputBps\":\"%llu\",\"peakRssKb\":\"%ld\"}",
+                       report->phaseMs[ JOB_REPORT_CONNECT ],
+                       report->phaseMs[ JOB_REPORT_FETCH ],
+                       report->phaseMs[ JOB_REPORT_FIRST_BLOCK ],
+                       report->phaseMs[ JOB_REPORT_DOWNLOAD ],
+                       report->phaseMs[ JOB_REPORT_VERIFY ],
+                       report->phaseMs[ JOB_REPORT_STATUS ],
+                       report->retransmits,
+                       report->duplicates,
+                       report->reconnects,
+                       ( unsigned long long ) throughput,
+                       usage.ru_maxrss );
+
+    return ( ( length > 0 ) && ( ( size_t ) length < bufferSize ) ) ? ( size_t ) length : 0U;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file job_report.h
+ * @brief Per-job performance report, published in the statusDetails of the
+ * final job status.
+ *
+ * The agent times the phases of a job and counts what went wrong on the
+ * way. The report is formatted as a flat JSON object of string values, as
+ * statusDetails requires, so the service keeps it with the job execution
+ * and it can be aggregated across devices without their logs.
+ */
+
+#ifndef JOB_REPORT_H_
+#define JOB_REPORT_H_
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of a buffer large enough for any formatted report.
+ */
+#define JOB_REPORT_DETAILS_SIZE    320U
+
+/**
+ * @brief Timed phases of a job.
+ */
+typedef enum JobReportPhase
+{
+    JOB_REPORT_CONNECT = 0,  /**< Connecting to AWS IoT. */
+    JOB_REPORT_FETCH,        /**< Fetching the job document. */
+    JOB_REPORT_FIRST_BLOCK,  /**< From the job document to the first block. */
+    JOB_REPORT_DOWNLOAD,     /**< From the first block to the last one. */
+    JOB_REPORT_VERIFY,       /**< Checking and installing the image. */
+    JOB_REPORT_STATUS,       /**< Publishing status updates of the job. */
+    JOB_REPORT_PHASE_COUNT
+} JobReportPhase_t;
+
+/**
+ * @brief Report of one job.
+ */
+typedef struct JobReport
+{
+    uint32_t phaseMs[ JOB_REPORT_PHASE_COUNT ];      /**< @brief Time spent
+                                                        in each phase. */
+    uint32_t phaseStartMs[ JOB_REPORT_PHASE_COUNT ]; /**< @brief Start of the
+                                                        running phases. */
+    uint32_t runningPhases;                          /**< @brief Bit per
+                                                        running phase. */
+    uint32_t retransmits;                            /**< @brief Blocks
+                                                        requested again. */
+    uint32_t duplicates;                             /**< @brief Blocks
+                                                        received again. */
+    uint32_t reconnects;                             /**< @brief Connections
+                                                        lost during the job. */
+    uint64_t bytesDownloaded;                        /**< @brief Bytes of
+                                                        the download. */
+} JobReport_t;
+
+/**
+ * @brief Clear a report for the next job.
+ *
+ * @param[out] report Report to clear.
+ */
+void JobReport_Reset( JobReport_t * report );
+
+/**
+ * @brief Start timing a phase. Starting a running phase restarts it.
+ *
+ * @param[in] report Report.
+ * @param[in] phase Phase to time.
+ * @param[in] nowMs Current time.
+ */
+void JobReport_Begin( JobReport_t * report,
+                      JobReportPhase_t phase,
+                      uint32_t nowMs );
+
+/**
+ * @brief Stop timing a phase and add its time. Ignored if the phase is not
+ * running.
+ *
+ * @param[in] report Report.
+ * @param[in] phase Phase to stop.
+ * @param[in] nowMs Current time.
+ */
+void JobReport_End( JobReport_t * report,
+                    JobReportPhase_t phase,
+                    uint32_t nowMs );
+
+/**
+ * @brief Set the time of a phase measured elsewhere.
+ *
+ * @param[in] report Report.
+ * @param[in] phase Phase.
+ * @param[in] timeMs Time spent in the phase.
+ */
+void JobReport_SetPhase( JobReport_t * report,
+                         JobReportPhase_t phase,
+                         uint32_t timeMs );
+
+/**
+ * @brief Format the report as a statusDetails object.
+ *
+ * The throughput is computed from the download phase, the peak memory is
+ * the peak resident set size of the process.
+ *
+ * @param[in] report Report.
+ * @param[out] buffer Buffer for the JSON object, at least
+ * #JOB_REPORT_DETAILS_SIZE bytes for any report to fit.
+ * @param[in] bufferSize Size of the buffer.
+ *
+ * @return Length of the object; zero if it did not fit.
+ */
+size_t JobReport_Format( const JobReport_t * report,
+                         char * buffer,
+                         size_t bufferSize );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+}
+#endif
+/* *INDENT-ON* */
+
+#endif /* ifndef JOB_REPORT_H_ */
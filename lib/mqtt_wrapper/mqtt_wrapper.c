@@ -12,80 +12,422 @@
 
 #include "mqtt_wrapper.h"
 
-static MQTTContext_t * globalCoreMqttContext = NULL;
+/* Buffers of the default instance. */
+static MqttWrapperInFlightPublish_t defaultInFlightPublishes[ MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES ];
+static MqttWrapperCommand_t defaultCommands[ MQTT_WRAPPER_COMMAND_QUEUE_SIZE ];
+static MqttWrapperRoute_t defaultRouteBuckets[ MQTT_WRAPPER_ROUTE_BUCKETS( MQTT_WRAPPER_MAX_ROUTES ) ];
+static char defaultRoutePool[ MQTT_WRAPPER_ROUTE_POOL_SIZE ];
 
-#define MAX_THING_NAME_SIZE 128U
-static char globalThingName[ MAX_THING_NAME_SIZE + 1 ];
-static size_t globalThingNameLength = 0U;
+/* What the functions without an instance act on. */
+static MqttWrapperInstance_t defaultInstance =
+{
+    .buffers =
+    {
+        .inFlightPublishes    = defaultInFlightPublishes,
+        .inFlightPublishCount = MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES,
+        .commands             = defaultCommands,
+        .commandCount         = MQTT_WRAPPER_COMMAND_QUEUE_SIZE,
+        .routeBuckets         = defaultRouteBuckets,
+        .routeBucketCount     = MQTT_WRAPPER_ROUTE_BUCKETS( MQTT_WRAPPER_MAX_ROUTES ),
+        .routePool            = defaultRoutePool,
+        .routePoolSize        = MQTT_WRAPPER_ROUTE_POOL_SIZE
+    }
+};
+
+/* Outcome of a QoS 1 publish. Only a full window lets a queued publish go
+ * out at QoS 0 instead. */
+typedef enum MqttWrapperQos1Status
+{
+    MQTT_WRAPPER_QOS1_SENT,
+    MQTT_WRAPPER_QOS1_WINDOW_FULL,
+    MQTT_WRAPPER_QOS1_FAILED
+} MqttWrapperQos1Status_t;
+
+/* The command queue of an instance is a bounded MPSC queue for the task
+ * owning its MQTT context. The sequence of a slot tells whose turn it is:
+ * equal to the enqueue position when free, one more once filled, so
+ * producers only race on the position and the owner never takes a lock.
+ *
+ * Routes are kept in an open addressing table, at most half full, with a
+ * bit per length of a registered prefix so only those lengths are probed. */
+#define ROUTE_HASH_SEED     2166136261U
+#define ROUTE_HASH_PRIME    16777619U
+
+static MqttWrapperRoute_t * findRoute( const MqttWrapperInstance_t * instance,
+                                       const char * topic,
+                                       size_t topicLength,
+                                       uint32_t hash,
+                                       bool prefix );
+
+static MQTTStatus_t sendInFlightPublish( MqttWrapperInstance_t * instance,
+                                         MqttWrapperInFlightPublish_t * publish,
+                                         bool dup );
+
+static uint32_t getResendTimeoutMs( const MqttWrapperInFlightPublish_t * publish );
+
+static bool connectClient( MqttWrapperInstance_t * instance,
+                           const char * clientId,
+                           size_t clientIdLength,
+                           bool cleanSession,
+                           bool * sessionPresent );
+
+static bool publishNow( MqttWrapperInstance_t * instance,
+                        char * topic,
+                        size_t topicLength,
+                        uint8_t * message,
+                        size_t messageLength );
+
+static MqttWrapperQos1Status_t publishQos1Now( MqttWrapperInstance_t * instance,
+                                               char * topic,
+                                               size_t topicLength,
+                                               uint8_t * message,
+                                               size_t messageLength,
+                                               MqttWrapperPubAckHandler_t handler,
+                                               void * context,
+                                               uint16_t * packetId );
+
+static bool subscribeNow( MqttWrapperInstance_t * instance,
+                          char * topic,
+                          size_t topicLength );
+
+static bool subscribeManyNow( MqttWrapperInstance_t * instance,
+                              char * const * topics,
+                              const size_t * topicLengths,
+                              size_t topicCount,
+                              MqttWrapperSubAckHandler_t handler,
+                              void * context,
+                              uint16_t * packetId );
+
+static bool enqueueCommand( MqttWrapperInstance_t * instance,
+                            MqttWrapperCommandType_t type,
+                            char * const * topics,
+                            const size_t * topicLengths,
+                            size_t topicCount,
+                            const uint8_t * message,
+                            size_t messageLength,
+                            MqttWrapperPubAckHandler_t pubAckHandler,
+                            MqttWrapperSubAckHandler_t subAckHandler,
+                            void * context );
+
+static bool executeCommand( MqttWrapperInstance_t * instance,
+                            MqttWrapperCommand_t * command );
+
+static bool isPowerOfTwo( size_t value );
 
 void mqttWrapper_setCoreMqttContext( MQTTContext_t * mqttContext )
 {
-    globalCoreMqttContext = mqttContext;
+    defaultInstance.mqttContext = mqttContext;
 }
 
 MQTTContext_t * mqttWrapper_getCoreMqttContext( void )
 {
-    assert( globalCoreMqttContext != NULL );
-    return globalCoreMqttContext;
+    return mqttWrapperInstance_getCoreMqttContext( &defaultInstance );
 }
 
 void mqttWrapper_setThingName( char * thingName, size_t thingNameLength )
 {
-    strncpy( globalThingName, thingName, MAX_THING_NAME_SIZE );
-    globalThingNameLength = thingNameLength;
+    size_t length = ( thingNameLength < MQTT_WRAPPER_MAX_THING_NAME_LENGTH ) ?
+                    thingNameLength : MQTT_WRAPPER_MAX_THING_NAME_LENGTH;
+
+    memcpy( defaultInstance.thingName, thingName, length );
+    defaultInstance.thingName[ length ] = '\0';
+    defaultInstance.thingNameLength = length;
 }
 
 void mqttWrapper_getThingName( char * thingNameBuffer,
                                size_t * thingNameLength )
 {
-    assert( globalThingName[ 0 ] != 0 );
+    const char * thingName = mqttWrapper_getThingNameView( thingNameLength );
 
-    memcpy( thingNameBuffer, globalThingName, globalThingNameLength );
-    thingNameBuffer[ globalThingNameLength ] = '\0';
-    *thingNameLength = globalThingNameLength;
+    memcpy( thingNameBuffer, thingName, *thingNameLength + 1U );
+}
+
+const char * mqttWrapper_getThingNameView( size_t * thingNameLength )
+{
+    return mqttWrapperInstance_getThingName( &defaultInstance, thingNameLength );
+}
+
+MqttWrapperInstance_t * mqttWrapper_getDefaultInstance( void )
+{
+    return &defaultInstance;
 }
 
 bool mqttWrapper_connect( char * thingName, size_t thingNameLength )
+{
+    bool sessionPresent = false;
+
+    return mqttWrapper_connectSession( thingName,
+                                       thingNameLength,
+                                       true,
+                                       &sessionPresent );
+}
+
+bool mqttWrapper_connectSession( char * thingName,
+                                 size_t thingNameLength,
+                                 bool cleanSession,
+                                 bool * sessionPresent )
+{
+    return connectClient( &defaultInstance,
+                          thingName,
+                          thingNameLength,
+                          cleanSession,
+                          sessionPresent );
+}
+
+size_t mqttWrapper_resumeSession( bool sessionPresent )
+{
+    return mqttWrapperInstance_resumeSession( &defaultInstance, sessionPresent );
+}
+
+bool mqttWrapper_isConnected( void )
+{
+    return mqttWrapperInstance_isConnected( &defaultInstance );
+}
+
+bool mqttWrapper_isConnectionBroken( void )
+{
+    return mqttWrapperInstance_isConnectionBroken( &defaultInstance );
+}
+
+bool mqttWrapper_publish( char * topic,
+                          size_t topicLength,
+                          uint8_t * message,
+                          size_t messageLength )
+{
+    return mqttWrapperInstance_publish( &defaultInstance,
+                                        topic,
+                                        topicLength,
+                                        message,
+                                        messageLength );
+}
+
+bool mqttWrapper_publishQos1( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              MqttWrapperPubAckHandler_t handler,
+                              void * context,
+                              uint16_t * packetId )
+{
+    return mqttWrapperInstance_publishQos1( &defaultInstance,
+                                            topic,
+                                            topicLength,
+                                            message,
+                                            messageLength,
+                                            handler,
+                                            context,
+                                            packetId );
+}
+
+bool mqttWrapper_handlePubAck( uint16_t packetId )
+{
+    return mqttWrapperInstance_handlePubAck( &defaultInstance, packetId );
+}
+
+size_t mqttWrapper_resendPublishes( void )
+{
+    return mqttWrapperInstance_resendPublishes( &defaultInstance );
+}
+
+uint32_t mqttWrapper_getResendDelayMs( void )
+{
+    return mqttWrapperInstance_getResendDelayMs( &defaultInstance );
+}
+
+void mqttWrapper_getPublishStats( MqttWrapperPublishStats_t * stats )
+{
+    mqttWrapperInstance_getPublishStats( &defaultInstance, stats );
+}
+
+bool mqttWrapper_subscribe( char * topic, size_t topicLength )
+{
+    return mqttWrapperInstance_subscribe( &defaultInstance, topic, topicLength );
+}
+
+bool mqttWrapper_subscribeMany( char * const * topics,
+                                const size_t * topicLengths,
+                                size_t topicCount,
+                                MqttWrapperSubAckHandler_t handler,
+                                void * context,
+                                uint16_t * packetId )
+{
+    return mqttWrapperInstance_subscribeMany( &defaultInstance,
+                                              topics,
+                                              topicLengths,
+                                              topicCount,
+                                              handler,
+                                              context,
+                                              packetId );
+}
+
+bool mqttWrapper_handleSubAck( MQTTPacketInfo_t * packetInfo,
+                               uint16_t packetId )
+{
+    return mqttWrapperInstance_handleSubAck( &defaultInstance, packetInfo, packetId );
+}
+
+bool mqttWrapperInstance_init( MqttWrapperInstance_t * instance,
+                               MQTTContext_t * mqttContext,
+                               const char * thingName,
+                               size_t thingNameLength,
+                               const MqttWrapperBuffers_t * buffers )
+{
+    bool success = ( instance != NULL ) && ( mqttContext != NULL ) &&
+                   ( thingName != NULL ) && ( buffers != NULL ) &&
+                   ( thingNameLength > 0U ) &&
+                   ( thingNameLength <= MQTT_WRAPPER_MAX_THING_NAME_LENGTH );
+
+    /* The queue and the router mask their positions, so their sizes are
+     * powers of two. */
+    if( success )
+    {
+        success = ( ( buffers->inFlightPublishes != NULL ) || ( buffers->inFlightPublishCount == 0U ) ) &&
+                  ( ( buffers->commands != NULL ) || ( buffers->commandCount == 0U ) ) &&
+                  ( ( buffers->routeBuckets != NULL ) || ( buffers->routeBucketCount == 0U ) ) &&
+                  ( ( buffers->routePool != NULL ) || ( buffers->routePoolSize == 0U ) ) &&
+                  isPowerOfTwo( buffers->commandCount ) &&
+                  isPowerOfTwo( buffers->routeBucketCount );
+    }
+
+    if( success )
+    {
+        memset( instance, 0x00, sizeof( MqttWrapperInstance_t ) );
+        instance->mqttContext = mqttContext;
+        memcpy( instance->thingName, thingName, thingNameLength );
+        instance->thingNameLength = thingNameLength;
+        instance->buffers = *buffers;
+
+        if( buffers->inFlightPublishCount > 0U )
+        {
+            memset( buffers->inFlightPublishes,
+                    0x00,
+                    buffers->inFlightPublishCount * sizeof( MqttWrapperInFlightPublish_t ) );
+        }
+
+        if( buffers->routeBucketCount > 0U )
+        {
+            memset( buffers->routeBuckets,
+                    0x00,
+                    buffers->routeBucketCount * sizeof( MqttWrapperRoute_t ) );
+        }
+    }
+
+    return success;
+}
+
+static bool isPowerOfTwo( size_t value )
+{
+    return ( value & ( value - 1U ) ) == 0U;
+}
+
+MQTTContext_t * mqttWrapperInstance_getCoreMqttContext( const MqttWrapperInstance_t * instance )
+{
+    assert( instance->mqttContext != NULL );
+    return instance->mqttContext;
+}
+
+const char * mqttWrapperInstance_getThingName( const MqttWrapperInstance_t * instance,
+                                               size_t * thingNameLength )
+{
+    assert( instance->thingName[ 0 ] != 0 );
+    assert( thingNameLength != NULL );
+
+    *thingNameLength = instance->thingNameLength;
+    return instance->thingName;
+}
+
+bool mqttWrapperInstance_connect( MqttWrapperInstance_t * instance,
+                                  bool cleanSession,
+                                  bool * sessionPresent )
+{
+    return connectClient( instance,
+                          instance->thingName,
+                          instance->thingNameLength,
+                          cleanSession,
+                          sessionPresent );
+}
+
+static bool connectClient( MqttWrapperInstance_t * instance,
+                           const char * clientId,
+                           size_t clientIdLength,
+                           bool cleanSession,
+                           bool * sessionPresent )
 {
     MQTTConnectInfo_t connectInfo = { 0 };
     MQTTStatus_t mqttStatus = MQTTSuccess;
-    bool sessionPresent = false;
 
-    assert( globalCoreMqttContext != NULL );
+    assert( instance->mqttContext != NULL );
+    assert( sessionPresent != NULL );
 
-    connectInfo.pClientIdentifier = thingName;
-    connectInfo.clientIdentifierLength = thingNameLength;
+    connectInfo.pClientIdentifier = clientId;
+    connectInfo.clientIdentifierLength = ( uint16_t ) clientIdLength;
     connectInfo.pUserName = NULL;
     connectInfo.userNameLength = 0U;
     connectInfo.pPassword = NULL;
     connectInfo.passwordLength = 0U;
-    connectInfo.keepAliveSeconds = 60U;
-    connectInfo.cleanSession = true;
-    mqttStatus = MQTT_Connect( globalCoreMqttContext,
+    connectInfo.keepAliveSeconds = MQTT_WRAPPER_KEEP_ALIVE_SECONDS;
+    connectInfo.cleanSession = cleanSession;
+    mqttStatus = MQTT_Connect( instance->mqttContext,
                                &connectInfo,
                                NULL,
                                5000U,
-                               &sessionPresent );
+                               sessionPresent );
+
+    if( mqttStatus == MQTTSuccess )
+    {
+        instance->connectionBroken = false;
+    }
+
     return mqttStatus == MQTTSuccess;
 }
 
-bool mqttWrapper_isConnected( void )
+size_t mqttWrapperInstance_resumeSession( MqttWrapperInstance_t * instance,
+                                          bool sessionPresent )
 {
-    bool isConnected = false;
-    assert( globalCoreMqttContext != NULL );
-    isConnected = globalCoreMqttContext->connectStatus == MQTTConnected;
-    return isConnected;
+    size_t replayed = 0U;
+    size_t i = 0U;
+
+    assert( instance->mqttContext != NULL );
+
+    /* A SUBACK does not outlive its connection. */
+    memset( instance->pendingSubscribes, 0x00, sizeof( instance->pendingSubscribes ) );
+
+    /* Without the session coreMQTT dropped its state too, so the publishes
+     * go out as new ones. */
+    for( i = 0U; i < instance->buffers.inFlightPublishCount; i++ )
+    {
+        if( ( instance->buffers.inFlightPublishes[ i ].packetId != 0U ) &&
+            ( sendInFlightPublish( instance, &instance->buffers.inFlightPublishes[ i ], sessionPresent ) == MQTTSuccess ) )
+        {
+            instance->publishStats.resent++;
+            replayed++;
+        }
+    }
+
+    return replayed;
 }
 
-bool mqttWrapper_publish( char * topic,
-                          size_t topicLength,
-                          uint8_t * message,
-                          size_t messageLength )
+bool mqttWrapperInstance_isConnected( const MqttWrapperInstance_t * instance )
+{
+    assert( instance->mqttContext != NULL );
+    return ( instance->mqttContext->connectStatus == MQTTConnected ) && !instance->connectionBroken;
+}
+
+bool mqttWrapperInstance_isConnectionBroken( const MqttWrapperInstance_t * instance )
+{
+    return instance->connectionBroken;
+}
+
+static bool publishNow( MqttWrapperInstance_t * instance,
+                        char * topic,
+                        size_t topicLength,
+                        uint8_t * message,
+                        size_t messageLength )
 {
     bool success = false;
-    assert( globalCoreMqttContext != NULL );
+    assert( instance->mqttContext != NULL );
 
-    success = mqttWrapper_isConnected();
+    success = mqttWrapperInstance_isConnected( instance );
     if( success )
     {
         MQTTStatus_t mqttStatus = MQTTSuccess;
@@ -98,20 +440,264 @@ bool mqttWrapper_publish( char * topic,
         pubInfo.pPayload = message;
         pubInfo.payloadLength = messageLength;
 
-        mqttStatus = MQTT_Publish( globalCoreMqttContext,
+        mqttStatus = MQTT_Publish( instance->mqttContext,
                                    &pubInfo,
-                                   MQTT_GetPacketId( globalCoreMqttContext ) );
+                                   MQTT_GetPacketId( instance->mqttContext ) );
+
+        /* Part of the packet may be out, nothing else can follow it. */
+        if( mqttStatus == MQTTSendFailed )
+        {
+            instance->connectionBroken = true;
+        }
+
         success = mqttStatus == MQTTSuccess;
     }
     return success;
 }
 
-bool mqttWrapper_subscribe( char * topic, size_t topicLength )
+static MQTTStatus_t sendInFlightPublish( MqttWrapperInstance_t * instance,
+                                         MqttWrapperInFlightPublish_t * publish,
+                                         bool dup )
 {
+    MQTTPublishInfo_t pubInfo = { 0 };
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+
+    pubInfo.qos = MQTTQoS1;
+    pubInfo.retain = false;
+    pubInfo.dup = dup;
+    pubInfo.pTopicName = publish->buffer;
+    pubInfo.topicNameLength = publish->topicLength;
+    pubInfo.pPayload = &publish->buffer[ publish->topicLength ];
+    pubInfo.payloadLength = publish->messageLength;
+
+    publish->lastSentMs = instance->mqttContext->getTime();
+    publish->attempts++;
+
+    mqttStatus = MQTT_Publish( instance->mqttContext,
+                               &pubInfo,
+                               publish->packetId );
+
+    /* Part of the packet may be out, nothing else can follow it. */
+    if( mqttStatus == MQTTSendFailed )
+    {
+        instance->connectionBroken = true;
+    }
+
+    return mqttStatus;
+}
+
+static MqttWrapperQos1Status_t publishQos1Now( MqttWrapperInstance_t * instance,
+                                               char * topic,
+                                               size_t topicLength,
+                                               uint8_t * message,
+                                               size_t messageLength,
+                                               MqttWrapperPubAckHandler_t handler,
+                                               void * context,
+                                               uint16_t * packetId )
+{
+    MqttWrapperInFlightPublish_t * publish = NULL;
+    MqttWrapperQos1Status_t status = MQTT_WRAPPER_QOS1_FAILED;
+    MQTTStatus_t mqttStatus = MQTTSuccess;
     bool success = false;
-    assert( globalCoreMqttContext != NULL );
+    size_t i = 0U;
+
+    assert( instance->mqttContext != NULL );
+    assert( packetId != NULL );
+
+    success = mqttWrapperInstance_isConnected( instance ) &&
+              ( topicLength > 0U ) &&
+              ( topicLength <= UINT16_MAX ) &&
+              ( topicLength + messageLength <= MQTT_WRAPPER_PUBLISH_BUFFER_SIZE );
+
+    for( i = 0U; success && ( publish == NULL ) && ( i < instance->buffers.inFlightPublishCount ); i++ )
+    {
+        if( instance->buffers.inFlightPublishes[ i ].packetId == 0U )
+        {
+            publish = &instance->buffers.inFlightPublishes[ i ];
+        }
+    }
+
+    if( success && ( publish == NULL ) )
+    {
+        instance->publishStats.windowFull++;
+        status = MQTT_WRAPPER_QOS1_WINDOW_FULL;
+        success = false;
+    }
 
-    success = mqttWrapper_isConnected();
+    if( success )
+    {
+        /* A copy, so the publish can be sent again after the caller's
+         * buffers are gone. */
+        memcpy( publish->buffer, topic, topicLength );
+        memcpy( &publish->buffer[ topicLength ], message, messageLength );
+        publish->topicLength = ( uint16_t ) topicLength;
+        publish->messageLength = messageLength;
+        publish->attempts = 0U;
+        publish->handler = handler;
+        publish->context = context;
+
+        /* The PUBACK may arrive before MQTT_Publish returns. */
+        *packetId = MQTT_GetPacketId( instance->mqttContext );
+        publish->packetId = *packetId;
+        publish->firstSentMs = instance->mqttContext->getTime();
+        mqttStatus = sendInFlightPublish( instance, publish, false );
+
+        /* With the connection broken, the publish stays in the window and
+         * goes out again once the session is resumed. */
+        if( ( mqttStatus == MQTTSuccess ) || ( mqttStatus == MQTTSendFailed ) )
+        {
+            instance->publishStats.sent++;
+            instance->publishStats.inFlight++;
+            status = MQTT_WRAPPER_QOS1_SENT;
+        }
+        else
+        {
+            publish->packetId = 0U;
+        }
+    }
+
+    return status;
+}
+
+bool mqttWrapperInstance_handlePubAck( MqttWrapperInstance_t * instance,
+                                       uint16_t packetId )
+{
+    MqttWrapperInFlightPublish_t * publish = NULL;
+    MqttWrapperPubAckHandler_t handler = NULL;
+    void * context = NULL;
+    uint32_t ackTimeMs = 0U;
+    size_t i = 0U;
+
+    for( i = 0U; ( publish == NULL ) && ( i < instance->buffers.inFlightPublishCount ); i++ )
+    {
+        if( ( packetId != 0U ) && ( instance->buffers.inFlightPublishes[ i ].packetId == packetId ) )
+        {
+            publish = &instance->buffers.inFlightPublishes[ i ];
+        }
+    }
+
+    if( publish != NULL )
+    {
+        ackTimeMs = instance->mqttContext->getTime() - publish->firstSentMs;
+        handler = publish->handler;
+        context = publish->context;
+        publish->packetId = 0U;
+
+        instance->publishStats.acknowledged++;
+        instance->publishStats.inFlight--;
+        instance->publishStats.totalAckTimeMs += ackTimeMs;
+        instance->publishStats.maxAckTimeMs = ( ackTimeMs > instance->publishStats.maxAckTimeMs ) ? ackTimeMs : instance->publishStats.maxAckTimeMs;
+
+        if( handler != NULL )
+        {
+            handler( packetId, ackTimeMs, context );
+        }
+    }
+
+    return publish != NULL;
+}
+
+/* Twice as long after every attempt. A publish whose first send failed has
+ * no attempt to back off from yet. */
+static uint32_t getResendTimeoutMs( const MqttWrapperInFlightPublish_t * publish )
+{
+    uint32_t shift = 0U;
+
+    if( publish->attempts > MQTT_WRAPPER_MAX_RESEND_BACKOFF_SHIFT )
+    {
+        shift = MQTT_WRAPPER_MAX_RESEND_BACKOFF_SHIFT;
+    }
+    else if( publish->attempts > 0U )
+    {
+        shift = publish->attempts - 1U;
+    }
+    else
+    {
+        /* Empty else. */
+    }
+
+    return MQTT_WRAPPER_PUBACK_TIMEOUT_MS << shift;
+}
+
+size_t mqttWrapperInstance_resendPublishes( MqttWrapperInstance_t * instance )
+{
+    MqttWrapperInFlightPublish_t * publish = NULL;
+    uint32_t nowMs = 0U;
+    size_t resent = 0U;
+    size_t i = 0U;
+
+    assert( instance->mqttContext != NULL );
+
+    if( mqttWrapperInstance_isConnected( instance ) && ( instance->publishStats.inFlight > 0U ) )
+    {
+        nowMs = instance->mqttContext->getTime();
+
+        for( i = 0U; i < instance->buffers.inFlightPublishCount; i++ )
+        {
+            publish = &instance->buffers.inFlightPublishes[ i ];
+
+            /* Only the publishes whose PUBACK is late go out again. */
+            if( ( publish->packetId != 0U ) &&
+                ( ( nowMs - publish->lastSentMs ) >= getResendTimeoutMs( publish ) ) &&
+                ( sendInFlightPublish( instance, publish, true ) == MQTTSuccess ) )
+            {
+                instance->publishStats.resent++;
+                resent++;
+            }
+        }
+    }
+
+    return resent;
+}
+
+uint32_t mqttWrapperInstance_getResendDelayMs( const MqttWrapperInstance_t * instance )
+{
+    const MqttWrapperInFlightPublish_t * publish = NULL;
+    uint32_t delayMs = UINT32_MAX;
+    uint32_t elapsedMs = 0U;
+    uint32_t timeoutMs = 0U;
+    uint32_t nowMs = 0U;
+    size_t i = 0U;
+
+    assert( instance->mqttContext != NULL );
+
+    if( instance->publishStats.inFlight > 0U )
+    {
+        nowMs = instance->mqttContext->getTime();
+
+        for( i = 0U; i < instance->buffers.inFlightPublishCount; i++ )
+        {
+            publish = &instance->buffers.inFlightPublishes[ i ];
+
+            if( publish->packetId != 0U )
+            {
+                timeoutMs = getResendTimeoutMs( publish );
+                elapsedMs = nowMs - publish->lastSentMs;
+                delayMs = ( elapsedMs >= timeoutMs ) ? 0U :
+                          ( ( timeoutMs - elapsedMs < delayMs ) ? timeoutMs - elapsedMs : delayMs );
+            }
+        }
+    }
+
+    return delayMs;
+}
+
+void mqttWrapperInstance_getPublishStats( const MqttWrapperInstance_t * instance,
+                                          MqttWrapperPublishStats_t * stats )
+{
+    assert( stats != NULL );
+
+    *stats = instance->publishStats;
+}
+
+static bool subscribeNow( MqttWrapperInstance_t * instance,
+                          char * topic,
+                          size_t topicLength )
+{
+    bool success = false;
+    assert( instance->mqttContext != NULL );
+
+    success = mqttWrapperInstance_isConnected( instance );
     if( success )
     {
         MQTTStatus_t mqttStatus = MQTTSuccess;
@@ -120,12 +706,708 @@ bool mqttWrapper_subscribe( char * topic, size_t topicLength )
         subscribeInfo.pTopicFilter = topic;
         subscribeInfo.topicFilterLength = topicLength;
 
-        mqttStatus = MQTT_Subscribe( globalCoreMqttContext,
+        mqttStatus = MQTT_Subscribe( instance->mqttContext,
                                      &subscribeInfo,
                                      1,
                                      MQTT_GetPacketId(
-                                         globalCoreMqttContext ) );
+                                         instance->mqttContext ) );
+        success = mqttStatus == MQTTSuccess;
+    }
+    return success;
+}
+
+static bool subscribeManyNow( MqttWrapperInstance_t * instance,
+                              char * const * topics,
+                              const size_t * topicLengths,
+                              size_t topicCount,
+                              MqttWrapperSubAckHandler_t handler,
+                              void * context,
+                              uint16_t * packetId )
+{
+    MQTTSubscribeInfo_t subscribeInfo[ MQTT_WRAPPER_MAX_FILTERS ];
+    MqttWrapperPendingSubscribe_t * pending = NULL;
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    bool success = false;
+    size_t i = 0U;
+
+    assert( instance->mqttContext != NULL );
+    assert( packetId != NULL );
+
+    success = mqttWrapperInstance_isConnected( instance ) &&
+              ( topicCount > 0U ) &&
+              ( topicCount <= MQTT_WRAPPER_MAX_FILTERS );
+
+    for( i = 0U; success && ( pending == NULL ) && ( i < MQTT_WRAPPER_MAX_PENDING_SUBSCRIBES ); i++ )
+    {
+        if( instance->pendingSubscribes[ i ].packetId == 0U )
+        {
+            pending = &instance->pendingSubscribes[ i ];
+        }
+    }
+
+    success = success && ( pending != NULL );
+
+    if( success )
+    {
+        memset( subscribeInfo, 0x00, sizeof( subscribeInfo ) );
+
+        for( i = 0U; i < topicCount; i++ )
+        {
+            subscribeInfo[ i ].qos = MQTTQoS0;
+            subscribeInfo[ i ].pTopicFilter = topics[ i ];
+            subscribeInfo[ i ].topicFilterLength = ( uint16_t ) topicLengths[ i ];
+        }
+
+        /* The SUBACK may arrive before MQTT_Subscribe returns. */
+        *packetId = MQTT_GetPacketId( instance->mqttContext );
+        pending->topicCount = topicCount;
+        pending->handler = handler;
+        pending->context = context;
+        pending->packetId = *packetId;
+
+        mqttStatus = MQTT_Subscribe( instance->mqttContext,
+                                     subscribeInfo,
+                                     topicCount,
+                                     *packetId );
         success = mqttStatus == MQTTSuccess;
+
+        if( !success )
+        {
+            pending->packetId = 0U;
+        }
+    }
+
+    return success;
+}
+
+bool mqttWrapperInstance_publish( MqttWrapperInstance_t * instance,
+                                  char * topic,
+                                  size_t topicLength,
+                                  uint8_t * message,
+                                  size_t messageLength )
+{
+    bool success = false;
+
+    if( instance->commandQueueEnabled )
+    {
+        success = mqttWrapperInstance_isConnected( instance ) &&
+                  enqueueCommand( instance,
+                                  MQTT_WRAPPER_COMMAND_PUBLISH,
+                                  &topic,
+                                  &topicLength,
+                                  1U,
+                                  message,
+                                  messageLength,
+                                  NULL,
+                                  NULL,
+                                  NULL );
+    }
+    else
+    {
+        success = publishNow( instance, topic, topicLength, message, messageLength );
+    }
+
+    return success;
+}
+
+bool mqttWrapperInstance_publishQos1( MqttWrapperInstance_t * instance,
+                                      char * topic,
+                                      size_t topicLength,
+                                      uint8_t * message,
+                                      size_t messageLength,
+                                      MqttWrapperPubAckHandler_t handler,
+                                      void * context,
+                                      uint16_t * packetId )
+{
+    bool success = false;
+
+    assert( packetId != NULL );
+
+    if( instance->commandQueueEnabled )
+    {
+        /* The packet ID is only known to the handler. */
+        *packetId = 0U;
+        success = mqttWrapperInstance_isConnected( instance ) &&
+                  enqueueCommand( instance,
+                                  MQTT_WRAPPER_COMMAND_PUBLISH_QOS1,
+                                  &topic,
+                                  &topicLength,
+                                  1U,
+                                  message,
+                                  messageLength,
+                                  handler,
+                                  NULL,
+                                  context );
+    }
+    else
+    {
+        success = publishQos1Now( instance,
+                                  topic,
+                                  topicLength,
+                                  message,
+                                  messageLength,
+                                  handler,
+                                  context,
+                                  packetId ) == MQTT_WRAPPER_QOS1_SENT;
+    }
+
+    return success;
+}
+
+bool mqttWrapperInstance_subscribe( MqttWrapperInstance_t * instance,
+                                    char * topic,
+                                    size_t topicLength )
+{
+    bool success = false;
+
+    if( instance->commandQueueEnabled )
+    {
+        success = mqttWrapperInstance_isConnected( instance ) &&
+                  enqueueCommand( instance,
+                                  MQTT_WRAPPER_COMMAND_SUBSCRIBE,
+                                  &topic,
+                                  &topicLength,
+                                  1U,
+                                  NULL,
+                                  0U,
+                                  NULL,
+                                  NULL,
+                                  NULL );
+    }
+    else
+    {
+        success = subscribeNow( instance, topic, topicLength );
+    }
+
+    return success;
+}
+
+bool mqttWrapperInstance_subscribeMany( MqttWrapperInstance_t * instance,
+                                        char * const * topics,
+                                        const size_t * topicLengths,
+                                        size_t topicCount,
+                                        MqttWrapperSubAckHandler_t handler,
+                                        void * context,
+                                        uint16_t * packetId )
+{
+    bool success = false;
+
+    assert( packetId != NULL );
+
+    if( instance->commandQueueEnabled )
+    {
+        *packetId = 0U;
+        success = mqttWrapperInstance_isConnected( instance ) &&
+                  ( topicCount > 0U ) &&
+                  ( topicCount <= MQTT_WRAPPER_MAX_FILTERS ) &&
+                  enqueueCommand( instance,
+                                  MQTT_WRAPPER_COMMAND_SUBSCRIBE,
+                                  topics,
+                                  topicLengths,
+                                  topicCount,
+                                  NULL,
+                                  0U,
+                                  NULL,
+                                  handler,
+                                  context );
     }
+    else
+    {
+        success = subscribeManyNow( instance,
+                                    topics,
+                                    topicLengths,
+                                    topicCount,
+                                    handler,
+                                    context,
+                                    packetId );
+    }
+
     return success;
 }
+
+void mqttWrapper_useCommandQueue( MqttWrapperWakeup_t wakeup,
+                                  void * context )
+{
+    ( void ) mqttWrapperInstance_useCommandQueue( &defaultInstance, wakeup, context );
+}
+
+size_t mqttWrapper_processCommands( void )
+{
+    return mqttWrapperInstance_processCommands( &defaultInstance );
+}
+
+size_t mqttWrapper_getQueuedCommandCount( void )
+{
+    return mqttWrapperInstance_getQueuedCommandCount( &defaultInstance );
+}
+
+void mqttWrapper_getCommandStats( MqttWrapperCommandStats_t * stats )
+{
+    mqttWrapperInstance_getCommandStats( &defaultInstance, stats );
+}
+
+bool mqttWrapperInstance_useCommandQueue( MqttWrapperInstance_t * instance,
+                                          MqttWrapperWakeup_t wakeup,
+                                          void * context )
+{
+    uint32_t i = 0U;
+    bool success = instance->buffers.commandCount > 0U;
+
+    for( i = 0U; success && ( i < instance->buffers.commandCount ); i++ )
+    {
+        instance->buffers.commands[ i ].sequence = i;
+    }
+
+    if( success )
+    {
+        instance->commandEnqueuePosition = 0U;
+        instance->commandDequeuePosition = 0U;
+        instance->commandWakeup = wakeup;
+        instance->commandWakeupContext = context;
+        instance->commandQueueEnabled = true;
+    }
+
+    return success;
+}
+
+static bool enqueueCommand( MqttWrapperInstance_t * instance,
+                            MqttWrapperCommandType_t type,
+                            char * const * topics,
+                            const size_t * topicLengths,
+                            size_t topicCount,
+                            const uint8_t * message,
+                            size_t messageLength,
+                            MqttWrapperPubAckHandler_t pubAckHandler,
+                            MqttWrapperSubAckHandler_t subAckHandler,
+                            void * context )
+{
+    MqttWrapperCommand_t * command = NULL;
+    uint32_t position = 0U;
+    uint32_t sequence = 0U;
+    int32_t difference = 0;
+    uint32_t mask = ( uint32_t ) instance->buffers.commandCount - 1U;
+    size_t length = messageLength;
+    size_t offset = 0U;
+    size_t i = 0U;
+    bool full = false;
+
+    for( i = 0U; i < topicCount; i++ )
+    {
+        length += topicLengths[ i ];
+    }
+
+    position = __atomic_load_n( &instance->commandEnqueuePosition, __ATOMIC_RELAXED );
+
+    /* Claim a slot: a free one has the sequence of the position, a smaller
+     * one means the queue is full. */
+    while( ( length <= MQTT_WRAPPER_PUBLISH_BUFFER_SIZE ) && ( command == NULL ) && !full )
+    {
+        sequence = __atomic_load_n( &instance->buffers.commands[ position & mask ].sequence,
+                                    __ATOMIC_ACQUIRE );
+        difference = ( int32_t ) ( sequence - position );
+
+        if( difference == 0 )
+        {
+            if( __atomic_compare_exchange_n( &instance->commandEnqueuePosition,
+                                             &position,
+                                             position + 1U,
+                                             true,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED ) )
+            {
+                command = &instance->buffers.commands[ position & mask ];
+            }
+        }
+        else if( difference < 0 )
+        {
+            ( void ) __atomic_fetch_add( &instance->commandStats.queueFull, 1U, __ATOMIC_RELAXED );
+            full = true;
+        }
+        else
+        {
+            position = __atomic_load_n( &instance->commandEnqueuePosition, __ATOMIC_RELAXED );
+        }
+    }
+
+    if( command != NULL )
+    {
+        command->type = type;
+        command->topicCount = topicCount;
+        command->messageLength = messageLength;
+        command->pubAckHandler = pubAckHandler;
+        command->subAckHandler = subAckHandler;
+        command->context = context;
+
+        for( i = 0U; i < topicCount; i++ )
+        {
+            memcpy( &command->buffer[ offset ], topics[ i ], topicLengths[ i ] );
+            command->topicLengths[ i ] = topicLengths[ i ];
+            offset += topicLengths[ i ];
+        }
+
+        if( messageLength > 0U )
+        {
+            memcpy( &command->buffer[ offset ], message, messageLength );
+        }
+
+        /* Publish the slot to the owner. */
+        __atomic_store_n( &command->sequence, position + 1U, __ATOMIC_RELEASE );
+        ( void ) __atomic_fetch_add( &instance->commandStats.queued, 1U, __ATOMIC_RELAXED );
+
+        if( instance->commandWakeup != NULL )
+        {
+            instance->commandWakeup( instance->commandWakeupContext );
+        }
+    }
+
+    return command != NULL;
+}
+
+static bool executeCommand( MqttWrapperInstance_t * instance,
+                            MqttWrapperCommand_t * command )
+{
+    char * topics[ MQTT_WRAPPER_MAX_FILTERS ];
+    char * message = &command->buffer[ command->topicLengths[ 0 ] ];
+    MqttWrapperQos1Status_t qos1Status = MQTT_WRAPPER_QOS1_FAILED;
+    uint16_t packetId = 0U;
+    size_t offset = 0U;
+    size_t i = 0U;
+    bool success = false;
+
+    switch( command->type )
+    {
+        case MQTT_WRAPPER_COMMAND_PUBLISH:
+            success = publishNow( instance,
+                                  command->buffer,
+                                  command->topicLengths[ 0 ],
+                                  ( uint8_t * ) message,
+                                  command->messageLength );
+            break;
+
+        case MQTT_WRAPPER_COMMAND_PUBLISH_QOS1:
+            qos1Status = publishQos1Now( instance,
+                                         command->buffer,
+                                         command->topicLengths[ 0 ],
+                                         ( uint8_t * ) message,
+                                         command->messageLength,
+                                         command->pubAckHandler,
+                                         command->context,
+                                         &packetId );
+            success = qos1Status == MQTT_WRAPPER_QOS1_SENT;
+
+            /* As a caller of the window would, with the window full. Any
+             * other failure counts as failed: a broken connection is left
+             * to the owner to reconnect, and a publish whose bytes may
+             * have gone out is not sent a second time. */
+            if( qos1Status == MQTT_WRAPPER_QOS1_WINDOW_FULL )
+            {
+                success = publishNow( instance,
+                                      command->buffer,
+                                      command->topicLengths[ 0 ],
+                                      ( uint8_t * ) message,
+                                      command->messageLength );
+                instance->commandStats.downgraded += success ? 1U : 0U;
+            }
+
+            break;
+
+        case MQTT_WRAPPER_COMMAND_SUBSCRIBE:
+
+            for( i = 0U; i < command->topicCount; i++ )
+            {
+                topics[ i ] = &command->buffer[ offset ];
+                offset += command->topicLengths[ i ];
+            }
+
+            success = subscribeManyNow( instance,
+                                        topics,
+                                        command->topicLengths,
+                                        command->topicCount,
+                                        command->subAckHandler,
+                                        command->context,
+                                        &packetId );
+            break;
+
+        default:
+            break;
+    }
+
+    return success;
+}
+
+size_t mqttWrapperInstance_processCommands( MqttWrapperInstance_t * instance )
+{
+    MqttWrapperCommand_t * command = NULL;
+    uint32_t mask = ( uint32_t ) instance->buffers.commandCount - 1U;
+    uint32_t depth = 0U;
+    size_t executed = 0U;
+
+    depth = __atomic_load_n( &instance->commandEnqueuePosition, __ATOMIC_RELAXED ) - instance->commandDequeuePosition;
+    instance->commandStats.maxDepth = ( depth > instance->commandStats.maxDepth ) ? depth : instance->commandStats.maxDepth;
+
+    while( instance->commandQueueEnabled )
+    {
+        command = &instance->buffers.commands[ instance->commandDequeuePosition & mask ];
+
+        /* Not filled yet, or still being filled. */
+        if( __atomic_load_n( &command->sequence, __ATOMIC_ACQUIRE ) != instance->commandDequeuePosition + 1U )
+        {
+            break;
+        }
+
+        if( executeCommand( instance, command ) )
+        {
+            instance->commandStats.executed++;
+        }
+        else
+        {
+            instance->commandStats.failed++;
+        }
+
+        /* Hand the slot back for the next round of positions. */
+        __atomic_store_n( &command->sequence,
+                          instance->commandDequeuePosition + ( uint32_t ) instance->buffers.commandCount,
+                          __ATOMIC_RELEASE );
+        instance->commandDequeuePosition++;
+        executed++;
+    }
+
+    return executed;
+}
+
+size_t mqttWrapperInstance_getQueuedCommandCount( const MqttWrapperInstance_t * instance )
+{
+    return __atomic_load_n( &instance->commandEnqueuePosition, __ATOMIC_RELAXED ) - instance->commandDequeuePosition;
+}
+
+void mqttWrapperInstance_getCommandStats( const MqttWrapperInstance_t * instance,
+                                          MqttWrapperCommandStats_t * stats )
+{
+    assert( stats != NULL );
+
+    *stats = instance->commandStats;
+}
+
+bool mqttWrapperInstance_handleSubAck( MqttWrapperInstance_t * instance,
+                                       MQTTPacketInfo_t * packetInfo,
+                                       uint16_t packetId )
+{
+    MqttWrapperPendingSubscribe_t * pending = NULL;
+    MqttWrapperSubAckHandler_t handler = NULL;
+    void * context = NULL;
+    uint8_t * statusCodes = NULL;
+    size_t statusCount = 0U;
+    bool granted = false;
+    size_t i = 0U;
+
+    for( i = 0U; ( pending == NULL ) && ( i < MQTT_WRAPPER_MAX_PENDING_SUBSCRIBES ); i++ )
+    {
+        if( ( packetId != 0U ) && ( instance->pendingSubscribes[ i ].packetId == packetId ) )
+        {
+            pending = &instance->pendingSubscribes[ i ];
+        }
+    }
+
+    if( pending != NULL )
+    {
+        granted = ( MQTT_GetSubAckStatusCodes( packetInfo,
+                                               &statusCodes,
+                                               &statusCount ) == MQTTSuccess ) &&
+                  ( statusCount == pending->topicCount );
+
+        for( i = 0U; granted && ( i < statusCount ); i++ )
+        {
+            granted = statusCodes[ i ] != ( uint8_t ) MQTTSubAckFailure;
+        }
+
+        handler = pending->handler;
+        context = pending->context;
+        pending->packetId = 0U;
+
+        if( handler != NULL )
+        {
+            handler( packetId, granted, context );
+        }
+    }
+
+    return pending != NULL;
+}
+
+static MqttWrapperRoute_t * findRoute( const MqttWrapperInstance_t * instance,
+                                       const char * topic,
+                                       size_t topicLength,
+                                       uint32_t hash,
+                                       bool prefix )
+{
+    MqttWrapperRoute_t * route = NULL;
+    size_t mask = instance->buffers.routeBucketCount - 1U;
+    size_t bucket = hash & mask;
+
+    /* Returns the matching route, or the empty bucket it would go into. */
+    for( ; ; )
+    {
+        route = &instance->buffers.routeBuckets[ bucket ];
+
+        if( ( route->handler == NULL ) ||
+            ( ( route->hash == hash ) &&
+              ( route->length == topicLength ) &&
+              ( route->prefix == prefix ) &&
+              ( memcmp( &instance->buffers.routePool[ route->offset ], topic, topicLength ) == 0 ) ) )
+        {
+            break;
+        }
+
+        bucket = ( bucket + 1U ) & mask;
+    }
+
+    return route;
+}
+
+bool mqttWrapper_addRoute( const char * topic,
+                           size_t topicLength,
+                           bool prefix,
+                           MqttWrapperTopicHandler_t handler,
+                           void * context )
+{
+    return mqttWrapperInstance_addRoute( &defaultInstance,
+                                         topic,
+                                         topicLength,
+                                         prefix,
+                                         handler,
+                                         context );
+}
+
+void mqttWrapper_clearRoutes( void )
+{
+    mqttWrapperInstance_clearRoutes( &defaultInstance );
+}
+
+size_t mqttWrapper_getRouteCount( void )
+{
+    return mqttWrapperInstance_getRouteCount( &defaultInstance );
+}
+
+bool mqttWrapper_routeMessage( char * topic,
+                               size_t topicLength,
+                               uint8_t * message,
+                               size_t messageLength )
+{
+    return mqttWrapperInstance_routeMessage( &defaultInstance,
+                                             topic,
+                                             topicLength,
+                                             message,
+                                             messageLength );
+}
+
+bool mqttWrapperInstance_addRoute( MqttWrapperInstance_t * instance,
+                                   const char * topic,
+                                   size_t topicLength,
+                                   bool prefix,
+                                   MqttWrapperTopicHandler_t handler,
+                                   void * context )
+{
+    MqttWrapperRoute_t * route = NULL;
+    uint32_t hash = ROUTE_HASH_SEED;
+    size_t i = 0U;
+    bool success = ( topic != NULL ) && ( handler != NULL ) &&
+                   ( instance->buffers.routeBucketCount > 0U ) &&
+                   ( topicLength > 0U ) &&
+                   ( topicLength <= MQTT_WRAPPER_MAX_ROUTE_LENGTH );
+
+    if( success )
+    {
+        for( i = 0U; i < topicLength; i++ )
+        {
+            hash = ( hash ^ ( uint8_t ) topic[ i ] ) * ROUTE_HASH_PRIME;
+        }
+
+        route = findRoute( instance, topic, topicLength, hash, prefix );
+
+        /* Registering a topic again replaces its handler. */
+        if( route->handler == NULL )
+        {
+            success = ( instance->routeCount < ( instance->buffers.routeBucketCount / 2U ) ) &&
+                      ( instance->routePoolUsed + topicLength <= instance->buffers.routePoolSize );
+
+            if( success )
+            {
+                memcpy( &instance->buffers.routePool[ instance->routePoolUsed ], topic, topicLength );
+                route->hash = hash;
+                route->offset = ( uint32_t ) instance->routePoolUsed;
+                route->length = ( uint32_t ) topicLength;
+                route->prefix = prefix;
+                instance->routePoolUsed += topicLength;
+                instance->routeCount++;
+            }
+        }
+    }
+
+    if( success )
+    {
+        route->handler = handler;
+        route->context = context;
+
+        if( prefix )
+        {
+            instance->prefixLengths[ topicLength / 8U ] |= ( uint8_t ) ( 1U << ( topicLength % 8U ) );
+            instance->longestPrefix = ( topicLength > instance->longestPrefix ) ? topicLength : instance->longestPrefix;
+        }
+    }
+
+    return success;
+}
+
+void mqttWrapperInstance_clearRoutes( MqttWrapperInstance_t * instance )
+{
+    if( instance->buffers.routeBucketCount > 0U )
+    {
+        memset( instance->buffers.routeBuckets,
+                0x00,
+                instance->buffers.routeBucketCount * sizeof( MqttWrapperRoute_t ) );
+    }
+
+    memset( instance->prefixLengths, 0x00, sizeof( instance->prefixLengths ) );
+    instance->routeCount = 0U;
+    instance->routePoolUsed = 0U;
+    instance->longestPrefix = 0U;
+}
+
+size_t mqttWrapperInstance_getRouteCount( const MqttWrapperInstance_t * instance )
+{
+    return instance->routeCount;
+}
+
+bool mqttWrapperInstance_routeMessage( MqttWrapperInstance_t * instance,
+                                       char * topic,
+                                       size_t topicLength,
+                                       uint8_t * message,
+                                       size_t messageLength )
+{
+    MqttWrapperRoute_t * match = NULL;
+    MqttWrapperRoute_t * route = NULL;
+    uint32_t hash = ROUTE_HASH_SEED;
+    size_t i = 0U;
+
+    /* The hash of every prefix is a step of the hash of the topic, so the
+     * prefixes are probed while the topic is hashed. */
+    for( i = 1U; ( instance->buffers.routeBucketCount > 0U ) && ( i <= topicLength ); i++ )
+    {
+        hash = ( hash ^ ( uint8_t ) topic[ i - 1U ] ) * ROUTE_HASH_PRIME;
+
+        if( ( i <= instance->longestPrefix ) &&
+            ( ( instance->prefixLengths[ i / 8U ] & ( 1U << ( i % 8U ) ) ) != 0U ) )
+        {
+            route = findRoute( instance, topic, i, hash, true );
+            match = ( route->handler != NULL ) ? route : match;
+        }
+    }
+
+    if( instance->buffers.routeBucketCount > 0U )
+    {
+        route = findRoute( instance, topic, topicLength, hash, false );
+        match = ( route->handler != NULL ) ? route : match;
+    }
+
+    return ( match != NULL ) &&
+           match->handler( topic, topicLength, message, messageLength, match->context );
+}
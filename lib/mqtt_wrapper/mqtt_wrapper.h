@@ -23,8 +23,35 @@ void mqttWrapper_getThingName( char * thingNameBuffer,
 
 bool mqttWrapper_connect( char * thingName, size_t thingNameLength );
 
+/*
+ * With cleanSession false the broker keeps the subscriptions and the
+ * unacknowledged QoS 1 state of the client while it is away. After such a
+ * reconnect, mqttWrapper_resumeSession replays the publishes still waiting
+ * for their PUBACK, as duplicates if the session was present.
+ */
+bool mqttWrapper_connectSession( char * thingName,
+                                 size_t thingNameLength,
+                                 bool cleanSession,
+                                 bool * sessionPresent );
+
+size_t mqttWrapper_resumeSession( bool sessionPresent );
+
 bool mqttWrapper_isConnected( void );
 
+/*
+ * Set once a send failed, when part of a packet may have gone out and
+ * nothing else can follow it on the connection. It is then no longer
+ * connected, until the owner reconnects. QoS 1 publishes caught by it stay
+ * in flight and are replayed by mqttWrapper_resumeSession.
+ */
+bool mqttWrapper_isConnectionBroken( void );
+
+/*
+ * Keep-alive interval sent in the CONNECT. An owner receiving with
+ * MQTT_ReceiveLoop instead of MQTT_ProcessLoop sends the PINGREQs itself.
+ */
+#define MQTT_WRAPPER_KEEP_ALIVE_SECONDS    60U
+
 bool mqttWrapper_publish( char * topic,
                           size_t topicLength,
                           uint8_t * message,
@@ -32,4 +59,362 @@ bool mqttWrapper_publish( char * topic,
 
 bool mqttWrapper_subscribe( char * topic, size_t topicLength );
 
+/*
+ * QoS 1 publishes. Up to MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES publishes await
+ * their PUBACK at a time, each with a copy of its topic and payload. The
+ * ones whose PUBACK is late are sent again with the DUP flag by
+ * mqttWrapper_resendPublishes, waiting twice as long after every attempt.
+ * The handler of a publish is called when its PUBACK arrives.
+ */
+#ifndef MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES
+    #define MQTT_WRAPPER_MAX_INFLIGHT_PUBLISHES    8U
+#endif
+
+#ifndef MQTT_WRAPPER_PUBLISH_BUFFER_SIZE
+    #define MQTT_WRAPPER_PUBLISH_BUFFER_SIZE    1024U
+#endif
+
+#ifndef MQTT_WRAPPER_PUBACK_TIMEOUT_MS
+    #define MQTT_WRAPPER_PUBACK_TIMEOUT_MS    2000U
+#endif
+
+#define MQTT_WRAPPER_MAX_RESEND_BACKOFF_SHIFT    4U
+
+typedef void ( * MqttWrapperPubAckHandler_t )( uint16_t packetId,
+                                               uint32_t ackTimeMs,
+                                               void * context );
+
+typedef struct MqttWrapperPublishStats
+{
+    uint32_t sent;
+    uint32_t acknowledged;
+    uint32_t resent;
+    uint32_t windowFull;
+    uint32_t inFlight;
+    uint32_t maxAckTimeMs;
+    uint64_t totalAckTimeMs;
+} MqttWrapperPublishStats_t;
+
+bool mqttWrapper_publishQos1( char * topic,
+                              size_t topicLength,
+                              uint8_t * message,
+                              size_t messageLength,
+                              MqttWrapperPubAckHandler_t handler,
+                              void * context,
+                              uint16_t * packetId );
+
+bool mqttWrapper_handlePubAck( uint16_t packetId );
+
+size_t mqttWrapper_resendPublishes( void );
+
+/* Time until mqttWrapper_resendPublishes has a publish to send again;
+ * UINT32_MAX when none is in flight. */
+uint32_t mqttWrapper_getResendDelayMs( void );
+
+void mqttWrapper_getPublishStats( MqttWrapperPublishStats_t * stats );
+
+/*
+ * Batched subscriptions. All topic filters go out in a single SUBSCRIBE
+ * without waiting for the SUBACK. When it arrives, mqttWrapper_handleSubAck
+ * reports it to the handler given for the batch, with granted set if the
+ * broker accepted every filter.
+ */
+#ifndef MQTT_WRAPPER_MAX_FILTERS
+    #define MQTT_WRAPPER_MAX_FILTERS    16U
+#endif
+
+#ifndef MQTT_WRAPPER_MAX_PENDING_SUBSCRIBES
+    #define MQTT_WRAPPER_MAX_PENDING_SUBSCRIBES    4U
+#endif
+
+typedef void ( * MqttWrapperSubAckHandler_t )( uint16_t packetId,
+                                               bool granted,
+                                               void * context );
+
+bool mqttWrapper_subscribeMany( char * const * topics,
+                                const size_t * topicLengths,
+                                size_t topicCount,
+                                MqttWrapperSubAckHandler_t handler,
+                                void * context,
+                                uint16_t * packetId );
+
+bool mqttWrapper_handleSubAck( MQTTPacketInfo_t * packetInfo,
+                               uint16_t packetId );
+
+/*
+ * Command queue. Once enabled, publishes and subscribes from any task are
+ * copied into a lock-free queue and return at once; the one task owning
+ * the MQTT context sends them from mqttWrapper_processCommands, so coreMQTT
+ * needs no locks. The wakeup is called after every command queued. Packet
+ * IDs are then only known to the PUBACK and SUBACK handlers, and a QoS 1
+ * publish finding the window full goes out at QoS 0. Any other failure of
+ * a command only counts as failed. Every instance has a queue of its own.
+ */
+/* A power of two. */
+#ifndef MQTT_WRAPPER_COMMAND_QUEUE_SIZE
+    #define MQTT_WRAPPER_COMMAND_QUEUE_SIZE    16U
+#endif
+
+typedef void ( * MqttWrapperWakeup_t )( void * context );
+
+typedef struct MqttWrapperCommandStats
+{
+    uint32_t queued;
+    uint32_t executed;
+    uint32_t failed;
+    uint32_t downgraded;
+    uint32_t queueFull;
+    uint32_t maxDepth;
+} MqttWrapperCommandStats_t;
+
+typedef enum MqttWrapperCommandType
+{
+    MQTT_WRAPPER_COMMAND_PUBLISH,
+    MQTT_WRAPPER_COMMAND_PUBLISH_QOS1,
+    MQTT_WRAPPER_COMMAND_SUBSCRIBE
+} MqttWrapperCommandType_t;
+
+typedef struct MqttWrapperCommand
+{
+    uint32_t sequence;
+    MqttWrapperCommandType_t type;
+    size_t topicCount;
+    size_t topicLengths[ MQTT_WRAPPER_MAX_FILTERS ];
+    size_t messageLength;
+    MqttWrapperPubAckHandler_t pubAckHandler;
+    MqttWrapperSubAckHandler_t subAckHandler;
+    void * context;
+    char buffer[ MQTT_WRAPPER_PUBLISH_BUFFER_SIZE ];
+} MqttWrapperCommand_t;
+
+void mqttWrapper_useCommandQueue( MqttWrapperWakeup_t wakeup,
+                                  void * context );
+
+size_t mqttWrapper_processCommands( void );
+
+/* Commands queued and not processed yet. Only for the owning task. */
+size_t mqttWrapper_getQueuedCommandCount( void );
+
+void mqttWrapper_getCommandStats( MqttWrapperCommandStats_t * stats );
+
+/*
+ * Topic router. Handlers are registered once for an exact topic or for a
+ * topic prefix, before messages arrive. An incoming topic is resolved in a
+ * single pass over its bytes: an exact route wins, otherwise the longest
+ * matching prefix route. Registered topics are copied into the router.
+ * Every instance routes its own topics.
+ */
+/* A power of two. */
+#ifndef MQTT_WRAPPER_MAX_ROUTES
+    #define MQTT_WRAPPER_MAX_ROUTES    256U
+#endif
+
+#ifndef MQTT_WRAPPER_ROUTE_POOL_SIZE
+    #define MQTT_WRAPPER_ROUTE_POOL_SIZE    16384U
+#endif
+
+#define MQTT_WRAPPER_MAX_ROUTE_LENGTH    256U
+
+/* Routes are kept in an open addressing table at most half full. */
+#define MQTT_WRAPPER_ROUTE_BUCKETS( maxRoutes )    ( 2U * ( maxRoutes ) )
+
+typedef bool ( * MqttWrapperTopicHandler_t )( char * topic,
+                                              size_t topicLength,
+                                              uint8_t * message,
+                                              size_t messageLength,
+                                              void * context );
+
+typedef struct MqttWrapperRoute
+{
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t length;
+    bool prefix;
+    MqttWrapperTopicHandler_t handler;
+    void * context;
+} MqttWrapperRoute_t;
+
+bool mqttWrapper_addRoute( const char * topic,
+                           size_t topicLength,
+                           bool prefix,
+                           MqttWrapperTopicHandler_t handler,
+                           void * context );
+
+void mqttWrapper_clearRoutes( void );
+
+size_t mqttWrapper_getRouteCount( void );
+
+bool mqttWrapper_routeMessage( char * topic,
+                               size_t topicLength,
+                               uint8_t * message,
+                               size_t messageLength );
+
+/*
+ * Instances. An instance holds what belongs to one device connection: its
+ * coreMQTT context, its thing name, the subscriptions and QoS 1 publishes
+ * it has in flight, its command queue and its topic router, so one process
+ * can keep many independent connections. The functions above act on a
+ * default instance, sized by the macros above.
+ *
+ * As with coreMQTT, the caller provides the buffers of an instance and
+ * chooses their sizes. Without command slots an instance has no command
+ * queue, without route buckets no router, and without in-flight publishes
+ * every QoS 1 publish finds the window full.
+ */
+#define MQTT_WRAPPER_MAX_THING_NAME_LENGTH    128U
+
+typedef struct MqttWrapperPendingSubscribe
+{
+    uint16_t packetId;
+    size_t topicCount;
+    MqttWrapperSubAckHandler_t handler;
+    void * context;
+} MqttWrapperPendingSubscribe_t;
+
+typedef struct MqttWrapperInFlightPublish
+{
+    uint16_t packetId;
+    uint16_t topicLength;
+    size_t messageLength;
+    uint32_t firstSentMs;
+    uint32_t lastSentMs;
+    uint32_t attempts;
+    MqttWrapperPubAckHandler_t handler;
+    void * context;
+    char buffer[ MQTT_WRAPPER_PUBLISH_BUFFER_SIZE ];
+} MqttWrapperInFlightPublish_t;
+
+typedef struct MqttWrapperBuffers
+{
+    MqttWrapperInFlightPublish_t * inFlightPublishes;
+    size_t inFlightPublishCount;
+    MqttWrapperCommand_t * commands; /* A power of two of them. */
+    size_t commandCount;
+    MqttWrapperRoute_t * routeBuckets; /* A power of two of them, see
+                                        * MQTT_WRAPPER_ROUTE_BUCKETS. */
+    size_t routeBucketCount;
+    char * routePool;
+    size_t routePoolSize;
+} MqttWrapperBuffers_t;
+
+typedef struct MqttWrapperInstance
+{
+    MQTTContext_t * mqttContext;
+    char thingName[ MQTT_WRAPPER_MAX_THING_NAME_LENGTH + 1U ];
+    size_t thingNameLength;
+    MqttWrapperBuffers_t buffers;
+    MqttWrapperPendingSubscribe_t pendingSubscribes[ MQTT_WRAPPER_MAX_PENDING_SUBSCRIBES ];
+    MqttWrapperPublishStats_t publishStats;
+    bool connectionBroken;
+    uint32_t commandEnqueuePosition;
+    uint32_t commandDequeuePosition;
+    bool commandQueueEnabled;
+    MqttWrapperWakeup_t commandWakeup;
+    void * commandWakeupContext;
+    MqttWrapperCommandStats_t commandStats;
+    size_t routeCount;
+    size_t routePoolUsed;
+    uint8_t prefixLengths[ ( MQTT_WRAPPER_MAX_ROUTE_LENGTH / 8U ) + 1U ];
+    size_t longestPrefix;
+} MqttWrapperInstance_t;
+
+MqttWrapperInstance_t * mqttWrapper_getDefaultInstance( void );
+
+/* Read only, NUL terminated and valid as long as the instance. */
+const char * mqttWrapper_getThingNameView( size_t * thingNameLength );
+
+/* The buffers are referenced, not copied, and must outlive the instance. */
+bool mqttWrapperInstance_init( MqttWrapperInstance_t * instance,
+                               MQTTContext_t * mqttContext,
+                               const char * thingName,
+                               size_t thingNameLength,
+                               const MqttWrapperBuffers_t * buffers );
+
+MQTTContext_t * mqttWrapperInstance_getCoreMqttContext( const MqttWrapperInstance_t * instance );
+
+const char * mqttWrapperInstance_getThingName( const MqttWrapperInstance_t * instance,
+                                               size_t * thingNameLength );
+
+/* The thing name of the instance is the client identifier. */
+bool mqttWrapperInstance_connect( MqttWrapperInstance_t * instance,
+                                  bool cleanSession,
+                                  bool * sessionPresent );
+
+size_t mqttWrapperInstance_resumeSession( MqttWrapperInstance_t * instance,
+                                          bool sessionPresent );
+
+bool mqttWrapperInstance_isConnected( const MqttWrapperInstance_t * instance );
+
+bool mqttWrapperInstance_isConnectionBroken( const MqttWrapperInstance_t * instance );
+
+bool mqttWrapperInstance_publish( MqttWrapperInstance_t * instance,
+                                  char * topic,
+                                  size_t topicLength,
+                                  uint8_t * message,
+                                  size_t messageLength );
+
+bool mqttWrapperInstance_publishQos1( MqttWrapperInstance_t * instance,
+                                      char * topic,
+                                      size_t topicLength,
+                                      uint8_t * message,
+                                      size_t messageLength,
+                                      MqttWrapperPubAckHandler_t handler,
+                                      void * context,
+                                      uint16_t * packetId );
+
+bool mqttWrapperInstance_handlePubAck( MqttWrapperInstance_t * instance,
+                                       uint16_t packetId );
+
+size_t mqttWrapperInstance_resendPublishes( MqttWrapperInstance_t * instance );
+
+uint32_t mqttWrapperInstance_getResendDelayMs( const MqttWrapperInstance_t * instance );
+
+void mqttWrapperInstance_getPublishStats( const MqttWrapperInstance_t * instance,
+                                          MqttWrapperPublishStats_t * stats );
+
+bool mqttWrapperInstance_subscribe( MqttWrapperInstance_t * instance,
+                                    char * topic,
+                                    size_t topicLength );
+
+bool mqttWrapperInstance_subscribeMany( MqttWrapperInstance_t * instance,
+                                        char * const * topics,
+                                        const size_t * topicLengths,
+                                        size_t topicCount,
+                                        MqttWrapperSubAckHandler_t handler,
+                                        void * context,
+                                        uint16_t * packetId );
+
+bool mqttWrapperInstance_handleSubAck( MqttWrapperInstance_t * instance,
+                                       MQTTPacketInfo_t * packetInfo,
+                                       uint16_t packetId );
+
+/* Fails for an instance without command slots. */
+bool mqttWrapperInstance_useCommandQueue( MqttWrapperInstance_t * instance,
+                                          MqttWrapperWakeup_t wakeup,
+                                          void * context );
+
+size_t mqttWrapperInstance_processCommands( MqttWrapperInstance_t * instance );
+
+size_t mqttWrapperInstance_getQueuedCommandCount( const MqttWrapperInstance_t * instance );
+
+void mqttWrapperInstance_getCommandStats( const MqttWrapperInstance_t * instance,
+                                          MqttWrapperCommandStats_t * stats );
+
+bool mqttWrapperInstance_addRoute( MqttWrapperInstance_t * instance,
+                                   const char * topic,
+                                   size_t topicLength,
+                                   bool prefix,
+                                   MqttWrapperTopicHandler_t handler,
+                                   void * context );
+
+void mqttWrapperInstance_clearRoutes( MqttWrapperInstance_t * instance );
+
+size_t mqttWrapperInstance_getRouteCount( const MqttWrapperInstance_t * instance );
+
+bool mqttWrapperInstance_routeMessage( MqttWrapperInstance_t * instance,
+                                       char * topic,
+                                       size_t topicLength,
+                                       uint8_t * message,
+                                       size_t messageLength );
+
 #endif
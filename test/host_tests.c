@@ -0,0 +1,64 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file host_tests.c
+ * @brief Runs the host side tests of the demo modules.
+ *
+ * The tests run in a fresh temporary directory, so the files they create
+ * never meet the files of a demo run.
+ */
+
+/* Standard includes. */
+#include <stdlib.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+
+#include "host_tests.h"
+
+uint32_t hostTestFailures = 0U;
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    char directory[] = "/tmp/ota_host_tests_XXXXXX";
+    int status = EXIT_FAILURE;
+
+    if( ( mkdtemp( directory ) == NULL ) || ( chdir( directory ) != 0 ) )
+    {
+        printf( "Failed to create the test directory.\n" );
+    }
+    else
+    {
+        testWriteCoalescer();
+        testResumeJournal();
+        testFlashSim();
+        testTopicRouter();
+        testJobIndex();
+        testConnectionSupervisor();
+
+        ( void ) chdir( "/" );
+        ( void ) rmdir( directory );
+
+        if( hostTestFailures == 0U )
+        {
+            printf( "All host tests passed.\n" );
+            status = EXIT_SUCCESS;
+        }
+        else
+        {
+            printf( "%u host test checks failed.\n",
+                    ( unsigned int ) hostTestFailures );
+        }
+    }
+
+    return status;
+}
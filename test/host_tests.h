@@ -0,0 +1,73 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file host_tests.h
+ * @brief Checks shared by the host side tests of the demo modules.
+ */
+
+#ifndef HOST_TESTS_H_
+#define HOST_TESTS_H_
+
+/* Standard includes. */
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Number of failed checks of the whole run.
+ */
+extern uint32_t hostTestFailures;
+
+/**
+ * @brief Report a failed check without stopping the test.
+ *
+ * @param[in] condition Condition expected to hold.
+ */
+#define TEST_CHECK( condition )                                    \
+    do                                                             \
+    {                                                              \
+        if( !( condition ) )                                       \
+        {                                                          \
+            printf( "%s:%d: Check failed: %s\n", __FILE__, __LINE__, \
+                    #condition );                                  \
+            hostTestFailures++;                                    \
+        }                                                          \
+    } while( 0 )
+
+/**
+ * @brief Tests of the write coalescer.
+ */
+void testWriteCoalescer( void );
+
+/**
+ * @brief Tests of the resume journal.
+ */
+void testResumeJournal( void );
+
+/**
+ * @brief Tests of the flash simulator.
+ */
+void testFlashSim( void );
+
+/**
+ * @brief Tests of the topic router of the MQTT wrapper.
+ */
+void testTopicRouter( void );
+
+/**
+ * @brief Tests of the job document index.
+ */
+void testJobIndex( void );
+
+/**
+ * @brief Tests of the connection supervisor.
+ */
+void testConnectionSupervisor( void );
+
+#endif /* ifndef HOST_TESTS_H_ */
@@ -0,0 +1,210 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file test_connection_supervisor.c
+ * @brief Tests the backoff and the recovery of the connection supervisor
+ * under injected faults.
+ */
+
+/* Standard includes. */
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_tests.h"
+#include "utils/clock.h"
+#include "utils/connection_supervisor.h"
+
+#define TEST_BASE_BACKOFF_MS    8U
+#define TEST_MAX_BACKOFF_MS     40U
+#define TEST_MAX_DELAYS         32U
+
+/**
+ * @brief Slack allowed between the waits and the measured downtime.
+ */
+#define TEST_DOWNTIME_SLACK_MS  100U
+
+/**
+ * @brief Fake connection whose attempts fail on demand.
+ */
+typedef struct TestConnection
+{
+    uint32_t failuresLeft;               /**< @brief Attempts still to fail. */
+    uint32_t attempts;                   /**< @brief Connect calls. */
+    uint32_t teardowns;                  /**< @brief Teardown calls. */
+    bool resumeSession;                  /**< @brief Report a resumed session. */
+    uint32_t delayCount;                 /**< @brief Waits requested. */
+    uint32_t delaysMs[ TEST_MAX_DELAYS ]; /**< @brief Length of the waits. */
+} TestConnection_t;
+
+static TestConnection_t connection;
+
+/*-----------------------------------------------------------*/
+
+static bool fakeConnect( void * context,
+                         bool * sessionPresent )
+{
+    TestConnection_t * testConnection = ( TestConnection_t * ) context;
+    bool connected = false;
+
+    testConnection->attempts++;
+
+    if( testConnection->failuresLeft > 0U )
+    {
+        testConnection->failuresLeft--;
+    }
+    else
+    {
+        *sessionPresent = testConnection->resumeSession;
+        connected = true;
+    }
+
+    return connected;
+}
+
+/*-----------------------------------------------------------*/
+
+static void fakeTeardown( void * context )
+{
+    ( ( TestConnection_t * ) context )->teardowns++;
+}
+
+/*-----------------------------------------------------------*/
+
+static void recordDelay( uint32_t delayMs )
+{
+    if( connection.delayCount < TEST_MAX_DELAYS )
+    {
+        connection.delaysMs[ connection.delayCount ] = delayMs;
+    }
+
+    connection.delayCount++;
+    Clock_SleepMs( delayMs );
+}
+
+/*-----------------------------------------------------------*/
+
+static void initSupervisor( ConnectionSupervisorContext_t * supervisor,
+                            uint32_t maxAttempts,
+                            uint32_t faultIntervalMs )
+{
+    ConnectionSupervisorConfig_t config =
+    {
+        .baseBackoffMs   = TEST_BASE_BACKOFF_MS,
+        .maxBackoffMs    = TEST_MAX_BACKOFF_MS,
+        .maxAttempts     = maxAttempts,
+        .faultIntervalMs = faultIntervalMs,
+        .connect         = fakeConnect,
+        .teardown        = fakeTeardown,
+        .delay           = recordDelay,
+        .context         = &connection
+    };
+
+    memset( &connection, 0, sizeof( connection ) );
+    ConnectionSupervisor_Init( supervisor, &config );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t checkBackoffDelays( uint32_t expectedCount )
+{
+    uint32_t jitterMaxMs = TEST_BASE_BACKOFF_MS;
+    uint32_t totalMs = 0U;
+    uint32_t i;
+
+    TEST_CHECK( connection.delayCount == expectedCount );
+
+    /* Every wait is jittered below a cap doubling up to the maximum. */
+    for( i = 0U; ( i < connection.delayCount ) && ( i < TEST_MAX_DELAYS ); i++ )
+    {
+        TEST_CHECK( connection.delaysMs[ i ] <= jitterMaxMs );
+        totalMs += connection.delaysMs[ i ];
+        jitterMaxMs = ( ( 2U * jitterMaxMs ) < TEST_MAX_BACKOFF_MS ) ?
+                      ( 2U * jitterMaxMs ) : TEST_MAX_BACKOFF_MS;
+    }
+
+    return totalMs;
+}
+
+/*-----------------------------------------------------------*/
+
+static void testGivesUp( void )
+{
+    ConnectionSupervisorContext_t supervisor;
+    bool sessionPresent = true;
+
+    initSupervisor( &supervisor, 3U, 0U );
+    connection.failuresLeft = UINT32_MAX;
+
+    TEST_CHECK( !ConnectionSupervisor_Connect( &supervisor, &sessionPresent ) );
+    TEST_CHECK( !sessionPresent );
+    TEST_CHECK( connection.attempts == 3U );
+    TEST_CHECK( connection.teardowns == 3U );
+    TEST_CHECK( supervisor.stats.failedAttempts == 3U );
+    TEST_CHECK( supervisor.stats.connects == 0U );
+    ( void ) checkBackoffDelays( 2U );
+}
+
+/*-----------------------------------------------------------*/
+
+static void testRecoversFromFaults( void )
+{
+    ConnectionSupervisorContext_t supervisor;
+    bool sessionPresent = false;
+    uint32_t delaysMs = 0U;
+    uint32_t startMs;
+    uint32_t elapsedMs;
+    uint32_t fault;
+
+    initSupervisor( &supervisor, 0U, 20U );
+    TEST_CHECK( ConnectionSupervisor_Connect( &supervisor, &sessionPresent ) );
+    TEST_CHECK( !ConnectionSupervisor_FaultDue( &supervisor ) );
+
+    startMs = Clock_GetTimeMs();
+
+    for( fault = 0U; fault < 3U; fault++ )
+    {
+        Clock_SleepMs( 25U );
+        TEST_CHECK( ConnectionSupervisor_FaultDue( &supervisor ) );
+
+        /* The broker stays away for a few attempts, then resumes the
+         * session. */
+        connection.failuresLeft = 4U;
+        connection.resumeSession = true;
+        connection.delayCount = 0U;
+        TEST_CHECK( ConnectionSupervisor_Reconnect( &supervisor, &sessionPresent ) );
+        TEST_CHECK( sessionPresent );
+        delaysMs += checkBackoffDelays( 4U );
+    }
+
+    elapsedMs = Clock_GetTimeMs() - startMs;
+
+    TEST_CHECK( supervisor.stats.faultsInjected == 3U );
+    TEST_CHECK( supervisor.stats.reconnects == 3U );
+    TEST_CHECK( supervisor.stats.sessionsResumed == 3U );
+    TEST_CHECK( supervisor.stats.connects == 4U );
+    TEST_CHECK( supervisor.stats.failedAttempts == 12U );
+    TEST_CHECK( connection.attempts == 16U );
+
+    /* Recovery costs the backoff waits and little else. */
+    TEST_CHECK( supervisor.stats.downtimeMs >= delaysMs );
+    TEST_CHECK( supervisor.stats.downtimeMs <= ( delaysMs + TEST_DOWNTIME_SLACK_MS ) );
+    TEST_CHECK( supervisor.stats.longestDowntimeMs <= supervisor.stats.downtimeMs );
+    TEST_CHECK( elapsedMs <= ( ( 3U * 25U ) + delaysMs + TEST_DOWNTIME_SLACK_MS ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void testConnectionSupervisor( void )
+{
+    srand( 1U );
+
+    testGivesUp();
+    testRecoversFromFaults();
+}
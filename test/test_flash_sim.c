@@ -0,0 +1,97 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file test_flash_sim.c
+ * @brief Tests the erase before write rules of the flash simulator.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+
+#include "host_tests.h"
+#include "storage/flash_sim_posix.h"
+
+#define TEST_NOR_PATH     "test_nor.bin"
+#define TEST_NAND_PATH    "test_nand.bin"
+
+/*-----------------------------------------------------------*/
+
+static void testNor( void )
+{
+    FlashSimGeometry_t geometry = FLASH_SIM_NOR_GEOMETRY( 2U );
+    FlashSimContext_t flash;
+    uint8_t data[ 16 ];
+    uint8_t readBack[ 16 ];
+
+    TEST_CHECK( FlashSim_Open( &flash, TEST_NOR_PATH, &geometry ) == FLASH_SIM_SUCCESS );
+    TEST_CHECK( FlashSim_IsSectorErased( &flash, 0U ) );
+
+    /* NOR flash only clears bits, so clearing more of them is fine. */
+    memset( data, 0xF0, sizeof( data ) );
+    TEST_CHECK( FlashSim_Program( &flash, 100U, data, sizeof( data ) ) == FLASH_SIM_SUCCESS );
+    memset( data, 0x30, sizeof( data ) );
+    TEST_CHECK( FlashSim_Program( &flash, 100U, data, sizeof( data ) ) == FLASH_SIM_SUCCESS );
+    TEST_CHECK( !FlashSim_IsSectorErased( &flash, 0U ) );
+
+    /* Setting a bit again needs an erase. */
+    memset( data, 0xA5, sizeof( data ) );
+    TEST_CHECK( FlashSim_Program( &flash, 100U, data, sizeof( data ) ) == FLASH_SIM_NOT_ERASED );
+    TEST_CHECK( FlashSim_Erase( &flash, 0U ) == FLASH_SIM_SUCCESS );
+    TEST_CHECK( FlashSim_IsSectorErased( &flash, 0U ) );
+    TEST_CHECK( FlashSim_Program( &flash, 100U, data, sizeof( data ) ) == FLASH_SIM_SUCCESS );
+
+    TEST_CHECK( FlashSim_Read( &flash, 100U, readBack, sizeof( readBack ) ) == FLASH_SIM_SUCCESS );
+    TEST_CHECK( memcmp( readBack, data, sizeof( data ) ) == 0 );
+
+    /* Nothing is written past the partition. */
+    TEST_CHECK( FlashSim_Program( &flash, 2U * geometry.sectorSize, data, sizeof( data ) ) ==
+                FLASH_SIM_INVALID_PARAMETER );
+
+    FlashSim_Close( &flash );
+    ( void ) unlink( TEST_NOR_PATH );
+}
+
+/*-----------------------------------------------------------*/
+
+static void testNand( void )
+{
+    FlashSimGeometry_t geometry = FLASH_SIM_NAND_GEOMETRY( 1U );
+    FlashSimContext_t flash;
+    static uint8_t page[ 2048 ];
+
+    TEST_CHECK( FlashSim_Open( &flash, TEST_NAND_PATH, &geometry ) == FLASH_SIM_SUCCESS );
+    memset( page, 0x5A, sizeof( page ) );
+
+    /* Only whole pages are programmed. */
+    TEST_CHECK( FlashSim_Program( &flash, 16U, page, 256U ) == FLASH_SIM_INVALID_PARAMETER );
+    TEST_CHECK( FlashSim_Program( &flash, 0U, page, 256U ) == FLASH_SIM_INVALID_PARAMETER );
+
+    /* A page is programmed once between erases, even with the same data. */
+    TEST_CHECK( FlashSim_Program( &flash, 2048U, page, sizeof( page ) ) == FLASH_SIM_SUCCESS );
+    TEST_CHECK( FlashSim_Program( &flash, 2048U, page, sizeof( page ) ) == FLASH_SIM_NOT_ERASED );
+    TEST_CHECK( FlashSim_Program( &flash, 4096U, page, sizeof( page ) ) == FLASH_SIM_SUCCESS );
+
+    TEST_CHECK( FlashSim_Erase( &flash, 0U ) == FLASH_SIM_SUCCESS );
+    TEST_CHECK( FlashSim_Program( &flash, 2048U, page, sizeof( page ) ) == FLASH_SIM_SUCCESS );
+
+    FlashSim_Close( &flash );
+    ( void ) unlink( TEST_NAND_PATH );
+}
+
+/*-----------------------------------------------------------*/
+
+void testFlashSim( void )
+{
+    testNor();
+    testNand();
+}
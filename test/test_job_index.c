@@ -0,0 +1,83 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file test_job_index.c
+ * @brief Tests the job document index on a StartNext response.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+#include "host_tests.h"
+#include "utils/job_index.h"
+
+static const char testStartNextResponse[] =
+    "{\"clientToken\":\"token\",\"execution\":{\"jobId\":\"AFR_OTA-job-1\","
+    "\"status\":\"QUEUED\",\"versionNumber\":1,\"jobDocument\":{\"afr_ota\":{"
+    "\"protocols\":[\"MQTT\"],\"streamname\":\"AFR_OTA-stream\",\"files\":["
+    "{\"filepath\":\"/image.bin\",\"filesize\":180000,\"fileid\":0,"
+    "\"certfile\":\"cert.pem\",\"fileType\":0,"
+    "\"sig-sha256-ecdsa\":\"c2ln\\\"bmF0dXJl\"},"
+    "{\"filepath\":\"/config.bin\",\"filesize\":512,\"fileid\":1,"
+    "\"certfile\":\"cert.pem\",\"fileType\":2,"
+    "\"sig-sha256-ecdsa\":\"Y29uZmln\",\"nested\":[1,{\"a\":null}]}]}}}}";
+
+/*-----------------------------------------------------------*/
+
+static bool spanEquals( const char * value,
+                        size_t valueLength,
+                        const char * expected )
+{
+    return ( valueLength == strlen( expected ) ) &&
+           ( memcmp( value, expected, valueLength ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+void testJobIndex( void )
+{
+    static JobIndex_t index;
+    AfrOtaJobDocumentFields_t fields;
+    const char * value = NULL;
+    size_t valueLength;
+
+    TEST_CHECK( JobIndex_Build( &index, testStartNextResponse,
+                                sizeof( testStartNextResponse ) - 1U ) );
+
+    valueLength = JobIndex_GetJobId( &index, &value );
+    TEST_CHECK( spanEquals( value, valueLength, "AFR_OTA-job-1" ) );
+
+    valueLength = JobIndex_GetJobDocument( &index, &value );
+    TEST_CHECK( ( valueLength > 0U ) && ( value[ 0 ] == '{' ) &&
+                ( value[ valueLength - 1U ] == '}' ) );
+
+    TEST_CHECK( JobIndex_GetFileCount( &index ) == 2U );
+
+    memset( &fields, 0, sizeof( fields ) );
+    TEST_CHECK( JobIndex_GetFile( &index, 0U, &fields ) );
+    TEST_CHECK( spanEquals( fields.filepath, fields.filepathLen, "/image.bin" ) );
+    TEST_CHECK( spanEquals( fields.certfile, fields.certfileLen, "cert.pem" ) );
+    TEST_CHECK( spanEquals( fields.signature, fields.signatureLen, "c2ln\\\"bmF0dXJl" ) );
+    TEST_CHECK( fields.fileSize == 180000U );
+    TEST_CHECK( fields.fileId == 0U );
+    TEST_CHECK( fields.fileType == 0U );
+
+    memset( &fields, 0, sizeof( fields ) );
+    TEST_CHECK( JobIndex_GetFile( &index, 1U, &fields ) );
+    TEST_CHECK( spanEquals( fields.filepath, fields.filepathLen, "/config.bin" ) );
+    TEST_CHECK( fields.fileSize == 512U );
+    TEST_CHECK( fields.fileId == 1U );
+    TEST_CHECK( fields.fileType == 2U );
+
+    TEST_CHECK( !JobIndex_GetFile( &index, 2U, &fields ) );
+
+    /* Malformed JSON is refused. */
+    TEST_CHECK( !JobIndex_Build( &index, "{\"a\":[1,2}", 10U ) );
+}
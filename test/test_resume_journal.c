@@ -0,0 +1,147 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file test_resume_journal.c
+ * @brief Tests the recovery of the resume journal after a torn write.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* POSIX includes. */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "host_tests.h"
+#include "storage/resume_journal_posix.h"
+
+#define TEST_JOURNAL_PATH    "test.journal"
+#define TEST_BLOCK_COUNT     64U
+
+static const uint8_t testDigest[ RESUME_JOURNAL_DIGEST_SIZE ] = { 1U, 2U, 3U };
+
+/*-----------------------------------------------------------*/
+
+static void initConfig( ResumeJournalConfig_t * config,
+                        const char * jobId )
+{
+    memset( config, 0, sizeof( *config ) );
+    config->path = TEST_JOURNAL_PATH;
+    config->jobId = jobId;
+    config->jobIdLength = strlen( jobId );
+    config->fileDigest = testDigest;
+    config->fileSize = TEST_BLOCK_COUNT * 256U;
+    config->blockCount = TEST_BLOCK_COUNT;
+    config->syncBlocks = 1U;
+    config->snapshotRecords = 0U;
+    config->dataFd = -1;
+}
+
+/*-----------------------------------------------------------*/
+
+static off_t getJournalSize( void )
+{
+    struct stat info;
+
+    return ( stat( TEST_JOURNAL_PATH, &info ) == 0 ) ? info.st_size : -1;
+}
+
+/*-----------------------------------------------------------*/
+
+static void testTruncatedTail( void )
+{
+    ResumeJournalConfig_t config;
+    ResumeJournalContext_t journal;
+    off_t sizeBefore;
+    off_t sizeAfter;
+    uint32_t block;
+
+    initConfig( &config, "job-1" );
+    TEST_CHECK( ResumeJournal_Open( &journal, &config ) );
+    TEST_CHECK( journal.stats.blocksRecovered == 0U );
+
+    TEST_CHECK( ResumeJournal_RecordBlocks( &journal, 0U, 4U ) );
+    sizeBefore = getJournalSize();
+    TEST_CHECK( ResumeJournal_RecordBlocks( &journal, 10U, 2U ) );
+    sizeAfter = getJournalSize();
+    ResumeJournal_Close( &journal, false );
+
+    /* Tear the last record, as a crash in the middle of its write would. */
+    TEST_CHECK( sizeAfter > sizeBefore );
+    TEST_CHECK( truncate( TEST_JOURNAL_PATH, sizeAfter - 3 ) == 0 );
+
+    TEST_CHECK( ResumeJournal_Open( &journal, &config ) );
+    TEST_CHECK( journal.stats.blocksRecovered == 4U );
+
+    for( block = 0U; block < TEST_BLOCK_COUNT; block++ )
+    {
+        TEST_CHECK( ResumeJournal_IsBlockStored( &journal, block ) == ( block < 4U ) );
+    }
+
+    /* Records written after the recovery replay behind the valid part. */
+    TEST_CHECK( ResumeJournal_RecordBlocks( &journal, 20U, 1U ) );
+    ResumeJournal_Close( &journal, false );
+
+    TEST_CHECK( ResumeJournal_Open( &journal, &config ) );
+    TEST_CHECK( journal.stats.blocksRecovered == 5U );
+    TEST_CHECK( ResumeJournal_IsBlockStored( &journal, 20U ) );
+    TEST_CHECK( !ResumeJournal_IsBlockStored( &journal, 10U ) );
+    ResumeJournal_Close( &journal, true );
+
+    TEST_CHECK( access( TEST_JOURNAL_PATH, F_OK ) != 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void testCorruptRecord( void )
+{
+    ResumeJournalConfig_t config;
+    ResumeJournalContext_t journal;
+    off_t size;
+    uint8_t byte = 0U;
+    int fd;
+
+    initConfig( &config, "job-2" );
+    TEST_CHECK( ResumeJournal_Open( &journal, &config ) );
+    TEST_CHECK( ResumeJournal_RecordBlocks( &journal, 0U, 2U ) );
+    TEST_CHECK( ResumeJournal_RecordBlocks( &journal, 30U, 3U ) );
+    ResumeJournal_Close( &journal, false );
+
+    /* Flip a byte of the last record, so its CRC no longer matches. */
+    size = getJournalSize();
+    fd = open( TEST_JOURNAL_PATH, O_RDWR );
+    TEST_CHECK( fd >= 0 );
+    TEST_CHECK( pread( fd, &byte, 1U, size - 6 ) == 1 );
+    byte ^= 0x40U;
+    TEST_CHECK( pwrite( fd, &byte, 1U, size - 6 ) == 1 );
+    ( void ) close( fd );
+
+    TEST_CHECK( ResumeJournal_Open( &journal, &config ) );
+    TEST_CHECK( journal.stats.blocksRecovered == 2U );
+    TEST_CHECK( ResumeJournal_IsBlockStored( &journal, 1U ) );
+    TEST_CHECK( !ResumeJournal_IsBlockStored( &journal, 30U ) );
+    ResumeJournal_Close( &journal, false );
+
+    /* The journal of another job is not replayed. */
+    initConfig( &config, "job-3" );
+    TEST_CHECK( ResumeJournal_Open( &journal, &config ) );
+    TEST_CHECK( journal.stats.blocksRecovered == 0U );
+    TEST_CHECK( !ResumeJournal_IsBlockStored( &journal, 1U ) );
+    ResumeJournal_Close( &journal, true );
+}
+
+/*-----------------------------------------------------------*/
+
+void testResumeJournal( void )
+{
+    testTruncatedTail();
+    testCorruptRecord();
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file test_topic_router.c
+ * @brief Tests the exact and prefix matching of the topic router.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+#include "host_tests.h"
+#include "mqtt_wrapper.h"
+
+#define TEST_JOBS_PREFIX       "$aws/things/thing/jobs/"
+#define TEST_START_NEXT        TEST_JOBS_PREFIX "start-next/accepted"
+#define TEST_STREAMS_PREFIX    "$aws/things/thing/streams/"
+#define TEST_STREAM_PREFIX     TEST_STREAMS_PREFIX "AFR_OTA-1/"
+
+/**
+ * @brief Handlers of the test routes.
+ */
+typedef enum TestRoute
+{
+    TEST_ROUTE_START_NEXT = 0,
+    TEST_ROUTE_JOBS,
+    TEST_ROUTE_STREAMS,
+    TEST_ROUTE_STREAM,
+    TEST_ROUTE_COUNT
+} TestRoute_t;
+
+static uint32_t routeHits[ TEST_ROUTE_COUNT ];
+
+/*-----------------------------------------------------------*/
+
+static bool countHit( char * topic,
+                      size_t topicLength,
+                      uint8_t * message,
+                      size_t messageLength,
+                      void * context )
+{
+    ( void ) topic;
+    ( void ) topicLength;
+    ( void ) message;
+    ( void ) messageLength;
+
+    routeHits[ *( const TestRoute_t * ) context ]++;
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool routeTopic( const char * topic )
+{
+    char topicBuffer[ MQTT_WRAPPER_MAX_ROUTE_LENGTH ];
+    size_t topicLength = strlen( topic );
+
+    memcpy( topicBuffer, topic, topicLength + 1U );
+    memset( routeHits, 0, sizeof( routeHits ) );
+
+    return mqttWrapper_routeMessage( topicBuffer, topicLength, NULL, 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+void testTopicRouter( void )
+{
+    static const TestRoute_t routes[ TEST_ROUTE_COUNT ] =
+    {
+        TEST_ROUTE_START_NEXT, TEST_ROUTE_JOBS,
+        TEST_ROUTE_STREAMS,    TEST_ROUTE_STREAM
+    };
+
+    mqttWrapper_clearRoutes();
+
+    TEST_CHECK( mqttWrapper_addRoute( TEST_START_NEXT, strlen( TEST_START_NEXT ), false,
+                                      countHit, ( void * ) &routes[ TEST_ROUTE_START_NEXT ] ) );
+    TEST_CHECK( mqttWrapper_addRoute( TEST_JOBS_PREFIX, strlen( TEST_JOBS_PREFIX ), true,
+                                      countHit, ( void * ) &routes[ TEST_ROUTE_JOBS ] ) );
+    TEST_CHECK( mqttWrapper_addRoute( TEST_STREAMS_PREFIX, strlen( TEST_STREAMS_PREFIX ), true,
+                                      countHit, ( void * ) &routes[ TEST_ROUTE_STREAMS ] ) );
+    TEST_CHECK( mqttWrapper_addRoute( TEST_STREAM_PREFIX, strlen( TEST_STREAM_PREFIX ), true,
+                                      countHit, ( void * ) &routes[ TEST_ROUTE_STREAM ] ) );
+    TEST_CHECK( mqttWrapper_getRouteCount() == TEST_ROUTE_COUNT );
+
+    /* An exact route wins over a prefix route of the same topic. */
+    TEST_CHECK( routeTopic( TEST_START_NEXT ) );
+    TEST_CHECK( routeHits[ TEST_ROUTE_START_NEXT ] == 1U );
+    TEST_CHECK( routeHits[ TEST_ROUTE_JOBS ] == 0U );
+
+    /* A topic only extending the exact route falls back to the prefix. */
+    TEST_CHECK( routeTopic( TEST_START_NEXT "/extra" ) );
+    TEST_CHECK( routeHits[ TEST_ROUTE_START_NEXT ] == 0U );
+    TEST_CHECK( routeHits[ TEST_ROUTE_JOBS ] == 1U );
+
+    TEST_CHECK( routeTopic( TEST_JOBS_PREFIX "job-1/update/accepted" ) );
+    TEST_CHECK( routeHits[ TEST_ROUTE_JOBS ] == 1U );
+
+    /* The longest matching prefix wins. */
+    TEST_CHECK( routeTopic( TEST_STREAM_PREFIX "data/cbor" ) );
+    TEST_CHECK( routeHits[ TEST_ROUTE_STREAM ] == 1U );
+    TEST_CHECK( routeHits[ TEST_ROUTE_STREAMS ] == 0U );
+
+    TEST_CHECK( routeTopic( TEST_STREAMS_PREFIX "AFR_OTA-2/data/cbor" ) );
+    TEST_CHECK( routeHits[ TEST_ROUTE_STREAMS ] == 1U );
+    TEST_CHECK( routeHits[ TEST_ROUTE_STREAM ] == 0U );
+
+    /* A topic shorter than every route, or matching none, is not routed. */
+    TEST_CHECK( !routeTopic( "$aws/things/thing/" ) );
+    TEST_CHECK( !routeTopic( "$aws/things/other/jobs/notify" ) );
+
+    mqttWrapper_clearRoutes();
+    TEST_CHECK( mqttWrapper_getRouteCount() == 0U );
+    TEST_CHECK( !routeTopic( TEST_START_NEXT ) );
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright Amazon.com, Inc. and its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ *
+ * Licensed under the MIT License. See the LICENSE accompanying this file
+ * for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/**
+ * @file test_write_coalescer.c
+ * @brief Tests the write alignment of the write coalescer.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+#include "host_tests.h"
+#include "storage/write_coalescer.h"
+
+#define TEST_UNIT_SIZE       8192U
+#define TEST_BLOCK_SIZE      256U
+#define TEST_PAGE_SIZE       2048U
+#define TEST_IMAGE_SIZE      20000U
+#define TEST_PAGE_COUNT      ( ( TEST_IMAGE_SIZE + TEST_PAGE_SIZE - 1U ) / TEST_PAGE_SIZE )
+#define TEST_PAD_BYTE        0xFFU
+
+/**
+ * @brief Everything the sink was asked to write.
+ */
+typedef struct TestSink
+{
+    uint8_t image[ TEST_PAGE_COUNT * TEST_PAGE_SIZE ]; /**< @brief Written data. */
+    uint8_t pageWrites[ TEST_PAGE_COUNT ];             /**< @brief Writes per page. */
+    uint32_t writes;                                   /**< @brief Number of writes. */
+    uint32_t unalignedWrites;                          /**< @brief Writes not on
+                                                          page boundaries. */
+} TestSink_t;
+
+static TestSink_t sink;
+
+/*-----------------------------------------------------------*/
+
+static bool sinkWrite( void * sinkContext,
+                       uint32_t offset,
+                       const uint8_t * data,
+                       size_t length )
+{
+    TestSink_t * testSink = ( TestSink_t * ) sinkContext;
+    uint32_t page;
+
+    testSink->writes++;
+
+    if( ( ( offset % TEST_PAGE_SIZE ) != 0U ) ||
+        ( ( length % TEST_PAGE_SIZE ) != 0U ) ||
+        ( ( offset + length ) > sizeof( testSink->image ) ) )
+    {
+        testSink->unalignedWrites++;
+    }
+    else
+    {
+        memcpy( &testSink->image[ offset ], data, length );
+
+        for( page = offset / TEST_PAGE_SIZE;
+             page < ( ( offset + length ) / TEST_PAGE_SIZE );
+             page++ )
+        {
+            testSink->pageWrites[ page ]++;
+        }
+    }
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static void initCoalescer( WriteCoalescerContext_t * coalescer,
+                           uint32_t openUnits )
+{
+    WriteCoalescerConfig_t config =
+    {
+        .unitSize       = TEST_UNIT_SIZE,
+        .blockSize      = TEST_BLOCK_SIZE,
+        .writeAlignment = TEST_PAGE_SIZE,
+        .imageSize      = TEST_IMAGE_SIZE,
+        .openUnits      = openUnits,
+        .padByte        = TEST_PAD_BYTE,
+        .write          = sinkWrite,
+        .wait           = NULL,
+        .sinkContext    = &sink
+    };
+
+    memset( &sink, 0, sizeof( sink ) );
+    TEST_CHECK( WriteCoalescer_Init( coalescer, &config ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void fillBlock( uint8_t * block,
+                       uint32_t offset )
+{
+    uint32_t i;
+
+    for( i = 0U; i < TEST_BLOCK_SIZE; i++ )
+    {
+        block[ i ] = ( uint8_t ) ( ( offset + i ) * 7U );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void testInOrder( void )
+{
+    WriteCoalescerContext_t coalescer;
+    uint8_t block[ TEST_BLOCK_SIZE ];
+    uint32_t offset;
+    uint32_t length;
+    uint32_t page;
+
+    initCoalescer( &coalescer, 1U );
+
+    for( offset = 0U; offset < TEST_IMAGE_SIZE; offset += TEST_BLOCK_SIZE )
+    {
+        length = ( ( TEST_IMAGE_SIZE - offset ) < TEST_BLOCK_SIZE ) ?
+                 ( TEST_IMAGE_SIZE - offset ) : TEST_BLOCK_SIZE;
+        fillBlock( block, offset );
+        TEST_CHECK( WriteCoalescer_Write( &coalescer, offset, block, length ) );
+    }
+
+    TEST_CHECK( WriteCoalescer_Flush( &coalescer ) );
+
+    TEST_CHECK( sink.unalignedWrites == 0U );
+    TEST_CHECK( coalescer.stats.partialUnitWrites == 0U );
+    TEST_CHECK( coalescer.stats.evictions == 0U );
+    TEST_CHECK( coalescer.stats.rejectedBlocks == 0U );
+
+    for( page = 0U; page < TEST_PAGE_COUNT; page++ )
+    {
+        TEST_CHECK( sink.pageWrites[ page ] == 1U );
+    }
+
+    for( offset = 0U; offset < TEST_IMAGE_SIZE; offset += TEST_BLOCK_SIZE )
+    {
+        length = ( ( TEST_IMAGE_SIZE - offset ) < TEST_BLOCK_SIZE ) ?
+                 ( TEST_IMAGE_SIZE - offset ) : TEST_BLOCK_SIZE;
+        fillBlock( block, offset );
+        TEST_CHECK( memcmp( &sink.image[ offset ], block, length ) == 0 );
+    }
+
+    WriteCoalescer_Deinit( &coalescer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void testEvictedUnit( void )
+{
+    WriteCoalescerContext_t coalescer;
+    uint8_t block[ TEST_BLOCK_SIZE ];
+    uint8_t padding[ TEST_BLOCK_SIZE ];
+    uint32_t page;
+
+    initCoalescer( &coalescer, 1U );
+    memset( padding, TEST_PAD_BYTE, sizeof( padding ) );
+
+    /* Fill parts of pages 0 and 2 of the first unit. */
+    fillBlock( block, 0U );
+    TEST_CHECK( WriteCoalescer_Write( &coalescer, 0U, block, TEST_BLOCK_SIZE ) );
+    fillBlock( block, 4096U );
+    TEST_CHECK( WriteCoalescer_Write( &coalescer, 4096U, block, TEST_BLOCK_SIZE ) );
+    TEST_CHECK( sink.writes == 0U );
+
+    /* A block of the next unit evicts the first, which is written padded. */
+    fillBlock( block, TEST_UNIT_SIZE );
+    TEST_CHECK( WriteCoalescer_Write( &coalescer, TEST_UNIT_SIZE, block, TEST_BLOCK_SIZE ) );
+    TEST_CHECK( coalescer.stats.evictions == 1U );
+    TEST_CHECK( sink.writes > 0U );
+    TEST_CHECK( memcmp( &sink.image[ TEST_BLOCK_SIZE ], padding, TEST_BLOCK_SIZE ) == 0 );
+
+    /* The rest of page 0 was padded, so a late block for it is rejected. */
+    fillBlock( block, TEST_BLOCK_SIZE );
+    TEST_CHECK( !WriteCoalescer_Write( &coalescer, TEST_BLOCK_SIZE, block, TEST_BLOCK_SIZE ) );
+    TEST_CHECK( coalescer.stats.rejectedBlocks == 1U );
+
+    TEST_CHECK( WriteCoalescer_Flush( &coalescer ) );
+
+    /* Every write is page aligned and no page is programmed twice. */
+    TEST_CHECK( sink.unalignedWrites == 0U );
+
+    for( page = 0U; page < TEST_PAGE_COUNT; page++ )
+    {
+        TEST_CHECK( sink.pageWrites[ page ] <= 1U );
+    }
+
+    fillBlock( block, 0U );
+    TEST_CHECK( memcmp( &sink.image[ 0 ], block, TEST_BLOCK_SIZE ) == 0 );
+    fillBlock( block, 4096U );
+    TEST_CHECK( memcmp( &sink.image[ 4096 ], block, TEST_BLOCK_SIZE ) == 0 );
+
+    WriteCoalescer_Deinit( &coalescer );
+}
+
+/*-----------------------------------------------------------*/
+
+void testWriteCoalescer( void )
+{
+    testInOrder();
+    testEvictedUnit();
+}